@@ -0,0 +1,198 @@
+//
+// Copyright (c) 2016-2017 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "AxiLiteStats.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+bool RegisterAccess::read(const std::vector<uint32_t>& addresses, std::vector<uint32_t>& values)
+{
+    values.resize(addresses.size());
+    for (size_t i = 0; i < addresses.size(); ++i)
+        if (!read(addresses[i], values[i]))
+            return false;
+    return true;
+}
+
+bool MlxFpgaRegisters::read(uint32_t address, uint32_t& value)
+{
+    std::ostringstream command;
+    command << "mlx_fpga -d " << device << " r 0x" << std::hex << address;
+    FILE* output = popen(command.str().c_str(), "r");
+    if (!output)
+        return false;
+    unsigned long result;
+    bool ok = fscanf(output, "%li", &result) == 1;
+    ok = pclose(output) == 0 && ok;
+    value = result;
+    return ok;
+}
+
+bool MlxFpgaRegisters::read(const std::vector<uint32_t>& addresses, std::vector<uint32_t>& values)
+{
+    if (addresses.empty())
+        return true;
+
+    std::ostringstream command;
+    command << std::hex;
+    for (size_t i = 0; i < addresses.size(); ++i)
+        command << (i ? " && " : "") << "mlx_fpga -d " << device << " r 0x" << addresses[i];
+    FILE* output = popen(command.str().c_str(), "r");
+    if (!output)
+        return false;
+    values.resize(addresses.size());
+    bool ok = true;
+    for (size_t i = 0; i < addresses.size() && ok; ++i) {
+        unsigned long result;
+        ok = fscanf(output, "%li", &result) == 1;
+        values[i] = result;
+    }
+    ok = pclose(output) == 0 && ok;
+    return ok;
+}
+
+bool MlxFpgaRegisters::write(uint32_t address, uint32_t value)
+{
+    std::ostringstream command;
+    command << "mlx_fpga -d " << device << " w 0x" << std::hex << address << " 0x" << value
+            << " > /dev/null";
+    return system(command.str().c_str()) == 0;
+}
+
+static std::string upper(std::string s)
+{
+    std::transform(s.begin(), s.end(), s.begin(), ::toupper);
+    return s;
+}
+
+bool AxiLiteLayout::load(const std::string& driver_header)
+{
+    std::ifstream in(driver_header);
+    if (!in) {
+        std::cerr << "Warning: couldn't open " << driver_header << "\n";
+        return false;
+    }
+
+    const std::regex addr("#define\\s+X\\w*?_ADDR_(\\w+)_DATA\\s+(0x[0-9a-fA-F]+)"),
+                     bits("#define\\s+X\\w*?_BITS_(\\w+)_DATA\\s+([0-9]+)");
+    std::string line;
+    std::smatch match;
+    while (std::getline(in, line)) {
+        if (std::regex_search(line, match, addr))
+            ports[match[1]].first = std::stoul(match[2], nullptr, 16);
+        else if (std::regex_search(line, match, bits))
+            ports[match[1]].second = std::stoul(match[2]);
+    }
+    return !ports.empty();
+}
+
+bool AxiLiteLayout::find(const std::string& port, uint32_t& address, unsigned& bits) const
+{
+    auto it = ports.find(upper(port));
+    if (it == ports.end())
+        return false;
+    address = it->second.first;
+    bits = it->second.second ?: 32;
+    return true;
+}
+
+void AxiLiteFieldCollector::add(const std::string& member, MetricsRegistry::kind type)
+{
+    field f = { { name + "." + member, type }, 0, 0 };
+    if (layout.find(port + "_" + member, f.address, f.bits))
+        fields.push_back(f);
+    else
+        missing.push_back(port + "_" + member);
+}
+
+MetricsRegistry::registration add_axilite_source(
+    MetricsRegistry& registry, const std::vector<AxiLiteFieldCollector::field>& fields,
+    std::shared_ptr<RegisterAccess> regs, const AxiLiteLayout& layout,
+    const std::string& snapshot_port)
+{
+    std::vector<MetricsRegistry::metric_info> metrics;
+    for (auto& f : fields)
+        metrics.push_back(f.info);
+
+    uint32_t snapshot_address = 0;
+    unsigned snapshot_bits;
+    bool snapshot = !snapshot_port.empty() &&
+                    layout.find(snapshot_port, snapshot_address, snapshot_bits);
+    auto generation = std::make_shared<uint32_t>(0);
+
+    /* The registers of each field, with the high word of wide fields
+     * following the low word */
+    std::vector<uint32_t> addresses;
+    for (auto& f : fields) {
+        addresses.push_back(f.address);
+        if (f.bits > 32)
+            addresses.push_back(f.address + 4);
+    }
+
+    return registry.add_source(metrics, [=](std::vector<uint64_t>& values) {
+        /* Other processes (e.g. packets_stats.sh) latch and release the
+         * same snapshot register */
+        int lock = -1;
+        if (snapshot) {
+            lock = open(NICA_STATS_LOCK_FILE, O_RDWR | O_CREAT, 0666);
+            if (lock < 0 || flock(lock, LOCK_EX)) {
+                if (lock >= 0)
+                    close(lock);
+                return false;
+            }
+        }
+
+        /* Latch the counters and let them run again when done */
+        bool ok = true;
+        if (snapshot) {
+            if (++*generation == 0)
+                ++*generation;
+            ok = regs->write(snapshot_address, *generation);
+        }
+
+        std::vector<uint32_t> words;
+        ok = ok && regs->read(addresses, words);
+        for (size_t i = 0, word = 0; i < fields.size() && ok; ++i) {
+            uint32_t low = words[word++], high = 0;
+            if (fields[i].bits > 32)
+                high = words[word++];
+            values[i] = uint64_t(high) << 32 | low;
+        }
+
+        if (snapshot) {
+            regs->write(snapshot_address, 0);
+            close(lock);
+        }
+        return ok;
+    });
+}
@@ -0,0 +1,148 @@
+//
+// Copyright (c) 2016-2017 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef AXILITESTATS_HPP
+#define AXILITESTATS_HPP
+
+#include "MetricsRegistry.hpp"
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* Lock file serializing the NICA statistics snapshots between processes.
+ * scripts/packets_stats.sh takes the same lock. */
+#define NICA_STATS_LOCK_FILE "/tmp/nica-stats.lock"
+
+/* Raw access to the NICA AXI4-Lite registers */
+class RegisterAccess {
+public:
+    virtual ~RegisterAccess() {}
+    virtual bool read(uint32_t address, uint32_t& value) = 0;
+    virtual bool write(uint32_t address, uint32_t value) = 0;
+    /* Read several registers at once */
+    virtual bool read(const std::vector<uint32_t>& addresses, std::vector<uint32_t>& values);
+};
+
+/* Register access through the mlx_fpga tool, like the scripts do */
+class MlxFpgaRegisters : public RegisterAccess {
+public:
+    MlxFpgaRegisters(const std::string& device) : device(device) {}
+    virtual bool read(uint32_t address, uint32_t& value);
+    virtual bool write(uint32_t address, uint32_t value);
+    /* Reads all the registers with a single shell invocation */
+    virtual bool read(const std::vector<uint32_t>& addresses, std::vector<uint32_t>& values);
+
+private:
+    std::string device;
+};
+
+/* Addresses of the NICA top function ports, taken from the driver header
+ * Vivado HLS generates for the AXI4-Lite interface (x<top>_<bundle>_hw.h).
+ * Struct ports are flattened there, e.g. stats->n2h.udp.hds.ft_action_drop
+ * becomes STATS_N2H_UDP_HDS_FT_ACTION_DROP. */
+class AxiLiteLayout {
+public:
+    bool load(const std::string& driver_header);
+    bool find(const std::string& port, uint32_t& address, unsigned& bits) const;
+
+private:
+    std::map<std::string, std::pair<uint32_t, unsigned> > ports;
+};
+
+/* Walks a statistics struct through its visit() method, collecting the
+ * fields that have registers in the layout */
+class AxiLiteFieldCollector {
+public:
+    struct field {
+        MetricsRegistry::metric_info info;
+        uint32_t address;
+        unsigned bits;
+    };
+
+    AxiLiteFieldCollector(const AxiLiteLayout& layout, const std::string& name,
+                          const std::string& port) :
+        layout(layout), name(name), port(port) {}
+
+    template <typename T>
+    void counter(const std::string& field, const T&) { add(field, MetricsRegistry::COUNTER); }
+    template <typename T>
+    void counter(const std::string& field, int index, const T&)
+    {
+        add(field + "_" + std::to_string(index), MetricsRegistry::COUNTER);
+    }
+    template <typename T>
+    void gauge(const std::string& field, const T&) { add(field, MetricsRegistry::GAUGE); }
+    template <typename T>
+    void nested(const std::string& field, const T& value)
+    {
+        AxiLiteFieldCollector inner(layout, name + "." + field, port + "_" + field);
+        value.visit(inner);
+        fields.insert(fields.end(), inner.fields.begin(), inner.fields.end());
+        missing.insert(missing.end(), inner.missing.begin(), inner.missing.end());
+    }
+    template <typename T>
+    void nested(const std::string& field, int index, const T& value)
+    {
+        nested(field + "_" + std::to_string(index), value);
+    }
+
+    std::vector<field> fields;
+    /* Ports that were not found in the layout */
+    std::vector<std::string> missing;
+
+private:
+    void add(const std::string& member, MetricsRegistry::kind type);
+
+    const AxiLiteLayout& layout;
+    std::string name, port;
+};
+
+/* Registers the fields of a NICA statistics struct as a single source.
+ * When snapshot_port is given, the statistics are latched through it
+ * before every sample (see stats_snapshot.hpp), holding
+ * NICA_STATS_LOCK_FILE. */
+MetricsRegistry::registration add_axilite_source(
+    MetricsRegistry& registry, const std::vector<AxiLiteFieldCollector::field>& fields,
+    std::shared_ptr<RegisterAccess> regs, const AxiLiteLayout& layout,
+    const std::string& snapshot_port);
+
+template <typename Stats>
+MetricsRegistry::registration add_axilite_stats(
+    MetricsRegistry& registry, const std::string& name, const std::string& port,
+    const AxiLiteLayout& layout, std::shared_ptr<RegisterAccess> regs,
+    const std::string& snapshot_port = "")
+{
+    AxiLiteFieldCollector collector(layout, name, port);
+    Stats stats;
+    stats.visit(collector);
+    for (auto& missing : collector.missing)
+        std::cerr << "Warning: no register for " << missing << "\n";
+    return add_axilite_source(registry, collector.fields, regs, layout, snapshot_port);
+}
+
+#endif //AXILITESTATS_HPP
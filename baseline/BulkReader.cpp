@@ -0,0 +1,117 @@
+//
+// Copyright (c) 2016-2017 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "BulkReader.hpp"
+#include <arpa/inet.h>
+#include <nica.h>
+#include <bulk_read.hpp>
+#include <chrono>
+#include <iostream>
+
+BulkReader::BulkReader(ikernel* ik, uint32_t max_count) :
+    ik(ik), max_count(max_count), cr(), buffer(max_count), mr(), sequence(0),
+    recv_posted(false)
+{
+    cr = custom_ring_create(ik);
+    if (!cr) {
+        std::cerr << "Warning: couldn't create a custom ring for bulk reads\n";
+        return;
+    }
+    mr = custom_ring_reg_mr(cr, buffer.data(), buffer.size() * sizeof(uint32_t),
+                            IBV_ACCESS_LOCAL_WRITE);
+    if (!mr)
+        std::cerr << "Warning: couldn't register the bulk read buffer\n";
+}
+
+BulkReader::~BulkReader()
+{
+    if (mr)
+        ibv_dereg_mr(mr);
+    if (cr)
+        custom_ring_destroy(cr);
+}
+
+bool BulkReader::read(int address, int stride, uint32_t count, std::vector<uint32_t>& values)
+{
+    if (!mr || count == 0 || count > max_count || count > GW_BULK_READ_MAX_COUNT)
+        return false;
+
+    /* A multi-packet message lands in a single receive buffer. A receive
+     * left by a read that failed to start is used for the next one. */
+    if (!recv_posted) {
+        ibv_sge sg = {};
+        sg.addr = (uintptr_t)buffer.data();
+        sg.length = buffer.size() * sizeof(uint32_t);
+        sg.lkey = mr->lkey;
+        ibv_recv_wr wr = {};
+        wr.wr_id = sequence + 1;
+        wr.sg_list = &sg;
+        wr.num_sge = 1;
+        ibv_recv_wr* bad_wr;
+        if (custom_ring_post_recv(cr, &wr, &bad_wr)) {
+            std::cerr << "Warning: couldn't post a bulk read buffer\n";
+            return false;
+        }
+        recv_posted = true;
+    }
+
+    if (ik_write(ik, GW_BULK_READ_RING, custom_ring_handle(cr)) ||
+        ik_write(ik, GW_BULK_READ_ADDRESS, address) ||
+        ik_write(ik, GW_BULK_READ_STRIDE, stride) ||
+        ik_write(ik, GW_BULK_READ_COUNT, count)) {
+        std::cerr << "Warning: couldn't start a bulk read\n";
+        return false;
+    }
+    ++sequence;
+    recv_posted = false;
+
+    /* The ikernel sends bulk reads in order, so the messages of reads that
+     * timed out arrive first, each one into the receive posted for it */
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    ibv_wc wc;
+    do {
+        int ret;
+        while ((ret = custom_ring_poll_cq(cr, 1, &wc)) == 0) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                std::cerr << "Warning: bulk read timed out\n";
+                return false;
+            }
+        }
+        if (ret < 0) {
+            std::cerr << "Warning: bulk read failed\n";
+            return false;
+        }
+    } while (wc.wr_id != sequence);
+
+    if (wc.status != IBV_WC_SUCCESS || wc.byte_len != count * sizeof(uint32_t)) {
+        std::cerr << "Warning: bulk read failed\n";
+        return false;
+    }
+
+    values.resize(count);
+    for (uint32_t i = 0; i < count; ++i)
+        values[i] = ntohl(buffer[i]);
+    return true;
+}
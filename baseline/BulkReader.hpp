@@ -0,0 +1,64 @@
+//
+// Copyright (c) 2016-2017 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef BULKREADER_HPP
+#define BULKREADER_HPP
+
+#include <cstdint>
+#include <vector>
+#include <infiniband/verbs.h>
+
+class ikernel;
+struct custom_ring;
+
+/* Reads a range of ikernel registers with a single gateway command: the
+ * values come back as a custom ring message instead of one gateway round
+ * trip per register (see bulk_read.hpp). */
+class BulkReader {
+public:
+    BulkReader(ikernel* ik, uint32_t max_count);
+    ~BulkReader();
+
+    bool valid() const { return mr; }
+
+    /* Read count registers starting at address, each one stride addresses
+     * after the previous (zero reads the same register repeatedly). */
+    bool read(int address, int stride, uint32_t count, std::vector<uint32_t>& values);
+
+private:
+    ikernel* ik;
+    uint32_t max_count;
+    custom_ring* cr;
+    std::vector<uint32_t> buffer;
+    ibv_mr* mr;
+    /* Number of the last bulk read the ikernel accepted. The receive buffer
+     * is tagged with the number of the read it is posted for, so that a
+     * read that timed out cannot complete a later one. */
+    uint64_t sequence;
+    /* A receive is posted for the next read */
+    bool recv_posted;
+};
+
+#endif //BULKREADER_HPP
@@ -25,6 +25,7 @@
 
 #include "CmsUdpServer.hpp"
 #include "cms-ikernel.hpp"
+#include "IkernelControl.hpp"
 #include <nica.h>
 #include <system_error>
 #include <arpa/inet.h>
@@ -39,30 +40,38 @@ CmsUdpServer::CmsUdpServer(boost::asio::io_service &io_service, const args &args
         std::cerr << "Warning: couldn't create ikernel\n";
         _k = K;
     } else {
-        write_hashes(ik);
-        read_k_value(ik);
+        control.reset(new IkernelControl(ik, 2 * K));
+        write_hashes();
+        read_k_value();
         int fd = socket_.native_handle();
         ik_attach(fd, ik);
     }
 }
 
-void CmsUdpServer::write_hashes(ikernel* ik) {
+void CmsUdpServer::write_hashes() {
+    // Queue all the writes before waiting for any of them
+    std::vector<std::future<void> > writes;
     for (int i = 0; i < DEPTH; ++i) {
         for (int j = 0; j < 2; ++j) {
             int hash = static_cast<int>(static_cast<float>(rand()) * static_cast<float>(LONG_PRIME)
                                         / static_cast<float>(RAND_MAX) + 1);
-            int ret = ik_write(ik, 2 * i + j + HASHES_BASE, hash);
-            if (ret) {
-                std::cerr << "Warning: couldn't write ikernel hash in cell " << (2 * i + j) << std::endl;
-            }
+            writes.push_back(control->write(2 * i + j + HASHES_BASE, hash));
+        }
+    }
+    for (size_t cell = 0; cell < writes.size(); ++cell) {
+        try {
+            writes[cell].get();
+        } catch (std::system_error& e) {
+            std::cerr << "Warning: couldn't write ikernel hash in cell " << cell << ": " << e.what() << std::endl;
         }
     }
 }
 
-void CmsUdpServer::read_k_value(ikernel* ik) {
-	int ret = ik_read(ik, READ_K_VALUE, (int *)&_k);
-	if (ret) {
-		std::cerr << "Warning: couldn't read k value from ikernel" << std::endl;
+void CmsUdpServer::read_k_value() {
+	try {
+		_k = control->read(READ_K_VALUE).get();
+	} catch (std::system_error& e) {
+		std::cerr << "Warning: couldn't read k value from ikernel: " << e.what() << std::endl;
 	}
 }
 
@@ -112,21 +121,38 @@ std::vector<int> CmsUdpServer::get_host_topK() {
 }
 
 std::vector<int> CmsUdpServer::get_topK() {
-    // Detach ikernel before reading topK in order to avoid reading
-    // partial updates.
     if (!ik) return std::vector<int>();
+    // The k value read from the hardware may exceed the bulk read size
+    if (!control->can_bulk_read(2*_k)) return read_topK_sequential();
+
+    // The whole top-K comes back in a single custom ring message, so the
+    // socket can stay attached while it is being read.
+    control->write(READ_TOP_K, 0); // topK - read_req
+    try {
+        std::vector<uint32_t> values = control->bulk_read(TOPK_READ_NEXT_VALUE, 0, 2*_k).get();
+        return std::vector<int>(values.begin(), values.end());
+    } catch (std::system_error& e) {
+        // Another READ_TOP_K would queue a second round behind this one
+        std::cerr << "Warning: couldn't bulk read topK from ikernel: " << e.what() << "\n";
+        return read_topK_sequential(true);
+    }
+}
 
+std::vector<int> CmsUdpServer::read_topK_sequential(bool requested) {
+    // Detach ikernel before reading topK in order to avoid reading
+    // partial updates.
     ik_detach(socket_.native_handle(), ik);
     std::vector<int> topK;
-    ik_write(ik,READ_TOP_K,0); // topK - read_req
-    for (uint32_t i = 0; i < 2*_k; ++i) {
-        int hw_cell = 0;
-        int ret = ik_read(ik, TOPK_READ_NEXT_VALUE , &hw_cell);
-        if (ret) {
-            std::error_condition econd = std::system_category().default_error_condition(errno);
-            std::cerr << "Warning: couldn't read cell from ikernel: " << econd.message() << "\n";
-        } else {
-            topK.push_back(hw_cell);
+    if (!requested)
+        control->write(READ_TOP_K, 0); // topK - read_req
+    std::vector<std::future<int> > cells;
+    for (uint32_t i = 0; i < 2*_k; ++i)
+        cells.push_back(control->read(TOPK_READ_NEXT_VALUE));
+    for (auto& cell : cells) {
+        try {
+            topK.push_back(cell.get());
+        } catch (std::system_error& e) {
+            std::cerr << "Warning: couldn't read cell from ikernel: " << e.what() << "\n";
         }
     }
 
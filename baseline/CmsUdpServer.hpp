@@ -30,10 +30,12 @@
 #include "cms.hpp"
 #include <boost/heap/fibonacci_heap.hpp>
 #include <map>
+#include <memory>
 
 #define K 256
 
 class ikernel;
+class IkernelControl;
 struct heap_data;
 
 using fibHeap = boost::heap::fibonacci_heap<heap_data>;
@@ -75,15 +77,19 @@ public:
     virtual ~CmsUdpServer();
 private:
     ikernel* ik;
+    std::unique_ptr<IkernelControl> control;
     CountMinSketch countMinSketch;
     int hashes[DEPTH][2];
     uint32_t _k;
     fibHeap topK;
     std::map<int, fibHeap::handle_type> index;
 
-    static void write_hashes(ikernel* ik);
-    void read_k_value(ikernel* ik);
+    void write_hashes();
+    void read_k_value();
     int read_int();
+    /* Reads the top-K round already requested with READ_TOP_K when
+     * requested is true, and requests a new one otherwise. */
+    std::vector<int> read_topK_sequential(bool requested = false);
 };
 
 
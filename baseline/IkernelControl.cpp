@@ -0,0 +1,235 @@
+//
+// Copyright (c) 2016-2017 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "IkernelControl.hpp"
+#include "BulkReader.hpp"
+#include <algorithm>
+#include <bulk_read.hpp>
+#include <cerrno>
+#include <nica.h>
+#include <system_error>
+
+/* Largest gap between counter addresses that are still read together */
+#define MAX_COUNTER_GAP 4
+
+namespace {
+
+template <typename T, typename F>
+void fulfill(std::promise<T>& promise, F f)
+{
+    try {
+        promise.set_value(f());
+    } catch (...) {
+        promise.set_exception(std::current_exception());
+    }
+}
+
+template <typename F>
+void fulfill(std::promise<void>& promise, F f)
+{
+    try {
+        f();
+        promise.set_value();
+    } catch (...) {
+        promise.set_exception(std::current_exception());
+    }
+}
+
+void checked_write(ikernel* ik, int address, int value)
+{
+    if (ik_write(ik, address, value))
+        throw std::system_error(errno, std::system_category(),
+                                "ik_write " + std::to_string(address));
+}
+
+int checked_read(ikernel* ik, int address)
+{
+    int value;
+    if (ik_read(ik, address, &value))
+        throw std::system_error(errno, std::system_category(),
+                                "ik_read " + std::to_string(address));
+    return value;
+}
+
+}
+
+IkernelControl::IkernelControl(ikernel* ik, uint32_t max_bulk_read) :
+    ik(ik), max_bulk_read(max_bulk_read),
+    bulk_reader(max_bulk_read ? new BulkReader(ik, max_bulk_read) : nullptr),
+    busy(false), stopping(false)
+{
+    thread = std::thread(&IkernelControl::worker, this);
+}
+
+IkernelControl::~IkernelControl()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queue_changed.notify_all();
+    thread.join();
+}
+
+void IkernelControl::enqueue(std::function<void()> op)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(op));
+    }
+    queue_changed.notify_all();
+}
+
+void IkernelControl::worker()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        queue_changed.wait(lock, [this]() { return stopping || !queue.empty(); });
+        if (queue.empty())
+            return;
+
+        /* Run everything queued so far back to back */
+        std::deque<std::function<void()> > batch;
+        batch.swap(queue);
+        busy = true;
+        lock.unlock();
+        for (auto& op : batch)
+            op();
+        lock.lock();
+        busy = false;
+        queue_changed.notify_all();
+    }
+}
+
+void IkernelControl::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    queue_changed.wait(lock, [this]() { return queue.empty() && !busy; });
+}
+
+std::future<void> IkernelControl::write(int address, int value)
+{
+    auto promise = std::make_shared<std::promise<void> >();
+    enqueue([=]() {
+        fulfill(*promise, [=]() { checked_write(ik, address, value); });
+    });
+    return promise->get_future();
+}
+
+std::future<int> IkernelControl::read(int address)
+{
+    auto promise = std::make_shared<std::promise<int> >();
+    enqueue([=]() {
+        fulfill(*promise, [=]() { return checked_read(ik, address); });
+    });
+    return promise->get_future();
+}
+
+bool IkernelControl::can_bulk_read(uint32_t count) const
+{
+    return bulk_reader && bulk_reader->valid() && count <= max_bulk_read &&
+           count <= GW_BULK_READ_MAX_COUNT;
+}
+
+std::future<std::vector<uint32_t> > IkernelControl::bulk_read(int address, int stride, uint32_t count)
+{
+    auto promise = std::make_shared<std::promise<std::vector<uint32_t> > >();
+    enqueue([=]() {
+        fulfill(*promise, [=]() {
+            std::vector<uint32_t> values;
+            if (!bulk_reader || !bulk_reader->read(address, stride, count, values))
+                throw std::system_error(EIO, std::system_category(), "bulk read");
+            return values;
+        });
+    });
+    return promise->get_future();
+}
+
+void IkernelControl::read_span(int first, uint32_t count, const std::vector<int>& addresses,
+                               std::map<int, int>& values)
+{
+    std::vector<uint32_t> span;
+    if (addresses.size() > 1 && bulk_reader && bulk_reader->read(first, 1, count, span)) {
+        for (int address : addresses)
+            values[address] = span[address - first];
+        return;
+    }
+
+    for (int address : addresses)
+        values[address] = checked_read(ik, address);
+}
+
+std::map<std::string, int> IkernelControl::read_counters_now(const counter_list& counters)
+{
+    std::vector<int> addresses;
+    for (auto& counter : counters)
+        addresses.push_back(counter.second);
+    std::sort(addresses.begin(), addresses.end());
+    addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+
+    /* Group the addresses into spans for bulk reads */
+    std::map<int, int> values;
+    std::vector<int> span;
+    for (int address : addresses) {
+        if (!span.empty() &&
+            (address - span.back() > MAX_COUNTER_GAP ||
+             uint32_t(address - span.front()) >= max_bulk_read)) {
+            read_span(span.front(), span.back() - span.front() + 1, span, values);
+            span.clear();
+        }
+        span.push_back(address);
+    }
+    if (!span.empty())
+        read_span(span.front(), span.back() - span.front() + 1, span, values);
+
+    std::map<std::string, int> result;
+    for (auto& counter : counters)
+        result[counter.first] = values[counter.second];
+    return result;
+}
+
+std::future<std::map<std::string, int> > IkernelControl::read_counters(const counter_list& counters,
+                                                                       int snapshot)
+{
+    auto promise = std::make_shared<std::promise<std::map<std::string, int> > >();
+    enqueue([=]() {
+        fulfill(*promise, [&]() {
+            if (snapshot < 0)
+                return read_counters_now(counters);
+
+            checked_write(ik, snapshot, 1);
+            std::map<std::string, int> result;
+            try {
+                result = read_counters_now(counters);
+            } catch (...) {
+                ik_write(ik, snapshot, 0);
+                throw;
+            }
+            checked_write(ik, snapshot, 0);
+            return result;
+        });
+    });
+    return promise->get_future();
+}
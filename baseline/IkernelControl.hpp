@@ -0,0 +1,114 @@
+//
+// Copyright (c) 2016-2017 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef IKERNELCONTROL_HPP
+#define IKERNELCONTROL_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+class ikernel;
+class BulkReader;
+
+/* Asynchronous access to ikernel gateway registers.
+ *
+ * Operations are queued and executed in order by a worker thread, so the
+ * caller can issue a whole configuration and only wait for the results it
+ * needs. Failures are reported through the returned futures as
+ * std::system_error.
+ *
+ * The worker still issues one gateway command at a time: queueing saves the
+ * caller's round trips, not gateway time. Only read_counters() and
+ * bulk_read() fetch several registers with one command. */
+class IkernelControl {
+public:
+    typedef std::vector<std::pair<std::string, int> > counter_list;
+
+    /* Bulk reads of up to max_bulk_read registers are used when the ikernel
+     * supports them (see bulk_read.hpp). Zero disables them for ikernels
+     * that do not. */
+    IkernelControl(ikernel* ik, uint32_t max_bulk_read = 256);
+    ~IkernelControl();
+
+    std::future<void> write(int address, int value);
+    std::future<int> read(int address);
+    /* Read count registers with one gateway command. */
+    std::future<std::vector<uint32_t> > bulk_read(int address, int stride, uint32_t count);
+    /* A bulk read of count registers is supported */
+    bool can_bulk_read(uint32_t count = 1) const;
+
+    /* Scatter read of named registers that have no side effects on read.
+     * Nearby addresses are fetched together with a bulk read. When a
+     * snapshot register is given, the counters are latched through it for
+     * the duration of the read, with no other operation in between. */
+    std::future<std::map<std::string, int> > read_counters(const counter_list& counters,
+                                                           int snapshot = -1);
+
+    /* Run another libnica call on the ikernel from the worker thread, in
+     * order with the queued register operations. libnica is not safe to use
+     * on the same ikernel from two threads at once. */
+    template <typename F>
+    std::future<typename std::result_of<F()>::type> call(F f)
+    {
+        typedef typename std::result_of<F()>::type result;
+        auto task = std::make_shared<std::packaged_task<result()> >(f);
+        enqueue([task]() { (*task)(); });
+        return task->get_future();
+    }
+
+    /* Wait until all queued operations have completed */
+    void flush();
+
+private:
+    void enqueue(std::function<void()> op);
+    void worker();
+    void read_span(int first, uint32_t count, const std::vector<int>& addresses,
+                   std::map<int, int>& values);
+    std::map<std::string, int> read_counters_now(const counter_list& counters);
+
+    ikernel* ik;
+    uint32_t max_bulk_read;
+    std::unique_ptr<BulkReader> bulk_reader;
+
+    std::mutex mutex;
+    std::condition_variable queue_changed;
+    std::deque<std::function<void()> > queue;
+    bool busy;
+    bool stopping;
+    std::thread thread;
+};
+
+#endif //IKERNELCONTROL_HPP
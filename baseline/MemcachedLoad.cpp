@@ -0,0 +1,288 @@
+//
+// Copyright (c) 2016-2017 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "MemcachedLoad.hpp"
+#include "UdpClient.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+/* Memcached UDP frame header */
+#define FRAME_HEADER_SIZE 8
+/* Binary protocol header fields */
+#define BINARY_HEADER_SIZE 24
+#define BINARY_REQUEST_MAGIC 0x80
+#define BINARY_RESPONSE_MAGIC 0x81
+#define BINARY_OPCODE_GET 0x00
+#define BINARY_OPCODE_SET 0x01
+#define BINARY_STATUS_OK 0x0000
+#define BINARY_STATUS_KEY_NOT_FOUND 0x0001
+
+typedef std::chrono::steady_clock load_clock;
+
+MemcachedLoad::MemcachedLoad(const args& args) : _args(args), _cdf(args.keys) {
+    double sum = 0;
+    for (int i = 0; i < _args.keys; ++i) {
+        sum += 1.0 / std::pow(i + 1, _args.zipf);
+        _cdf[i] = sum;
+    }
+    for (auto& p : _cdf)
+        p /= sum;
+}
+
+/* Keys are their rank, padded to the key size */
+std::string MemcachedLoad::key(int rank) const {
+    std::string digits = std::to_string(rank);
+    if (int(digits.size()) >= _args.key_size)
+        return digits;
+    return std::string(_args.key_size - digits.size(), 'k') + digits;
+}
+
+int MemcachedLoad::sample_key(std::mt19937_64& rng) const {
+    std::uniform_real_distribution<double> uniform(0, 1);
+    auto it = std::lower_bound(_cdf.begin(), _cdf.end(), uniform(rng));
+    return std::min(int(it - _cdf.begin()), _args.keys - 1);
+}
+
+static void append_be(std::string& s, uint64_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; --i)
+        s += char(value >> (8 * i));
+}
+
+std::string MemcachedLoad::request(uint16_t id, bool get, const std::string& key) const {
+    std::string r;
+    /* Request ID, sequence number 0 of a single datagram */
+    append_be(r, id, 2);
+    append_be(r, 0, 2);
+    append_be(r, 1, 2);
+    append_be(r, 0, 2);
+
+    const std::string value(get ? 0 : _args.value_size, 'v');
+    if (!_args.binary) {
+        if (get)
+            r += "get " + key + "\r\n";
+        else
+            r += "set " + key + " 0 0 " + std::to_string(value.size()) + "\r\n" + value + "\r\n";
+        return r;
+    }
+
+    const int extras = get ? 0 : 8;
+    r += char(BINARY_REQUEST_MAGIC);
+    r += char(get ? BINARY_OPCODE_GET : BINARY_OPCODE_SET);
+    append_be(r, key.size(), 2);
+    r += char(extras);
+    r += char(0); /* data type */
+    append_be(r, 0, 2); /* vbucket */
+    append_be(r, extras + key.size() + value.size(), 4);
+    append_be(r, id, 4); /* opaque */
+    append_be(r, 0, 8); /* CAS */
+    append_be(r, 0, extras); /* flags and expiration */
+    return r + key + value;
+}
+
+void MemcachedLoad::run_thread(int thread_id, bool populate, results& r) {
+    struct slot {
+        uint16_t id;
+        bool get, hit, error;
+        int datagrams;
+        load_clock::time_point sent;
+    };
+
+    UdpClient client(_args.local_ip);
+    udp::endpoint endpoint = client.get_endpoint(_args.host,
+        std::to_string(std::stoi(_args.port) + thread_id % _args.ports));
+    udp::socket& socket = client.get_socket();
+    socket.non_blocking(true);
+
+    std::random_device seed;
+    std::mt19937_64 rng(seed() + thread_id);
+    std::bernoulli_distribution get_dist(_args.get_ratio);
+
+    std::vector<slot> slots(_args.outstanding);
+    std::vector<int> free_slots, id_slot(1 << 16, -1);
+    for (int i = _args.outstanding - 1; i >= 0; --i)
+        free_slots.push_back(i);
+    uint16_t next_id = 0;
+    /* Populating sets the keys of this thread in order */
+    int next_rank = thread_id;
+
+    const auto timeout = std::chrono::milliseconds(_args.timeout_ms);
+    const auto deadline = load_clock::now() + std::chrono::seconds(_args.secs);
+    char buffer[1 << 16];
+
+    for (;;) {
+        const auto now = load_clock::now();
+        const bool done = populate ? next_rank >= _args.keys : now >= deadline;
+        if (done && (!populate || int(free_slots.size()) == _args.outstanding))
+            break;
+
+        while (!done && !free_slots.empty() && id_slot[next_id] < 0 &&
+               (!populate || next_rank < _args.keys)) {
+            const int index = free_slots.back();
+            slot& s = slots[index];
+            s.id = next_id++;
+            s.get = populate ? false : get_dist(rng);
+            s.hit = s.error = false;
+            s.datagrams = 0;
+
+            const int rank = populate ? next_rank : sample_key(rng);
+            const std::string datagram = request(s.id, s.get, key(rank));
+
+            boost::system::error_code ec;
+            s.sent = load_clock::now();
+            socket.send_to(boost::asio::buffer(datagram), endpoint, 0, ec);
+            if (ec == boost::asio::error::would_block)
+                break;
+            if (populate)
+                next_rank += _args.threads;
+            if (ec) {
+                std::cerr << "Warning: couldn't send request: " << ec.message() << "\n";
+                ++r.errors;
+                continue;
+            }
+            free_slots.pop_back();
+            id_slot[s.id] = index;
+            ++r.sent;
+        }
+
+        for (;;) {
+            boost::system::error_code ec;
+            udp::endpoint sender;
+            const size_t length = socket.receive_from(boost::asio::buffer(buffer), sender, 0, ec);
+            if (ec || length < FRAME_HEADER_SIZE)
+                break;
+
+            const unsigned char* header = reinterpret_cast<const unsigned char*>(buffer);
+            const uint16_t id = (header[0] << 8) | header[1];
+            const int seq = (header[2] << 8) | header[3], total = (header[4] << 8) | header[5];
+            const int index = id_slot[id];
+            if (index < 0)
+                continue;
+
+            slot& s = slots[index];
+            if (seq == 0) {
+                const char* payload = buffer + FRAME_HEADER_SIZE;
+                const size_t payload_length = length - FRAME_HEADER_SIZE;
+                if (_args.binary) {
+                    const unsigned char* response = header + FRAME_HEADER_SIZE;
+                    const int status = payload_length >= BINARY_HEADER_SIZE ?
+                                       (response[6] << 8) | response[7] : -1;
+                    s.hit = s.get && status == BINARY_STATUS_OK;
+                    s.error = status < 0 || response[0] != BINARY_RESPONSE_MAGIC ||
+                              (status != BINARY_STATUS_OK &&
+                               !(s.get && status == BINARY_STATUS_KEY_NOT_FOUND));
+                } else {
+                    const std::string response(payload, std::min(payload_length, size_t(6)));
+                    s.hit = s.get && response.compare(0, 6, "VALUE ") == 0;
+                    s.error = s.get ? !s.hit && response.compare(0, 3, "END") != 0 :
+                              response.compare(0, 6, "STORED") != 0;
+                }
+            }
+            if (++s.datagrams < total)
+                continue;
+
+            ++r.received;
+            r.errors += s.error;
+            if (s.get) {
+                ++r.gets;
+                r.hits += s.hit;
+            }
+            if (!populate)
+                r.latencies_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    load_clock::now() - s.sent).count());
+            id_slot[s.id] = -1;
+            free_slots.push_back(index);
+        }
+
+        /* Give up on requests whose response was lost */
+        for (int i = 0; i < _args.outstanding; ++i) {
+            slot& s = slots[i];
+            if (id_slot[s.id] != i || now - s.sent < timeout)
+                continue;
+            ++r.lost;
+            id_slot[s.id] = -1;
+            free_slots.push_back(i);
+        }
+    }
+}
+
+static uint32_t percentile(const std::vector<uint32_t>& sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))];
+}
+
+int MemcachedLoad::run() {
+    std::vector<results> thread_results(_args.threads);
+    std::vector<std::thread> threads(_args.threads);
+
+    for (bool populate : { true, false }) {
+        if (populate && !_args.populate)
+            continue;
+
+        thread_results = std::vector<results>(_args.threads);
+        for (int i = 0; i < _args.threads; ++i)
+            threads[i] = std::thread([this, i, populate, &thread_results] {
+                this->run_thread(i, populate, thread_results[i]);
+            });
+        for (auto& t : threads)
+            t.join();
+
+        if (populate) {
+            long lost = 0;
+            for (auto& r : thread_results)
+                lost += r.lost + r.errors;
+            if (lost)
+                std::cerr << "Warning: " << lost << " keys were not populated\n";
+        }
+    }
+
+    results total;
+    for (auto& r : thread_results) {
+        total.sent += r.sent;
+        total.received += r.received;
+        total.lost += r.lost;
+        total.errors += r.errors;
+        total.gets += r.gets;
+        total.hits += r.hits;
+        total.latencies_ns.insert(total.latencies_ns.end(), r.latencies_ns.begin(), r.latencies_ns.end());
+    }
+    std::sort(total.latencies_ns.begin(), total.latencies_ns.end());
+
+    std::cout << "requests sent: " << total.sent << std::endl;
+    std::cout << "responses: " << total.received << " (" << total.received / _args.secs << " per second)" << std::endl;
+    std::cout << "lost: " << total.lost << ", errors: " << total.errors << std::endl;
+    if (total.gets > 0)
+        std::cout << "GET hit rate: " << 100.0 * total.hits / total.gets << " %" << std::endl;
+    std::cout << "latency p50/p99/p999: "
+              << percentile(total.latencies_ns, 0.5) / 1000.0 << " / "
+              << percentile(total.latencies_ns, 0.99) / 1000.0 << " / "
+              << percentile(total.latencies_ns, 0.999) / 1000.0 << " us" << std::endl;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,89 @@
+//
+// Copyright (c) 2016-2017 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef MEMCACHEDLOAD_HPP
+#define MEMCACHEDLOAD_HPP
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+/* Memcached UDP load generator.
+ *
+ * Each thread keeps up to `outstanding` requests in flight on its own
+ * socket, choosing keys from a Zipf distribution over the keyspace, and
+ * measures the latency of every response. Requests whose response does not
+ * arrive within the timeout are counted as lost. */
+class MemcachedLoad {
+public:
+    struct args {
+        std::string host;
+        std::string port;
+        /* Thread i sends to port + i % ports */
+        int ports;
+        std::string local_ip;
+        int threads;
+        int secs;
+        int outstanding;
+        int timeout_ms;
+        bool binary;
+        /* Number of keys, and the Zipf exponent of their popularity
+         * (0 is uniform) */
+        int keys;
+        double zipf;
+        /* Fraction of requests that are GETs, the rest are SETs */
+        double get_ratio;
+        int key_size;
+        int value_size;
+        /* SET every key once before the measurement */
+        bool populate;
+    };
+
+    explicit MemcachedLoad(const args& args);
+
+    /* Runs the load and prints the results */
+    int run();
+
+private:
+    struct results {
+        long sent, received, lost, errors;
+        long gets, hits;
+        std::vector<uint32_t> latencies_ns;
+
+        results() : sent(0), received(0), lost(0), errors(0), gets(0), hits(0) {}
+    };
+
+    args _args;
+    /* Cumulative probability of each key rank */
+    std::vector<double> _cdf;
+
+    std::string key(int rank) const;
+    int sample_key(std::mt19937_64& rng) const;
+    std::string request(uint16_t id, bool get, const std::string& key) const;
+    void run_thread(int thread_id, bool populate, results& r);
+};
+
+#endif //MEMCACHEDLOAD_HPP
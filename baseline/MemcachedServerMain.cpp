@@ -0,0 +1,104 @@
+//
+// Copyright (c) 2016-2017 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "RunnableServerBase.hpp"
+#include "MemcachedUdpServer.hpp"
+#include "memcached-ik.hpp"
+#include <vma/vma_extra.h>
+
+#include <future>
+
+class memcached_main : public RunnableServerBase {
+public:
+    memcached_main(const unsigned char *uuid, int argc, char **argv)
+            : RunnableServerBase(uuid, argc, argv) {}
+
+protected:
+
+    virtual void add_options(options_description& desc) {
+        desc.add_options()
+                ("ikernel", "attach the memcached ikernel")
+                ("binary", "configure the ikernel for the binary protocol");
+    }
+
+    virtual void preflight() {
+        requests = std::vector<std::future<long> >(thread_num);
+        keys = std::vector<std::future<long> >(thread_num);
+    }
+
+    virtual void postflight() {
+        long host_requests = 0, host_keys = 0;
+
+        for (int i = 0; i < thread_num; ++i) {
+            host_requests += requests[i].get();
+            host_keys += keys[i].get();
+        }
+
+        std::cout << "host requests: " << host_requests << " (" << host_requests / secs << " per second)" << std::endl;
+        std::cout << "host GET keys: " << host_keys << " (" << host_keys / secs << " per second)" << std::endl;
+        if (ikernel_counters.empty())
+            return;
+
+        const long nic_keys = ikernel_counters["get_hits"];
+        std::cout << "NIC GET keys: " << nic_keys << " (" << nic_keys / secs << " per second)" << std::endl;
+        for (auto& counter : ikernel_counters)
+            std::cout << "ikernel " << counter.first << ": " << counter.second << std::endl;
+        if (nic_keys + host_keys > 0)
+            std::cout << "GET keys served by the NIC: " << 100.0 * nic_keys / (nic_keys + host_keys)
+                      << " %" << std::endl;
+    }
+
+    virtual void start_server(const int &thread_id) {
+        MemcachedUdpServer::args args = {
+                .port = short(port + thread_id),
+                .interface = vm["interface"].as<std::string>(),
+                .attach = vm.count("ikernel") > 0,
+                .binary = vm.count("binary") > 0,
+                .counters = thread_id == 0,
+        };
+        std::promise<long> request_count, key_count;
+        requests[thread_id] = request_count.get_future();
+        keys[thread_id] = key_count.get_future();
+        MemcachedUdpServer s(io_service, args, store);
+        s.do_receive();
+        io_service.run();
+
+        request_count.set_value(s.get_requests());
+        key_count.set_value(s.get_keys());
+
+        if (thread_id == 0)
+            ikernel_counters = s.get_ikernel_counters();
+    }
+
+    MemcachedStore store;
+    std::vector<std::future<long> > requests, keys;
+    std::map<std::string, int> ikernel_counters;
+};
+
+int main(int argc, char **argv) {
+    uuid_t uuid = MEMCACHED_UUID;
+
+    return memcached_main(uuid, argc, argv).run();
+}
@@ -0,0 +1,321 @@
+//
+// Copyright (c) 2016-2017 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "MemcachedUdpServer.hpp"
+#include "memcached-ik.hpp"
+#include "IkernelControl.hpp"
+#include <nica.h>
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <system_error>
+#include <vector>
+
+/* Binary protocol opcodes and statuses the ikernel does not handle */
+#define BINARY_OPCODE_SET 0x01
+#define BINARY_OPCODE_DELETE 0x04
+#define BINARY_OPCODE_NOOP 0x0a
+#define BINARY_OPCODE_SETQ 0x11
+#define BINARY_OPCODE_DELETEQ 0x14
+#define BINARY_STATUS_OK 0x0000
+#define BINARY_STATUS_KEY_NOT_FOUND 0x0001
+#define BINARY_STATUS_INVALID_ARGUMENTS 0x0004
+#define BINARY_STATUS_UNKNOWN_COMMAND 0x0081
+
+bool MemcachedStore::get(const std::string& key, item& found) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = items.find(key);
+    if (it == items.end())
+        return false;
+    found = it->second;
+    return true;
+}
+
+uint64_t MemcachedStore::set(const std::string& key, uint32_t flags, const std::string& value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    item& i = items[key];
+    i.flags = flags;
+    i.cas = next_cas++;
+    i.value = value;
+    return i.cas;
+}
+
+bool MemcachedStore::erase(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return items.erase(key) > 0;
+}
+
+MemcachedUdpServer::MemcachedUdpServer(boost::asio::io_service &io_service, const args &args,
+                                       MemcachedStore& store)
+        : UdpServer(io_service, args.port, args.interface), store(store), ik(NULL),
+          requests(0), keys(0), hits(0) {
+    if (!args.attach)
+        return;
+
+    uuid_t uuid = MEMCACHED_UUID;
+    ik = ik_create(args.interface.c_str(), uuid);
+    if (!ik) {
+        std::cerr << "Warning: couldn't create ikernel\n";
+        return;
+    }
+
+    /* The memcached ikernel has no bulk reads */
+    control.reset(new IkernelControl(ik, 0));
+    control->write(MEMCACHED_PROTOCOL, args.binary ? MEMCACHED_BINARY : MEMCACHED_ASCII);
+    if (args.counters)
+        initial_counters = read_ikernel_counters();
+    int fd = socket_.native_handle();
+    ik_attach(fd, ik);
+}
+
+/* Splits the line at p into tokens, and advances p past it */
+static void tokenize_line(const char*& p, const char* end, std::vector<std::string>& tokens) {
+    static const char crlf[] = "\r\n";
+    const char* eol = std::search(p, end, crlf, crlf + 2);
+    std::string line(p, eol);
+    p = eol == end ? end : eol + 2;
+
+    std::istringstream stream(line);
+    std::string token;
+    tokens.clear();
+    while (stream >> token)
+        tokens.push_back(token);
+}
+
+void MemcachedUdpServer::process_ascii(const char* p, const char* end, std::string& response) {
+    std::vector<std::string> tokens;
+
+    while (p < end) {
+        tokenize_line(p, end, tokens);
+        if (tokens.empty()) {
+            response += "ERROR\r\n";
+            continue;
+        }
+
+        const std::string& command = tokens[0];
+        const bool noreply = tokens.back() == "noreply";
+        if (command == "get") {
+            for (size_t i = 1; i < tokens.size(); ++i) {
+                MemcachedStore::item item;
+                ++keys;
+                if (!store.get(tokens[i], item))
+                    continue;
+                ++hits;
+                response += "VALUE " + tokens[i] + " " + std::to_string(item.flags) + " " +
+                            std::to_string(item.value.size()) + "\r\n" + item.value + "\r\n";
+            }
+            response += "END\r\n";
+        } else if (command == "set" && (tokens.size() == 5 || (tokens.size() == 6 && noreply))) {
+            /* Expiration times are ignored */
+            const uint32_t flags = strtoul(tokens[2].c_str(), NULL, 10);
+            const size_t bytes = strtoul(tokens[4].c_str(), NULL, 10);
+            if (size_t(end - p) < bytes + 2 || memcmp(p + bytes, "\r\n", 2)) {
+                response += "CLIENT_ERROR bad data chunk\r\n";
+                return;
+            }
+            store.set(tokens[1], flags, std::string(p, bytes));
+            p += bytes + 2;
+            if (!noreply)
+                response += "STORED\r\n";
+        } else if (command == "delete" && (tokens.size() == 2 || (tokens.size() == 3 && noreply))) {
+            const bool found = store.erase(tokens[1]);
+            if (!noreply)
+                response += found ? "DELETED\r\n" : "NOT_FOUND\r\n";
+        } else {
+            response += "ERROR\r\n";
+        }
+    }
+}
+
+static uint32_t read_be32(const unsigned char* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+static void append_be(std::string& s, uint64_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; --i)
+        s += char(value >> (8 * i));
+}
+
+static void append_binary_response(std::string& response, uint8_t opcode, uint16_t status,
+                                   const unsigned char* opaque, uint64_t cas,
+                                   const std::string& extras, const std::string& key,
+                                   const std::string& value) {
+    response += char(BINARY_RESPONSE_MAGIC);
+    response += char(opcode);
+    append_be(response, key.size(), 2);
+    response += char(extras.size());
+    response += char(0); /* data type */
+    append_be(response, status, 2);
+    append_be(response, extras.size() + key.size() + value.size(), 4);
+    response.append(reinterpret_cast<const char*>(opaque), 4);
+    append_be(response, cas, 8);
+    response += extras + key + value;
+}
+
+void MemcachedUdpServer::process_binary(const char* p, const char* end, std::string& response) {
+    while (end - p >= BINARY_HEADER_SIZE) {
+        const unsigned char* header = reinterpret_cast<const unsigned char*>(p);
+        const uint8_t opcode = header[1];
+        const uint16_t key_length = (header[2] << 8) | header[3];
+        const uint8_t extras_length = header[4];
+        const uint32_t body_length = read_be32(&header[8]);
+        const unsigned char* opaque = &header[12];
+
+        if (header[0] != BINARY_REQUEST_MAGIC || uint32_t(end - p) - BINARY_HEADER_SIZE < body_length ||
+            uint32_t(extras_length) + key_length > body_length)
+            return;
+
+        const char* body = p + BINARY_HEADER_SIZE;
+        const std::string key(body + extras_length, key_length);
+        const std::string value(body + extras_length + key_length,
+                                body_length - extras_length - key_length);
+        p = body + body_length;
+
+        switch (opcode) {
+        case BINARY_OPCODE_GET:
+        case BINARY_OPCODE_GETQ:
+        case BINARY_OPCODE_GETK:
+        case BINARY_OPCODE_GETKQ: {
+            const bool quiet = opcode == BINARY_OPCODE_GETQ || opcode == BINARY_OPCODE_GETKQ;
+            const bool with_key = opcode == BINARY_OPCODE_GETK || opcode == BINARY_OPCODE_GETKQ;
+            MemcachedStore::item item;
+            ++keys;
+            if (store.get(key, item)) {
+                std::string flags;
+                append_be(flags, item.flags, 4);
+                ++hits;
+                append_binary_response(response, opcode, BINARY_STATUS_OK, opaque, item.cas,
+                                       flags, with_key ? key : "", item.value);
+            } else if (!quiet) {
+                append_binary_response(response, opcode, BINARY_STATUS_KEY_NOT_FOUND, opaque, 0,
+                                       "", with_key ? key : "", "");
+            }
+            break;
+        }
+        case BINARY_OPCODE_SET:
+        case BINARY_OPCODE_SETQ: {
+            if (extras_length != 8) {
+                append_binary_response(response, opcode, BINARY_STATUS_INVALID_ARGUMENTS, opaque, 0,
+                                       "", "", "");
+                break;
+            }
+            /* Expiration times are ignored */
+            const uint64_t cas = store.set(key, read_be32(reinterpret_cast<const unsigned char*>(body)), value);
+            if (opcode == BINARY_OPCODE_SET)
+                append_binary_response(response, opcode, BINARY_STATUS_OK, opaque, cas, "", "", "");
+            break;
+        }
+        case BINARY_OPCODE_DELETE:
+        case BINARY_OPCODE_DELETEQ: {
+            const bool found = store.erase(key);
+            if (opcode == BINARY_OPCODE_DELETE || !found)
+                append_binary_response(response, opcode,
+                                       found ? BINARY_STATUS_OK : BINARY_STATUS_KEY_NOT_FOUND,
+                                       opaque, 0, "", "", "");
+            break;
+        }
+        case BINARY_OPCODE_NOOP:
+            append_binary_response(response, opcode, BINARY_STATUS_OK, opaque, 0, "", "", "");
+            break;
+        default:
+            append_binary_response(response, opcode, BINARY_STATUS_UNKNOWN_COMMAND, opaque, 0,
+                                   "", "", "");
+            break;
+        }
+    }
+}
+
+void MemcachedUdpServer::process(std::size_t length) {
+    if (length < frame_header_size)
+        return;
+
+    const char* payload = reinterpret_cast<const char*>(data_) + frame_header_size;
+    const char* end = reinterpret_cast<const char*>(data_) + length;
+    std::string response;
+
+    ++requests;
+    if (payload < end && uint8_t(*payload) == BINARY_REQUEST_MAGIC)
+        process_binary(payload, end, response);
+    else
+        process_ascii(payload, end, response);
+
+    if (!response.empty())
+        send_response(response);
+}
+
+void MemcachedUdpServer::send_response(const std::string& response) {
+    const size_t chunk = max_datagram - frame_header_size;
+    const size_t total = (response.size() + chunk - 1) / chunk;
+    char datagram[max_datagram];
+
+    for (size_t seq = 0; seq < total; ++seq) {
+        const size_t offset = seq * chunk;
+        const size_t bytes = std::min(chunk, response.size() - offset);
+
+        /* Request ID from the request, then sequence number and datagram count */
+        memcpy(datagram, data_, 2);
+        datagram[2] = seq >> 8;
+        datagram[3] = seq;
+        datagram[4] = total >> 8;
+        datagram[5] = total;
+        datagram[6] = datagram[7] = 0;
+        memcpy(datagram + frame_header_size, response.data() + offset, bytes);
+
+        boost::system::error_code ec;
+        socket_.send_to(boost::asio::buffer(datagram, frame_header_size + bytes), sender_endpoint_,
+                        0, ec);
+        if (ec)
+            std::cerr << "Warning: couldn't send response: " << ec.message() << "\n";
+    }
+}
+
+std::map<std::string, int> MemcachedUdpServer::read_ikernel_counters() {
+    static const IkernelControl::counter_list counters = {
+        { "get_hits", MEMCACHED_GET_HITS },
+        { "get_misses", MEMCACHED_GET_MISSES },
+        { "sets", MEMCACHED_SETS },
+        { "evictions", MEMCACHED_EVICTIONS },
+        { "dropped_backpressure", MEMCACHED_DROPPED_BACKPRESSURE },
+    };
+
+    try {
+        return control->read_counters(counters, MEMCACHED_SNAPSHOT).get();
+    } catch (std::system_error& e) {
+        std::cerr << "Warning: couldn't read ikernel counters: " << e.what() << "\n";
+        return std::map<std::string, int>();
+    }
+}
+
+std::map<std::string, int> MemcachedUdpServer::get_ikernel_counters() {
+    if (!control)
+        return std::map<std::string, int>();
+
+    std::map<std::string, int> counters = read_ikernel_counters();
+    for (auto& counter : counters)
+        counter.second -= initial_counters[counter.first];
+    return counters;
+}
+
+MemcachedUdpServer::~MemcachedUdpServer() {}
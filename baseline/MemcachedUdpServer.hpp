@@ -0,0 +1,109 @@
+//
+// Copyright (c) 2016-2017 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef MEMCACHEDUDPSERVER_HPP
+#define MEMCACHEDUDPSERVER_HPP
+
+#include "UdpServer.hpp"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class ikernel;
+class IkernelControl;
+
+/* In-memory key-value store shared by all server threads */
+class MemcachedStore {
+public:
+    struct item {
+        uint32_t flags;
+        uint64_t cas;
+        std::string value;
+    };
+
+    MemcachedStore() : next_cas(1) {}
+
+    bool get(const std::string& key, item& found);
+    /* Returns the CAS value of the new item */
+    uint64_t set(const std::string& key, uint32_t flags, const std::string& value);
+    bool erase(const std::string& key);
+
+private:
+    std::mutex mutex;
+    std::unordered_map<std::string, item> items;
+    uint64_t next_cas;
+};
+
+/* Memcached over UDP, in the ASCII and binary protocols. Requests the
+ * ikernel answers never reach the server, so comparing the server's counts
+ * with the ikernel's shows how much of the load the NIC serves. */
+class MemcachedUdpServer : public UdpServer {
+public:
+    struct args {
+        short port;
+        std::string interface;
+        /* Attach the memcached ikernel to the socket */
+        bool attach;
+        /* Configure the ikernel for the binary protocol */
+        bool binary;
+        /* Take a snapshot of the ikernel's counters now, to compare against
+         * at the end of the run */
+        bool counters;
+    };
+
+    MemcachedUdpServer(boost::asio::io_service& io_service, const args& args,
+                       MemcachedStore& store);
+    virtual void process(std::size_t length);
+
+    /* Requests and GET keys served by the host */
+    long get_requests() const { return requests; }
+    long get_keys() const { return keys; }
+    long get_hits() const { return hits; }
+
+    /* ikernel counters since construction (empty without an ikernel) */
+    std::map<std::string, int> get_ikernel_counters();
+
+    virtual ~MemcachedUdpServer();
+private:
+    /* Memcached UDP frame header */
+    enum { frame_header_size = 8 };
+    /* Responses larger than this are split into several datagrams */
+    enum { max_datagram = 1400 };
+
+    MemcachedStore& store;
+    ikernel* ik;
+    std::unique_ptr<IkernelControl> control;
+    std::map<std::string, int> initial_counters;
+    long requests, keys, hits;
+
+    void process_ascii(const char* p, const char* end, std::string& response);
+    void process_binary(const char* p, const char* end, std::string& response);
+    void send_response(const std::string& response);
+    std::map<std::string, int> read_ikernel_counters();
+};
+
+#endif //MEMCACHEDUDPSERVER_HPP
@@ -0,0 +1,125 @@
+//
+// Copyright (c) 2016-2017 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "MetricsRegistry.hpp"
+
+MetricsRegistry::registration& MetricsRegistry::registration::operator=(registration&& other)
+{
+    if (registry)
+        registry->remove(id);
+    registry = other.registry;
+    id = other.id;
+    other.registry = nullptr;
+    return *this;
+}
+
+MetricsRegistry::registration::~registration()
+{
+    if (registry)
+        registry->remove(id);
+}
+
+MetricsRegistry::MetricsRegistry() : next_id(0), last_sample(std::chrono::steady_clock::now())
+{
+}
+
+MetricsRegistry::registration MetricsRegistry::add_source(const std::vector<metric_info>& metrics, source read)
+{
+    std::lock_guard<std::mutex> sources_lock(sources_mutex);
+    std::lock_guard<std::mutex> values_lock(values_mutex);
+    group g = { metrics, read, false, std::vector<uint64_t>(metrics.size()),
+                std::vector<double>(metrics.size()) };
+    groups[next_id] = g;
+    return registration(this, next_id++);
+}
+
+MetricsRegistry::registration MetricsRegistry::add_counter(const std::string& name, std::function<uint64_t()> read)
+{
+    return add_source({ { name, COUNTER } }, [read](std::vector<uint64_t>& values) {
+        values[0] = read();
+        return true;
+    });
+}
+
+MetricsRegistry::registration MetricsRegistry::add_gauge(const std::string& name, std::function<uint64_t()> read)
+{
+    return add_source({ { name, GAUGE } }, [read](std::vector<uint64_t>& values) {
+        values[0] = read();
+        return true;
+    });
+}
+
+void MetricsRegistry::remove(int id)
+{
+    std::lock_guard<std::mutex> sources_lock(sources_mutex);
+    std::lock_guard<std::mutex> values_lock(values_mutex);
+    groups.erase(id);
+}
+
+void MetricsRegistry::sample()
+{
+    std::lock_guard<std::mutex> sources_lock(sources_mutex);
+
+    std::map<int, std::vector<uint64_t> > samples;
+    std::map<int, bool> valid;
+    for (auto& g : groups) {
+        std::vector<uint64_t> values(g.second.metrics.size());
+        valid[g.first] = g.second.read(values);
+        samples[g.first] = values;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - last_sample).count();
+    last_sample = now;
+
+    std::lock_guard<std::mutex> values_lock(values_mutex);
+    for (auto& g : groups) {
+        group& cur = g.second;
+        const std::vector<uint64_t>& values = samples[g.first];
+        for (size_t i = 0; i < cur.metrics.size(); ++i) {
+            /* A counter that went back was reset */
+            if (cur.metrics[i].type == COUNTER && cur.valid && valid[g.first] &&
+                seconds > 0 && values[i] >= cur.values[i])
+                cur.rates[i] = (values[i] - cur.values[i]) / seconds;
+            else
+                cur.rates[i] = 0;
+        }
+        cur.valid = valid[g.first];
+        if (cur.valid)
+            cur.values = values;
+    }
+}
+
+void MetricsRegistry::write(std::ostream& out) const
+{
+    std::lock_guard<std::mutex> values_lock(values_mutex);
+    for (auto& g : groups) {
+        if (!g.second.valid)
+            continue;
+        for (size_t i = 0; i < g.second.metrics.size(); ++i)
+            out << g.second.metrics[i].name << ' ' << g.second.values[i] << ' '
+                << g.second.rates[i] << '\n';
+    }
+}
@@ -0,0 +1,119 @@
+//
+// Copyright (c) 2016-2017 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef METRICSREGISTRY_HPP
+#define METRICSREGISTRY_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/* A host counter with a single writer that other threads can sample */
+class host_counter {
+public:
+    host_counter(uint64_t value = 0) : value(value) {}
+
+    host_counter& operator+=(uint64_t n)
+    {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        return *this;
+    }
+    host_counter& operator++() { return *this += 1; }
+    operator uint64_t() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value;
+};
+
+/* Named metrics collected from the host, the ikernels and the NICA
+ * statistics registers.
+ *
+ * Metrics are read in groups by a source function, so that a group can be
+ * latched and read together. Each sample() polls all the sources and
+ * computes the rate of every counter since the previous sample. */
+class MetricsRegistry {
+public:
+    enum kind { COUNTER, GAUGE };
+
+    struct metric_info {
+        std::string name;
+        kind type;
+    };
+
+    /* Reads the values of a group's metrics, in order. Returns false when
+     * the values are not available. */
+    typedef std::function<bool(std::vector<uint64_t>& values)> source;
+
+    /* Removes its source from the registry when destroyed */
+    class registration {
+    public:
+        registration() : registry(), id() {}
+        registration(MetricsRegistry* registry, int id) : registry(registry), id(id) {}
+        registration(registration&& other) : registry(other.registry), id(other.id) { other.registry = nullptr; }
+        registration& operator=(registration&& other);
+        ~registration();
+
+    private:
+        MetricsRegistry* registry;
+        int id;
+    };
+
+    MetricsRegistry();
+
+    registration add_source(const std::vector<metric_info>& metrics, source read);
+    registration add_counter(const std::string& name, std::function<uint64_t()> read);
+    registration add_gauge(const std::string& name, std::function<uint64_t()> read);
+
+    void sample();
+    /* One "name value rate" line per metric. The rate of gauges is 0. */
+    void write(std::ostream& out) const;
+
+private:
+    struct group {
+        std::vector<metric_info> metrics;
+        source read;
+        bool valid;
+        std::vector<uint64_t> values;
+        std::vector<double> rates;
+    };
+
+    void remove(int id);
+
+    /* Held while sources are called, so that a source is not removed while
+     * it is running */
+    std::mutex sources_mutex;
+    mutable std::mutex values_mutex;
+    std::map<int, group> groups;
+    int next_id;
+    std::chrono::steady_clock::time_point last_sample;
+};
+
+#endif //METRICSREGISTRY_HPP
@@ -0,0 +1,86 @@
+//
+// Copyright (c) 2016-2017 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "MetricsServer.hpp"
+#include <memory>
+#include <sstream>
+#include <unistd.h>
+
+using boost::asio::local::stream_protocol;
+
+MetricsServer::MetricsServer(MetricsRegistry& registry, const std::string& path,
+                             std::chrono::milliseconds period) :
+    registry(registry), path(path), period(period),
+    acceptor(io_service), socket(io_service), stopping(false)
+{
+    ::unlink(path.c_str());
+    acceptor.open();
+    acceptor.bind(stream_protocol::endpoint(path));
+    acceptor.listen();
+    do_accept();
+
+    server_thread = std::thread([this]() { io_service.run(); });
+    poll_thread = std::thread(&MetricsServer::poll, this);
+}
+
+MetricsServer::~MetricsServer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    stop_changed.notify_all();
+    poll_thread.join();
+
+    io_service.stop();
+    server_thread.join();
+    ::unlink(path.c_str());
+}
+
+void MetricsServer::poll()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        lock.unlock();
+        registry.sample();
+        lock.lock();
+        stop_changed.wait_for(lock, period, [this]() { return stopping; });
+    }
+}
+
+void MetricsServer::do_accept()
+{
+    acceptor.async_accept(socket, [this](boost::system::error_code ec) {
+        if (!ec) {
+            std::ostringstream out;
+            registry.write(out);
+            auto text = std::make_shared<std::string>(out.str());
+            auto client = std::make_shared<stream_protocol::socket>(std::move(socket));
+            boost::asio::async_write(*client, boost::asio::buffer(*text),
+                [text, client](boost::system::error_code, std::size_t) {});
+        }
+        do_accept();
+    });
+}
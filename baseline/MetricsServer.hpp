@@ -0,0 +1,68 @@
+//
+// Copyright (c) 2016-2017 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef METRICSSERVER_HPP
+#define METRICSSERVER_HPP
+
+#include "MetricsRegistry.hpp"
+#include <boost/asio.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/* Samples a metrics registry periodically and serves the latest sample on a
+ * local Unix socket. Each connection receives the metrics as text (see
+ * MetricsRegistry::write) and is then closed, e.g.:
+ *
+ *     socat - UNIX-CONNECT:/tmp/nica-metrics.sock
+ */
+class MetricsServer {
+public:
+    MetricsServer(MetricsRegistry& registry, const std::string& path,
+                  std::chrono::milliseconds period = std::chrono::seconds(1));
+    ~MetricsServer();
+
+private:
+    void poll();
+    void do_accept();
+
+    MetricsRegistry& registry;
+    std::string path;
+    std::chrono::milliseconds period;
+
+    boost::asio::io_service io_service;
+    boost::asio::local::stream_protocol::acceptor acceptor;
+    boost::asio::local::stream_protocol::socket socket;
+    std::thread server_thread;
+
+    std::mutex mutex;
+    std::condition_variable stop_changed;
+    bool stopping;
+    std::thread poll_thread;
+};
+
+#endif //METRICSSERVER_HPP
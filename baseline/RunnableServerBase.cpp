@@ -50,7 +50,13 @@ int RunnableServerBase::parse_command_line_options() {
             ("seconds,s", value<int>()->default_value(5), "running time in seconds")
             ("threshold,v", value<uint32_t>()->default_value(0), "threshold value")
 	    ("interface,I", value<std::string>()->default_value(""), "interface name")
-	    ("use_custom_ring,c", "enable custom ring");
+	    ("use_custom_ring,c", "enable custom ring")
+	    ("coalesce", "receive batched custom ring messages")
+	    ("metrics-socket", value<std::string>(), "serve metrics on a Unix socket")
+	    ("axilite-layout", value<std::string>(), "NICA register layout (Vivado HLS driver header)")
+	    ("fpga-device", value<std::string>()->default_value("/dev/mst/mt4117_pciconf0_fpga"),
+	     "FPGA device for reading NICA registers");
+    add_options(desc);
 
     store(parse_command_line(argc, argv, desc), vm);
 
@@ -27,10 +27,12 @@
 #define IKERNEL_RUNNABLESERVERBASE_HPP
 
 #include <boost/asio/io_service.hpp>
+#include <boost/program_options/options_description.hpp>
 #include <boost/program_options/variables_map.hpp>
 
 struct ikernel_attributes;
 
+using boost::program_options::options_description;
 using boost::program_options::variables_map;
 
 class RunnableServerBase {
@@ -39,6 +41,8 @@ public:
     virtual ~RunnableServerBase();
     virtual int run();
     virtual int parse_command_line_options();
+    /* Server specific command line options */
+    virtual void add_options(options_description& desc) {}
 
     virtual void preflight() = 0;
     virtual void postflight() = 0;
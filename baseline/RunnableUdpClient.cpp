@@ -32,6 +32,7 @@
 #include <boost/program_options/parsers.hpp>
 #include <arpa/inet.h>
 #include "UdpClient.hpp"
+#include "MemcachedLoad.hpp"
 #include <pktgen.hpp>
 #include <nica.h>
 #include <unistd.h>
@@ -54,6 +55,22 @@ int main(int argc, char* argv[]) {
 	    ("payload-size,s", po::value<int>()->default_value(4), "payload size in bytes, default 4 Bytes")
             ("burst-size,b", po::value<int>()->default_value(4000), "burst_size for pktgen ikernel, default 4000");
         ;
+        po::options_description memcached_desc("memcached load options");
+        memcached_desc.add_options()
+            ("memcached", "generate memcached requests instead of fixed payloads")
+            ("binary", "use the memcached binary protocol")
+            ("threads,t", po::value<int>()->default_value(1), "number of threads, each with its own socket")
+            ("ports", po::value<int>()->default_value(1), "thread i sends to port + i % ports")
+            ("seconds", po::value<int>()->default_value(5), "running time in seconds")
+            ("outstanding", po::value<int>()->default_value(32), "requests in flight per thread")
+            ("timeout-ms", po::value<int>()->default_value(100), "time to wait for a response")
+            ("keys", po::value<int>()->default_value(100000), "number of keys")
+            ("zipf", po::value<double>()->default_value(0.99), "Zipf exponent of key popularity (0 is uniform)")
+            ("get-ratio", po::value<double>()->default_value(0.9), "fraction of requests that are GETs")
+            ("key-size", po::value<int>()->default_value(10), "key size in bytes")
+            ("value-size", po::value<int>()->default_value(10), "value size in bytes")
+            ("populate", "set every key once before measuring");
+        desc.add(memcached_desc);
 
         po::variables_map vm;
         po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -68,6 +85,27 @@ int main(int argc, char* argv[]) {
                     port = vm["port"].as<std::string>(),
                     interface = vm["interface"].as<std::string>(),
                     local_ip = vm["local-ip"].as<std::string>();
+
+        if (vm.count("memcached")) {
+            MemcachedLoad::args args = {
+                .host = hostname,
+                .port = port,
+                .ports = vm["ports"].as<int>(),
+                .local_ip = local_ip,
+                .threads = vm["threads"].as<int>(),
+                .secs = vm["seconds"].as<int>(),
+                .outstanding = vm["outstanding"].as<int>(),
+                .timeout_ms = vm["timeout-ms"].as<int>(),
+                .binary = vm.count("binary") > 0,
+                .keys = vm["keys"].as<int>(),
+                .zipf = vm["zipf"].as<double>(),
+                .get_ratio = vm["get-ratio"].as<double>(),
+                .key_size = vm["key-size"].as<int>(),
+                .value_size = vm["value-size"].as<int>(),
+                .populate = vm.count("populate") > 0,
+            };
+            return MemcachedLoad(args).run();
+        }
 	
 	int payload_size = vm["payload-size"].as<int>();
 	int burst_size = vm["burst-size"].as<int>();
@@ -27,6 +27,8 @@
 #include <arpa/inet.h>
 #include <nica.h>
 #include <threshold.hpp>
+#include <custom_rx_ring.hpp>
+#include "IkernelControl.hpp"
 #include <system_error>
 
 #include <boost/lexical_cast.hpp>
@@ -55,8 +57,8 @@ int StatisticsUdpServer::post_recv(int producer_index, int num_entries)
 
     for (int i = 0; i < num_entries; ++i) {
         size_t wr_id = posted_receive_buffers++;
-        sg[i].addr = (uintptr_t)&(receive_buffer[wr_id % NUM_RECEIVE_WR]);
-        sg[i].length =  sizeof(*receive_buffer);
+        sg[i].addr = (uintptr_t)receive_slot(wr_id);
+        sg[i].length = slot_size;
         sg[i].lkey = mr->lkey;
 
         wr[i].wr_id = uint64_t(wr_id);
@@ -77,9 +79,12 @@ int StatisticsUdpServer::post_recv(int producer_index, int num_entries)
     return 0;
 }
 
-StatisticsUdpServer::StatisticsUdpServer(boost::asio::io_service &io_service, const StatisticsUdpServer::args& args, const uint32_t threshold, bool use_custom_ring)
+StatisticsUdpServer::StatisticsUdpServer(boost::asio::io_service &io_service, const StatisticsUdpServer::args& args, const uint32_t threshold, bool use_custom_ring,
+                                         bool coalesce)
         : UdpServer(io_service, args.port, args.interface), secs(args.secs), max(0), min(0), sum(0), count(0), threshold_count(0), threshold(threshold),
-	use_custom_ring(use_custom_ring), ik(), receive_buffer(), mr(), cr(), consumer_index(0), producer_index(0), posted_receive_buffers(0), outstanding_recv_wrs(0)
+	use_custom_ring(use_custom_ring), coalesce(coalesce),
+	slot_size(coalesce ? COALESCE_MAX_BYTES : sizeof(uint64_t)), ik(), receive_buffer(), mr(), cr(), consumer_index(0), producer_index(0), posted_receive_buffers(0), outstanding_recv_wrs(0),
+	record_credits(0), written_record_credits(0)
 {
 
     uuid_t uuid = THRESHOLD_UUID;
@@ -87,22 +92,23 @@ StatisticsUdpServer::StatisticsUdpServer(boost::asio::io_service &io_service, co
     if (!ik) {
         std::cerr << "Warning: couldn't create ikernel\n";
     } else {
-        int ret = ik_write(ik, THRESHOLD_VALUE, threshold);
-        if (ret) {
-            std::cerr << "Warning: couldn't write ikernel threshold\n";
-        }
+        control.reset(new IkernelControl(ik, THRESHOLD_DROPPED_BACKPRESSURE - THRESHOLD_MIN + 1));
+        auto threshold_written = control->write(THRESHOLD_VALUE, threshold);
+        auto coalesce_written = control->write(THRESHOLD_COALESCE, coalesce);
+        /* Other libnica calls on the ikernel run on the control's worker,
+         * after the writes above */
         int fd = socket_.native_handle();
-        ik_attach(fd, ik);
-	auto flow_id = ik_socket_flow_id(fd);
+	auto flow_id = control->call([=]() {
+		ik_attach(fd, ik);
+		return ik_socket_flow_id(fd);
+	}).get();
 	std::cout << "Got flow ID: " << flow_id << "\n";
+	std::future<void> ring_written;
 
 	if (use_custom_ring) {
-		cr = custom_ring_create(ik);
-		receive_buffer = new uint64_t[NUM_RECEIVE_WR];
-		for (int i = 0; i  < NUM_RECEIVE_WR; ++i) {
-	                receive_buffer[i] = 0;
-		}
-                mr = custom_ring_reg_mr(cr, receive_buffer, sizeof(*receive_buffer) * NUM_RECEIVE_WR, IBV_ACCESS_LOCAL_WRITE);
+		cr = control->call([=]() { return custom_ring_create(ik); }).get();
+		receive_buffer = new uint8_t[slot_size * NUM_RECEIVE_WR]();
+                mr = custom_ring_reg_mr(cr, receive_buffer, slot_size * NUM_RECEIVE_WR, IBV_ACCESS_LOCAL_WRITE);
 		if (!mr) {
 			perror("ibv_reg_mr");
 			return;
@@ -111,19 +117,33 @@ StatisticsUdpServer::StatisticsUdpServer(boost::asio::io_service &io_service, co
                     return;
 		std::cout << "Got custom ring handle " << custom_ring_handle(cr) << "\n";
 
-		ret = ik_write(ik, THRESHOLD_RING_ID + flow_id, custom_ring_handle(cr));
+		ring_written = control->write(THRESHOLD_RING_ID + flow_id, custom_ring_handle(cr));
 	} else {
-		ret = ik_write(ik, THRESHOLD_RING_ID, 0);
+		ring_written = control->write(THRESHOLD_RING_ID, 0);
 	}
-	if (ret) {
-		perror("ik_write for threshold ring id");
+
+	try {
+		ring_written.get();
+	} catch (std::system_error& e) {
+		std::cerr << "ERROR: ik_write for threshold ring id " << e.what() << "\n";
 		return;
 	}
+	try {
+		threshold_written.get();
+	} catch (std::system_error& e) {
+		std::cerr << "Warning: couldn't write ikernel threshold: " << e.what() << "\n";
+	}
+	try {
+		coalesce_written.get();
+	} catch (std::system_error& e) {
+		std::cerr << "Warning: couldn't write ikernel coalesce setting: " << e.what() << "\n";
+	}
     }
 }
 
 StatisticsUdpServer::~StatisticsUdpServer()
 {
+	control.reset();
 	if (mr)
         	ibv_dereg_mr(mr);
 	if (receive_buffer)
@@ -137,7 +157,10 @@ StatisticsUdpServer::~StatisticsUdpServer()
 void StatisticsUdpServer::process(std::size_t length) {
    assert(length >= 4);
 
-   uint32_t new_data = read_uint();
+   process_value(read_uint());
+}
+
+void StatisticsUdpServer::process_value(uint32_t new_data) {
    ++count;
    sum += new_data;
    max = std::max(max, new_data);
@@ -149,9 +172,51 @@ void StatisticsUdpServer::process(std::size_t length) {
    }
 }
 
+uint16_t StatisticsUdpServer::process_batch(const uint8_t* message, uint32_t length) {
+    const uint16_t* header = reinterpret_cast<const uint16_t*>(message);
+    const uint16_t records = ntohs(header[0]);
+    const uint16_t record_length = ntohs(header[1]);
+
+    if (record_length < sizeof(uint32_t) ||
+        uint32_t(COALESCE_HEADER_BYTES + records * record_length) > length) {
+        std::cerr << "invalid batch: " << records << " records of " << record_length << " bytes\n";
+        return 0;
+    }
+
+    for (int i = 0; i < records; ++i) {
+        uint32_t value;
+        memcpy(&value, message + COALESCE_HEADER_BYTES + i * record_length, sizeof(value));
+        process_value(ntohl(value));
+    }
+    return records;
+}
+
+void StatisticsUdpServer::grant_record_credits() {
+    if (record_credits == written_record_credits)
+        return;
+    /* A single write in flight; the next one carries the latest count */
+    if (record_credits_written.valid()) {
+        if (record_credits_written.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return;
+        try {
+            record_credits_written.get();
+        } catch (std::system_error& e) {
+            std::cerr << "Warning: couldn't grant record credits: " << e.what() << "\n";
+        }
+    }
+
+    written_record_credits = record_credits;
+    record_credits_written = control->write(THRESHOLD_RECORD_CREDITS,
+                                            int(uint32_t(record_credits) << 16 | custom_ring_handle(cr)));
+}
+
+uint8_t* StatisticsUdpServer::receive_slot(size_t wr_id) {
+    return &receive_buffer[(wr_id % NUM_RECEIVE_WR) * slot_size];
+}
+
 uint32_t StatisticsUdpServer::read_uint() {
     if (use_custom_ring) {
-        return receive_buffer[(consumer_index++) % NUM_RECEIVE_WR];
+        return *reinterpret_cast<uint64_t*>(receive_slot(consumer_index++));
     } else {
         return ntohl(*reinterpret_cast<uint32_t*>(data_+14));   
     }
@@ -163,73 +228,83 @@ int StatisticsUdpServer::get_host_count() {
 }
 
 int StatisticsUdpServer::get_dropped_count() {
-    int hw_count = 0;
-    int ret = ik_read(ik, THRESHOLD_COUNT, &hw_count);
-    if (ret) {
-        std::error_condition econd = std::system_category().default_error_condition(errno);
-        std::cerr << "Warning: couldn't read count from ikernel: " << econd.message() << "\n";
-    } else {
-        std::cerr << "hw counter value: " << hw_count << "\n";
-    }
- 
-    int hw_threshold_value = 0;
-    ret = ik_read(ik, THRESHOLD_VALUE, &hw_threshold_value);
-    if (ret) {
-        std::error_condition econd = std::system_category().default_error_condition(errno);
-        std::cerr << "Warning: couldn't read threshold value from ikernel: " << econd.message() << "\n";
-    } else {
-        std::cerr << "threshold value: " << hw_threshold_value << "\n";
-    }
-   
+    if (!control)
+        return 0;
+
+    /* Latch the counters so that they are all taken at the same time */
+    auto counters = control->read_counters({
+        { "hw counter value", THRESHOLD_COUNT },
+        { "threshold value", THRESHOLD_VALUE },
+        { "dropped packets", THRESHOLD_DROPPED },
+        { "hw min", THRESHOLD_MIN },
+        { "hw max", THRESHOLD_MAX },
+        { "hw sum_lo", THRESHOLD_SUM_LO },
+        { "hw dropped backpressure", THRESHOLD_DROPPED_BACKPRESSURE },
+    }, THRESHOLD_SNAPSHOT);
+
     int hw_dropped = 0;
-    ret = ik_read(ik, THRESHOLD_DROPPED, &hw_dropped);
-    if (ret) {
-        std::error_condition econd = std::system_category().default_error_condition(errno);
-        std::cerr << "Warning: couldn't read dropped value from ikernel: " << econd.message() << "\n";
-    } else {
-        std::cerr << "dropped packets: " << hw_dropped << "\n";
+    try {
+        auto values = counters.get();
+        for (auto& counter : values)
+            std::cerr << counter.first << ": " << counter.second << "\n";
+        hw_dropped = values["dropped packets"];
+    } catch (std::system_error& e) {
+        std::cerr << "Warning: couldn't read counters from ikernel: " << e.what() << "\n";
     }
 
-    int hw_min = 0;
-    ret = ik_read(ik, THRESHOLD_MIN, &hw_min);
-    if (ret) {
-        std::error_condition econd = std::system_category().default_error_condition(errno);
-        std::cerr << "Warning: couldn't read min value from ikernel: " << econd.message() << "\n";
-    } else {
-        std::cerr << "hw min: " << hw_min << "\n";
-    }
+    std::cerr << "host threshold_count " << uint64_t(threshold_count) << "\n";
+    std::cerr << "host count " << uint64_t(count) << "\n";
 
-    int hw_max = 0;
-    ret = ik_read(ik, THRESHOLD_MAX, &hw_max);
-    if (ret) {
-        std::error_condition econd = std::system_category().default_error_condition(errno);
-        std::cerr << "Warning: couldn't read max value from ikernel: " << econd.message() << "\n";
-    } else {
-        std::cerr << "hw max: " << hw_max << "\n";
-    }
-   
-    int hw_sum_lo = 0;
-    ret = ik_read(ik, THRESHOLD_SUM_LO, &hw_sum_lo);
-    if (ret) {
-        std::error_condition econd = std::system_category().default_error_condition(errno);
-        std::cerr << "Warning: couldn't read sum_lo value from ikernel: " << econd.message() << "\n";
-    } else {
-        std::cerr << "hw sum_lo: " << hw_sum_lo << "\n";
-    }
+    return hw_dropped;//count + hw_count;
+}
 
-    int hw_dropped_backpressure = 0;
-    ret = ik_read(ik, THRESHOLD_DROPPED_BACKPRESSURE, &hw_dropped_backpressure);
-    if (ret) {
-        std::error_condition econd = std::system_category().default_error_condition(errno);
-        std::cerr << "Warning: couldn't read value from ikernel: " << econd.message() << "\n";
-    } else {
-        std::cerr << "hw dropped backpressure: " << hw_dropped_backpressure << "\n";
+std::vector<MetricsRegistry::registration> StatisticsUdpServer::register_metrics(
+    MetricsRegistry& registry, const std::string& prefix)
+{
+    std::vector<MetricsRegistry::registration> handles;
+
+    handles.push_back(registry.add_counter(prefix + ".host.count",
+        [this]() { return uint64_t(count); }));
+    handles.push_back(registry.add_counter(prefix + ".host.threshold_count",
+        [this]() { return uint64_t(threshold_count); }));
+    handles.push_back(registry.add_counter(prefix + ".host.sum",
+        [this]() { return uint64_t(sum); }));
+
+    if (!control)
+        return handles;
+
+    const IkernelControl::counter_list registers = {
+        { "count", THRESHOLD_COUNT },
+        { "dropped", THRESHOLD_DROPPED },
+        { "dropped_backpressure", THRESHOLD_DROPPED_BACKPRESSURE },
+        { "sum_lo", THRESHOLD_SUM_LO },
+        { "min", THRESHOLD_MIN },
+        { "max", THRESHOLD_MAX },
+        { "value", THRESHOLD_VALUE },
+    };
+    std::vector<MetricsRegistry::metric_info> metrics;
+    for (auto& reg : registers) {
+        bool gauge = reg.second == THRESHOLD_MIN || reg.second == THRESHOLD_MAX ||
+                     reg.second == THRESHOLD_VALUE;
+        metrics.push_back({ prefix + ".ikernel." + reg.first,
+                            gauge ? MetricsRegistry::GAUGE : MetricsRegistry::COUNTER });
     }
 
-    std::cerr << "host threshold_count " << threshold_count << "\n";
-    std::cerr << "host count " << count << "\n";
-
-    return hw_dropped;//count + hw_count;
+    handles.push_back(registry.add_source(metrics,
+        [this, registers](std::vector<uint64_t>& values) {
+            /* Latch the registers so that the group is consistent */
+            auto counters = control->read_counters(registers, THRESHOLD_SNAPSHOT);
+
+            try {
+                auto read = counters.get();
+                for (size_t i = 0; i < registers.size(); ++i)
+                    values[i] = uint32_t(read[registers[i].first]);
+            } catch (std::system_error& e) {
+                return false;
+            }
+            return true;
+        }));
+    return handles;
 }
 
 void StatisticsUdpServer::print_statistics() {
@@ -260,13 +335,22 @@ void StatisticsUdpServer::do_receive()
             abort();
         }
         producer_index = wc[i].wr_id;
-        std::cout << "got completion (wr_id = " << wc[i].wr_id << ") value " << std::hex << (uint32_t)receive_buffer[producer_index % NUM_RECEIVE_WR] << " length " << wc[i].byte_len << "\n";
+        if (coalesce) {
+            const uint16_t records = process_batch(receive_slot(producer_index), wc[i].byte_len);
+            if (records > 1)
+                record_credits += records - 1;
+            consumer_index = producer_index;
+            continue;
+        }
+        std::cout << "got completion (wr_id = " << wc[i].wr_id << ") value " << std::hex << *reinterpret_cast<uint32_t*>(receive_slot(producer_index)) << " length " << wc[i].byte_len << "\n";
     }
     while (producer_index != consumer_index)
         process(4);
 
     if (outstanding_recv_wrs < NUM_RECEIVE_WR / 2)
         post_recv(producer_index, NUM_RECEIVE_WR / 2);
+    if (coalesce)
+        grant_record_credits();
 
     // polling
     io_service.post([this]() { do_receive(); });
@@ -27,10 +27,14 @@
 #define STATISTICSUDPSERVER_HPP
 
 #include "UdpServer.hpp"
+#include "MetricsRegistry.hpp"
 #include <infiniband/verbs.h>
+#include <memory>
+#include <future>
 
 class ikernel;
 class custom_ring;
+class IkernelControl;
 
 class StatisticsUdpServer : public UdpServer {
 public:
@@ -40,7 +44,8 @@ public:
         std::string interface;
     };
 
-    StatisticsUdpServer(boost::asio::io_service& io_service, const args& args, const uint32_t threshold, bool use_custom_ring);
+    StatisticsUdpServer(boost::asio::io_service& io_service, const args& args, const uint32_t threshold, bool use_custom_ring,
+                        bool coalesce = false);
     ~StatisticsUdpServer();
     virtual void process(std::size_t length);
     void print_statistics();
@@ -48,29 +53,49 @@ public:
     int get_dropped_count();    
     int get_host_count();
 
+    /* Registers the host counters and the threshold ikernel's registers
+     * under the given prefix */
+    std::vector<MetricsRegistry::registration> register_metrics(
+        MetricsRegistry& registry, const std::string& prefix);
+
     virtual void do_receive();
 
 private:
     int post_recv(int first_entry, int num_entries);
+    void process_value(uint32_t value);
+    /* Process the records of a batched message, returning their number */
+    uint16_t process_batch(const uint8_t* message, uint32_t length);
+    /* Grant the ikernel back the credits of batched records */
+    void grant_record_credits();
+    uint8_t* receive_slot(size_t wr_id);
 
     uint32_t secs;
     uint32_t max;
     uint32_t min;
-    uint32_t sum;
-    uint32_t count;
-    uint32_t threshold_count;
+    host_counter sum;
+    host_counter count;
+    host_counter threshold_count;
     uint32_t threshold;
 
     bool use_custom_ring;
+    /* Each custom ring message holds a batch of values */
+    bool coalesce;
+    size_t slot_size;
     ikernel* ik;
-    uint64_t* receive_buffer;
+    uint8_t* receive_buffer;
     ibv_mr *mr;
     custom_ring* cr;
+    std::unique_ptr<IkernelControl> control;
 
     uint32_t consumer_index; // last read
     uint32_t producer_index; // last received
     uint32_t posted_receive_buffers; // of all times
     uint32_t outstanding_recv_wrs; // remaining
+    /* The ikernel charges a credit for each record, but a batch takes a
+     * single receive buffer: records received beyond one per batch, and the
+     * last count written to the ikernel */
+    uint16_t record_credits, written_record_credits;
+    std::future<void> record_credits_written;
     uint32_t read_uint();
 };
 
@@ -25,6 +25,8 @@
 
 #include "StatisticsUdpServer.hpp"
 #include "RunnableServerBase.hpp"
+#include "MetricsServer.hpp"
+#include "NicaMetrics.hpp"
 #include "threshold.hpp"
 #include <vma/vma_extra.h>
 #include <future>
@@ -40,6 +42,18 @@ protected:
         dropped_counts = std::vector<std::future<int> >(thread_num);
         host_counts = std::vector<std::future<int> >(thread_num);
 
+        if (!vm.count("metrics-socket"))
+            return;
+
+        metrics.reset(new MetricsRegistry());
+        if (vm.count("axilite-layout")) {
+            AxiLiteLayout layout;
+            if (layout.load(vm["axilite-layout"].as<std::string>())) {
+                auto regs = std::make_shared<MlxFpgaRegisters>(vm["fpga-device"].as<std::string>());
+                nica_metrics = add_nica_metrics(*metrics, layout, regs);
+            }
+        }
+        metrics_server.reset(new MetricsServer(*metrics, vm["metrics-socket"].as<std::string>()));
     }
 
     virtual void postflight() {
@@ -64,15 +78,23 @@ protected:
         std::promise<int> dropped_count,host_count;
         dropped_counts[thread_id] = dropped_count.get_future();
         host_counts[thread_id] = host_count.get_future();
-        StatisticsUdpServer s(io_service, args, threshold, vm.count("use_custom_ring"));
+        StatisticsUdpServer s(io_service, args, threshold, vm.count("use_custom_ring"),
+                              vm.count("coalesce"));
+        std::vector<MetricsRegistry::registration> server_metrics;
+        if (metrics)
+            server_metrics = s.register_metrics(*metrics, "threshold." + std::to_string(thread_id));
         s.do_receive();
 	io_service.run();
+        server_metrics.clear();
         dropped_count.set_value(s.get_dropped_count());
 
         host_count.set_value(s.get_host_count());
     }
 
     std::vector<std::future<int> > dropped_counts,host_counts;
+    std::unique_ptr<MetricsRegistry> metrics;
+    std::vector<MetricsRegistry::registration> nica_metrics;
+    std::unique_ptr<MetricsServer> metrics_server;
 };
 
 int main(int argc, char **argv) {
@@ -32,6 +32,10 @@
 
 using boost::asio::ip::udp;
 
+#ifndef NICA_MAX_FRAME_SIZE
+#define NICA_MAX_FRAME_SIZE 1520
+#endif
+
 class UdpServer {
 public:
     UdpServer(boost::asio::io_service& io_service, short port, const std::string& interface);
@@ -45,7 +49,8 @@ protected:
     boost::asio::io_service& io_service;
     udp::socket socket_;
     udp::endpoint sender_endpoint_;
-    enum { max_length = 1024 };
+    /* Large enough for the payload of the largest frame NICA handles */
+    enum { max_length = NICA_MAX_FRAME_SIZE };
     unsigned char data_[max_length];
 };
 
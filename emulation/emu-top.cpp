@@ -115,6 +115,11 @@ namespace emulation {
             if (address >= 0x14 && address <= 0x30)
                 return gateway.reg_access(address - 0x14, value, read);
 
+            if (address >= 0x800 &&
+                address < 0x800 + 4 * hls_ik::credit_update_registers::num_entries)
+                return var_access(ports.host_credit_regs.rings[(address - 0x800) / 4],
+                                  value, read);
+
             switch (address) {
             case 0x0:
             case 0x4:
@@ -125,22 +130,9 @@ namespace emulation {
             case 0x10: // uuid valid
                 if (read) *value = 1;
                 break;
-            case 0x34: {
-                uint32_t msn_ring = ports.host_credit_regs.reset;
-                msn_ring <<= ports.host_credit_regs.max_msn.width;
-                msn_ring |= ports.host_credit_regs.max_msn;
-                msn_ring <<= ports.host_credit_regs.ring_id.width;
-                msn_ring |= ports.host_credit_regs.ring_id;
-
-                var_access(msn_ring, value, read);
-
-                ports.host_credit_regs.ring_id = msn_ring;
-                msn_ring >>= ports.host_credit_regs.ring_id.width;
-                ports.host_credit_regs.max_msn = msn_ring;
-                msn_ring >>= ports.host_credit_regs.max_msn.width;
-                ports.host_credit_regs.reset = msn_ring;
+            case 0x34: // deprecated credit update register
+                var_access(ports.host_credit_regs.legacy, value, read);
                 break;
-            }
             default:
                 std::cerr << "Unknown address in ikernel: " << address << '\n';
                 break;
@@ -216,6 +208,12 @@ namespace emulation {
         case 0x410:
             var_access(cfg.h2n.enable, value, read);
             break;
+        case 0xc0:
+            var_access(cfg.n2h.stats_snapshot, value, read);
+            break;
+        case 0x4c0:
+            var_access(cfg.h2n.stats_snapshot, value, read);
+            break;
 	case 0x800:
 	    var_access(stats.flow_table_size, value, read);
             break;
@@ -239,9 +237,9 @@ namespace emulation {
     {
         std::lock_guard<std::mutex> lock(emulation_interface_mutex);
 
-        for (size_t i = 0; i < pkt->len; i += 32) {
+        for (size_t i = 0; i < pkt->len; i += hls_ik::axi_data::data_bytes) {
             hls_ik::axi_data flit;
-            const uint8_t cur_len = std::min(pkt->len - i, 32ul);
+            const uint8_t cur_len = std::min(pkt->len - i, size_t(hls_ik::axi_data::data_bytes));
 
             flit.set_data(pkt->data + i, cur_len);
             flit.last = i + cur_len == pkt->len;
@@ -256,7 +254,7 @@ namespace emulation {
     }
 
     struct packet_buffer {
-        char data[2048]; // TODO
+        char data[MAX_PACKET_SIZE + hls_ik::axi_data::data_bytes];
         packet pkt;
         mlx::stream& out;
 
@@ -275,7 +273,7 @@ namespace emulation {
             while (!out.empty()) {
                 hls_ik::axi_data flit = out.read();
 
-                if (pkt.len < sizeof(data) - 32)
+                if (pkt.len < sizeof(data) - hls_ik::axi_data::data_bytes)
                     pkt.len += flit.get_data(data + pkt.len);
                 if (flit.last) {
                     ret_pkt = new packet(pkt);
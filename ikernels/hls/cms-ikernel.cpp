@@ -77,15 +77,19 @@ int cms::reg_read(int address, int* value)
     return 0;
 }
 
-void cms::net_ingress(hls_ik::pipeline_ports& p) {
+void cms::net_ingress(hls_ik::pipeline_ports& p, hls_ik::credit_update_registers& host_credit_regs) {
 #pragma HLS pipeline enable_flush ii=1
     DO_PRAGMA(HLS STREAM variable=_hashes_addresses depth=2*DEPTH);
     DO_PRAGMA(HLS STREAM variable=_hashes_values depth=2*DEPTH);
     DO_PRAGMA(HLS STREAM variable=_topK_read_request depth=1);
     DO_PRAGMA(HLS STREAM variable=_topK_values depth=4)
 
+    update(host_credit_regs);
+
     switch (_state) {
 	case METADATA:
+	    if (bulk_read_send(p))
+		return;
 	    if (!p.metadata_input.empty()) {
 		metadata m = p.metadata_input.read();
 		p.action.write(DROP);
@@ -97,7 +101,7 @@ void cms::net_ingress(hls_ik::pipeline_ports& p) {
 	    if (!p.data_input.empty() && !_values_stream.full()) {
 
 		axi_data d = p.data_input.read();
-		value v = d.data(255-14*8, 256 - value::width-14*8);
+		value v = d.data(d.data.width - 1 - 14*8, d.data.width - value::width-14*8);
 		_values_stream.write(v);
 
 		_state = d.last ? METADATA : OTHER_WORDS;
@@ -156,9 +160,7 @@ void cms::step(hls_ik::ports& p)
 {
 #pragma HLS inline
     pass_packets(p.host);
-    net_ingress(p.net);
-    hls_helpers::produce(p.net.data_output);
-    hls_helpers::produce(p.net.metadata_output);
+    net_ingress(p.net, p.host_credit_regs);
 }
 
 static cms cms_inst;
@@ -32,6 +32,7 @@
 #include "cms.hpp"
 #include <ikernel.hpp>
 #include <gateway.hpp>
+#include <bulk_read-impl.hpp>
 
 typedef ap_uint<32> value;
 
@@ -48,7 +49,7 @@ struct value_and_frequency {
 void cms_ikernel(hls_ik::ports& ik, hls_ik::ikernel_id& uuid, hls_ik::gateway_registers& gateway,
 	     value_and_frequency& to_heap, hls::stream<value_and_frequency>& heap_out, ap_uint<32> k_value);
 
-class cms : public hls_ik::ikernel, public hls_ik::gateway_impl<cms> {
+class cms : public hls_ik::ikernel, public hls_ik::bulk_read_gateway_impl<cms> {
 public:
 
     virtual void step(hls_ik::ports& ports);
@@ -74,7 +75,7 @@ protected:
 
     CountMinSketch sketch;
 
-    void net_ingress(hls_ik::pipeline_ports&);
+    void net_ingress(hls_ik::pipeline_ports&, hls_ik::credit_update_registers& host_credit_regs);
 };
 
 
@@ -116,6 +116,16 @@ unsigned int CountMinSketch::estimate(int item) {
     return minval;
 }
 
+// CountMinSketch halve the counters of column col in all rows
+void CountMinSketch::halve(int col) {
+    for (unsigned int j = 0; j < DEPTH; j++) {
+#pragma HLS unroll
+        C[j][col] = C[j][col] / 2;
+    }
+    if (col == WIDTH - 1)
+        total = total / 2;
+}
+
 // CountMinSketch estimate item count (string)
 unsigned int CountMinSketch::estimate(const char *str) {
     int hashval = hashstr(str);
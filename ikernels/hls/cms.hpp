@@ -86,6 +86,10 @@ public:
     // return total count
     unsigned int totalcount();
 
+    // halve the counters of a single column, for aging the sketch one
+    // column at a time
+    void halve(int col);
+
     // generates a hash value for a string
     // same as djb2 hash function
     unsigned int hashstr(const char *str);
@@ -55,11 +55,11 @@ void echo_one_direction::echo_pipeline(hls_ik::pipeline_ports& in, hls_ik::pipel
                 first = false;
 
                 if (respond_to_sockperf) {
-                    short flags = d.data(255 - 8 * 8, 256 - 10 * 8);
+                    short flags = d.data(d.data.width - 1 - 8 * 8, d.data.width - 10 * 8);
                     bool pong_request = flags & 2;
                     // Turn off client bit on the response packet
                     flags &= ~1;
-                    d.data(255 - 8 * 8, 256 - 10 * 8) = flags;
+                    d.data(d.data.width - 1 - 8 * 8, d.data.width - 10 * 8) = flags;
 
                     respond = pong_request;
                 } else {
@@ -0,0 +1,111 @@
+//
+// Copyright (c) 2016-2018 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef EXTERNAL_MEMORY_HPP
+#define EXTERNAL_MEMORY_HPP
+
+#include <hls_stream.h>
+#include <ap_int.h>
+
+/* An access to an external memory. Writes return no response. */
+template <typename T>
+struct external_memory_request {
+    bool write;
+    ap_uint<32> address;
+    T data;
+};
+
+#if !defined(__SYNTHESIS__)
+/* Emulation of an external memory port (e.g. the on-board DDR) holding Size
+ * elements of type T.
+ *
+ * Requests are served in order. A read returns its data Latency calls after it
+ * was issued, and a new request is accepted at most once every Interval calls,
+ * modeling the port's bandwidth. Reads are pipelined, so up to Outstanding of
+ * them can be in flight.
+ *
+ * The storage is a plain array, so the model is for emulation only; in
+ * hardware the port would be an AXI master of the top function. */
+template <typename T, unsigned Size, unsigned Latency, unsigned Interval,
+          unsigned Outstanding = 16>
+class external_memory {
+public:
+    typedef external_memory_request<T> request;
+    typedef hls::stream<request> request_stream;
+    typedef hls::stream<T> response_stream;
+
+    external_memory() : _cycle(0), _next_issue(0), _outstanding(0), _have_head(false) {
+#pragma HLS stream variable=_in_flight depth=Outstanding
+    }
+
+    void access(request_stream& requests, response_stream& responses)
+    {
+#pragma HLS pipeline enable_flush ii=1
+        ++_cycle;
+
+        if (!_have_head && !_in_flight.empty()) {
+            _head = _in_flight.read();
+            _have_head = true;
+        }
+
+        if (_have_head && _cycle >= _head.ready && !responses.full()) {
+            responses.write(_head.data);
+            _have_head = false;
+            --_outstanding;
+        }
+
+        if (_cycle < _next_issue || requests.empty() || _outstanding == Outstanding)
+            return;
+
+        request r = requests.read();
+        const unsigned address = r.address % Size;
+        if (r.write) {
+            _memory[address] = r.data;
+        } else {
+            in_flight read;
+            read.ready = _cycle + Latency;
+            read.data = _memory[address];
+            _in_flight.write(read);
+            ++_outstanding;
+        }
+        _next_issue = _cycle + Interval;
+    }
+
+private:
+    struct in_flight {
+        ap_uint<64> ready;
+        T data;
+    };
+
+    T _memory[Size];
+    ap_uint<64> _cycle, _next_issue;
+    unsigned _outstanding;
+    hls::stream<in_flight> _in_flight;
+    in_flight _head;
+    bool _have_head;
+};
+#endif
+
+#endif // EXTERNAL_MEMORY_HPP
@@ -9,66 +9,205 @@
 #include <hls_helper.h>
 #include <mlx.h>
 #include "memcached_cache.hpp"
+#include "cms.hpp"
+#include "external_memory.hpp"
 #include "programmable_fifo.hpp"
 
+/* Protocol of the ikernel's clients: MEMCACHED_ASCII (default) or
+ * MEMCACHED_BINARY. Takes effect from the next packet in each direction. */
+#define MEMCACHED_PROTOCOL 0x10
+
+#define MEMCACHED_ASCII 0
+#define MEMCACHED_BINARY 1
+
+/* Write-through mode: when non-zero, ASCII SET requests install their value
+ * in the cache once the host responds STORED, instead of only invalidating
+ * it. Off by default. */
+#define MEMCACHED_WRITE_THROUGH 0x11
+
+/* Writing a non-zero value latches the counters below, so that reads return
+ * a consistent snapshot. Writing zero makes reads return the live counters
+ * again. */
+#define MEMCACHED_SNAPSHOT 0x12
+/* Keys of GET requests found in the cache, and not found */
+#define MEMCACHED_GET_HITS 0x13
+#define MEMCACHED_GET_MISSES 0x14
+/* SET requests */
+#define MEMCACHED_SETS 0x15
+/* Cached keys erased by a SET or by a failed write-through */
+#define MEMCACHED_INVALIDATIONS 0x16
+/* Cached keys replaced by another key of the same set */
+#define MEMCACHED_EVICTIONS 0x17
+/* GET requests with hits passed to the host since the reply streams were full */
+#define MEMCACHED_DROPPED_BACKPRESSURE 0x18
+/* GET misses whose set was full of other keys */
+#define MEMCACHED_COLLISIONS 0x19
+
+/* Admission filter: when non-zero, a value that would evict another key is
+ * only cached if its key was requested more often than the evicted one.
+ * Off by default. */
+#define MEMCACHED_ADMISSION 0x1a
+/* Values the admission filter kept out of the cache */
+#define MEMCACHED_ADMISSION_REJECTS 0x1b
+
+/* Second cache tier: when non-zero, single key ASCII GETs that miss the
+ * on-chip cache are looked up in DRAM before going to the host. Off by
+ * default. The DRAM is only emulated, so synthesized designs ignore it. */
+#define MEMCACHED_DRAM 0x1c
+/* DRAM lookups that found the key, and that did not */
+#define MEMCACHED_DRAM_HITS 0x1d
+#define MEMCACHED_DRAM_MISSES 0x1e
+
 #ifndef MEMCACHED_CACHE_SIZE
 #define MEMCACHED_CACHE_SIZE 4096
 #endif
-#define BUFFER_SIZE (20 + MEMCACHED_VALUE_SIZE + MEMCACHED_KEY_SIZE)
-#define BUFFER_SIZE_WORDS ((BUFFER_SIZE + 31) / 32)
-// Value size length. VALUE_BYTES_SIZE and MEMCACHED_VALUE_SIZE should be changed together.
-#define VALUE_BYTES_SIZE 2
+#ifndef MEMCACHED_CACHE_WAYS
+#define MEMCACHED_CACHE_WAYS 4
+#endif
 #ifndef MEMCACHED_VALUE_SIZE
 #define MEMCACHED_VALUE_SIZE 10
 #endif
 #ifndef MEMCACHED_KEY_SIZE
 #define MEMCACHED_KEY_SIZE 10
 #endif
-#define REPLY_SIZE (8 + 6 + MEMCACHED_KEY_SIZE + 3 + VALUE_BYTES_SIZE + 2 + MEMCACHED_VALUE_SIZE + 7)
+/* Keys in a single get request */
+#ifndef MEMCACHED_MAX_KEYS
+#define MEMCACHED_MAX_KEYS 32
+#endif
+/* Multi-get requests answered partly by the ikernel, whose host responses
+ * are waiting to be renumbered */
+#define MEMCACHED_SPLIT_TABLE_SIZE 64
+/* Written-through SET requests waiting for the host's STORED response */
+#define MEMCACHED_PENDING_SETS_SIZE 64
+/* Entries of the DRAM tier, and the model of its memory port: read latency in
+ * cycles, and bytes transferred per cycle */
+#ifndef MEMCACHED_DRAM_SIZE
+#define MEMCACHED_DRAM_SIZE 65536
+#endif
+#ifndef MEMCACHED_DRAM_LATENCY
+#define MEMCACHED_DRAM_LATENCY 100
+#endif
+#ifndef MEMCACHED_DRAM_BYTES_PER_CYCLE
+#define MEMCACHED_DRAM_BYTES_PER_CYCLE 64
+#endif
+/* DRAM lookups in flight */
+#define MEMCACHED_DRAM_OUTSTANDING 16
+/* GET keys counted by the admission filter's sketch before its counters are
+ * halved */
+#ifndef MEMCACHED_SKETCH_SAMPLES
+#define MEMCACHED_SKETCH_SAMPLES (10 * MEMCACHED_CACHE_SIZE)
+#endif
+
+/* Number of decimal digits needed to print n */
+static constexpr int decimal_digits(unsigned n)
+{
+    return n < 10 ? 1 : 1 + decimal_digits(n / 10);
+}
+
+/* Binary protocol header fields */
+#define BINARY_HEADER_SIZE 24
+#define BINARY_REQUEST_MAGIC 0x80
+#define BINARY_RESPONSE_MAGIC 0x81
+#define BINARY_OPCODE_GET 0x00
+#define BINARY_OPCODE_GETQ 0x09
+#define BINARY_OPCODE_GETK 0x0c
+#define BINARY_OPCODE_GETKQ 0x0d
+
+/* ASCII digits of the largest value length */
+#define VALUE_LENGTH_DIGITS decimal_digits(MEMCACHED_VALUE_SIZE)
+/* A single value in an ASCII reply: VALUE <key> 0 <bytes>\r\n<data>\r\n */
+#define ASCII_VALUE_SIZE (6 + MEMCACHED_KEY_SIZE + 3 + VALUE_LENGTH_DIGITS + 2 + MEMCACHED_VALUE_SIZE + 2)
+/* A binary reply: <header><flags><key><value> */
+#define BINARY_REPLY_SIZE (BINARY_HEADER_SIZE + 4 + MEMCACHED_KEY_SIZE + MEMCACHED_VALUE_SIZE)
+#define FRAGMENT_SIZE (ASCII_VALUE_SIZE > BINARY_REPLY_SIZE ? ASCII_VALUE_SIZE : BINARY_REPLY_SIZE)
+/* Payload of a host response datagram after the frame header, and the
+ * missed keys of a split request whose cacheable values fit in it. The
+ * ikernel splits only those, so its datagram can announce a total of two. */
+#define MEMCACHED_HOST_DATAGRAM_PAYLOAD (1400 - 8)
+#define MEMCACHED_SPLIT_MAX_MISSES ((MEMCACHED_HOST_DATAGRAM_PAYLOAD - 5) / ASCII_VALUE_SIZE)
 
 DECLARE_TOP_FUNCTION(memcached_top);
 
-#define STRINGIZE(x) #x
-#define STRINGIZE_VALUE_OF(x) STRINGIZE(x)
-
-static constexpr const char* ASCII_MEMCACHED_VALUE_SIZE = STRINGIZE_VALUE_OF(MEMCACHED_VALUE_SIZE);
-
-struct memcached_response {
-    char data[REPLY_SIZE];
-
-    memcached_response() {
-        data[8] = 'V';
-        data[9] = 'A';
-        data[10] = 'L';
-        data[11] = 'U';
-        data[12] = 'E';
-        data[13] = ' ';
-        data[14 + MEMCACHED_KEY_SIZE] = ' ';
-        data[15 + MEMCACHED_KEY_SIZE] = '0'; // Flags
-        data[16 + MEMCACHED_KEY_SIZE] = ' ';
-
-        // Value size
-        hls_helpers::memcpy<VALUE_BYTES_SIZE>(&data[17 + MEMCACHED_KEY_SIZE], &ASCII_MEMCACHED_VALUE_SIZE[0]);
-
-        // Spaces
-        data[17 + MEMCACHED_KEY_SIZE + VALUE_BYTES_SIZE] = '\r';
-        data[18 + MEMCACHED_KEY_SIZE + VALUE_BYTES_SIZE] = '\n';
-        data[19 + MEMCACHED_KEY_SIZE + VALUE_BYTES_SIZE + MEMCACHED_VALUE_SIZE] = '\r';
-        data[20 + MEMCACHED_KEY_SIZE + VALUE_BYTES_SIZE + MEMCACHED_VALUE_SIZE] = '\n';
-        data[21 + MEMCACHED_KEY_SIZE + VALUE_BYTES_SIZE + MEMCACHED_VALUE_SIZE] = 'E';
-        data[22 + MEMCACHED_KEY_SIZE + VALUE_BYTES_SIZE + MEMCACHED_VALUE_SIZE] = 'N';
-        data[23 + MEMCACHED_KEY_SIZE + VALUE_BYTES_SIZE + MEMCACHED_VALUE_SIZE] = 'D';
-        data[24 + MEMCACHED_KEY_SIZE + VALUE_BYTES_SIZE + MEMCACHED_VALUE_SIZE] = '\r';
-        data[25 + MEMCACHED_KEY_SIZE + VALUE_BYTES_SIZE + MEMCACHED_VALUE_SIZE] = '\n';
+/* Part of a generated packet. Replies and rewritten requests are built from
+ * fragments (frame header, one per key, trailer) packed into data words. */
+struct memcached_fragment {
+    char data[FRAGMENT_SIZE];
+    /* Number of valid bytes in data */
+    unsigned short length;
+    /* Last fragment of the packet */
+    bool last;
+};
+
+/* Packs a stream of fragments into data words, one word per call */
+class fragment_packer {
+public:
+    fragment_packer() : _have_fragment(false), _offset(0), _pending_bytes(0) {}
+
+    /* Returns true after writing the last word of a packet */
+    bool pack(hls::stream<memcached_fragment>& in, hls_ik::data_stream& out)
+    {
+#pragma HLS inline
+#pragma HLS array_partition variable=_pending complete
+        static const int word_bytes = hls_ik::axi_data::data_bytes;
+
+        if (!_have_fragment) {
+            if (in.empty())
+                return false;
+            _fragment = in.read();
+            _offset = 0;
+            _have_fragment = true;
+        }
+
+        if (out.full())
+            return false;
+
+        const int n = std::min(word_bytes - _pending_bytes, _fragment.length - _offset);
+        for (int i = 0; i < word_bytes; ++i) {
+#pragma HLS unroll
+            if (i >= _pending_bytes && i < _pending_bytes + n)
+                _pending[i] = _fragment.data[_offset + i - _pending_bytes];
+        }
+        _pending_bytes += n;
+        _offset += n;
+
+        const bool end = _offset == _fragment.length;
+        const bool last = end && _fragment.last;
+        if (end)
+            _have_fragment = false;
+
+        if (_pending_bytes == word_bytes || last) {
+            hls_ik::axi_data d;
+            d.set_data(_pending, _pending_bytes);
+            d.last = last;
+            out.write(d);
+            _pending_bytes = 0;
+        }
+
+        return last;
     }
+
+private:
+    memcached_fragment _fragment;
+    bool _have_fragment;
+    int _offset;
+    char _pending[hls_ik::axi_data::data_bytes];
+    int _pending_bytes;
 };
 
+/* SET stands for any request that may modify the key */
 enum request_type { GET, SET, OTHER };
 
+/* The request's keys are passed separately, in order */
 struct memcached_parsed_request {
     char udp_header[8];
-    memcached_key<MEMCACHED_KEY_SIZE> key;
+    unsigned char num_keys;
     request_type type;
+    bool binary;
+    /* A SET whose value (passed separately) may be written through */
+    bool cacheable;
+    /* Binary protocol opcode and opaque, echoed in the reply */
+    unsigned char opcode;
+    char opaque[4];
     hls_ik::metadata metadata;
 };
 
@@ -77,8 +216,82 @@ struct memcached_key_value_pair {
     memcached_value<MEMCACHED_VALUE_SIZE> value;
 };
 
+/* What to do with a request packet. A rewritten request is passed to the
+ * host with new data and length. */
+struct memcached_command {
+    hls_ik::action action;
+    bool rewrite;
+    unsigned short length;
+};
+
+/* A client's request, identified by its frame header request ID */
+struct memcached_request_id {
+    ap_uint<32> ip;
+    ap_uint<16> port;
+    ap_uint<16> id;
+
+    bool operator==(const memcached_request_id& o) const {
+        return ip == o.ip && port == o.port && id == o.id;
+    }
+};
+
+struct memcached_stats {
+    ap_uint<32> get_hits, get_misses, sets, invalidations, evictions,
+                dropped_backpressure, collisions, admission_rejects,
+                dram_hits, dram_misses;
+
+    memcached_stats() : get_hits(0), get_misses(0), sets(0), invalidations(0),
+        evictions(0), dropped_backpressure(0), collisions(0),
+        admission_rejects(0), dram_hits(0), dram_misses(0) {}
+};
+
+/* Counter increments of a single handle_parsed_packet call, passed to
+ * gateway_update */
+struct memcached_stats_update {
+    ap_uint<1> get_hit, get_miss, set, dropped_backpressure, collision;
+    ap_uint<2> invalidations, evictions, admission_rejects;
+
+    memcached_stats_update() : get_hit(0), get_miss(0), set(0),
+        dropped_backpressure(0), collision(0), invalidations(0), evictions(0),
+        admission_rejects(0) {}
+
+    bool empty() const {
+        return !get_hit && !get_miss && !set && !dropped_backpressure &&
+               !collision && invalidations == 0 && evictions == 0 &&
+               admission_rejects == 0;
+    }
+};
+
+/* An entry of the direct mapped DRAM tier */
+struct memcached_dram_entry {
+    memcached_key<MEMCACHED_KEY_SIZE> key;
+    memcached_value<MEMCACHED_VALUE_SIZE> value;
+    bool valid;
+};
+
+#define MEMCACHED_DRAM_INTERVAL \
+    ((sizeof(memcached_dram_entry) + MEMCACHED_DRAM_BYTES_PER_CYCLE - 1) / MEMCACHED_DRAM_BYTES_PER_CYCLE)
+
+/* A request waiting for its DRAM lookup. The request packet itself was
+ * dropped, and is generated again if the key is not found. */
+struct memcached_dram_lookup {
+    char udp_header[8];
+    memcached_key<MEMCACHED_KEY_SIZE> key;
+    hls_ik::metadata metadata;
+};
+
+/* A SET waiting for the host response. Its value is cached if the host
+ * stores it and install is set; otherwise the key is erased again. */
+struct memcached_pending_set {
+    memcached_request_id client;
+    memcached_key<MEMCACHED_KEY_SIZE> key;
+    memcached_value<MEMCACHED_VALUE_SIZE> value;
+    bool install;
+};
+
 /* Arbiter between two sets of actions/metadata_output/data_output competing
- * over an ikernel's egress interface. */
+ * over an ikernel's egress interface. A DROP action comes without metadata
+ * or data. */
 class ikernel_arbiter
 {
 public:
@@ -106,20 +319,35 @@ public:
 #pragma HLS stream variable=a2 depth=15
         hls_ik::axi_data data;
 
+        ap_uint<2> action;
+
         switch (state) {
         case IDLE:
             /* First port has priority */
-            if (!m1.empty() && !a1.empty()) {
+            if (!a1.empty()) {
                 cur = 0;
-                mout.write(m1.read());
-                aout.write(a1.read());
-            } else if (!m2.empty() && !a2.empty()) {
+                action = a1.read();
+            } else if (!a2.empty()) {
                 cur = 1;
-                mout.write(m2.read());
-                aout.write(a2.read());
+                action = a2.read();
             } else {
                 return;
             }
+            aout.write(action);
+            if (action == hls_ik::DROP)
+                return;
+            state = METADATA;
+            /* Fallthrough */
+        case METADATA:
+            if (cur == 0) {
+                if (m1.empty())
+                    return;
+                mout.write(m1.read());
+            } else {
+                if (m2.empty())
+                    return;
+                mout.write(m2.read());
+            }
             state = STREAM;
             /* Fallthrough */
         case STREAM:
@@ -138,50 +366,204 @@ public:
         }
     }
 
-    enum { IDLE, STREAM } state;
+    enum { IDLE, METADATA, STREAM } state;
     ap_uint<1> cur;
 };
 
 class memcached : public hls_ik::ikernel, public hls_ik::gateway_impl<memcached> {
 public:
     virtual void step(hls_ik::ports& p);
+    virtual int reg_write(int address, int value);
+    virtual int reg_read(int address, int* value);
+    virtual void gateway_update();
     memcached();
 
 private:
-    memcached_response generate_response(const memcached_parsed_request &parsed_request, const memcached_value<MEMCACHED_VALUE_SIZE> &value);
+    memcached_fragment generate_response(const memcached_key<MEMCACHED_KEY_SIZE> &key, const memcached_value<MEMCACHED_VALUE_SIZE> &value);
+    memcached_fragment generate_binary_response(const memcached_parsed_request &parsed_request, const memcached_key<MEMCACHED_KEY_SIZE> &key, const memcached_value<MEMCACHED_VALUE_SIZE> &value);
+    int response_length(const memcached_parsed_request &parsed_request, const memcached_key<MEMCACHED_KEY_SIZE> &key, const memcached_value<MEMCACHED_VALUE_SIZE> &value);
     void parse_packet();
-    void drop_or_pass(hls_ik::pipeline_ports& in);
+    void drop_or_pass();
     void reply_cached_value(hls_ik::pipeline_ports &out);
+    void reply_dram_lookup();
+    void write_dram(const memcached_key<MEMCACHED_KEY_SIZE>& key,
+                    const memcached_value<MEMCACHED_VALUE_SIZE>& value, bool valid);
+    ap_uint<32> dram_address(const memcached_key<MEMCACHED_KEY_SIZE>& key) const;
     void intercept_out_metadata(hls_ik::pipeline_ports &out);
     void intercept_out(hls_ik::pipeline_ports &out);
     void handle_parsed_packet();
-    void parse_out_payload(const hls_ik::axi_data &d, int& offset, char key[MEMCACHED_KEY_SIZE], char value[MEMCACHED_VALUE_SIZE]);
-    void parse_in_payload(const hls_ik::axi_data &d, int& offset, char udp_header[8], char key[MEMCACHED_KEY_SIZE]);
+    void lookup(memcached_stats_update& update);
+    bool admit(const memcached_key<MEMCACHED_KEY_SIZE>& key);
+    void insert(const memcached_key<MEMCACHED_KEY_SIZE>& key,
+                const memcached_value<MEMCACHED_VALUE_SIZE>& value,
+                memcached_stats_update& update);
+    void parse_out_payload(const hls_ik::axi_data &d, int& offset);
+    void parse_out_byte(int pos, char c);
+    void parse_out_binary_byte(int pos, char c);
+    void parse_in_payload(const hls_ik::axi_data &d, int& offset);
+    void parse_in_byte(int pos, char c);
+    void parse_in_binary_byte(int pos, char c);
+    void parse_in_set_byte(char c);
+    void push_key();
+    void renumber_split_response(const memcached_request_id& client, hls_ik::axi_data& d);
+    void match_pending_set(const memcached_request_id& client);
 
     enum state { METADATA, DATA };
-    enum reply_state { REQUEST_METADATA, READ_REQUEST, GENERATE_RESPONSE };
+    /* The dropper also sends rewritten requests after dropping the
+     * original data */
+    enum dropper_state { DROPPER_METADATA, DROPPER_DATA, DROPPER_REWRITE };
+    enum reply_state { REQUEST_METADATA, GENERATE_RESPONSE };
+    /* Answering a DRAM lookup: a hit is replied with the frame header, the
+     * value and END fragments, and a miss regenerates the request */
+    enum dram_state { DRAM_IDLE, DRAM_VALUE, DRAM_END };
+    /* Parsing request keys: in ASCII a SET key ends with a space, and GET
+     * keys are separated by spaces and end with CRLF; in binary the key
+     * length is in the header. Other requests, and keys that are too long,
+     * go to the host. */
+    enum key_state { KEY, KEY_VALID, KEY_INVALID };
+    /* Looking up a request's keys one by one, then generating the reply for
+     * the hits and the rewritten request for the misses */
+    enum lookup_state { LOOKUP_IDLE, LOOKUP_KEYS, LOOKUP_DECIDE, LOOKUP_REPLY, LOOKUP_REWRITE };
+    /* Parsing a "VALUE <key> <flags> <bytes>\r\n<data>\r\n" response, or a
+     * binary GETK response. Only responses with zero flags and values that
+     * fit are cached. */
+    enum value_state { VALUE_KEY, VALUE_FLAGS, VALUE_BYTES, VALUE_LF, VALUE_DATA,
+                       VALUE_DONE, VALUE_INVALID };
+    /* Parsing the rest of a "set <key> <flags> <exptime> <bytes>\r\n<data>\r\n"
+     * request. Only values with zero flags and expiration time that fit are
+     * written through, and not noreply requests, whose failure cannot be
+     * detected. */
+    enum set_state { SET_FLAGS, SET_EXPTIME, SET_BYTES, SET_LF, SET_DATA, SET_CR,
+                     SET_DATA_LF, SET_DONE, SET_INVALID };
 
-    state _in_state, _dropper_state;
+    state _in_state;
+    dropper_state _dropper_state;
+    key_state _in_key_state;
+    set_state _in_set_state;
+    /* Characters in the current SET field, and the length it announces */
+    unsigned _in_set_digits, _in_set_bytes;
+    value_state _out_value_state;
+    /* Length announced in the response and flag characters seen */
+    unsigned _out_value_bytes, _out_flags_length;
+    /* Binary header fields: key, extras and body lengths, and the request
+     * bytes seen so far */
+    unsigned _in_key_bytes, _in_extras_bytes, _in_body_bytes, _in_bytes;
+    unsigned _out_key_bytes, _out_body_bytes;
+    /* Response bytes seen, and whether they are "STORED\r\n" so far */
+    unsigned _out_bytes;
+    bool _out_stored;
+    /** Protocol used by each direction, updated from the gateway between
+     * packets through the streams. */
+    bool _in_binary, _out_binary;
+    hls::stream<bool> _in_binary_values, _out_binary_values;
+    /** Protocol returned by reg_read */
+    bool _binary_cache;
+    /** Write-through mode, used by handle_parsed_packet and updated through
+     * the stream between requests */
+    bool _write_through, _write_through_cache;
+    hls::stream<bool> _write_through_values;
     reply_state _reply_state;
-    hls_ik::action _dropper_action;
-    char _request_type_char, _response_type_char;
-    int _in_offset, _out_offset, _reply_offset;
-    memcached_response _current_response;
-    memcached_cache<MEMCACHED_KEY_SIZE, MEMCACHED_VALUE_SIZE, MEMCACHED_CACHE_SIZE> _index;
+    /* Current reply comes from a DRAM lookup */
+    bool _reply_from_dram;
+    memcached_command _dropper_command;
+    int _in_offset, _out_offset;
+    memcached_cache<MEMCACHED_KEY_SIZE, MEMCACHED_VALUE_SIZE, MEMCACHED_CACHE_SIZE, MEMCACHED_CACHE_WAYS> _index;
     memcached_parsed_request _parsed_request;
+    /* Key being parsed */
+    memcached_key<MEMCACHED_KEY_SIZE> _in_key;
+    /* Value of a SET request being parsed */
+    memcached_value<MEMCACHED_VALUE_SIZE> _in_value;
     memcached_key_value_pair _parsed_response;
     hls_ik::metadata _in_metadata;
-    programmmable_fifo<hls_ik::action> _action_stream;
+    programmmable_fifo<memcached_command> _action_stream;
     programmmable_fifo<memcached_key_value_pair> _kv_pairs_stream;
     programmmable_fifo<memcached_parsed_request> _parsed_requests_stream;
+    /* Has room for the keys of a whole request when not full */
+    programmmable_fifo<memcached_key<MEMCACHED_KEY_SIZE>, 2 * MEMCACHED_MAX_KEYS> _request_keys;
+    /* The value of each SET request */
+    programmmable_fifo<memcached_value<MEMCACHED_VALUE_SIZE> > _request_values;
     hls_ik::metadata_stream _reply_metadata_stream, _parser_metadata, _buffer_metadata;
     hls_ik::data_stream _parser_data, _buffer_data;
     hls_helpers::duplicator<1, ap_uint<hls_ik::axi_data::width> > _raw_dup;
     hls_helpers::duplicator<1, ap_uint<hls_ik::metadata::width> > _metadata_dup;
-    hls::stream<memcached_response> _reply_data_stream;
+    hls::stream<memcached_fragment> _reply_data_stream, _rewrite_stream;
+    fragment_packer _reply_packer, _rewrite_packer;
+
+    lookup_state _lookup_state;
+    memcached_parsed_request _lookup_request;
+    int _lookup_index, _lookup_hits, _lookup_replied;
+    /* Lengths of the reply and the rewritten request */
+    int _lookup_reply_length, _lookup_rewrite_length;
+    memcached_key<MEMCACHED_KEY_SIZE> _lookup_keys[MEMCACHED_MAX_KEYS];
+    memcached_value<MEMCACHED_VALUE_SIZE> _lookup_values[MEMCACHED_MAX_KEYS];
+    bool _lookup_hit[MEMCACHED_MAX_KEYS];
+
+    /** Partly answered requests, passed from handle_parsed_packet to
+     * intercept_out, which renumbers the datagrams of their host responses.
+     * The table is indexed by request ID. */
+    hls::stream<memcached_request_id> _split_requests;
+    memcached_request_id _split_table[MEMCACHED_SPLIT_TABLE_SIZE];
+    bool _split_valid[MEMCACHED_SPLIT_TABLE_SIZE];
+    /* Destination of each host response, from intercept_out_metadata */
+    hls::stream<memcached_request_id> _out_clients;
+
+    /** SET requests in write-through mode, passed from handle_parsed_packet
+     * to intercept_out, which checks the host response. The table is indexed
+     * by request ID. Values the host stored go back to be cached; other keys,
+     * or keys whose entry was replaced before the response arrived, go back
+     * to be erased again, in case a GET response cached them meanwhile. */
+    hls::stream<memcached_pending_set> _pending_sets_stream;
+    memcached_pending_set _pending_sets[MEMCACHED_PENDING_SETS_SIZE];
+    bool _pending_valid[MEMCACHED_PENDING_SETS_SIZE];
+    /* Pending SET the current host response belongs to */
+    bool _out_set_response;
+    memcached_pending_set _out_set;
+    programmmable_fifo<memcached_key<MEMCACHED_KEY_SIZE> > _failed_sets;
+
+    memcached_stats _stats;
+    /** Statistics latched by MEMCACHED_SNAPSHOT for the host to read */
+    memcached_stats _snapshot;
+    bool _use_snapshot;
+    hls::stream<memcached_stats_update> _stats_updates;
+
+    /** TinyLFU-style admission: the sketch counts GET keys, and is aged by
+     * halving its counters (one column per call) after every
+     * MEMCACHED_SKETCH_SAMPLES keys. */
+    CountMinSketch _sketch;
+    unsigned _sketch_samples;
+    bool _sketch_halving;
+    int _sketch_column;
+    /** Admission filter mode, updated through the stream */
+    bool _admission, _admission_cache;
+    hls::stream<bool> _admission_values;
+
+    /** DRAM tier. handle_parsed_packet is its only user: it writes every
+     * value it caches and every invalidation, and reads it for misses. The
+     * dropped requests wait in _dram_lookups for the results, in order. */
+#if !defined(__SYNTHESIS__)
+    external_memory<memcached_dram_entry, MEMCACHED_DRAM_SIZE, MEMCACHED_DRAM_LATENCY,
+                    MEMCACHED_DRAM_INTERVAL, MEMCACHED_DRAM_OUTSTANDING> _dram;
+#endif
+    hls::stream<external_memory_request<memcached_dram_entry> > _dram_requests;
+    hls::stream<memcached_dram_entry> _dram_responses;
+    programmmable_fifo<memcached_dram_lookup, 2 * MEMCACHED_DRAM_OUTSTANDING> _dram_lookups;
+    /** DRAM tier mode, updated through the stream */
+    bool _dram_enabled, _dram_cache;
+    hls::stream<bool> _dram_values;
+    dram_state _dram_state;
+    memcached_dram_lookup _dram_lookup;
+    memcached_dram_entry _dram_entry;
+    /* Replies to DRAM hits, and requests regenerated for misses */
+    hls_ik::metadata_stream _dram_reply_metadata;
+    hls::stream<memcached_fragment> _dram_reply_data, _dram_miss_data;
+    fragment_packer _dram_miss_packer;
+    /* Result of each DRAM lookup, for the statistics */
+    hls::stream<bool> _dram_results;
 
     /* port 1 is for passthrough, 2 is for generated */
     ikernel_arbiter h2n_arb;
+    /* port 1 is for the original requests, 2 is for regenerated ones */
+    ikernel_arbiter n2h_arb;
 };
 
 #endif //MEMCACHED_HPP
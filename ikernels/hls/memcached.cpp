@@ -2,10 +2,25 @@
 
 using namespace hls_ik;
 
+/* Hash functions of the admission filter's sketch */
+static int sketch_hashes[DEPTH][2] = {
+    { 12037, 2311 },
+    { 27751, 9551 },
+    { 18311, 30103 },
+};
+
+/* Bytes and bits in a data word */
+static const int word_bytes = axi_data::data_bytes;
+static const int word_bits = word_bytes * 8;
+
 memcached::memcached() :
     _action_stream(10),
     _kv_pairs_stream(10),
-    _parsed_requests_stream(10)
+    _parsed_requests_stream(10),
+    _request_keys(MEMCACHED_MAX_KEYS),
+    _request_values(10),
+    _failed_sets(10),
+    _dram_lookups(MEMCACHED_DRAM_OUTSTANDING)
 {
 #pragma HLS stream variable=_buffer_data depth=30
 #pragma HLS stream variable=_parser_data depth=30
@@ -13,41 +28,296 @@ memcached::memcached() :
 #pragma HLS stream variable=_parser_metadata depth=30
 #pragma HLS stream variable=_reply_data_stream depth=15
 #pragma HLS stream variable=_reply_metadata_stream depth=15
+#pragma HLS stream variable=_rewrite_stream depth=15
+#pragma HLS stream variable=_split_requests depth=15
+#pragma HLS stream variable=_out_clients depth=15
+#pragma HLS stream variable=_pending_sets_stream depth=15
+#pragma HLS stream variable=_stats_updates depth=15
+#pragma HLS stream variable=_dram_requests depth=15
+#pragma HLS stream variable=_dram_responses depth=15
+#pragma HLS stream variable=_dram_reply_metadata depth=15
+#pragma HLS stream variable=_dram_reply_data depth=15
+#pragma HLS stream variable=_dram_miss_data depth=15
+#pragma HLS stream variable=_dram_results depth=15
+#pragma HLS data_pack variable=_dram_reply_data
+#pragma HLS data_pack variable=_dram_miss_data
 #pragma HLS data_pack variable=_reply_data_stream
+#pragma HLS data_pack variable=_rewrite_stream
+    _sketch.setHashes(sketch_hashes);
 }
 
-void memcached::parse_out_payload(const hls_ik::axi_data &d, int& offset, char key[MEMCACHED_KEY_SIZE], char value[MEMCACHED_VALUE_SIZE]) {
+void memcached::parse_out_byte(int pos, char c) {
 #pragma HLS inline
-    for (int i = 0; i < 32; ++i) {
-#pragma HLS unroll
-        const int bottom = 255 - ((i + 1) * 8 - 1), top = 255 - (i * 8);
+    static const char stored[] = "STORED\r\n";
 
-        if (32 * offset + i >= 14 && 32 * offset + i <= 14 + MEMCACHED_KEY_SIZE - 1) {
-            key[32 * offset + i - 14] = d.data.range(top, bottom);
-        }
+    _out_bytes = pos + 1;
+    if (pos >= 8 && pos < 16 && c != stored[pos - 8])
+        _out_stored = false;
+    if (pos == 8 && c != 'V')
+        _out_value_state = VALUE_INVALID;
+    /* Key starts after the frame header and "VALUE " */
+    if (pos < 14)
+        return;
+
+    memcached_key<MEMCACHED_KEY_SIZE>& key = _parsed_response.key;
+    memcached_value<MEMCACHED_VALUE_SIZE>& value = _parsed_response.value;
+
+    switch (_out_value_state) {
+    case VALUE_KEY:
+        if (c == ' ')
+            _out_value_state = key.length > 0 ? VALUE_FLAGS : VALUE_INVALID;
+        else if (key.length < MEMCACHED_KEY_SIZE)
+            key.data[key.length++] = c;
+        else
+            _out_value_state = VALUE_INVALID;
+        break;
+    case VALUE_FLAGS:
+        if (c == ' ')
+            _out_value_state = _out_flags_length == 1 ? VALUE_BYTES : VALUE_INVALID;
+        else if (c == '0')
+            ++_out_flags_length;
+        else
+            _out_value_state = VALUE_INVALID;
+        break;
+    case VALUE_BYTES:
+        if (c == '\r')
+            _out_value_state = VALUE_LF;
+        else if (c >= '0' && c <= '9' && _out_value_bytes <= MEMCACHED_VALUE_SIZE)
+            _out_value_bytes = _out_value_bytes * 10 + (c - '0');
+        else
+            /* CAS unique in a gets response, or a malformed length */
+            _out_value_state = VALUE_INVALID;
+        break;
+    case VALUE_LF:
+        if (c != '\n' || _out_value_bytes > MEMCACHED_VALUE_SIZE)
+            _out_value_state = VALUE_INVALID;
+        else
+            _out_value_state = _out_value_bytes == 0 ? VALUE_DONE : VALUE_DATA;
+        break;
+    case VALUE_DATA:
+        value.data[value.length++] = c;
+        if (value.length == _out_value_bytes)
+            _out_value_state = VALUE_DONE;
+        break;
+    case VALUE_DONE:
+    case VALUE_INVALID:
+        break;
+    }
+}
 
-        const int value_pos = 19 + MEMCACHED_KEY_SIZE + VALUE_BYTES_SIZE;
-        if (32 * offset + i >= value_pos && 32 * offset + i <= value_pos + MEMCACHED_VALUE_SIZE - 1) {
-            value[32 * offset + i - value_pos] = d.data.range(top, bottom);
+void memcached::parse_out_binary_byte(int pos, char c) {
+#pragma HLS inline
+    const unsigned char b = c;
+    /* Extras (flags) come after the header, followed by the key and value */
+    const int key_pos = 8 + BINARY_HEADER_SIZE + 4;
+
+    memcached_key<MEMCACHED_KEY_SIZE>& key = _parsed_response.key;
+    memcached_value<MEMCACHED_VALUE_SIZE>& value = _parsed_response.value;
+
+    if (_out_value_state == VALUE_INVALID || _out_value_state == VALUE_DONE)
+        return;
+
+    if (pos == 8) {
+        if (b != BINARY_RESPONSE_MAGIC)
+            _out_value_state = VALUE_INVALID;
+    } else if (pos == 9) {
+        /* Only responses that carry the key can be cached */
+        if (b != BINARY_OPCODE_GETK && b != BINARY_OPCODE_GETKQ)
+            _out_value_state = VALUE_INVALID;
+    } else if (pos == 10) {
+        _out_key_bytes = b << 8;
+    } else if (pos == 11) {
+        _out_key_bytes |= b;
+        if (_out_key_bytes == 0 || _out_key_bytes > MEMCACHED_KEY_SIZE)
+            _out_value_state = VALUE_INVALID;
+    } else if (pos == 12) {
+        if (b != 4)
+            _out_value_state = VALUE_INVALID;
+    } else if (pos == 14 || pos == 15) {
+        /* Status */
+        if (b != 0)
+            _out_value_state = VALUE_INVALID;
+    } else if (pos >= 16 && pos < 20) {
+        _out_body_bytes = (_out_body_bytes << 8) | b;
+        if (pos == 19) {
+            _out_value_bytes = _out_body_bytes - 4 - _out_key_bytes;
+            if (_out_body_bytes < 4 + _out_key_bytes || _out_value_bytes > MEMCACHED_VALUE_SIZE)
+                _out_value_state = VALUE_INVALID;
         }
+    } else if (pos >= 24 && pos < 32) {
+        value.cas[pos - 24] = c;
+    } else if (pos >= 32 && pos < key_pos) {
+        if (b != 0)
+            _out_value_state = VALUE_INVALID;
+    } else if (pos >= key_pos && key.length < _out_key_bytes) {
+        key.data[key.length++] = c;
+        if (key.length == _out_key_bytes)
+            _out_value_state = _out_value_bytes == 0 ? VALUE_DONE : VALUE_DATA;
+    } else if (_out_value_state == VALUE_DATA) {
+        value.data[value.length++] = c;
+        if (value.length == _out_value_bytes)
+            _out_value_state = VALUE_DONE;
+    }
+}
+
+void memcached::parse_out_payload(const hls_ik::axi_data &d, int& offset) {
+#pragma HLS inline
+    for (int i = 0; i < word_bytes; ++i) {
+#pragma HLS unroll
+        const int bottom = word_bits - 1 - ((i + 1) * 8 - 1), top = word_bits - 1 - (i * 8);
+
+        if (!d.keep[word_bytes - 1 - i])
+            continue;
+
+        if (_out_binary)
+            parse_out_binary_byte(word_bytes * offset + i, d.data.range(top, bottom));
+        else
+            parse_out_byte(word_bytes * offset + i, d.data.range(top, bottom));
     }
 
     ++offset;
 }
 
-void memcached::parse_in_payload(const hls_ik::axi_data &d, int& offset, char udp_header[8], char key[MEMCACHED_KEY_SIZE]) {
+void memcached::push_key() {
+#pragma HLS inline
+    _request_keys.write(_in_key);
+    ++_parsed_request.num_keys;
+    _in_key = memcached_key<MEMCACHED_KEY_SIZE>();
+}
+
+void memcached::parse_in_set_byte(char c) {
 #pragma HLS inline
-    for (int i = 0; i < 32; ++i) {
+    switch (_in_set_state) {
+    case SET_FLAGS:
+    case SET_EXPTIME:
+        if (c == ' ') {
+            _in_set_state = _in_set_digits != 1 ? SET_INVALID :
+                            _in_set_state == SET_FLAGS ? SET_EXPTIME : SET_BYTES;
+            _in_set_digits = 0;
+        } else if (c == '0') {
+            ++_in_set_digits;
+        } else {
+            _in_set_state = SET_INVALID;
+        }
+        break;
+    case SET_BYTES:
+        if (c == '\r')
+            _in_set_state = _in_set_digits > 0 ? SET_LF : SET_INVALID;
+        else if (c >= '0' && c <= '9' && _in_set_bytes <= MEMCACHED_VALUE_SIZE) {
+            _in_set_bytes = _in_set_bytes * 10 + (c - '0');
+            ++_in_set_digits;
+        } else
+            _in_set_state = SET_INVALID;
+        break;
+    case SET_LF:
+        if (c != '\n' || _in_set_bytes > MEMCACHED_VALUE_SIZE)
+            _in_set_state = SET_INVALID;
+        else
+            _in_set_state = _in_set_bytes == 0 ? SET_CR : SET_DATA;
+        break;
+    case SET_DATA:
+        _in_value.data[_in_value.length++] = c;
+        if (_in_value.length == _in_set_bytes)
+            _in_set_state = SET_CR;
+        break;
+    case SET_CR:
+        _in_set_state = c == '\r' ? SET_DATA_LF : SET_INVALID;
+        break;
+    case SET_DATA_LF:
+        _in_set_state = c == '\n' ? SET_DONE : SET_INVALID;
+        break;
+    case SET_DONE:
+    case SET_INVALID:
+        _in_set_state = SET_INVALID;
+        break;
+    }
+}
+
+void memcached::parse_in_byte(int pos, char c) {
+#pragma HLS inline
+    if (_parsed_request.type == SET && _in_key_state == KEY_VALID) {
+        parse_in_set_byte(c);
+        return;
+    }
+
+    /* Keys start after the frame header and "get " or "set " */
+    if (pos == 11 && c != ' ')
+        _in_key_state = KEY_INVALID;
+    if (pos < 12 || _in_key_state != KEY)
+        return;
+
+    const bool get = _parsed_request.type == GET;
+
+    if (c == ' ' || c == '\r') {
+        if (_in_key.length > 0)
+            push_key();
+        /* A SET has a single key. Extra spaces between GET keys are fine. */
+        if (c == '\r' || !get)
+            _in_key_state = (c == '\r') == get && _parsed_request.num_keys > 0 ?
+                            KEY_VALID : KEY_INVALID;
+    } else if (c == '\n' || _in_key.length == MEMCACHED_KEY_SIZE ||
+               (_in_key.length == 0 && _parsed_request.num_keys == MEMCACHED_MAX_KEYS)) {
+        _in_key_state = KEY_INVALID;
+    } else {
+        _in_key.data[_in_key.length++] = c;
+    }
+}
+
+void memcached::parse_in_binary_byte(int pos, char c) {
+#pragma HLS inline
+    const unsigned char b = c;
+    const int key_pos = 8 + BINARY_HEADER_SIZE + _in_extras_bytes;
+
+    _in_bytes = pos + 1;
+    if (_in_key_state != KEY)
+        return;
+
+    if (pos == 8) {
+        if (b != BINARY_REQUEST_MAGIC)
+            _in_key_state = KEY_INVALID;
+    } else if (pos == 9) {
+        _parsed_request.opcode = b;
+        _parsed_request.type = b == BINARY_OPCODE_GET || b == BINARY_OPCODE_GETQ ||
+                               b == BINARY_OPCODE_GETK || b == BINARY_OPCODE_GETKQ ?
+                               GET : SET;
+    } else if (pos == 10) {
+        _in_key_bytes = b << 8;
+    } else if (pos == 11) {
+        _in_key_bytes |= b;
+        if (_in_key_bytes == 0 || _in_key_bytes > MEMCACHED_KEY_SIZE)
+            _in_key_state = KEY_INVALID;
+    } else if (pos == 12) {
+        _in_extras_bytes = b;
+    } else if (pos >= 16 && pos < 20) {
+        _in_body_bytes = (_in_body_bytes << 8) | b;
+    } else if (pos >= 20 && pos < 24) {
+        _parsed_request.opaque[pos - 20] = c;
+    } else if (pos >= key_pos) {
+        _in_key.data[_in_key.length++] = c;
+        if (_in_key.length == _in_key_bytes) {
+            push_key();
+            _in_key_state = KEY_VALID;
+        }
+    }
+}
+
+void memcached::parse_in_payload(const hls_ik::axi_data &d, int& offset) {
+#pragma HLS inline
+    for (int i = 0; i < word_bytes; ++i) {
 #pragma HLS unroll
-        const int bottom = 255 - ((i + 1) * 8 - 1), top = 255 - (i * 8);
+        const int bottom = word_bits - 1 - ((i + 1) * 8 - 1), top = word_bits - 1 - (i * 8);
 
         if (offset == 0 && i < 8) {
-            udp_header[i] = d.data.range(top, bottom);
+            _parsed_request.udp_header[i] = d.data.range(top, bottom);
         }
 
-        if (32 * offset + i >= 12 && 32 * offset + i <= 12 + MEMCACHED_KEY_SIZE - 1) {
-            key[32 * offset + i - 12] = d.data.range(top, bottom);
-        }
+        if (!d.keep[word_bytes - 1 - i])
+            continue;
+
+        if (_in_binary)
+            parse_in_binary_byte(word_bytes * offset + i, d.data.range(top, bottom));
+        else
+            parse_in_byte(word_bytes * offset + i, d.data.range(top, bottom));
     }
 
     ++offset;
@@ -55,89 +325,129 @@ void memcached::parse_in_payload(const hls_ik::axi_data &d, int& offset, char ud
 
 void memcached::reply_cached_value(hls_ik::pipeline_ports &out) {
 #pragma HLS pipeline enable_flush ii=1
-#pragma HLS array_partition variable=_current_response.data complete
     switch (_reply_state) {
         case REQUEST_METADATA:
-            if (!_reply_metadata_stream.empty() && !h2n_arb.a2.full() && !h2n_arb.m2.full()) {
+            if (h2n_arb.a2.full() || h2n_arb.m2.full())
+                break;
+
+            if (!_reply_metadata_stream.empty()) {
                 h2n_arb.a2.write(GENERATE);
                 h2n_arb.m2.write(_reply_metadata_stream.read());
-                _reply_state = READ_REQUEST;
-		goto read_request;
-            }
-
-	    break;
-
-        case READ_REQUEST:
-read_request:
-            if (!_reply_data_stream.empty()) {
-                _current_response = _reply_data_stream.read();
+                _reply_from_dram = false;
+                _reply_state = GENERATE_RESPONSE;
+            } else if (!_dram_reply_metadata.empty()) {
+                h2n_arb.a2.write(GENERATE);
+                h2n_arb.m2.write(_dram_reply_metadata.read());
+                _reply_from_dram = true;
                 _reply_state = GENERATE_RESPONSE;
             }
 
 	    break;
 
         case GENERATE_RESPONSE:
-	    if (h2n_arb.d2.full()) return;
-
-            const int valid_bytes = std::min(32, REPLY_SIZE - _reply_offset);
-            const bool last = _reply_offset + valid_bytes == REPLY_SIZE;
-            hls_ik::axi_data d;
-            d.set_data(_current_response.data + _reply_offset, valid_bytes);
-            d.last = last;
-            h2n_arb.d2.write(d);
-            _reply_offset += 32;
-
-            if (last) {
-                _reply_state = REQUEST_METADATA;
-                _reply_offset = 0;
+            if (_reply_from_dram) {
+                if (_reply_packer.pack(_dram_reply_data, h2n_arb.d2))
+                    _reply_state = REQUEST_METADATA;
+            } else {
+                if (_reply_packer.pack(_reply_data_stream, h2n_arb.d2))
+                    _reply_state = REQUEST_METADATA;
             }
 
             break;
     }
 }
 
-void memcached::drop_or_pass(hls_ik::pipeline_ports& in) {
+void memcached::drop_or_pass() {
 #pragma HLS pipeline enable_flush ii=1
     switch (_dropper_state) {
-        case METADATA:
+        case DROPPER_METADATA:
             if (!_action_stream.empty()
-                && !_buffer_metadata.empty()) {
+                && !_buffer_metadata.empty()
+                && !n2h_arb.a1.full() && !n2h_arb.m1.full()) {
                 hls_ik::metadata metadata = _buffer_metadata.read();
-                _dropper_action = _action_stream.read();
-                in.action.write(_dropper_action);
+                _dropper_command = _action_stream.read();
+                n2h_arb.a1.write(_dropper_command.action);
 
-                if (_dropper_action == PASS) {
-                    in.metadata_output.write(metadata);
+                if (_dropper_command.action == PASS) {
+                    if (_dropper_command.rewrite)
+                        metadata.length = _dropper_command.length;
+                    n2h_arb.m1.write(metadata);
                 }
 
-                _dropper_state = DATA;
+                _dropper_state = DROPPER_DATA;
             }
 
             break;
 
-        case DATA:
-            if (!_buffer_data.empty()) {
+        case DROPPER_DATA:
+            if (!_buffer_data.empty() && !n2h_arb.d1.full()) {
                 axi_data d = _buffer_data.read();
 
-                if (_dropper_action == PASS) {
-                    in.data_output.write(d);
+                if (_dropper_command.action == PASS && !_dropper_command.rewrite) {
+                    n2h_arb.d1.write(d);
                 }
 
                 if (d.last) {
-                    _dropper_state = METADATA;
+                    _dropper_state = _dropper_command.rewrite ? DROPPER_REWRITE : DROPPER_METADATA;
                 }
             }
 
             break;
+
+        case DROPPER_REWRITE:
+            /* Send the rewritten request instead of the original */
+            if (_rewrite_packer.pack(_rewrite_stream, n2h_arb.d1))
+                _dropper_state = DROPPER_METADATA;
+
+            break;
     }
 }
 
 void memcached::intercept_out_metadata(hls_ik::pipeline_ports &out) {
 #pragma HLS pipeline enable_flush ii=3
-    if (!out.metadata_input.empty() && !h2n_arb.a1.full() && !h2n_arb.m1.full()) {
+    if (!out.metadata_input.empty() && !h2n_arb.a1.full() && !h2n_arb.m1.full() &&
+        !_out_clients.full()) {
         hls_ik::metadata out_metadata = out.metadata_input.read();
         h2n_arb.a1.write(PASS);
         h2n_arb.m1.write(out_metadata);
+
+        memcached_request_id client = memcached_request_id();
+        if (out_metadata.ring_id == 0) {
+            hls_ik::packet_metadata pkt = out_metadata.get_packet_metadata();
+            client.ip = pkt.ip_dst;
+            client.port = pkt.udp_dst;
+        }
+        _out_clients.write(client);
+    }
+}
+
+/* The ikernel sent the hits of a split request as the first of two
+ * datagrams, so the host's single datagram comes after it */
+void memcached::renumber_split_response(const memcached_request_id& client, hls_ik::axi_data& d) {
+#pragma HLS inline
+    const int top = word_bits - 1;
+    ap_uint<16> sequence = d.data(top - 16, top - 31);
+    ap_uint<16> total = d.data(top - 32, top - 47);
+    const int index = client.id % MEMCACHED_SPLIT_TABLE_SIZE;
+
+    if (!_split_valid[index] || !(_split_table[index] == client))
+        return;
+
+    d.data(top - 16, top - 31) = sequence + 1;
+    d.data(top - 32, top - 47) = total + 1;
+    if (sequence + 1 == total)
+        _split_valid[index] = false;
+}
+
+/* Look for the written-through SET a host response answers */
+void memcached::match_pending_set(const memcached_request_id& client) {
+#pragma HLS inline
+    const int index = client.id % MEMCACHED_PENDING_SETS_SIZE;
+
+    _out_set_response = _pending_valid[index] && _pending_sets[index].client == client;
+    if (_out_set_response) {
+        _out_set = _pending_sets[index];
+        _pending_valid[index] = false;
     }
 }
 
@@ -145,24 +455,65 @@ void memcached::intercept_out(hls_ik::pipeline_ports &out) {
 #pragma HLS pipeline enable_flush ii=1
 #pragma HLS array_partition variable=_parsed_response.key.data complete
 #pragma HLS array_partition variable=_parsed_response.value.data complete
-    if (_kv_pairs_stream.full()) return;
+    if (_kv_pairs_stream.full() || _failed_sets.full()) return;
+
+    if (!_split_requests.empty()) {
+        memcached_request_id split = _split_requests.read();
+        _split_table[split.id % MEMCACHED_SPLIT_TABLE_SIZE] = split;
+        _split_valid[split.id % MEMCACHED_SPLIT_TABLE_SIZE] = true;
+    }
+
+    if (!_pending_sets_stream.empty()) {
+        memcached_pending_set pending = _pending_sets_stream.read();
+        const int index = pending.client.id % MEMCACHED_PENDING_SETS_SIZE;
+        /* The replaced entry's response can no longer be checked */
+        if (_pending_valid[index])
+            _failed_sets.write(_pending_sets[index].key);
+        _pending_sets[index] = pending;
+        _pending_valid[index] = true;
+        return;
+    }
+
+    if (_out_offset == 0 && !_out_binary_values.empty())
+        _out_binary = _out_binary_values.read();
+
+    if (_out_offset == 0 && _out_clients.empty())
+        return;
 
     if (!out.data_input.empty() && !h2n_arb.d1.full()) {
         axi_data d = out.data_input.read();
 
         if (_out_offset == 0) {
-            const int bottom = 255 - ((8 + 1) * 8 - 1), top = 255 - (8 * 8);
-            _response_type_char = d.data.range(top, bottom);
+            memcached_request_id client = _out_clients.read();
+            client.id = d.data(word_bits - 1, word_bits - 16);
+            /* Binary requests are never split */
+            if (!_out_binary)
+                renumber_split_response(client, d);
+            match_pending_set(client);
+            _out_bytes = 0;
+            _out_stored = true;
+            _parsed_response = memcached_key_value_pair();
+            _out_value_state = VALUE_KEY;
+            _out_value_bytes = 0;
+            _out_flags_length = 0;
+            _out_key_bytes = 0;
+            _out_body_bytes = 0;
         }
 
-        parse_out_payload(d, _out_offset, _parsed_response.key.data, _parsed_response.value.data);
+        parse_out_payload(d, _out_offset);
 
         // We parse get responses.
         // On get response: cache the key.
         if (d.last) {
-            if (_response_type_char == 'V') {
+            const bool stored = _out_set_response && _out_stored && _out_bytes == 16;
+            if (stored && _out_set.install) {
+                _kv_pairs_stream.write(memcached_key_value_pair{_out_set.key, _out_set.value});
+            } else if (_out_value_state == VALUE_DONE) {
                 _kv_pairs_stream.write(_parsed_response);
             }
+            if (_out_set_response && !(stored && _out_set.install)) {
+                _failed_sets.write(_out_set.key);
+            }
 
             _out_offset = 0;
         }
@@ -174,12 +525,27 @@ void memcached::intercept_out(hls_ik::pipeline_ports &out) {
 void memcached::parse_packet() {
 #pragma HLS pipeline enable_flush ii=1
 #pragma HLS array_partition variable=_parsed_request.udp_header complete
-#pragma HLS array_partition variable=_parsed_request.key.data complete
+#pragma HLS array_partition variable=_in_key.data complete
     switch (_in_state) {
         case METADATA:
-            if (!_parser_metadata.empty()) {
+            if (!_in_binary_values.empty())
+                _in_binary = _in_binary_values.read();
+
+            if (!_parser_metadata.empty() && !_request_keys.full() && !_request_values.full()) {
                 _in_metadata = _parser_metadata.read();
+                _parsed_request = memcached_parsed_request();
                 _parsed_request.metadata = _in_metadata;
+                _parsed_request.binary = _in_binary;
+                _in_key_state = KEY;
+                _in_key = memcached_key<MEMCACHED_KEY_SIZE>();
+                _in_set_state = SET_FLAGS;
+                _in_set_digits = 0;
+                _in_set_bytes = 0;
+                _in_value = memcached_value<MEMCACHED_VALUE_SIZE>();
+                _in_key_bytes = 0;
+                _in_extras_bytes = 0;
+                _in_body_bytes = 0;
+                _in_bytes = 0;
                 _in_state = DATA;
             }
             break;
@@ -188,22 +554,32 @@ void memcached::parse_packet() {
             if (!_parser_data.empty() && !_parsed_requests_stream.full()) {
                 axi_data d = _parser_data.read();
 
-                if (_in_offset == 0) {
-                    const int bottom = 255 - ((8 + 1) * 8 - 1), top = 255 - (8 * 8);
-                    _request_type_char = d.data.range(top, bottom);
+                if (_in_offset == 0 && !_in_binary) {
+                    const int bottom = word_bits - 1 - ((8 + 1) * 8 - 1), top = word_bits - 1 - (8 * 8);
+                    const char request_type_char = d.data.range(top, bottom);
 
-                    if (_request_type_char == 'g') {
+                    if (request_type_char == 'g') {
                         _parsed_request.type = GET;
-                    } else if (_request_type_char == 's') {
+                    } else if (request_type_char == 's') {
                         _parsed_request.type = SET;
                     } else {
                         _parsed_request.type = OTHER;
                     }
                 }
 
-                parse_in_payload(d, _in_offset, _parsed_request.udp_header, _parsed_request.key.data);
+                parse_in_payload(d, _in_offset);
 
                 if (d.last) {
+                    if (_in_key_state != KEY_VALID)
+                        _parsed_request.type = OTHER;
+                    /* Only reply to datagrams holding a single binary GET */
+                    if (_in_binary && _parsed_request.type == GET &&
+                        _in_bytes != 8 + BINARY_HEADER_SIZE + _in_body_bytes)
+                        _parsed_request.type = OTHER;
+                    if (_parsed_request.type == SET) {
+                        _parsed_request.cacheable = !_in_binary && _in_set_state == SET_DONE;
+                        _request_values.write(_in_value);
+                    }
                     _parsed_requests_stream.write(_parsed_request);
                     _in_offset = 0;
                     _in_state = METADATA;
@@ -216,59 +592,671 @@ void memcached::parse_packet() {
 
 void memcached::handle_parsed_packet() {
 #pragma HLS pipeline enable_flush ii=3
-    if (!_kv_pairs_stream.empty()) {
-        memcached_key_value_pair kv = _kv_pairs_stream.read();
-        _index.insert(kv.key, kv.value);
+    if (_stats_updates.full())
+        return;
+
+    memcached_stats_update update;
+
+    if (!_admission_values.empty())
+        _admission = _admission_values.read();
+    if (!_dram_values.empty())
+        _dram_enabled = _dram_values.read();
+
+    if (_sketch_halving) {
+        _sketch.halve(_sketch_column);
+        _sketch_halving = ++_sketch_column < WIDTH;
+    }
+
+    /* The lookup may use the DRAM port in this call */
+    const bool lookup_dram = _lookup_state == LOOKUP_DECIDE ||
+        (_lookup_state == LOOKUP_KEYS && _lookup_request.type == SET);
+
+    if (!lookup_dram && !_dram_requests.full()) {
+        if (!_kv_pairs_stream.empty()) {
+            memcached_key_value_pair kv = _kv_pairs_stream.read();
+            insert(kv.key, kv.value, update);
+        } else if (!_failed_sets.empty()) {
+            memcached_key<MEMCACHED_KEY_SIZE> key = _failed_sets.read();
+            update.invalidations += _index.erase(key);
+            write_dram(key, memcached_value<MEMCACHED_VALUE_SIZE>(), false);
+        }
+    }
+
+    lookup(update);
+
+    if (!update.empty())
+        _stats_updates.write(update);
+}
+
+/* A key that would evict another is admitted only if it is estimated to be
+ * requested more often */
+bool memcached::admit(const memcached_key<MEMCACHED_KEY_SIZE>& key) {
+#pragma HLS inline
+    maybe<memcached_key<MEMCACHED_KEY_SIZE> > victim = _index.victim(key);
+
+    return !_admission || !victim.valid() ||
+           _sketch.estimate(_index.hash(key)) > _sketch.estimate(_index.hash(victim.value()));
+}
+
+void memcached::insert(const memcached_key<MEMCACHED_KEY_SIZE>& key,
+                       const memcached_value<MEMCACHED_VALUE_SIZE>& value,
+                       memcached_stats_update& update) {
+#pragma HLS inline
+    /* The DRAM tier holds every value, admitted on-chip or not */
+    write_dram(key, value, true);
+
+    if (admit(key))
+        update.evictions += _index.insert(key, value);
+    else
+        ++update.admission_rejects;
+}
+
+/* Entry of a key in the DRAM tier. It uses a hash independent of the
+ * on-chip cache's (FNV-1a rather than djb2), so the keys of a single cache
+ * set, which are the ones evicted to DRAM together, spread over all of it. */
+ap_uint<32> memcached::dram_address(const memcached_key<MEMCACHED_KEY_SIZE>& key) const {
+#pragma HLS inline
+    ap_uint<32> hash = 2166136261u;
+    for (int i = 0; i < MEMCACHED_KEY_SIZE; ++i) {
+#pragma HLS unroll
+        hash = (hash ^ ap_uint<8>(key.data[i])) * ap_uint<32>(16777619u);
+    }
+
+    return hash % MEMCACHED_DRAM_SIZE;
+}
+
+/* Writes or invalidates the key's entry in the direct mapped DRAM tier. An
+ * invalidation clears the entry even if it holds another key. */
+void memcached::write_dram(const memcached_key<MEMCACHED_KEY_SIZE>& key,
+                           const memcached_value<MEMCACHED_VALUE_SIZE>& value, bool valid) {
+#pragma HLS inline
+    external_memory_request<memcached_dram_entry> request;
+    request.write = true;
+    request.address = dram_address(key);
+    request.data.key = key;
+    request.data.value = value;
+    request.data.valid = valid;
+    _dram_requests.write(request);
+}
+
+void memcached::lookup(memcached_stats_update& update) {
+#pragma HLS inline
+    const bool binary = _lookup_request.binary;
+    const bool partial = _lookup_hits < _lookup_request.num_keys;
+    memcached_fragment fragment;
+#pragma HLS array_partition variable=fragment.data complete
+
+    switch (_lookup_state) {
+    case LOOKUP_IDLE:
+        if (!_write_through_values.empty())
+            _write_through = _write_through_values.read();
+
+        if (_parsed_requests_stream.empty())
+            return;
+
+        _lookup_request = _parsed_requests_stream.read();
+        _lookup_index = 0;
+        _lookup_hits = 0;
+        _lookup_replied = 0;
+        /* Frame header */
+        _lookup_reply_length = 8;
+        /* Frame header, "get" and CRLF */
+        _lookup_rewrite_length = 8 + 3 + 2;
+        _lookup_state = LOOKUP_KEYS;
+        break;
+
+    case LOOKUP_KEYS:
+        if (_lookup_index == _lookup_request.num_keys) {
+            _lookup_state = LOOKUP_DECIDE;
+            break;
+        }
+
+        if (_request_keys.empty())
+            return;
+        if (_lookup_request.type == SET &&
+            (_request_values.empty() || _pending_sets_stream.full() || _dram_requests.full()))
+            return;
+
+        {
+            memcached_key<MEMCACHED_KEY_SIZE> key = _request_keys.read();
+            _lookup_keys[_lookup_index] = key;
+            _lookup_hit[_lookup_index] = false;
+
+            if (_lookup_request.type == GET) {
+                _sketch.update(_index.hash(key), 1);
+                if (++_sketch_samples == MEMCACHED_SKETCH_SAMPLES) {
+                    _sketch_samples = 0;
+                    _sketch_halving = true;
+                    _sketch_column = 0;
+                }
+
+                maybe<memcached_value<MEMCACHED_VALUE_SIZE> > found = _index.find(key);
+                update.get_hit = found.valid();
+                update.get_miss = !found.valid();
+                update.collision = !found.valid() && _index.set_full(key);
+                if (found.valid()) {
+                    _lookup_values[_lookup_index] = found.value();
+                    _lookup_hit[_lookup_index] = true;
+                    ++_lookup_hits;
+                    _lookup_reply_length += response_length(_lookup_request, key, found.value());
+                } else {
+                    _lookup_rewrite_length += 1 + key.length;
+                }
+            } else if (_lookup_request.type == SET) {
+                memcached_value<MEMCACHED_VALUE_SIZE> value = _request_values.read();
+                update.set = 1;
+                update.invalidations += _index.erase(key);
+                write_dram(key, memcached_value<MEMCACHED_VALUE_SIZE>(), false);
+                /* In write-through mode the host response decides: a
+                 * plain value is cached once it is stored, and any other
+                 * SET erases the key again after an earlier pending one */
+                if (_write_through) {
+                    hls_ik::packet_metadata pkt = _lookup_request.metadata.get_packet_metadata();
+                    memcached_pending_set pending;
+                    pending.client.ip = pkt.ip_src;
+                    pending.client.port = pkt.udp_src;
+                    pending.client.id = (ap_uint<8>(_lookup_request.udp_header[0]), ap_uint<8>(_lookup_request.udp_header[1]));
+                    pending.key = key;
+                    pending.value = value;
+                    pending.install = _lookup_request.cacheable;
+                    _pending_sets_stream.write(pending);
+                }
+            }
+        }
+        ++_lookup_index;
+        break;
+
+    case LOOKUP_DECIDE:
+        if (_action_stream.full() || _split_requests.full())
+            return;
+
+        /* Look up a single key ASCII GET that missed in the DRAM tier. Only
+         * requests that can be generated again exactly are sent there, and
+         * only if a reply with the largest value fits in a datagram. */
+        if (_dram_enabled && ASCII_VALUE_SIZE + 5 <= MEMCACHED_HOST_DATAGRAM_PAYLOAD &&
+            _lookup_request.type == GET && !binary &&
+            _lookup_request.num_keys == 1 && _lookup_hits == 0 &&
+            _lookup_request.metadata.length == 8 + 4 + _lookup_keys[0].length + 2 &&
+            !_dram_requests.full() && !_dram_lookups.full()) {
+            _action_stream.write(memcached_command{DROP, false, 0});
+
+            external_memory_request<memcached_dram_entry> request;
+            request.write = false;
+            request.address = dram_address(_lookup_keys[0]);
+            _dram_requests.write(request);
+
+            memcached_dram_lookup dram_lookup;
+            hls_helpers::memcpy<8>(&dram_lookup.udp_header[0], &_lookup_request.udp_header[0]);
+            dram_lookup.key = _lookup_keys[0];
+            dram_lookup.metadata = _lookup_request.metadata;
+            _dram_lookups.write(dram_lookup);
+
+            _lookup_state = LOOKUP_IDLE;
+            break;
+        }
+
+        // Pass the request to the host if the reply streams are full (even upon a cache hit),
+        // if the reply does not fit in a single datagram, or if the host
+        // response to the missed keys may need more than one datagram
+        if (_lookup_request.type != GET || _lookup_hits == 0 ||
+            _lookup_reply_length + (binary || partial ? 0 : 5) > 8 + MEMCACHED_HOST_DATAGRAM_PAYLOAD ||
+            (partial && _lookup_request.num_keys - _lookup_hits > MEMCACHED_SPLIT_MAX_MISSES) ||
+            _reply_metadata_stream.full() || _reply_data_stream.full() ||
+            _rewrite_stream.full()) {
+            update.dropped_backpressure = _lookup_request.type == GET && _lookup_hits > 0;
+            _action_stream.write(memcached_command{PASS, false, 0});
+            _lookup_state = LOOKUP_IDLE;
+            break;
+        }
+
+        hls_helpers::memcpy<8>(&fragment.data[0], &_lookup_request.udp_header[0]);
+        fragment.length = 8;
+        fragment.last = false;
+
+        if (partial) {
+            /* The reply is the first of two datagrams, the host response to
+             * the rewritten request follows */
+            fragment.data[2] = 0;
+            fragment.data[3] = 0;
+            fragment.data[4] = 0;
+            fragment.data[5] = 2;
+
+            _action_stream.write(memcached_command{PASS, true, (unsigned short)_lookup_rewrite_length});
+
+            hls_ik::packet_metadata pkt = _lookup_request.metadata.get_packet_metadata();
+            memcached_request_id client;
+            client.ip = pkt.ip_src;
+            client.port = pkt.udp_src;
+            client.id = (ap_uint<8>(_lookup_request.udp_header[0]), ap_uint<8>(_lookup_request.udp_header[1]));
+            _split_requests.write(client);
+
+            memcached_fragment rewrite;
+            hls_helpers::memcpy<8>(&rewrite.data[0], &_lookup_request.udp_header[0]);
+            rewrite.data[8] = 'g';
+            rewrite.data[9] = 'e';
+            rewrite.data[10] = 't';
+            rewrite.length = 11;
+            rewrite.last = false;
+            _rewrite_stream.write(rewrite);
+        } else {
+            if (!binary)
+                _lookup_reply_length += 5; /* END\r\n */
+            _action_stream.write(memcached_command{DROP, false, 0});
+        }
+
+        _reply_metadata_stream.write(_lookup_request.metadata.reply(_lookup_reply_length));
+        _reply_data_stream.write(fragment);
+        _lookup_index = 0;
+        _lookup_state = LOOKUP_REPLY;
+        break;
+
+    case LOOKUP_REPLY:
+        if (_reply_data_stream.full())
+            return;
+
+        if (_lookup_index == _lookup_request.num_keys) {
+            if (!binary && !partial) {
+                static const char trailer[] = "END\r\n";
+                hls_helpers::memcpy<5>(&fragment.data[0], &trailer[0]);
+                fragment.length = 5;
+                fragment.last = true;
+                _reply_data_stream.write(fragment);
+            }
+            _lookup_index = 0;
+            _lookup_state = partial ? LOOKUP_REWRITE : LOOKUP_IDLE;
+            break;
+        }
+
+        if (_lookup_hit[_lookup_index]) {
+            fragment = binary ?
+                generate_binary_response(_lookup_request, _lookup_keys[_lookup_index], _lookup_values[_lookup_index]) :
+                generate_response(_lookup_keys[_lookup_index], _lookup_values[_lookup_index]);
+            ++_lookup_replied;
+            fragment.last = binary || (partial && _lookup_replied == _lookup_hits);
+            _reply_data_stream.write(fragment);
+        }
+        ++_lookup_index;
+        break;
+
+    case LOOKUP_REWRITE:
+        if (_rewrite_stream.full())
+            return;
+
+        if (_lookup_index == _lookup_request.num_keys) {
+            fragment.data[0] = '\r';
+            fragment.data[1] = '\n';
+            fragment.length = 2;
+            fragment.last = true;
+            _rewrite_stream.write(fragment);
+            _lookup_state = LOOKUP_IDLE;
+            break;
+        }
+
+        if (!_lookup_hit[_lookup_index]) {
+            const memcached_key<MEMCACHED_KEY_SIZE>& key = _lookup_keys[_lookup_index];
+            fragment.data[0] = ' ';
+            for (int i = 0; i < MEMCACHED_KEY_SIZE; ++i) {
+#pragma HLS unroll
+                if (i < key.length)
+                    fragment.data[1 + i] = key.data[i];
+            }
+            fragment.length = 1 + key.length;
+            fragment.last = false;
+            _rewrite_stream.write(fragment);
+        }
+        ++_lookup_index;
+        break;
     }
+}
+
+void memcached::reply_dram_lookup() {
+#pragma HLS pipeline enable_flush ii=1
+    /* Requests the DRAM tier missed go to the host as the original would */
+    _dram_miss_packer.pack(_dram_miss_data, n2h_arb.d2);
+
+    memcached_fragment fragment;
+#pragma HLS array_partition variable=fragment.data complete
 
-    if (_parsed_requests_stream.empty() || _action_stream.full()) return;
+    switch (_dram_state) {
+    case DRAM_IDLE: {
+        if (_dram_responses.empty() || _dram_lookups.empty() || _dram_results.full() ||
+            _dram_reply_metadata.full() || _dram_reply_data.full() ||
+            n2h_arb.a2.full() || n2h_arb.m2.full() || _dram_miss_data.full())
+            return;
 
-    memcached_parsed_request parsed_request = _parsed_requests_stream.read();
-#pragma HLS array_partition variable=parsed_request.key.data complete
+        _dram_entry = _dram_responses.read();
+        _dram_lookup = _dram_lookups.read();
+        const bool hit = _dram_entry.valid && _dram_entry.key == _dram_lookup.key;
+        _dram_results.write(hit);
 
-    bool pass_to_host = true;
+        hls_helpers::memcpy<8>(&fragment.data[0], &_dram_lookup.udp_header[0]);
+        if (hit) {
+            const memcached_parsed_request ascii = memcached_parsed_request();
+            const int length = 8 + response_length(ascii, _dram_lookup.key, _dram_entry.value) + 5;
+            _dram_reply_metadata.write(_dram_lookup.metadata.reply(length));
+            fragment.length = 8;
+            fragment.last = false;
+            _dram_reply_data.write(fragment);
+            _dram_state = DRAM_VALUE;
+        } else {
+            static const char get[] = "get ";
+            const memcached_key<MEMCACHED_KEY_SIZE>& key = _dram_lookup.key;
+
+            hls_helpers::memcpy<4>(&fragment.data[8], &get[0]);
+            for (int i = 0; i < MEMCACHED_KEY_SIZE; ++i) {
+#pragma HLS unroll
+                if (i < key.length)
+                    fragment.data[12 + i] = key.data[i];
+            }
+            fragment.data[12 + key.length] = '\r';
+            fragment.data[13 + key.length] = '\n';
+            fragment.length = 14 + key.length;
+            fragment.last = true;
 
-    if (parsed_request.type == GET) {
-        maybe<memcached_value<MEMCACHED_VALUE_SIZE> > found = _index.find(parsed_request.key);
-        // Pass the request to the host if the reply streams are full (even upon a cache hit)
-        if (found.valid() && !_reply_metadata_stream.full() && !_reply_data_stream.full()) {
-            _reply_metadata_stream.write(parsed_request.metadata.reply(REPLY_SIZE));
-            _reply_data_stream.write(generate_response(parsed_request, found.value()));
-            pass_to_host = false;
+            hls_ik::metadata metadata = _dram_lookup.metadata;
+            metadata.length = fragment.length;
+            n2h_arb.a2.write(GENERATE);
+            n2h_arb.m2.write(metadata);
+            _dram_miss_data.write(fragment);
         }
-    } else if (parsed_request.type == SET) {
-        _index.erase(parsed_request.key);
+        break;
     }
 
-    _action_stream.write(pass_to_host ? PASS : DROP);
+    case DRAM_VALUE:
+        if (_dram_reply_data.full())
+            return;
+
+        fragment = generate_response(_dram_lookup.key, _dram_entry.value);
+        fragment.last = false;
+        _dram_reply_data.write(fragment);
+        _dram_state = DRAM_END;
+        break;
+
+    case DRAM_END: {
+        if (_dram_reply_data.full())
+            return;
+
+        static const char trailer[] = "END\r\n";
+        hls_helpers::memcpy<5>(&fragment.data[0], &trailer[0]);
+        fragment.length = 5;
+        fragment.last = true;
+        _dram_reply_data.write(fragment);
+        _dram_state = DRAM_IDLE;
+        break;
+    }
+    }
 }
 
-memcached_response memcached::generate_response(const memcached_parsed_request& parsed_request, const memcached_value<MEMCACHED_VALUE_SIZE> &value) {
-    memcached_response response;
+/* Number of ASCII digits of a value length */
+static int value_length_digits(unsigned length)
+{
+#pragma HLS inline
+    int num_digits = 1;
+    unsigned limit = 10;
+    for (int i = 1; i < VALUE_LENGTH_DIGITS; ++i) {
+#pragma HLS unroll
+        if (length >= limit)
+            num_digits = i + 1;
+        limit *= 10;
+    }
+    return num_digits;
+}
+
+static bool binary_reply_with_key(unsigned char opcode)
+{
+#pragma HLS inline
+    return opcode == BINARY_OPCODE_GETK || opcode == BINARY_OPCODE_GETKQ;
+}
+
+int memcached::response_length(const memcached_parsed_request& parsed_request,
+                               const memcached_key<MEMCACHED_KEY_SIZE> &key,
+                               const memcached_value<MEMCACHED_VALUE_SIZE> &value) {
+#pragma HLS inline
+    if (parsed_request.binary)
+        return BINARY_HEADER_SIZE + 4 +
+               (binary_reply_with_key(parsed_request.opcode) ? int(key.length) : 0) +
+               value.length;
+
+    return 6 + key.length + 3 + value_length_digits(value.length) + 2 + value.length + 2;
+}
+
+memcached_fragment memcached::generate_response(const memcached_key<MEMCACHED_KEY_SIZE> &key, const memcached_value<MEMCACHED_VALUE_SIZE> &value) {
+    memcached_fragment response;
+#pragma HLS array_partition variable=response.data complete
+#pragma HLS array_partition variable=key.data complete
+#pragma HLS array_partition variable=value.data complete
+    static const char header[] = "VALUE ";
+
+    hls_helpers::memcpy<6>(&response.data[0], &header[0]);
+
+    int pos = 6;
+    for (int i = 0; i < MEMCACHED_KEY_SIZE; ++i) {
+#pragma HLS unroll
+        if (i < key.length)
+            response.data[pos + i] = key.data[i];
+    }
+    pos += key.length;
+
+    /* Flags are always zero */
+    response.data[pos++] = ' ';
+    response.data[pos++] = '0';
+    response.data[pos++] = ' ';
+
+    /* Value length in ASCII */
+    const int num_digits = value_length_digits(value.length);
+    unsigned length = value.length;
+    for (int i = 0; i < VALUE_LENGTH_DIGITS; ++i) {
+#pragma HLS unroll
+        if (i < num_digits)
+            response.data[pos + num_digits - 1 - i] = '0' + length % 10;
+        length /= 10;
+    }
+    pos += num_digits;
+    response.data[pos++] = '\r';
+    response.data[pos++] = '\n';
+
+    for (int i = 0; i < MEMCACHED_VALUE_SIZE; ++i) {
+#pragma HLS unroll
+        if (i < value.length)
+            response.data[pos + i] = value.data[i];
+    }
+    pos += value.length;
+
+    response.data[pos++] = '\r';
+    response.data[pos++] = '\n';
+    response.length = pos;
+
+    return response;
+}
+
+memcached_fragment memcached::generate_binary_response(const memcached_parsed_request& parsed_request, const memcached_key<MEMCACHED_KEY_SIZE> &key, const memcached_value<MEMCACHED_VALUE_SIZE> &value) {
+    memcached_fragment response;
 #pragma HLS array_partition variable=response.data complete
-#pragma HLS array_partition variable=parsed_request.udp_header complete
-#pragma HLS array_partition variable=parsed_request.key.data complete
+#pragma HLS array_partition variable=key.data complete
 #pragma HLS array_partition variable=value.data complete
+    const int key_length = binary_reply_with_key(parsed_request.opcode) ? int(key.length) : 0;
+    const unsigned body_length = 4 + key_length + value.length;
+
+    char* header = &response.data[0];
+    header[0] = BINARY_RESPONSE_MAGIC;
+    header[1] = parsed_request.opcode;
+    header[2] = key_length >> 8;
+    header[3] = key_length;
+    header[4] = 4; /* Extras: flags */
+    header[5] = 0; /* Data type */
+    header[6] = 0; /* Status */
+    header[7] = 0;
+    header[8] = body_length >> 24;
+    header[9] = body_length >> 16;
+    header[10] = body_length >> 8;
+    header[11] = body_length;
+    hls_helpers::memcpy<4>(&header[12], &parsed_request.opaque[0]);
+    hls_helpers::memcpy<8>(&header[16], &value.cas[0]);
+
+    /* Flags are always zero */
+    int pos = BINARY_HEADER_SIZE;
+    for (int i = 0; i < 4; ++i) {
+#pragma HLS unroll
+        response.data[pos + i] = 0;
+    }
+    pos += 4;
+
+    for (int i = 0; i < MEMCACHED_KEY_SIZE; ++i) {
+#pragma HLS unroll
+        if (i < key_length)
+            response.data[pos + i] = key.data[i];
+    }
+    pos += key_length;
 
-    hls_helpers::memcpy<8>(&response.data[0], &parsed_request.udp_header[0]);
-    hls_helpers::memcpy<MEMCACHED_KEY_SIZE>(&response.data[14], &parsed_request.key.data[0]);
-    hls_helpers::memcpy<MEMCACHED_VALUE_SIZE>(&response.data[19 + MEMCACHED_KEY_SIZE + VALUE_BYTES_SIZE], &value.data[0]);
+    for (int i = 0; i < MEMCACHED_VALUE_SIZE; ++i) {
+#pragma HLS unroll
+        if (i < value.length)
+            response.data[pos + i] = value.data[i];
+    }
+    response.length = pos + value.length;
 
     return response;
 }
 
+void memcached::gateway_update()
+{
+#pragma HLS inline
+    if (!_dram_results.empty()) {
+        if (_dram_results.read())
+            ++_stats.dram_hits;
+        else
+            ++_stats.dram_misses;
+    }
+
+    if (_stats_updates.empty())
+        return;
+
+    memcached_stats_update update = _stats_updates.read();
+    _stats.get_hits += update.get_hit;
+    _stats.get_misses += update.get_miss;
+    _stats.sets += update.set;
+    _stats.invalidations += update.invalidations;
+    _stats.evictions += update.evictions;
+    _stats.dropped_backpressure += update.dropped_backpressure;
+    _stats.collisions += update.collision;
+    _stats.admission_rejects += update.admission_rejects;
+}
+
+int memcached::reg_write(int address, int value)
+{
+#pragma HLS inline
+    switch (address) {
+    case MEMCACHED_PROTOCOL:
+        if (value != MEMCACHED_ASCII && value != MEMCACHED_BINARY)
+            return -1;
+        _in_binary_values.write(value == MEMCACHED_BINARY);
+        _out_binary_values.write(value == MEMCACHED_BINARY);
+        _binary_cache = value == MEMCACHED_BINARY;
+        break;
+    case MEMCACHED_WRITE_THROUGH:
+        _write_through_values.write(value != 0);
+        _write_through_cache = value != 0;
+        break;
+    case MEMCACHED_ADMISSION:
+        _admission_values.write(value != 0);
+        _admission_cache = value != 0;
+        break;
+    case MEMCACHED_DRAM:
+#if defined(__SYNTHESIS__)
+        value = 0;
+#endif
+        _dram_values.write(value != 0);
+        _dram_cache = value != 0;
+        break;
+    case MEMCACHED_SNAPSHOT:
+        /* gateway_update runs in the same process, so the copy is
+         * consistent */
+        _snapshot = _stats;
+        _use_snapshot = value != 0;
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+int memcached::reg_read(int address, int* value)
+{
+#pragma HLS inline
+    const memcached_stats s = _use_snapshot ? _snapshot : _stats;
+    switch (address) {
+    case MEMCACHED_PROTOCOL:
+        *value = _binary_cache ? MEMCACHED_BINARY : MEMCACHED_ASCII;
+        break;
+    case MEMCACHED_WRITE_THROUGH:
+        *value = _write_through_cache;
+        break;
+    case MEMCACHED_SNAPSHOT:
+        *value = _use_snapshot;
+        break;
+    case MEMCACHED_GET_HITS:
+        *value = s.get_hits;
+        break;
+    case MEMCACHED_GET_MISSES:
+        *value = s.get_misses;
+        break;
+    case MEMCACHED_SETS:
+        *value = s.sets;
+        break;
+    case MEMCACHED_INVALIDATIONS:
+        *value = s.invalidations;
+        break;
+    case MEMCACHED_EVICTIONS:
+        *value = s.evictions;
+        break;
+    case MEMCACHED_DROPPED_BACKPRESSURE:
+        *value = s.dropped_backpressure;
+        break;
+    case MEMCACHED_COLLISIONS:
+        *value = s.collisions;
+        break;
+    case MEMCACHED_ADMISSION:
+        *value = _admission_cache;
+        break;
+    case MEMCACHED_ADMISSION_REJECTS:
+        *value = s.admission_rejects;
+        break;
+    case MEMCACHED_DRAM:
+        *value = _dram_cache;
+        break;
+    case MEMCACHED_DRAM_HITS:
+        *value = s.dram_hits;
+        break;
+    case MEMCACHED_DRAM_MISSES:
+        *value = s.dram_misses;
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
 void memcached::step(hls_ik::ports& p)
 {
 #pragma HLS inline
     _raw_dup.dup2(p.net.data_input, _parser_data, _buffer_data);
     _metadata_dup.dup2(p.net.metadata_input, _parser_metadata, _buffer_metadata);
-    drop_or_pass(p.net);
+    drop_or_pass();
     handle_parsed_packet();
+#if !defined(__SYNTHESIS__)
+    _dram.access(_dram_requests, _dram_responses);
+#else
+    /* No DRAM tier: discard its writes */
+    if (!_dram_requests.empty())
+        _dram_requests.read();
+#endif
+    reply_dram_lookup();
     parse_packet();
     reply_cached_value(p.host);
     intercept_out_metadata(p.host);
     intercept_out(p.host);
     h2n_arb.arbitrate(p.host.metadata_output, p.host.data_output, p.host.action);
+    n2h_arb.arbitrate(p.net.metadata_output, p.net.data_output, p.net.action);
 }
 
 DEFINE_TOP_FUNCTION(memcached_top, memcached, MEMCACHED_UUID)
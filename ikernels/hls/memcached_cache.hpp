@@ -18,16 +18,21 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include <boost/functional/hash.hpp>
 
+/* A key of up to Size bytes. The hash covers the whole array, so bytes past
+ * the length must be zero. */
 template <unsigned Size>
 struct memcached_key {
+    static_assert(Size < 256, "memcached keys are limited to 250 bytes");
+
     char data[Size];
+    unsigned char length;
 
     bool operator==(const memcached_key<Size>& rhs) const {
-         bool equal = true;
+         bool equal = length == rhs.length;
 
          for (int i = 0; i < Size; ++i) {
 #pragma HLS unroll
-              if (data[i] != rhs.data[i]) {
+              if (i < length && data[i] != rhs.data[i]) {
                    equal = false;
                    break;
               }
@@ -37,9 +42,16 @@ struct memcached_key {
     }
 };
 
+/* A value of up to Size bytes. Each cache entry is a fixed slot of the
+ * maximum size, and the length says how much of it is used. */
 template <unsigned Size>
 struct memcached_value {
+    static_assert(Size < 65536, "value length must fit its length field");
+
     char data[Size];
+    unsigned short length;
+    /* CAS of a binary protocol response, returned in cached replies */
+    char cas[8];
 };
 
 template <typename Value>
@@ -56,44 +68,162 @@ private:
     Value _value;
 };
 
-template <unsigned KeySize, unsigned ValueSize, unsigned Size>
+/* An N-way set associative cache of Size entries. Each key maps to a single
+ * set, whose ways are all compared in one lookup. Replacement within a set
+ * is least recently used, where both find and insert count as a use. With
+ * Ways = 1 the cache is direct mapped. */
+template <unsigned KeySize, unsigned ValueSize, unsigned Size, unsigned Ways = 1>
 class memcached_cache
 {
 public:
-    memcached_cache() : valid() {}
+    static_assert(Ways > 0 && Ways <= 256 && Size % Ways == 0,
+                  "cache size must be a multiple of the number of ways");
+    static const unsigned Sets = Size / Ways;
+
+    memcached_cache() : valid()
+    {
+        for (unsigned set = 0; set < Sets; ++set)
+            for (unsigned way = 0; way < Ways; ++way)
+                age[set][way] = way;
+    }
 
-    void insert(const memcached_key<KeySize>& key, const memcached_value<ValueSize>& value)
+    /* Returns true if another key was evicted to make room */
+    bool insert(const memcached_key<KeySize>& key, const memcached_value<ValueSize>& value)
     {
 #pragma HLS inline
-        size_t index = h(key);
+#pragma HLS array_partition variable=tags complete dim=2
+#pragma HLS array_partition variable=values complete dim=2
+#pragma HLS array_partition variable=valid complete dim=2
+#pragma HLS array_partition variable=age complete dim=2
+        size_t set = h(key);
+        maybe<unsigned> way = lookup(set, key);
+        unsigned victim = way.valid() ? way.value() : replace(set);
+        const bool evicted = !way.valid() && valid[set][victim];
+
+        tags[set][victim] = key;
+        values[set][victim] = value;
+        valid[set][victim] = true;
+        touch(set, victim);
 
-        tags[index] = key;
-        values[index] = value;
-        valid[index] = true;
+        return evicted;
     }
 
-    void erase(const memcached_key<KeySize>& k)
+    /* Returns true if the key was cached */
+    bool erase(const memcached_key<KeySize>& k)
     {
 #pragma HLS inline
-        size_t index = h(k);
+        size_t set = h(k);
+        maybe<unsigned> way = lookup(set, k);
 
-        if (tags[index] == k)
-            valid[index] = false;
+        if (way.valid())
+            valid[set][way.value()] = false;
+
+        return way.valid();
     }
 
-    maybe<memcached_value<ValueSize> > find(const memcached_key<KeySize>& k) const
+    /* The key that inserting k would evict, if any */
+    maybe<memcached_key<KeySize> > victim(const memcached_key<KeySize>& k) const
     {
 #pragma HLS inline
-        size_t index = h(k);
-        memcached_key<KeySize> tag = tags[index];
-        memcached_value<ValueSize> value = values[index];
+        size_t set = h(k);
+        unsigned way = replace(set);
+
+        if (lookup(set, k).valid() || !valid[set][way])
+            return maybe<memcached_key<KeySize> >();
+
+        return maybe<memcached_key<KeySize> >(tags[set][way]);
+    }
 
-        return maybe<memcached_value<ValueSize> >(valid[index] && tag == k, value);
+    /* Hash of a key, also usable outside the cache */
+    size_t hash(const memcached_key<KeySize>& k) const
+    {
+#pragma HLS inline
+        return h_b(h_a(k), k);
+    }
+
+    /* True if all the ways of the key's set are taken, so that inserting a
+     * missing key evicts another */
+    bool set_full(const memcached_key<KeySize>& k) const
+    {
+#pragma HLS inline
+        size_t set = h(k);
+        bool full = true;
+
+        for (unsigned way = 0; way < Ways; ++way) {
+#pragma HLS unroll
+            if (!valid[set][way])
+                full = false;
+        }
+
+        return full;
+    }
+
+    maybe<memcached_value<ValueSize> > find(const memcached_key<KeySize>& k)
+    {
+#pragma HLS inline
+        size_t set = h(k);
+        maybe<unsigned> way = lookup(set, k);
+
+        if (!way.valid())
+            return maybe<memcached_value<ValueSize> >();
+
+        touch(set, way.value());
+        return maybe<memcached_value<ValueSize> >(values[set][way.value()]);
     }
 private:
+    /* Returns the way holding the key, if any */
+    maybe<unsigned> lookup(size_t set, const memcached_key<KeySize>& k) const
+    {
+#pragma HLS inline
+        maybe<unsigned> result;
+
+        for (unsigned way = 0; way < Ways; ++way) {
+#pragma HLS unroll
+            if (valid[set][way] && tags[set][way] == k)
+                result = maybe<unsigned>(way);
+        }
+
+        return result;
+    }
+
+    /* Picks an empty way if there is one, otherwise the least recently used */
+    unsigned replace(size_t set) const
+    {
+#pragma HLS inline
+        unsigned victim = 0;
+        bool found_empty = false;
+
+        for (unsigned way = 0; way < Ways; ++way) {
+#pragma HLS unroll
+            if (!valid[set][way] && !found_empty) {
+                victim = way;
+                found_empty = true;
+            } else if (!found_empty && age[set][way] == Ways - 1) {
+                victim = way;
+            }
+        }
+
+        return victim;
+    }
+
+    /* Marks a way as most recently used. The ages of a set are always a
+     * permutation of 0..Ways-1, with 0 the most recently used. */
+    void touch(size_t set, unsigned used)
+    {
+#pragma HLS inline
+        unsigned used_age = age[set][used];
+
+        for (unsigned way = 0; way < Ways; ++way) {
+#pragma HLS unroll
+            if (age[set][way] < used_age)
+                ++age[set][way];
+        }
+        age[set][used] = 0;
+    }
+
     size_t h(const memcached_key<KeySize>& tag) const {
 #pragma HLS inline
-            return h_b(h_a(tag), tag) % Size;
+            return hash(tag) % Sets;
     }
 
     size_t h_a(const memcached_key<KeySize>& tag) const {
@@ -117,9 +247,10 @@ private:
 	    return seed;
     }
 
-    memcached_key<KeySize> tags[Size];
-    memcached_value<ValueSize> values[Size];
-    bool valid[Size];
+    memcached_key<KeySize> tags[Sets][Ways];
+    memcached_value<ValueSize> values[Sets][Ways];
+    bool valid[Sets][Ways];
+    unsigned char age[Sets][Ways];
 };
 
 #endif // MEMCACHEDCACHE_HPP
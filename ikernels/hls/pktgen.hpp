@@ -72,7 +72,8 @@ private:
     /** Packet metadata */
     hls_ik::metadata metadata;
     /** Size of the data array (in elements) */
-    static const int data_size = 2048 / 32;
+    static const int data_size = (NICA_MAX_FRAME_SIZE + hls_ik::axi_data::data_bytes - 1) /
+        hls_ik::axi_data::data_bytes;
     /** An array that holds the packet payload to duplicate */
     hls_ik::axi_data data[data_size];
 };
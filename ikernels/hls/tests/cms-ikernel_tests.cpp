@@ -92,8 +92,8 @@ namespace {
 	    p.net.metadata_input.write(m);
 	    ap_uint<32> val = i + 1;
 	    vals.push_back(val);
-	    ap_uint<256> data = (ap_uint<14 * 8>(0), ap_uint<32>(val), ap_uint<256 - 32 - 14 * 8>(0));
-	    hls_ik::axi_data d(data, 0xffffffff, true);
+	    hls_ik::axi_data::data_t data = (ap_uint<14 * 8>(0), ap_uint<32>(val), ap_uint<hls_ik::axi_data::data_bytes * 8 - 32 - 14 * 8>(0));
+	    hls_ik::axi_data d(data, hls_ik::axi_data::keep_bytes(32), true);
 	    p.net.data_input.write(d);
 	}
 
@@ -76,6 +76,18 @@ namespace {
         EXPECT_EQ(sketch.estimate("ikernel"), 0);
     }
 
+    TEST_F(cms_tests, Halve) {
+        sketch.update(1, 7);
+        sketch.update(2, 1);
+
+        for (int col = 0; col < WIDTH; ++col)
+            sketch.halve(col);
+
+        EXPECT_EQ(sketch.estimate(1), 3);
+        EXPECT_EQ(sketch.estimate(2), 0);
+        EXPECT_EQ(sketch.totalcount(), 4);
+    }
+
 } // namespace
 
 int main(int argc, char **argv) {
@@ -113,8 +113,24 @@ protected:
 
     void update_credits(hls_ik::ring_id_t ring_id, hls_ik::msn_t max_msn)
     {
-        p.host_credit_regs.ring_id = ring_id;
-        p.host_credit_regs.max_msn = max_msn;
+        hls_ik::credit_update credits(p.host_credit_regs.rings[ring_id - 1]);
+        credits.max_msn = max_msn;
+        p.host_credit_regs.rings[ring_id - 1] = credits;
+    }
+
+    /* Restart the ring's message count from zero */
+    void reset_credits(hls_ik::ring_id_t ring_id)
+    {
+        hls_ik::credit_update credits(p.host_credit_regs.rings[ring_id - 1]);
+        credits.reset = ~credits.reset;
+        p.host_credit_regs.rings[ring_id - 1] = credits;
+    }
+
+    /* Let the ikernel sweep the whole credit page */
+    void apply_credits()
+    {
+        for (int i = 0; i < hls_ik::credit_update_registers::num_entries; ++i)
+            top();
     }
 
     void test_passthrough(hls_ik::pipeline_ports& in, hls_ik::pipeline_ports& out,
@@ -0,0 +1,172 @@
+/* Copyright (C) 2017 Haggai Eran
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "memcached_cache.hpp"
+#include "gtest/gtest.h"
+
+#include <cstring>
+
+namespace {
+
+    typedef memcached_key<4> key;
+    typedef memcached_value<4> value;
+
+    key make_key(const char* s)
+    {
+        key k = key();
+        k.length = strlen(s);
+        memcpy(k.data, s, k.length);
+        return k;
+    }
+
+    value make_value(const char* s)
+    {
+        value v = value();
+        v.length = strlen(s);
+        memcpy(v.data, s, v.length);
+        return v;
+    }
+
+    /* A single set, so that all keys conflict */
+    typedef memcached_cache<4, 4, 4, 4> single_set_cache;
+
+    TEST(memcached_cache, conflicting_keys) {
+        single_set_cache cache;
+
+        cache.insert(make_key("key0"), make_value("val0"));
+        cache.insert(make_key("key1"), make_value("val1"));
+        cache.insert(make_key("key2"), make_value("val2"));
+        cache.insert(make_key("key3"), make_value("val3"));
+
+        for (const char* k : { "key0", "key1", "key2", "key3" }) {
+            maybe<value> found = cache.find(make_key(k));
+            ASSERT_TRUE(found.valid()) << k;
+            ASSERT_EQ(0, memcmp(found.value().data, "val", 3));
+            ASSERT_EQ(k[3], found.value().data[3]);
+        }
+    }
+
+    TEST(memcached_cache, lru_replacement) {
+        single_set_cache cache;
+
+        cache.insert(make_key("key0"), make_value("val0"));
+        cache.insert(make_key("key1"), make_value("val1"));
+        cache.insert(make_key("key2"), make_value("val2"));
+        cache.insert(make_key("key3"), make_value("val3"));
+
+        /* key1 is now the least recently used */
+        ASSERT_TRUE(cache.find(make_key("key0")).valid());
+        cache.insert(make_key("key4"), make_value("val4"));
+
+        EXPECT_TRUE(cache.find(make_key("key0")).valid());
+        EXPECT_FALSE(cache.find(make_key("key1")).valid());
+        EXPECT_TRUE(cache.find(make_key("key2")).valid());
+        EXPECT_TRUE(cache.find(make_key("key3")).valid());
+        EXPECT_TRUE(cache.find(make_key("key4")).valid());
+    }
+
+    TEST(memcached_cache, update_in_place) {
+        single_set_cache cache;
+
+        cache.insert(make_key("key0"), make_value("val0"));
+        cache.insert(make_key("key0"), make_value("new0"));
+        cache.insert(make_key("key1"), make_value("val1"));
+        cache.insert(make_key("key2"), make_value("val2"));
+        cache.insert(make_key("key3"), make_value("val3"));
+
+        maybe<value> found = cache.find(make_key("key0"));
+        ASSERT_TRUE(found.valid());
+        EXPECT_EQ(0, memcmp(found.value().data, "new0", 4));
+        EXPECT_TRUE(cache.find(make_key("key3")).valid());
+    }
+
+    TEST(memcached_cache, erase_frees_way) {
+        single_set_cache cache;
+
+        cache.insert(make_key("key0"), make_value("val0"));
+        cache.insert(make_key("key1"), make_value("val1"));
+        cache.insert(make_key("key2"), make_value("val2"));
+        cache.insert(make_key("key3"), make_value("val3"));
+
+        cache.erase(make_key("key2"));
+        EXPECT_FALSE(cache.find(make_key("key2")).valid());
+
+        /* The empty way is used before evicting anything */
+        cache.insert(make_key("key4"), make_value("val4"));
+        for (const char* k : { "key0", "key1", "key3", "key4" })
+            EXPECT_TRUE(cache.find(make_key(k)).valid()) << k;
+    }
+
+    TEST(memcached_cache, report_evictions) {
+        single_set_cache cache;
+
+        EXPECT_FALSE(cache.insert(make_key("key0"), make_value("val0")));
+        EXPECT_FALSE(cache.insert(make_key("key1"), make_value("val1")));
+        EXPECT_FALSE(cache.insert(make_key("key2"), make_value("val2")));
+        EXPECT_FALSE(cache.set_full(make_key("key3")));
+        EXPECT_FALSE(cache.insert(make_key("key3"), make_value("val3")));
+        EXPECT_TRUE(cache.set_full(make_key("key4")));
+
+        /* Updating a cached key evicts nothing */
+        EXPECT_FALSE(cache.insert(make_key("key0"), make_value("new0")));
+        EXPECT_TRUE(cache.insert(make_key("key4"), make_value("val4")));
+
+        EXPECT_TRUE(cache.erase(make_key("key4")));
+        EXPECT_FALSE(cache.erase(make_key("key4")));
+        EXPECT_FALSE(cache.set_full(make_key("key4")));
+    }
+
+    TEST(memcached_cache, victim) {
+        single_set_cache cache;
+
+        cache.insert(make_key("key0"), make_value("val0"));
+        cache.insert(make_key("key1"), make_value("val1"));
+        cache.insert(make_key("key2"), make_value("val2"));
+        EXPECT_FALSE(cache.victim(make_key("key3")).valid());
+        cache.insert(make_key("key3"), make_value("val3"));
+
+        /* key0 is the least recently used */
+        maybe<key> victim = cache.victim(make_key("key4"));
+        ASSERT_TRUE(victim.valid());
+        EXPECT_TRUE(victim.value() == make_key("key0"));
+        /* Cached keys evict nothing */
+        EXPECT_FALSE(cache.victim(make_key("key1")).valid());
+    }
+
+    TEST(memcached_cache, key_length) {
+        single_set_cache cache;
+
+        cache.insert(make_key("ab"), make_value("val0"));
+
+        EXPECT_TRUE(cache.find(make_key("ab")).valid());
+        EXPECT_FALSE(cache.find(make_key("a")).valid());
+        EXPECT_FALSE(cache.find(make_key("abc")).valid());
+    }
+
+    TEST(memcached_cache, direct_mapped) {
+        memcached_cache<4, 4, 1> cache;
+
+        cache.insert(make_key("key0"), make_value("val0"));
+        cache.insert(make_key("key1"), make_value("val1"));
+
+        EXPECT_FALSE(cache.find(make_key("key0")).valid());
+        EXPECT_TRUE(cache.find(make_key("key1")).valid());
+    }
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
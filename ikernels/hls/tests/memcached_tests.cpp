@@ -49,21 +49,21 @@ namespace {
         c.n2h.enable = true;
         c.h2n.enable = true;
 
-        if (MEMCACHED_KEY_SIZE == 10 && MEMCACHED_VALUE_SIZE == 10)
+        if (MEMCACHED_KEY_SIZE >= 10 && MEMCACHED_VALUE_SIZE >= 10)
             ASSERT_GE(read_pcap("memcached-responses.pcap", cxp2sbu), 0);
         run();
-        if (MEMCACHED_KEY_SIZE == 10 && MEMCACHED_VALUE_SIZE == 10)
+        if (MEMCACHED_KEY_SIZE >= 10 && MEMCACHED_VALUE_SIZE >= 10)
             ASSERT_GE(read_pcap("memcached-requests.pcap", nwp2sbu), 0);
         run();
 
         write_pcap(nwp_output, sbu2nwp, false);
         write_pcap(cxp_output, sbu2cxp, false);
 
-        if (MEMCACHED_KEY_SIZE == 10 && MEMCACHED_VALUE_SIZE == 10)
+        if (MEMCACHED_KEY_SIZE >= 10 && MEMCACHED_VALUE_SIZE >= 10)
             EXPECT_TRUE(compare_output(filename(nwp_output), "",
                                        "memcached-all-responses.pcap", ""));
         // cxp_output should be empty
-        if (MEMCACHED_KEY_SIZE == 10 && MEMCACHED_VALUE_SIZE == 10)
+        if (MEMCACHED_KEY_SIZE >= 10 && MEMCACHED_VALUE_SIZE >= 10)
             EXPECT_TRUE(compare_output(filename(cxp_output), "",
                                        "memcached-requests.pcap", "sctp"));
     }
@@ -71,6 +71,415 @@ namespace {
     INSTANTIATE_TEST_CASE_P(memcached_test_instance, memcached_test,
             ::testing::Values(&memcached_top));
 
+    /* Feeds memcached payloads directly to the ikernel */
+    class memcached_payload_test : public ikernel_test {
+    protected:
+        /* Memcached UDP frame header */
+        const std::string frame = std::string("\x00\x07\x00\x00\x00\x01\x00\x00", 8);
+
+        void send(pipeline_ports& in, const std::string& payload, int cycles = 100)
+        {
+            metadata m;
+            packet_metadata pkt = m.get_packet_metadata();
+            pkt.ip_src = 1;
+            pkt.ip_dst = 2;
+            pkt.udp_src = 11211;
+            pkt.udp_dst = 11211;
+            m.set_packet_metadata(pkt);
+            m.length = payload.size();
+            /* Responses from the host go back to the client */
+            if (&in == &p.host)
+                m = m.reply(payload.size());
+            in.metadata_input.write(m);
+
+            for (size_t offset = 0; offset < payload.size(); offset += axi_data::data_bytes) {
+                const int bytes = std::min(payload.size() - offset, size_t(axi_data::data_bytes));
+                axi_data d;
+                d.set_data(payload.data() + offset, bytes);
+                d.last = offset + bytes == payload.size();
+                in.data_input.write(d);
+            }
+
+            for (int i = 0; i < cycles; ++i)
+                top();
+        }
+
+        std::string receive(pipeline_ports& out, metadata* m = NULL)
+        {
+            std::string payload;
+            axi_data d;
+
+            metadata out_metadata = out.metadata_output.read();
+            if (m)
+                *m = out_metadata;
+            do {
+                char buffer[axi_data::data_bytes];
+                d = out.data_output.read();
+                payload.append(buffer, d.get_data(buffer));
+            } while (!d.last);
+
+            return payload;
+        }
+
+        /* Sends a response from the host, which passes through */
+        void respond(const std::string& response)
+        {
+            send(p.host, frame + response);
+            ASSERT_EQ(PASS, p.host.action.read());
+            EXPECT_EQ(frame + response, receive(p.host));
+        }
+
+        /* Sends a request and returns the reply, or an empty string if the
+         * request went to the host */
+        std::string request(const std::string& request)
+        {
+            send(p.net, frame + request);
+            if (p.net.action.read() == PASS) {
+                receive(p.net);
+                return "";
+            }
+            EXPECT_EQ(GENERATE, p.host.action.read());
+            return receive(p.host);
+        }
+
+        /* Returns keys that all map to a single set of the cache */
+        std::vector<std::string> same_set_keys(const std::string& prefix, size_t count)
+        {
+            typedef memcached_cache<MEMCACHED_KEY_SIZE, MEMCACHED_VALUE_SIZE,
+                                    MEMCACHED_CACHE_SIZE, MEMCACHED_CACHE_WAYS> cache_type;
+            std::unique_ptr<cache_type> cache(new cache_type);
+
+            std::vector<std::string> keys;
+            size_t set = 0;
+            for (int i = 0; keys.size() < count; ++i) {
+                std::string k = prefix + std::to_string(i);
+                memcached_key<MEMCACHED_KEY_SIZE> key = memcached_key<MEMCACHED_KEY_SIZE>();
+                key.length = k.size();
+                std::copy(k.begin(), k.end(), key.data);
+                size_t key_set = cache->hash(key) % cache_type::Sets;
+                if (keys.empty())
+                    set = key_set;
+                if (key_set == set)
+                    keys.push_back(k);
+            }
+            return keys;
+        }
+    };
+
+    TEST_P(memcached_payload_test, variable_length) {
+        respond("VALUE k1 0 3\r\nabc\r\nEND\r\n");
+        respond("VALUE key-two 0 10\r\n0123456789\r\nEND\r\n");
+
+        EXPECT_EQ(frame + "VALUE k1 0 3\r\nabc\r\nEND\r\n", request("get k1\r\n"));
+        EXPECT_EQ(frame + "VALUE key-two 0 10\r\n0123456789\r\nEND\r\n",
+                  request("get key-two\r\n"));
+        /* A prefix of a cached key is a different key */
+        EXPECT_EQ("", request("get key\r\n"));
+
+        /* SET invalidates the cached value */
+        EXPECT_EQ("", request("set k1 0 0 1\r\nx\r\n"));
+        EXPECT_EQ("", request("get k1\r\n"));
+    }
+
+    TEST_P(memcached_payload_test, not_cached) {
+        const std::string long_key(MEMCACHED_KEY_SIZE + 1, 'k');
+        const std::string long_value(MEMCACHED_VALUE_SIZE + 1, 'v');
+
+        respond("VALUE " + long_key + " 0 1\r\nv\r\nEND\r\n");
+        respond("VALUE long-value 0 " + std::to_string(long_value.size()) + "\r\n" +
+                long_value + "\r\nEND\r\n");
+        respond("VALUE flags 5 1\r\nv\r\nEND\r\n");
+
+        EXPECT_EQ("", request("get " + long_key + "\r\n"));
+        EXPECT_EQ("", request("get long-value\r\n"));
+        EXPECT_EQ("", request("get flags\r\n"));
+    }
+
+    TEST_P(memcached_payload_test, multi_get) {
+        const std::string v1 = "VALUE k1 0 3\r\nabc\r\n", v2 = "VALUE k2 0 2\r\nde\r\n";
+        respond(v1 + "END\r\n");
+        respond(v2 + "END\r\n");
+
+        /* All keys hit */
+        EXPECT_EQ(frame + v1 + v2 + "END\r\n", request("get k1 k2\r\n"));
+        EXPECT_EQ(frame + v2 + v1 + v1 + "END\r\n", request("get k2 k1 k1\r\n"));
+
+        /* No key hits: the request goes to the host unchanged */
+        send(p.net, frame + "get k3 k4\r\n");
+        ASSERT_EQ(PASS, p.net.action.read());
+        EXPECT_EQ(frame + "get k3 k4\r\n", receive(p.net));
+
+        /* With large values the host response to both missed keys may not
+         * fit in a single datagram */
+        if (MEMCACHED_SPLIT_MAX_MISSES < 2) {
+            EXPECT_EQ("", request("get k1 k3 k2 k4\r\n"));
+            return;
+        }
+
+        /* Some keys hit: the ikernel replies with the first datagram, and the
+         * host gets a request for the other keys */
+        send(p.net, frame + "get k1 k3 k2 k4\r\n");
+        ASSERT_EQ(PASS, p.net.action.read());
+        metadata m;
+        EXPECT_EQ(frame + "get k3 k4\r\n", receive(p.net, &m));
+        EXPECT_EQ(frame.size() + 11, m.length);
+
+        const std::string first("\x00\x07\x00\x00\x00\x02\x00\x00", 8);
+        ASSERT_EQ(GENERATE, p.host.action.read());
+        EXPECT_EQ(first + v1 + v2, receive(p.host));
+
+        /* The host response becomes the second datagram */
+        const std::string second("\x00\x07\x00\x01\x00\x02\x00\x00", 8);
+        send(p.host, frame + "VALUE k3 0 1\r\nf\r\nEND\r\n");
+        ASSERT_EQ(PASS, p.host.action.read());
+        EXPECT_EQ(second + "VALUE k3 0 1\r\nf\r\nEND\r\n", receive(p.host));
+
+        /* Later responses are not renumbered */
+        respond("VALUE k4 0 1\r\ng\r\nEND\r\n");
+    }
+
+    TEST_P(memcached_payload_test, reply_size) {
+        const std::string value(MEMCACHED_VALUE_SIZE, 'v');
+        const std::string v = "VALUE big 0 " + std::to_string(value.size()) + "\r\n" + value + "\r\n";
+        /* The number of hits whose reply overflows a datagram, which only
+         * large values reach within a request */
+        const size_t hits = MEMCACHED_HOST_DATAGRAM_PAYLOAD / v.size() + 1;
+        if (hits > MEMCACHED_MAX_KEYS)
+            return;
+
+        respond(v + "END\r\n");
+        std::string get = "get";
+        std::string reply;
+        for (size_t i = 1; i < hits; ++i) {
+            get += " big";
+            reply += v;
+        }
+        if (reply.size() + 5 <= MEMCACHED_HOST_DATAGRAM_PAYLOAD)
+            EXPECT_EQ(frame + reply + "END\r\n", request(get + "\r\n"));
+
+        EXPECT_EQ("", request(get + " big\r\n"));
+        /* Neither can the hits of a split request overflow it */
+        EXPECT_EQ("", request(get + " big k1\r\n"));
+    }
+
+    TEST_P(memcached_payload_test, write_through) {
+        /* Off by default: SET only invalidates */
+        EXPECT_EQ(0, read(MEMCACHED_WRITE_THROUGH));
+        EXPECT_EQ("", request("set wt1 0 0 3\r\nabc\r\n"));
+        EXPECT_EQ("", request("get wt1\r\n"));
+
+        write(MEMCACHED_WRITE_THROUGH, 1);
+        EXPECT_EQ(1, read(MEMCACHED_WRITE_THROUGH));
+
+        /* The value is cached only once the host stores it */
+        EXPECT_EQ("", request("set wt1 0 0 3\r\nabc\r\n"));
+        EXPECT_EQ("", request("get wt1\r\n"));
+        respond("STORED\r\n");
+        EXPECT_EQ(frame + "VALUE wt1 0 3\r\nabc\r\nEND\r\n", request("get wt1\r\n"));
+
+        /* A SET the host does not store is not cached, and its key is erased */
+        EXPECT_EQ("", request("set wt1 0 0 2\r\nxy\r\n"));
+        EXPECT_EQ("", request("get wt1\r\n"));
+        respond("NOT_STORED\r\n");
+        EXPECT_EQ("", request("get wt1\r\n"));
+
+        /* Only plain values are written through */
+        EXPECT_EQ("", request("set wt3 1 0 1\r\nv\r\n"));
+        EXPECT_EQ("", request("get wt3\r\n"));
+        EXPECT_EQ("", request("set wt3 0 60 1\r\nv\r\n"));
+        EXPECT_EQ("", request("get wt3\r\n"));
+        EXPECT_EQ("", request("set wt3 0 0 1 noreply\r\nv\r\n"));
+        EXPECT_EQ("", request("get wt3\r\n"));
+        EXPECT_EQ("", request("set wt3 0 0 2\r\nv\r\n"));
+        EXPECT_EQ("", request("get wt3\r\n"));
+
+        /* A non-cacheable SET still invalidates */
+        EXPECT_EQ("", request("set wt1 0 0 " + std::to_string(MEMCACHED_VALUE_SIZE + 1) + "\r\n" +
+                              std::string(MEMCACHED_VALUE_SIZE + 1, 'v') + "\r\n"));
+        EXPECT_EQ("", request("get wt1\r\n"));
+
+        write(MEMCACHED_WRITE_THROUGH, 0);
+    }
+
+    TEST_P(memcached_payload_test, counters) {
+        write(MEMCACHED_SNAPSHOT, 1);
+        EXPECT_EQ(1, read(MEMCACHED_SNAPSHOT));
+        const int hits = read(MEMCACHED_GET_HITS), misses = read(MEMCACHED_GET_MISSES),
+                  sets = read(MEMCACHED_SETS), invalidations = read(MEMCACHED_INVALIDATIONS);
+
+        respond("VALUE c1 0 1\r\na\r\nEND\r\n");
+        request("get c1\r\n");
+        request("get c2\r\n");
+        request("get c1 c1\r\n");
+        request("get c2 c3\r\n");
+        request("set c1 0 0 1\r\nb\r\n");
+        request("set c1 0 0 1\r\nb\r\n");
+
+        /* The snapshot does not change until it is taken again */
+        EXPECT_EQ(hits, read(MEMCACHED_GET_HITS));
+        write(MEMCACHED_SNAPSHOT, 1);
+
+        EXPECT_EQ(3, read(MEMCACHED_GET_HITS) - hits);
+        EXPECT_EQ(3, read(MEMCACHED_GET_MISSES) - misses);
+        EXPECT_EQ(2, read(MEMCACHED_SETS) - sets);
+        /* Only the first SET erased a cached value */
+        EXPECT_EQ(1, read(MEMCACHED_INVALIDATIONS) - invalidations);
+
+        write(MEMCACHED_SNAPSHOT, 0);
+        EXPECT_EQ(0, read(MEMCACHED_SNAPSHOT));
+    }
+
+    TEST_P(memcached_payload_test, admission) {
+        /* Keys of a single set, one more than it can hold */
+        std::vector<std::string> keys = same_set_keys("adm", MEMCACHED_CACHE_WAYS + 1);
+        const std::string cold = keys.back();
+        keys.pop_back();
+
+        write(MEMCACHED_ADMISSION, 1);
+        EXPECT_EQ(1, read(MEMCACHED_ADMISSION));
+        write(MEMCACHED_SNAPSHOT, 1);
+        const int rejects = read(MEMCACHED_ADMISSION_REJECTS);
+
+        /* Requested twice each */
+        for (auto& k : keys) {
+            EXPECT_EQ("", request("get " + k + "\r\n"));
+            respond("VALUE " + k + " 0 1\r\nv\r\nEND\r\n");
+            EXPECT_NE("", request("get " + k + "\r\n"));
+        }
+
+        /* Requested once: not admitted */
+        EXPECT_EQ("", request("get " + cold + "\r\n"));
+        respond("VALUE " + cold + " 0 1\r\nv\r\nEND\r\n");
+        EXPECT_EQ("", request("get " + cold + "\r\n"));
+        for (auto& k : keys)
+            EXPECT_NE("", request("get " + k + "\r\n"));
+
+        write(MEMCACHED_SNAPSHOT, 1);
+        EXPECT_EQ(1, read(MEMCACHED_ADMISSION_REJECTS) - rejects);
+
+        /* Once it is requested more often, it evicts the least recently used */
+        for (int i = 0; i < 3; ++i)
+            EXPECT_EQ("", request("get " + cold + "\r\n"));
+        respond("VALUE " + cold + " 0 1\r\nv\r\nEND\r\n");
+        EXPECT_NE("", request("get " + cold + "\r\n"));
+        EXPECT_EQ("", request("get " + keys.front() + "\r\n"));
+
+        write(MEMCACHED_SNAPSHOT, 0);
+        write(MEMCACHED_ADMISSION, 0);
+    }
+
+    TEST_P(memcached_payload_test, dram) {
+        /* The first key is evicted from the on-chip cache but stays in DRAM */
+        std::vector<std::string> keys = same_set_keys("dram", MEMCACHED_CACHE_WAYS + 1);
+        auto response = [](const std::string& k) {
+            return "VALUE " + k + " 0 " + std::to_string(k.size()) + "\r\n" + k + "\r\nEND\r\n";
+        };
+        for (auto& k : keys)
+            respond(response(k));
+        const std::string evicted = keys.front(), cached = keys.back();
+
+        /* Off by default */
+        EXPECT_EQ(0, read(MEMCACHED_DRAM));
+        EXPECT_EQ("", request("get " + evicted + "\r\n"));
+
+        write(MEMCACHED_DRAM, 1);
+        EXPECT_EQ(1, read(MEMCACHED_DRAM));
+        write(MEMCACHED_SNAPSHOT, 1);
+        const int hits = read(MEMCACHED_DRAM_HITS), misses = read(MEMCACHED_DRAM_MISSES);
+
+        /* The reply comes after the DRAM latency */
+        send(p.net, frame + "get " + evicted + "\r\n");
+        ASSERT_EQ(DROP, p.net.action.read());
+        for (int i = 0; i < 2 * MEMCACHED_DRAM_LATENCY; ++i)
+            top();
+        ASSERT_EQ(GENERATE, p.host.action.read());
+        EXPECT_EQ(frame + response(evicted), receive(p.host));
+
+        /* An on-chip hit overtakes a pending DRAM lookup */
+        send(p.net, frame + "get " + evicted + "\r\n", 0);
+        send(p.net, frame + "get " + cached + "\r\n");
+        ASSERT_EQ(DROP, p.net.action.read());
+        ASSERT_EQ(DROP, p.net.action.read());
+        for (int i = 0; i < 2 * MEMCACHED_DRAM_LATENCY; ++i)
+            top();
+        ASSERT_EQ(GENERATE, p.host.action.read());
+        EXPECT_EQ(frame + response(cached), receive(p.host));
+        ASSERT_EQ(GENERATE, p.host.action.read());
+        EXPECT_EQ(frame + response(evicted), receive(p.host));
+
+        /* A DRAM miss sends the request on to the host */
+        send(p.net, frame + "get dram-miss\r\n");
+        ASSERT_EQ(DROP, p.net.action.read());
+        for (int i = 0; i < 2 * MEMCACHED_DRAM_LATENCY; ++i)
+            top();
+        ASSERT_EQ(GENERATE, p.net.action.read());
+        EXPECT_EQ(frame + "get dram-miss\r\n", receive(p.net));
+
+        /* SET invalidates the DRAM entry too */
+        EXPECT_EQ("", request("set " + evicted + " 0 0 1\r\nx\r\n"));
+        send(p.net, frame + "get " + evicted + "\r\n");
+        ASSERT_EQ(DROP, p.net.action.read());
+        for (int i = 0; i < 2 * MEMCACHED_DRAM_LATENCY; ++i)
+            top();
+        ASSERT_EQ(GENERATE, p.net.action.read());
+        EXPECT_EQ(frame + "get " + evicted + "\r\n", receive(p.net));
+
+        write(MEMCACHED_SNAPSHOT, 1);
+        EXPECT_EQ(2, read(MEMCACHED_DRAM_HITS) - hits);
+        EXPECT_EQ(2, read(MEMCACHED_DRAM_MISSES) - misses);
+
+        write(MEMCACHED_SNAPSHOT, 0);
+        write(MEMCACHED_DRAM, 0);
+    }
+
+    /* Builds a binary protocol message */
+    std::string binary_message(uint8_t magic, uint8_t opcode, const std::string& extras,
+                               const std::string& key, const std::string& value,
+                               uint32_t opaque = 0, const std::string& cas = std::string(8, '\0'))
+    {
+        const uint32_t body = extras.size() + key.size() + value.size();
+        const char header[] = {
+            char(magic), char(opcode), char(key.size() >> 8), char(key.size()),
+            char(extras.size()), 0, 0, 0,
+            char(body >> 24), char(body >> 16), char(body >> 8), char(body),
+            char(opaque >> 24), char(opaque >> 16), char(opaque >> 8), char(opaque),
+        };
+
+        return std::string(header, sizeof(header)) + cas + extras + key + value;
+    }
+
+    TEST_P(memcached_payload_test, binary) {
+        const std::string flags(4, '\0');
+        const std::string cas("\x01\x02\x03\x04\x05\x06\x07\x08", 8);
+
+        write(MEMCACHED_PROTOCOL, MEMCACHED_BINARY);
+        EXPECT_EQ(MEMCACHED_BINARY, read(MEMCACHED_PROTOCOL));
+
+        respond(binary_message(BINARY_RESPONSE_MAGIC, BINARY_OPCODE_GETK, flags, "bk1", "hello", 7, cas));
+
+        EXPECT_EQ(frame + binary_message(BINARY_RESPONSE_MAGIC, BINARY_OPCODE_GET, flags, "", "hello", 0x1234, cas),
+                  request(binary_message(BINARY_REQUEST_MAGIC, BINARY_OPCODE_GET, "", "bk1", "", 0x1234)));
+        EXPECT_EQ(frame + binary_message(BINARY_RESPONSE_MAGIC, BINARY_OPCODE_GETK, flags, "bk1", "hello", 5, cas),
+                  request(binary_message(BINARY_REQUEST_MAGIC, BINARY_OPCODE_GETK, "", "bk1", "", 5)));
+
+        /* More than one request in the datagram */
+        EXPECT_EQ("", request(binary_message(BINARY_REQUEST_MAGIC, BINARY_OPCODE_GETKQ, "", "bk1", "") +
+                              binary_message(BINARY_REQUEST_MAGIC, 0x0a /* noop */, "", "", "")));
+
+        /* DELETE invalidates the cached value */
+        EXPECT_EQ("", request(binary_message(BINARY_REQUEST_MAGIC, 0x04, "", "bk1", "")));
+        EXPECT_EQ("", request(binary_message(BINARY_REQUEST_MAGIC, BINARY_OPCODE_GET, "", "bk1", "")));
+
+        /* Responses with non-zero flags are not cached */
+        respond(binary_message(BINARY_RESPONSE_MAGIC, BINARY_OPCODE_GETK, std::string("\0\0\0\1", 4), "bk2", "v"));
+        EXPECT_EQ("", request(binary_message(BINARY_REQUEST_MAGIC, BINARY_OPCODE_GET, "", "bk2", "")));
+
+        write(MEMCACHED_PROTOCOL, MEMCACHED_ASCII);
+    }
+
+    INSTANTIATE_TEST_CASE_P(memcached_payload_test_instance, memcached_payload_test,
+            ::testing::Values(&memcached_top));
+
 } // namespace
 
 int main(int argc, char **argv) {
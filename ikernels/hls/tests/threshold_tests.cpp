@@ -27,6 +27,7 @@
 #include "threshold.hpp"
 #include "threshold-impl.hpp"
 #include <vector>
+#include <map>
 #include <ctime> 
 #include <ap_int.h>
 #include <limits.h>
@@ -93,8 +94,8 @@ namespace {
             dropped_packets_num += rand_val < threshold_val ? 1 : 0;
             vec.push_back(rand_val < threshold_val ? DROP : PASS);		
             //   cout << "[" << i << "] : " << rand_val << "\n";	
-            ap_uint<256> data = (ap_uint<14*8>(0),ap_uint<32>(rand_val), ap_uint<256 - 32 - 14*8>(0));
-            axi_data d(data, 0xffffffff, true);
+            axi_data::data_t data = (ap_uint<14*8>(0),ap_uint<32>(rand_val), ap_uint<axi_data::data_bytes * 8 - 32 - 14*8>(0));
+            axi_data d(data, axi_data::keep_bytes(32), true);
             p.net.data_input.write(d);
         }
 
@@ -152,6 +153,7 @@ namespace {
 
         const int total = 100;
         update_credits(1, total);
+        apply_credits();
 
         for (int i = 0; i < total; ++i) {
             p.net.metadata_input.write(m);
@@ -162,8 +164,8 @@ namespace {
             dropped_packets_num += rand_val < threshold_val ? 1 : 0;
             vec.push_back(rand_val < threshold_val ? DROP : PASS);		
             //   cout << "[" << i << "] : " << rand_val << "\n";	
-            ap_uint<256> data = (ap_uint<14*8>(0),ap_uint<32>(rand_val), ap_uint<256 - 32 - 14*8>(0));
-            axi_data d(data, 0xffffffff, true);
+            axi_data::data_t data = (ap_uint<14*8>(0),ap_uint<32>(rand_val), ap_uint<axi_data::data_bytes * 8 - 32 - 14*8>(0));
+            axi_data d(data, axi_data::keep_bytes(32), true);
             p.net.data_input.write(d);
         }
 
@@ -193,6 +195,184 @@ namespace {
         EXPECT_EQ(total, read(THRESHOLD_COUNT) - count_start) << "count";
     }
 
+    TEST_P(threshold_test, custom_ring_credit_races) {
+        write(THRESHOLD_VALUE, 0);
+        write(THRESHOLD_RING_ID + 3, 3);
+        write(THRESHOLD_RING_ID + 4, 4);
+        int backpressure_start = read(THRESHOLD_DROPPED_BACKPRESSURE);
+
+        /* Several host writes land between two ikernel steps: a stale limit
+         * for ring 3 superseded by a newer one, and a limit for ring 4. */
+        update_credits(3, 2);
+        update_credits(4, 7);
+        update_credits(3, 5);
+        apply_credits();
+
+        auto send = [&](int packets) {
+            std::map<int, int> passed;
+            for (int i = 0; i < packets; ++i) {
+                for (int flow = 3; flow <= 4; ++flow) {
+                    metadata m;
+                    m.length = 32;
+                    m.ikernel_id = 1;
+                    m.flow_id = flow;
+                    p.net.metadata_input.write(m);
+                    axi_data::data_t data = (ap_uint<14*8>(0), ap_uint<32>(i + 1),
+                        ap_uint<axi_data::data_bytes * 8 - 32 - 14*8>(0));
+                    p.net.data_input.write(axi_data(data, axi_data::keep_bytes(32), true));
+                }
+            }
+            while (!p.net.data_input.empty())
+                top();
+            for (int i = 0; i < 64; ++i)
+                top();
+
+            while (!p.net.action.empty()) {
+                if (action(int(p.net.action.read())) != PASS)
+                    continue;
+                metadata m = p.net.metadata_output.read();
+                ++passed[m.ring_id];
+                p.net.data_output.read();
+            }
+            return passed;
+        };
+
+        auto passed = send(10);
+        EXPECT_EQ(passed[3], 5);
+        EXPECT_EQ(passed[4], 7);
+        EXPECT_EQ(read(THRESHOLD_DROPPED_BACKPRESSURE) - backpressure_start, 8);
+
+        /* A reset and a credit increase posted together both apply */
+        reset_credits(3);
+        update_credits(4, 9);
+        apply_credits();
+
+        passed = send(10);
+        EXPECT_EQ(passed[3], 5);
+        EXPECT_EQ(passed[4], 2);
+
+        /* The deprecated register resets ring 3 with three credits, and the
+         * unchanged page entry does not override it */
+        p.host_credit_regs.legacy = (ap_uint<1>(1), hls_ik::msn_t(3), hls_ik::ring_id_t(3));
+        apply_credits();
+
+        passed = send(10);
+        EXPECT_EQ(passed[3], 3);
+        EXPECT_EQ(passed[4], 0);
+        p.host_credit_regs.legacy = 0;
+    }
+
+    TEST_P(threshold_test, ring_dump) {
+        const int rings[FLOW_TABLE_SIZE] = { 0, 5, 1, 3, 4, 0 };
+        for (int flow = 0; flow < FLOW_TABLE_SIZE; ++flow)
+            write(THRESHOLD_RING_ID + flow, rings[flow]);
+
+        write(THRESHOLD_RING_DUMP, 1);
+        for (int flow = 1; flow < FLOW_TABLE_SIZE; ++flow)
+            EXPECT_EQ(rings[flow], read(THRESHOLD_RING_DUMP)) << "flow " << flow;
+        /* The dump is over */
+        EXPECT_EQ(-1, read(THRESHOLD_RING_DUMP));
+        EXPECT_EQ(rings[2], read(THRESHOLD_RING_ID + 2));
+
+        /* Cancel a dump that was not read to the end */
+        write(THRESHOLD_RING_DUMP, 0);
+        EXPECT_EQ(rings[0], read(THRESHOLD_RING_DUMP));
+        write(THRESHOLD_RING_DUMP, -1);
+        EXPECT_EQ(-1, read(THRESHOLD_RING_DUMP));
+        write(THRESHOLD_RING_DUMP, 3);
+        for (int flow = 3; flow < FLOW_TABLE_SIZE; ++flow)
+            EXPECT_EQ(rings[flow], read(THRESHOLD_RING_DUMP)) << "flow " << flow;
+        EXPECT_EQ(-1, read(THRESHOLD_RING_DUMP));
+    }
+
+    TEST_P(threshold_test, bulk_read) {
+        const int first = THRESHOLD_MIN, count = THRESHOLD_DROPPED_BACKPRESSURE - first + 1;
+        reset_credits(6);
+        update_credits(6, 0);
+        apply_credits();
+        std::vector<int> expected;
+        for (int i = 0; i < count; ++i)
+            expected.push_back(read(first + i));
+
+        write(GW_BULK_READ_RING, 6);
+        write(GW_BULK_READ_ADDRESS, first);
+        write(GW_BULK_READ_STRIDE, 1);
+        write(GW_BULK_READ_COUNT, count);
+        /* Repeated reads of a single register span multiple packets */
+        const int repeat = GW_BULK_READ_PACKET_VALUES + 3;
+        write(GW_BULK_READ_ADDRESS, THRESHOLD_VALUE);
+        write(GW_BULK_READ_STRIDE, 0);
+        write(GW_BULK_READ_COUNT, repeat);
+        for (int i = 0; i < count + repeat; ++i)
+            top();
+        /* Each bulk read waits for a host credit */
+        EXPECT_TRUE(p.net.metadata_output.empty());
+        update_credits(6, 2);
+        apply_credits();
+        /* The credits may only be applied at the end of the sweep, and each
+         * packet header takes a cycle of its own */
+        for (int i = 0; i < 2 * (count + repeat); ++i)
+            top();
+
+        std::vector<int> values;
+        std::vector<bool> end_of_message;
+        while (!p.net.metadata_output.empty()) {
+            EXPECT_EQ(GENERATE, action(int(p.net.action.read())));
+            metadata m = p.net.metadata_output.read();
+            EXPECT_EQ(6, m.ring_id);
+            end_of_message.push_back(m.get_custom_ring_metadata().end_of_message);
+
+            int length = 0;
+            axi_data d;
+            do {
+                d = p.net.data_output.read();
+                for (int i = 0; i < d.num_valid_bytes() / 4; ++i)
+                    values.push_back(d.data(d.data.width - 1 - 32 * i, d.data.width - 32 * (i + 1)));
+                length += d.num_valid_bytes();
+            } while (!d.last);
+            EXPECT_EQ(m.length, length);
+        }
+
+        EXPECT_EQ(std::vector<bool>({ true, false, true }), end_of_message);
+        ASSERT_EQ(count + repeat, values.size());
+        for (int i = 0; i < count; ++i)
+            EXPECT_EQ(expected[i], values[i]) << "register " << first + i;
+        for (int i = count; i < count + repeat; ++i)
+            EXPECT_EQ(read(THRESHOLD_VALUE), values[i]);
+    }
+
+    TEST_P(threshold_test, snapshot) {
+        write(THRESHOLD_VALUE, 0xffffffff);
+        write(THRESHOLD_SNAPSHOT, 1);
+        EXPECT_EQ(1, read(THRESHOLD_SNAPSHOT));
+        const int count = read(THRESHOLD_COUNT), dropped = read(THRESHOLD_DROPPED);
+
+        metadata m;
+        m.length = 32;
+        const int total = 10;
+        for (int i = 0; i < total; ++i) {
+            p.net.metadata_input.write(m);
+            axi_data::data_t data = (ap_uint<14*8>(0), ap_uint<32>(i), ap_uint<axi_data::data_bytes * 8 - 32 - 14*8>(0));
+            p.net.data_input.write(axi_data(data, axi_data::keep_bytes(32), true));
+        }
+        for (int i = 0; i < 64; ++i)
+            top();
+        for (int i = 0; i < total; ++i)
+            EXPECT_EQ(DROP, action(int(p.net.action.read())));
+
+        /* Reads return the latched values */
+        EXPECT_EQ(count, read(THRESHOLD_COUNT)) << "count";
+        EXPECT_EQ(dropped, read(THRESHOLD_DROPPED)) << "dropped packets";
+
+        write(THRESHOLD_SNAPSHOT, 1);
+        EXPECT_EQ(count + total, read(THRESHOLD_COUNT)) << "count";
+        EXPECT_EQ(dropped + total, read(THRESHOLD_DROPPED)) << "dropped packets";
+
+        write(THRESHOLD_SNAPSHOT, 0);
+        EXPECT_EQ(0, read(THRESHOLD_SNAPSHOT));
+        EXPECT_EQ(count + total, read(THRESHOLD_COUNT)) << "count";
+    }
+
     INSTANTIATE_TEST_CASE_P(threshold_test_instance, threshold_test,
             ::testing::Values(&threshold_top));
 
@@ -27,6 +27,7 @@
 
 #include <ikernel.hpp>
 #include <gateway.hpp>
+#include <bulk_read-impl.hpp>
 #include <flow_table.hpp>
 #include <context_manager.hpp>
 
@@ -43,16 +44,20 @@ struct threshold_stats {
     threshold_stats() : min(-1U), max(0), count(0), dropped(0), sum(0) {}
 };
 
-class flow_to_ring : public context_manager<hls_ik::ring_id_t, 3>
+class flow_to_ring : public context_manager<hls_ik::ring_id_t, hls_ik::flow_id_t::width>
 {
+    static_assert(FLOW_TABLE_SIZE <= (1 << hls_ik::flow_id_t::width),
+                  "flow IDs alias in the ring map");
 public:
     int write(int address, int value);
     int read(int address, int *value);
+    int dump(int first);
+    int next(int *value);
 
     hls_ik::ring_id_t find_ring(const hls_ik::flow_id_t& flow_id);
 };
 
-class threshold : public hls_ik::ikernel, public hls_ik::gateway_impl<threshold> {
+class threshold : public hls_ik::ikernel, public hls_ik::bulk_read_gateway_impl<threshold> {
 public:
     virtual void step(hls_ik::ports& ports);
     virtual int reg_write(int address, int value);
@@ -61,6 +66,9 @@ public:
 
 protected:
     threshold_stats stats;
+    /** Statistics latched by THRESHOLD_SNAPSHOT for the host to read */
+    threshold_stats snapshot;
+    bool use_snapshot;
     /** Used by net_ingress to determine whether packets should be passed or
      * dropped */
     value threshold_value;
@@ -72,6 +80,12 @@ protected:
      * This cannot be the same as threshold_value, since that breaks the dataflow
      * optimization. */
     value threshold_cache;
+    /** Mark custom ring values for batching (see coalesce.hpp) */
+    bool coalesce;
+    hls::stream<bool> coalesce_values;
+    bool coalesce_cache;
+    /** Record credits granted by the host, applied by net_ingress */
+    hls::stream<ap_uint<32> > record_credit_values;
     flow_to_ring ring_map;
     hls_ik::ring_id_t ring_id;
     hls_ik::metadata meta;
@@ -57,6 +57,9 @@ int flow_to_ring::read(int address, int *value)
         return GW_FAIL;
     }
         
+    if (gateway_dumping())
+        return GW_FAIL;
+
     if (!gateway_query(address))
         return GW_BUSY;
 
@@ -64,6 +67,37 @@ int flow_to_ring::read(int address, int *value)
     return GW_DONE;
 }
 
+int flow_to_ring::dump(int first)
+{
+    if (first < 0) {
+        if (!gateway_dump(0, 0))
+            return GW_BUSY;
+        return GW_DONE;
+    }
+
+    if (first >= FLOW_TABLE_SIZE || gateway_dumping())
+        return GW_FAIL;
+
+    if (!gateway_dump(first, FLOW_TABLE_SIZE - first))
+        return GW_BUSY;
+
+    return GW_DONE;
+}
+
+int flow_to_ring::next(int *value)
+{
+    if (!gateway_dumping()) {
+        *value = 0xffffffff;
+        return GW_FAIL;
+    }
+
+    if (!gateway_next())
+        return GW_BUSY;
+
+    *value = gateway_context;
+    return GW_DONE;
+}
+
 void threshold::net_ingress(hls_ik::pipeline_ports& p, credit_update_registers& host_credit_regs)
 {
 #pragma HLS pipeline enable_flush ii=1
@@ -72,10 +106,18 @@ void threshold::net_ingress(hls_ik::pipeline_ports& p, credit_update_registers&
     update(host_credit_regs);
     if (!threshold_values.empty())
         threshold_value = threshold_values.read();
+    if (!coalesce_values.empty())
+        coalesce = coalesce_values.read();
+    if (!record_credit_values.empty()) {
+        const ap_uint<32> grant = record_credit_values.read();
+        grant_record_credits(grant(15, 0), grant(31, 16));
+    }
     ring_map.update();
 
     switch (state) {
     case METADATA:
+        if (bulk_read_send(p))
+            return;
         if (p.metadata_input.empty())
             return;
 
@@ -89,9 +131,9 @@ void threshold::net_ingress(hls_ik::pipeline_ports& p, credit_update_registers&
             return;
 
         d = p.data_input.read();
-        value v = d.data(255-14*8, 256 - value::width-14*8);
+        value v = d.data(d.data.width - 1 - 14*8, d.data.width - value::width-14*8);
         const bool backpressure = !can_transmit(meta.ikernel_id, ring_id, 4, HOST);
-//        std::cout << "value: " << d.data(255-14*8, 256 - value::width-14*8) << "\n";
+//        std::cout << "value: " << d.data(d.data.width - 1 - 14*8, d.data.width - value::width-14*8) << "\n";
         values_to_stats.write(std::make_tuple(v, backpressure));
 
         drop = v < threshold_value || backpressure;
@@ -101,11 +143,12 @@ void threshold::net_ingress(hls_ik::pipeline_ports& p, credit_update_registers&
                 meta.ring_id = ring_id;
                 custom_ring_metadata cr;
                 cr.end_of_message = 1;
+                cr.coalesce = coalesce;
                 meta.var = cr;
                 meta.length = 4;
                 meta.verify();
-                d.data(255, 256 - value::width) = v;
-                d.keep = 0xf0000000;
+                d.data(d.data.width - 1, d.data.width - value::width) = v;
+                d.keep = axi_data::keep_bytes(value::width / 8);
                 d.last = 1;
             }
             p.metadata_output.write(meta);
@@ -168,6 +211,23 @@ int threshold::reg_write(int address, int value)
         threshold_values.write(value);
         threshold_cache = value;
         break;
+    case THRESHOLD_COALESCE:
+        coalesce_values.write(value);
+        coalesce_cache = value;
+        break;
+    case THRESHOLD_RECORD_CREDITS:
+        if (record_credit_values.full())
+            return GW_BUSY;
+        record_credit_values.write(value);
+        break;
+    case THRESHOLD_RING_DUMP:
+        return ring_map.dump(value);
+    case THRESHOLD_SNAPSHOT:
+        /* gateway_update runs in the same process, so the copy is
+         * consistent */
+        snapshot = stats;
+        use_snapshot = value != 0;
+        break;
     default:
         return -1;
     }
@@ -181,32 +241,42 @@ int threshold::reg_read(int address, int* value)
         return ring_map.read(address - THRESHOLD_RING_ID, value);
 
 /* Ignore dependency since these are statistics and we don't really care if they
- * are exactly up-to-date. */
+ * are exactly up-to-date. The host can use THRESHOLD_SNAPSHOT for a consistent
+ * view. */
+    const threshold_stats s = use_snapshot ? snapshot : stats;
     switch (address) {
+    case THRESHOLD_SNAPSHOT:
+        *value = use_snapshot;
+        break;
     case THRESHOLD_MIN:
-        *value = stats.min;
+        *value = s.min;
         break;
     case THRESHOLD_MAX:
-        *value = stats.max;
+        *value = s.max;
         break;
     case THRESHOLD_COUNT:
-        *value = stats.count;
+        *value = s.count;
         break;
     case THRESHOLD_SUM_LO:
-        *value = stats.sum(31, 0);
+        *value = s.sum(31, 0);
         break;
     case THRESHOLD_SUM_HI:
-        *value = stats.sum(63, 32);
+        *value = s.sum(63, 32);
         break;
     case THRESHOLD_VALUE:
         *value = threshold_cache;
         break;
     case THRESHOLD_DROPPED:
-        *value = stats.dropped;
+        *value = s.dropped;
         break;
     case THRESHOLD_DROPPED_BACKPRESSURE:
-        *value = stats.dropped_backpressure;
+        *value = s.dropped_backpressure;
+        break;
+    case THRESHOLD_COALESCE:
+        *value = coalesce_cache;
         break;
+    case THRESHOLD_RING_DUMP:
+        return ring_map.next(value);
     default:
         *value = -1;
         return -1;
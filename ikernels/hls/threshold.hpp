@@ -29,14 +29,27 @@
 // 2b49fec3-d30c-464d-a6a1-171f9e4443f1
 #define THRESHOLD_UUID { 0x2b, 0x49, 0xfe, 0xc3, 0xd3, 0x0c, 0x46, 0x4d, 0xa6, 0xa1, 0x17, 0x1f, 0x9e, 0x44, 0x43, 0xf1 }
 
+/* Write a non-zero value to latch all the statistics below at once; reads
+ * then return the latched values until the next write. Write zero to read
+ * the live counters again. */
+#define THRESHOLD_SNAPSHOT 0x0c
 #define THRESHOLD_MIN 0x10
 #define THRESHOLD_MAX 0x14
 #define THRESHOLD_COUNT 0x18
 #define THRESHOLD_SUM_LO 0x1c
 #define THRESHOLD_SUM_HI 0x20
 #define THRESHOLD_VALUE 0x24
+/* Write (records << 16 | ring ID) with the number of records the host
+ * received on the ring beyond one per message since its credits were reset,
+ * to grant back the credits of coalesced records */
+#define THRESHOLD_RECORD_CREDITS 0x25
 #define THRESHOLD_DROPPED 0x28
 #define THRESHOLD_DROPPED_BACKPRESSURE 0x29
+#define THRESHOLD_COALESCE 0x2a
+/* Write a flow ID to dump the ring IDs of that flow and the ones after it;
+ * each read then returns the next ring ID. Write a negative value to cancel
+ * a dump that was not read to the end. */
+#define THRESHOLD_RING_DUMP 0x2b
 #define THRESHOLD_RING_ID 0x2c
 
 #endif // THRESHOLD_HPP
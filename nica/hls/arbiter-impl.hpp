@@ -31,6 +31,7 @@
 #include "arbiter.hpp"
 #include "maybe.hpp"
 #include "nica-top.hpp"
+#include "stats_snapshot.hpp"
 
 class bucket
 {
@@ -63,7 +64,8 @@ public:
     void charge_tokens(int num_tokens)
     {
         cur_tokens -= num_tokens;
-        assert(cur_tokens >= -(1 << 14)); // pass quota here
+        /* A port may exceed its quota by up to one frame */
+        assert(cur_tokens >= -((1 << 14) + MAX_PACKET_SIZE)); // pass quota here
     }
 };
 
@@ -109,27 +111,31 @@ public:
     /* Accept a variable length list of arbiter_input_stream structs */
     template <typename ...Args>
     void arbiter_step(stream& out, arbiter_stats<num_ports>* s,
+        snapshot_generation snapshot,
         hls_ik::gateway_registers& g, trace_event events[4],
         Args&... args)
     {
 #pragma HLS inline
 #pragma HLS array_partition variable=s->port complete
 #pragma HLS array_partition variable=s->tx_port complete
-        transmit(s, out, events, args...);
-        pick_next_packet(s, g);
+        transmit(s, snapshot, out, events, args...);
+        pick_next_packet(s, snapshot, g);
     }
 
     template <typename ...Args>
     void pick_next_packet(arbiter_stats<num_ports>* s,
+        snapshot_generation snapshot,
         hls_ik::gateway_registers& g)
     {
 #pragma HLS latency max=3
 #pragma HLS array_partition variable=buckets complete
 #pragma HLS inline region
-        arbiter_stats_output:
-        for (int i = 0; i < num_ports; ++i)
+        if (pick_snapshot.latch(snapshot)) {
+            arbiter_stats_output:
+            for (int i = 0; i < num_ports; ++i)
 #pragma HLS unroll
-            s->port[i] = stats.port[i];
+                s->port[i] = stats.port[i];
+        }
 
         hls_ik::gateway_impl<arbiter<num_ports, T> >::gateway(this, g);
 
@@ -182,16 +188,18 @@ public:
     }
 
     template <typename ...Args>
-    void transmit(arbiter_stats<num_ports>* s, stream& out,
-                  trace_event events[4],
+    void transmit(arbiter_stats<num_ports>* s, snapshot_generation snapshot,
+                  stream& out, trace_event events[4],
                   Args&... args)
     {
 #pragma HLS pipeline II=1 enable_flush
 #pragma HLS array_partition variable=stats.tx_port complete
-        for (int i = 0; i < num_ports; ++i)
-            s->tx_port[i] = stats.tx_port[i];
-        s->idle = state == IDLE;
-        s->out_full = stats.out_full;
+        if (transmit_snapshot.latch(snapshot)) {
+            for (int i = 0; i < num_ports; ++i)
+                s->tx_port[i] = stats.tx_port[i];
+            s->idle = state == IDLE;
+            s->out_full = stats.out_full;
+        }
         for (int i = 0; i < 4; ++i)
             events[i] = 0;
 
@@ -221,7 +229,7 @@ public:
                 break;
 
             selected_port = selected_port_stream.read();
-            assert(!selected_port.valid() || selected_port.value() < 3);
+            assert(!selected_port.valid() || selected_port.value() < num_ports);
             if (selected_port.valid()) {
                 // Make sure only 0-2 are accessed
                 switch (selected_port.value()) {
@@ -354,7 +362,7 @@ private:
         tx_mid_packet = true;
         T word = in.read();
         out.write(word);
-        accumulated_charge += 32;
+        accumulated_charge += MLX_AXI4_WIDTH_BYTES;
         /* Reset idle counter */
         idle_counter = idle_timeout;
 
@@ -392,6 +400,7 @@ private:
     maybe<stream_selector> selected_port;
     hls::stream<maybe<stream_selector> > selected_port_stream;
     arbiter_stats<num_ports> stats;
+    stats_snapshot pick_snapshot, transmit_snapshot;
     ap_uint<32> cycle_counter;
     bucket buckets[num_ports];
     /* Number of bytes to charge this port when evicting it */
@@ -34,6 +34,14 @@ struct arbiter_per_port_stats {
     ap_uint<64> not_empty;
     ap_uint<64> no_tokens;
     int cur_tokens;
+
+    template <typename Visitor>
+    void visit(Visitor& v) const
+    {
+        v.counter("not_empty", not_empty);
+        v.counter("no_tokens", no_tokens);
+        v.gauge("cur_tokens", cur_tokens);
+    }
 };
 
 struct arbiter_tx_per_port_stats {
@@ -44,6 +52,15 @@ struct arbiter_tx_per_port_stats {
     ap_uint<64> packets;
     ap_uint<3> last_pkt_id;
     ap_uint<12> last_user;
+
+    template <typename Visitor>
+    void visit(Visitor& v) const
+    {
+        v.counter("words", words);
+        v.counter("packets", packets);
+        v.gauge("last_pkt_id", last_pkt_id);
+        v.gauge("last_user", last_user);
+    }
 };
 
 template <unsigned num_ports>
@@ -54,6 +71,17 @@ struct arbiter_stats {
     arbiter_tx_per_port_stats tx_port[num_ports];
     bool idle;
     ap_uint<64> out_full;
+
+    template <typename Visitor>
+    void visit(Visitor& v) const
+    {
+        for (unsigned i = 0; i < num_ports; ++i)
+            v.nested("port", i, port[i]);
+        for (unsigned i = 0; i < num_ports; ++i)
+            v.nested("tx_port", i, tx_port[i]);
+        v.gauge("idle", idle);
+        v.counter("out_full", out_full);
+    }
 };
 
 #define ARBITER_BUCKET_PERIOD 0x0
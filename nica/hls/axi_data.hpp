@@ -26,27 +26,65 @@
 #pragma once
 
 #include <boost/operators.hpp>
+#include <ap_int.h>
+#include <hls_stream.h>
+#include "hls_helper.h"
+
+/* Width in bits of the data path between the NIC ports, the UDP pipeline and
+ * the ikernels. Supported values are 256 and 512. */
+#ifndef NICA_DATA_WIDTH
+#define NICA_DATA_WIDTH 256
+#endif
+
+/* Largest Ethernet frame (without the FCS) the data path carries, in bytes.
+ * Values above 1520 enable jumbo frames, up to 9216 bytes. */
+#ifndef NICA_MAX_FRAME_SIZE
+#define NICA_MAX_FRAME_SIZE 1520
+#endif
 
 namespace hls_ik {
 
-    struct axi_data : public boost::equality_comparable<axi_data> {
-        ap_uint<256> data;
-        ap_uint<32> keep;
+    template <unsigned data_width>
+    struct axi_data_t : public boost::equality_comparable<axi_data_t<data_width> > {
+        static_assert(data_width == 256 || data_width == 512,
+                      "unsupported data path width");
+
+        static const int data_bytes = data_width / 8;
+        typedef ap_uint<data_width> data_t;
+        typedef ap_uint<data_bytes> keep_t;
+        /** Number of valid bytes in a word (0 to data_bytes) */
+        typedef ap_uint<hls_helpers::log2(data_bytes) + 1> bytes_t;
+
+        data_t data;
+        keep_t keep;
         ap_uint<1> last;
 
-        axi_data() {}
-        axi_data(const ap_uint<256>& data, const ap_uint<32>& keep, bool last) :
+        axi_data_t() {}
+        axi_data_t(const data_t& data, const keep_t& keep, bool last) :
             data(data), keep(keep), last(last) {}
 
-        static ap_uint<32> keep_bytes(const ap_uint<6>& valid_bytes)
+        static keep_t keep_bytes(const bytes_t& valid_bytes)
+        {
+            const keep_t all = ~keep_t(0);
+            return valid_bytes >= data_bytes ? all : keep_t(~(all >> valid_bytes));
+        }
+
+        /** Number of valid bytes, assuming the keep bits are contiguous
+         * from the most significant bit. */
+        bytes_t num_valid_bytes() const
         {
-            return 0xffffffff ^ ((1 << (32 - valid_bytes)) - 1);
+            bytes_t count = 0;
+            for (int byte = 0; byte < data_bytes; ++byte) {
+#pragma HLS unroll
+                count += keep[byte];
+            }
+            return count;
         }
 
-        void set_data(const char *d, const ap_uint<6>& valid_bytes)
+        void set_data(const char *d, const bytes_t& valid_bytes)
         {
             keep = keep_bytes(valid_bytes);
-            for (int byte = 0; byte < 32; ++byte) {
+            for (int byte = 0; byte < data_bytes; ++byte) {
 #pragma HLS unroll
                 const char data_word = (byte < valid_bytes) ? d[byte] : 0;
                 data(data.width - 1 - 8 * byte, data.width - 8 - 8 * byte) = data_word;
@@ -55,32 +93,35 @@ namespace hls_ik {
 
         int get_data(char *d) const
         {
-            for (int byte = 0; byte < 32; ++byte) {
+            for (int byte = 0; byte < data_bytes; ++byte) {
 #pragma HLS unroll
                 const uint8_t cur = data(data.width - 1 - 8 * byte, data.width - 8 - 8 * byte);
-                if (keep[31 - byte])
+                if (keep[data_bytes - 1 - byte])
                     d[byte] = cur;
                 else
                     return byte;
             }
 
-            return 32;
+            return data_bytes;
         }
 
-        bool operator ==(const axi_data& other) const { return data == other.data && keep == other.keep && last == other.last; }
+        bool operator ==(const axi_data_t& other) const { return data == other.data && keep == other.keep && last == other.last; }
 
-        static const int width = 256 + 32 + 1;
+        static const int width = data_width + data_bytes + 1;
 
-        axi_data(const ap_uint<width> d) :
-            data(d(288, 33)),
-            keep(d(32, 1)),
+        axi_data_t(const ap_uint<width> d) :
+            data(d(width - 1, data_bytes + 1)),
+            keep(d(data_bytes, 1)),
             last(d(0, 0))
         {}
 
         operator ap_uint<width>() {
             return (data, keep, last);
         }
+
+        typedef hls::stream<ap_uint<width> > stream;
     };
 
-    typedef hls::stream<ap_uint<axi_data::width> > data_stream;
+    typedef axi_data_t<NICA_DATA_WIDTH> axi_data;
+    typedef axi_data::stream data_stream;
 }
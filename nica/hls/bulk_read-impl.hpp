@@ -0,0 +1,211 @@
+/* * Copyright (c) 2016-2018 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "bulk_read.hpp"
+#include "ikernel.hpp"
+
+namespace hls_ik {
+    struct bulk_read_descriptor
+    {
+        ring_id_t ring;
+        ap_uint<16> count;
+    };
+
+    /* A gateway that can also stream a range of registers back to the host
+     * over a custom ring, instead of one gateway round trip per register.
+     *
+     * The gateway reads one register per call whenever the host is not
+     * accessing it, and the ikernel sends the values from its pipeline by
+     * calling bulk_read_send() between packets. Each bulk read is a single
+     * custom ring message, sent once the ring has a host credit for it, so
+     * the derived class must also be an ikernel that calls update(). */
+    template <typename derived>
+    class bulk_read_gateway_impl : public gateway_impl<derived> {
+    public:
+        bulk_read_gateway_impl() :
+            bulk_ring(0), bulk_address(0), bulk_stride(1), read_address(0),
+            read_stride(0), bulk_left(0),
+            send_state(SEND_IDLE)
+        {}
+
+        static void gateway(derived* instance, hls_ik::gateway_registers& r) {
+#pragma HLS pipeline enable_flush ii=1
+        _PragmaSyn("HLS data_pack variable=r.cmd")
+            /* A new bulk read waits for the previous one to be read out */
+            const bool wait_bulk_read = r.cmd.write &&
+                r.cmd.addr == GW_BULK_READ_COUNT && instance->bulk_left;
+
+            if (r.cmd.go && !instance->axilite_gateway_done && !wait_bulk_read) {
+                int res;
+                if (r.cmd.write) {
+                    if (r.cmd.addr >= GW_BULK_READ_RING)
+                        res = instance->bulk_read_write(r.cmd.addr, r.data);
+                    else
+                        res = instance->reg_write(r.cmd.addr, r.data);
+                } else {
+                    res = instance->reg_read(r.cmd.addr, &r.data);
+                }
+                if (res != GW_BUSY) {
+                    instance->axilite_gateway_done = true;
+                    r.done = 1;
+                }
+            } else if (!r.cmd.go && instance->axilite_gateway_done) {
+                instance->axilite_gateway_done = false;
+                r.done = 0;
+            } else if (instance->bulk_left && !instance->bulk_values.full()) {
+                int value;
+                if (instance->reg_read(instance->read_address, &value) != GW_BUSY) {
+                    instance->bulk_values.write(value);
+                    instance->read_address += instance->read_stride;
+                    --instance->bulk_left;
+                }
+            }
+            instance->gateway_update();
+        }
+
+    protected:
+        /* Call from the ikernel's pipeline when it is between packets.
+         * Returns true while a bulk read message is being sent, and the
+         * pipeline must not output anything else. */
+        bool bulk_read_send(pipeline_ports& p)
+        {
+#pragma HLS inline
+            const int values_per_word = axi_data::data_bytes / 4;
+
+            switch (send_state) {
+            case SEND_IDLE:
+                if (bulk_descriptors.empty())
+                    return false;
+
+                send_desc = bulk_descriptors.read();
+                send_state = SEND_CREDITS;
+                /* Fall through */
+
+            case SEND_CREDITS: {
+                /* Let packets through while waiting for the host */
+                ikernel& ik = *static_cast<derived*>(this);
+                if (!ik.can_transmit(0, send_desc.ring, 0, HOST))
+                    return false;
+
+                ik.new_message(send_desc.ring, HOST);
+                send_state = SEND_HEADER;
+                goto send_header;
+            }
+
+            case SEND_HEADER: {
+send_header:
+                send_packet_left = send_desc.count < GW_BULK_READ_PACKET_VALUES ?
+                    int(send_desc.count) : int(GW_BULK_READ_PACKET_VALUES);
+
+                metadata m;
+                m.ring_id = send_desc.ring;
+                m.length = send_packet_left * 4;
+                custom_ring_metadata cr;
+                cr.end_of_message = send_desc.count == send_packet_left;
+                m.set_custom_ring_metadata(cr);
+                p.action.write(GENERATE);
+                p.metadata_output.write(m);
+
+                send_word = 0;
+                send_offset = 0;
+                send_state = SEND_DATA;
+                return true;
+            }
+
+            case SEND_DATA:
+                if (bulk_values.empty())
+                    return true;
+
+                send_word(send_word.width - 1 - 32 * send_offset,
+                          send_word.width - 32 * (send_offset + 1)) = bulk_values.read();
+                ++send_offset;
+                --send_packet_left;
+                --send_desc.count;
+                if (send_offset == values_per_word || !send_packet_left) {
+                    p.data_output.write(axi_data(send_word,
+                        axi_data::keep_bytes(send_offset * 4), !send_packet_left));
+                    send_word = 0;
+                    send_offset = 0;
+                    if (!send_packet_left)
+                        send_state = send_desc.count ? SEND_HEADER : SEND_IDLE;
+                }
+                return true;
+            }
+            return true;
+        }
+
+    private:
+        int bulk_read_write(int address, int value)
+        {
+#pragma HLS inline
+            switch (address) {
+            case GW_BULK_READ_RING:
+                bulk_ring = value;
+                return GW_DONE;
+            case GW_BULK_READ_ADDRESS:
+                bulk_address = value;
+                return GW_DONE;
+            case GW_BULK_READ_STRIDE:
+                bulk_stride = value;
+                return GW_DONE;
+            case GW_BULK_READ_COUNT: {
+                if (value <= 0 || value > GW_BULK_READ_MAX_COUNT || bulk_ring == 0)
+                    return GW_FAIL;
+                if (bulk_descriptors.full())
+                    return GW_BUSY;
+
+                bulk_read_descriptor desc = { bulk_ring, ap_uint<16>(value) };
+                bulk_descriptors.write(desc);
+                read_address = bulk_address;
+                read_stride = bulk_stride;
+                bulk_left = value;
+                return GW_DONE;
+            }
+            default:
+                return GW_FAIL;
+            }
+        }
+
+        /* Gateway side: settings for the next bulk read */
+        ring_id_t bulk_ring;
+        int bulk_address;
+        int bulk_stride;
+        /* The bulk read in progress */
+        int read_address;
+        int read_stride;
+        ap_uint<16> bulk_left;
+
+        hls::stream<bulk_read_descriptor> bulk_descriptors;
+        hls::stream<int> bulk_values;
+
+        /* Pipeline side */
+        enum { SEND_IDLE, SEND_CREDITS, SEND_HEADER, SEND_DATA } send_state;
+        bulk_read_descriptor send_desc;
+        int send_packet_left;
+        axi_data::data_t send_word;
+        ap_uint<8> send_offset;
+    };
+}
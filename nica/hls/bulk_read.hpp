@@ -0,0 +1,45 @@
+/* * Copyright (c) 2016-2018 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+/* Reserved gateway addresses for bulk reads (see bulk_read-impl.hpp).
+ *
+ * The host sets the custom ring, the first register address and the stride
+ * between addresses (zero to read the same register repeatedly, e.g. to
+ * drain a table). Writing the number of registers to GW_BULK_READ_COUNT
+ * starts the read. The values return as a single custom ring message, 32
+ * bits each in network byte order, split into packets of up to
+ * GW_BULK_READ_PACKET_VALUES values. Registers that fail to read return -1.
+ * The message is sent once the ring has a host credit, and lands in a single
+ * posted receive buffer large enough for all the values. */
+enum {
+    GW_BULK_READ_RING = 0x3ffffff0,
+    GW_BULK_READ_ADDRESS = 0x3ffffff1,
+    GW_BULK_READ_STRIDE = 0x3ffffff2,
+    GW_BULK_READ_COUNT = 0x3ffffff3,
+
+    GW_BULK_READ_PACKET_VALUES = 256,
+    GW_BULK_READ_MAX_COUNT = 0xffff,
+};
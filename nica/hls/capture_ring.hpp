@@ -0,0 +1,49 @@
+/* * Copyright (c) 2016-2018 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+/* Number of sampled headers the capture ring can hold. Samples arriving
+ * while the ring is full, or lost while the ring was busy, are counted in
+ * CAPTURE_DROPPED and discarded. */
+#define CAPTURE_RING_SIZE 64
+
+/* Number of 32-bit words in a captured header (Ethernet, IPv4 and UDP). */
+#define CAPTURE_WORDS 11
+
+enum {
+    /* Sample one of every N packets. Zero disables sampling; packets
+     * matching a flow table entry with FT_RESULT_CAPTURE are always
+     * captured. */
+    CAPTURE_SAMPLE_RATE = 0x0,
+    /* Number of headers waiting in the ring (read-only) */
+    CAPTURE_COUNT = 0x1,
+    /* Number of samples lost because the ring was full or busy (read-only) */
+    CAPTURE_DROPPED = 0x2,
+    /* Write any value to release the oldest header in the ring */
+    CAPTURE_POP = 0x3,
+
+    /* Words of the oldest header in the ring, in network order */
+    CAPTURE_DATA_BASE = 0x10,
+};
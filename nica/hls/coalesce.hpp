@@ -0,0 +1,228 @@
+/* * Copyright (c) 2016-2017 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include "udp.h"
+#include "custom_rx_ring.hpp"
+
+struct coalesce_config
+{
+    /* Maximal batch size in bytes, including the batch header. Zero
+     * disables coalescing. */
+    ap_uint<16> max_bytes;
+    /* Number of cycles a batch may wait for more records */
+    ap_uint<32> timeout;
+
+    /* Coalescing is enabled by default, so that an ikernel marking its
+     * messages for coalescing works without configuring the custom ring */
+    coalesce_config() : max_bytes(COALESCE_MAX_BYTES), timeout(COALESCE_DEFAULT_TIMEOUT) {}
+};
+
+/** Packs small custom ring messages into batched messages.
+ *
+ * A record is a single-word custom ring message with both the end-of-message
+ * and the coalesce bits set. Consecutive records of the same ring and length
+ * are appended to a batch, which is sent as a single generated message once
+ * it is full, when its timeout expires, or when any other message arrives.
+ * The original packets of the records are dropped. Batches begin with a
+ * COALESCE_HEADER_BYTES header. Other packets pass through unchanged. */
+class coalesce
+{
+public:
+    typedef hls_ik::axi_data axi;
+    typedef axi::data_t data_t;
+
+    coalesce() : state(IDLE) {}
+
+    void step(hls::stream<coalesce_config>& config_updates,
+              udp::udp_builder_metadata_stream& hdr_in, hls_ik::data_stream& data_in,
+              udp::udp_builder_metadata_stream& hdr_out, hls_ik::data_stream& data_out)
+    {
+#pragma HLS pipeline enable_flush ii=1
+        if (!config_updates.empty())
+            config = config_updates.read();
+
+        switch (state) {
+        case IDLE:
+            if (hdr_in.empty())
+                return;
+
+            cur = hdr_in.read();
+            state = HEADER;
+            /* Fall through */
+        case HEADER:
+            if (hdr_out.full())
+                return;
+
+            if (is_record(cur)) {
+                batch = cur;
+                batch.mlx = mlx::metadata();
+                batch.generated = true;
+                count = 0;
+                offset = COALESCE_HEADER_BYTES;
+                partial = 0;
+                timer = 0;
+                hdr_out.write(drop_original(cur));
+                state = RECORD;
+            } else {
+                hdr_out.write(cur);
+                state = !cur.mlx.get_drop() && !cur.ik.empty_packet() ? PASS : IDLE;
+            }
+            break;
+
+        case PASS: {
+            if (data_in.empty() || data_out.full())
+                return;
+
+            axi flit = data_in.read();
+            data_out.write(flit);
+            if (flit.last)
+                state = IDLE;
+            break;
+        }
+        case RECORD: {
+            if (data_in.empty())
+                return;
+
+            axi flit = data_in.read();
+            assert(flit.last);
+            append(flit.data);
+            state = offset + batch.ik.length > config.max_bytes ? FLUSH_HEADER : BATCH;
+            pending = false;
+            break;
+        }
+        case BATCH:
+            if (timer >= config.timeout) {
+                pending = false;
+                state = FLUSH_HEADER;
+                goto flush_header;
+            }
+            ++timer;
+
+            if (hdr_in.empty() || hdr_out.full())
+                return;
+
+            cur = hdr_in.read();
+            if (is_record(cur) && cur.ik.ring_id == batch.ik.ring_id &&
+                cur.ik.length == batch.ik.length) {
+                hdr_out.write(drop_original(cur));
+                state = RECORD;
+                break;
+            }
+            /* Send the batch before the new message */
+            pending = true;
+            state = FLUSH_HEADER;
+            /* Fall through */
+        case FLUSH_HEADER: {
+flush_header:
+            if (hdr_out.full())
+                return;
+
+            udp::udp_builder_metadata m = batch;
+            hls_ik::custom_ring_metadata cr;
+            cr.end_of_message = 1;
+            m.ik.set_custom_ring_metadata(cr);
+            m.ik.length = offset;
+            hdr_out.write(m);
+            word = 0;
+            state = FLUSH_DATA;
+            break;
+        }
+        case FLUSH_DATA: {
+            if (data_out.full())
+                return;
+
+            data_t data = word == offset / axi::data_bytes ? partial : buffer[word];
+            if (word == 0)
+                data(data.width - 1, data.width - COALESCE_HEADER_BYTES * 8) =
+                    (count, ap_uint<16>(batch.ik.length));
+            const int remaining = offset - word * axi::data_bytes;
+            const bool last = remaining <= axi::data_bytes;
+            data_out.write(axi(data, last ? axi::keep_bytes(remaining) : ~axi::keep_t(0), last));
+            ++word;
+            if (last)
+                state = pending ? HEADER : IDLE;
+            break;
+        }
+        }
+    }
+
+private:
+    enum { buffer_words = COALESCE_MAX_BYTES / axi::data_bytes };
+
+    bool is_record(const udp::udp_builder_metadata& m) const
+    {
+        if (config.max_bytes == 0 || m.mlx.get_drop() || m.ik.ring_id == 0)
+            return false;
+
+        hls_ik::custom_ring_metadata cr = m.ik.get_custom_ring_metadata();
+        return cr.end_of_message && cr.coalesce && !m.ik.empty_packet() &&
+               m.ik.length <= axi::data_bytes &&
+               COALESCE_HEADER_BYTES + m.ik.length <= config.max_bytes;
+    }
+
+    static udp::udp_builder_metadata drop_original(udp::udp_builder_metadata m)
+    {
+        m.mlx.set_drop(true);
+        return m;
+    }
+
+    /** Append a record at the current offset. Complete words are stored in
+     * the buffer, and the last incomplete word is kept in a register. */
+    void append(data_t data)
+    {
+        const ap_uint<16> len = batch.ik.length;
+        const data_t all = ~data_t(0);
+        data &= len >= axi::data_bytes ? all : data_t(~(all >> (len * 8)));
+
+        const int index = offset / axi::data_bytes;
+        const int byte = offset % axi::data_bytes;
+        partial |= data >> (byte * 8);
+        if (byte + len >= axi::data_bytes) {
+            buffer[index] = partial;
+            partial = byte + len > axi::data_bytes ?
+                data_t(data << ((axi::data_bytes - byte) * 8)) : data_t(0);
+        }
+        offset += len;
+        ++count;
+    }
+
+    enum { IDLE, HEADER, PASS, RECORD, BATCH, FLUSH_HEADER, FLUSH_DATA } state;
+    coalesce_config config;
+    /* The header being processed */
+    udp::udp_builder_metadata cur;
+    /* The header of the first record in the batch */
+    udp::udp_builder_metadata batch;
+    /* Batch size in bytes, including the header */
+    ap_uint<16> offset;
+    ap_uint<16> count;
+    ap_uint<32> timer;
+    /* A message arrived that needs to be sent after the batch */
+    bool pending;
+    ap_uint<hls_helpers::log2(buffer_words) + 1> word;
+    data_t partial;
+    data_t buffer[buffer_words];
+};
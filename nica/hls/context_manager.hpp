@@ -26,13 +26,26 @@
 
 #include <tuple>
 
-template <typename context_t, uint8_t log_size>
+/* A table of contexts that the data path accesses directly, while the gateway
+ * writes and reads entries through streams served by update().
+ *
+ * Reads are pipelined: the gateway may request a range of entries with
+ * gateway_dump(), and update() then streams up to max_queries of them ahead
+ * of the gateway, which collects them one by one with gateway_next(). A dump
+ * of zero entries cancels the one in progress. */
+template <typename context_t, uint8_t log_size, size_t max_queries = 16>
 class context_manager {
 public:
     typedef ap_uint<log_size> index_t;
+    /* Number of entries in a dump (up to the whole table) */
+    typedef ap_uint<log_size + 1> count_t;
     static const size_t size = 1 << log_size;
 
-    context_manager() : query_sent(false) {}
+    context_manager() : query_sent(false), dump_pending(0), generation(0),
+        dump_left(0), dump_generation(0)
+    {
+#pragma HLS stream variable=responses depth=max_queries
+    }
 
     bool gateway_set(index_t index)
     {
@@ -45,20 +58,60 @@ public:
     bool gateway_query(index_t index)
     {
         if (!query_sent) {
-            if (queries.full())
+            if (!gateway_dump(index, 1))
                 return false;
-            queries.write(index);
             query_sent = true;
             return false;
         } else {
-            if (responses.empty())
+            if (!gateway_next())
                 return false;
-            gateway_context = responses.read();
             query_sent = false;
             return true;
         }
     }
 
+    /* Request count entries starting at first. Fails if the previous dump
+     * has not been fully collected, unless count is zero, which cancels it. */
+    bool gateway_dump(index_t first, count_t count)
+    {
+        if ((count && dump_pending) || queries.full())
+            return false;
+        if (!count) {
+            if (!dump_pending)
+                return true;
+            /* Entries update() streamed before it sees the cancellation carry
+             * the old generation, and gateway_next() skips them */
+            ++generation;
+            for (size_t i = 0; i < max_queries; ++i) {
+                if (!responses.empty())
+                    responses.read();
+            }
+            query_sent = false;
+        }
+        queries.write(std::make_tuple(first, count, generation));
+        dump_pending = count;
+        return true;
+    }
+
+    /* A dump is in progress, so gateway_query() cannot be used until its
+     * entries have been collected */
+    bool gateway_dumping() const { return dump_pending && !query_sent; }
+
+    /* Collect the next dumped entry into gateway_context */
+    bool gateway_next()
+    {
+        if (!dump_pending || responses.empty())
+            return false;
+        context_t context;
+        ap_uint<1> response_generation;
+        std::tie(context, response_generation) = responses.read();
+        if (response_generation != generation)
+            return false;
+        gateway_context = context;
+        --dump_pending;
+        return true;
+    }
+
     context_t& operator[](index_t index)
     {
         return contexts[index];
@@ -69,6 +122,13 @@ public:
         return contexts[index];
     }
 
+    /* update() has a gateway update to apply or a dumped entry to send */
+    bool update_pending() const
+    {
+        return !updates.empty() || !queries.empty() || (dump_left && !responses.full());
+    }
+
+    /* Apply one gateway update and read one dumped entry */
     void update()
     {
         if (!updates.empty()) {
@@ -78,18 +138,36 @@ public:
             std::tie(index, context) =  updates.read();
             contexts[index] = context;
         }
-        if (!queries.empty() && !responses.full()) {
-            index_t index = queries.read();
-            responses.write(contexts[index]);
-        }
+
+        /* The gateway only requests a new dump once the previous one has
+         * been collected or cancelled, so it replaces what is left of it */
+        if (!queries.empty())
+            std::tie(dump_index, dump_left, dump_generation) = queries.read();
+
+        if (!dump_left || responses.full())
+            return;
+
+        responses.write(std::make_tuple(contexts[dump_index], dump_generation));
+        ++dump_index;
+        --dump_left;
     }
 
     context_t gateway_context;
-private:
+protected:
     context_t contexts[size];
+private:
+    /* Gateway side */
     bool query_sent;
+    count_t dump_pending;
+    /* Incremented on every cancelled dump */
+    ap_uint<1> generation;
+
+    /* update() side */
+    index_t dump_index;
+    count_t dump_left;
+    ap_uint<1> dump_generation;
 
     hls::stream<std::tuple<index_t, context_t> > updates;
-    hls::stream<index_t> queries;
-    hls::stream<context_t> responses;
+    hls::stream<std::tuple<index_t, count_t, ap_uint<1> > > queries;
+    hls::stream<std::tuple<context_t, ap_uint<1> > > responses;
 };
@@ -0,0 +1,88 @@
+/* * Copyright (c) 2016-2018 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <ap_int.h>
+
+namespace hls_helpers {
+
+/** CRC-32 as used by Ethernet and the InfiniBand ICRC (reflected polynomial
+ * 0x04c11db7). The functions here operate on the raw CRC state, without the
+ * initial and final inversions, so that the state is linear in its inputs. */
+enum { crc32_poly = 0xedb88320 };
+
+/** Update the CRC state with a number of bytes. The first byte is at the
+ * most significant bits of data, as in the data path words. */
+template <unsigned bytes>
+ap_uint<32> crc32_raw(ap_uint<32> crc, const ap_uint<bytes * 8>& data)
+{
+#pragma HLS inline
+    for (int i = bytes - 1; i >= 0; --i) {
+#pragma HLS unroll
+        crc ^= ap_uint<32>(data(i * 8 + 7, i * 8));
+        for (int bit = 0; bit < 8; ++bit) {
+#pragma HLS unroll
+            crc = (crc >> 1) ^ (crc[0] ? ap_uint<32>(crc32_poly) : ap_uint<32>(0));
+        }
+    }
+    return crc;
+}
+
+/** Advance the CRC state over n zero bytes, for n < 2 * bit. Applies one
+ * constant matrix per set bit of n, so the logic depth is logarithmic in
+ * the word size. */
+template <unsigned bit>
+struct crc32_zeros {
+    static ap_uint<32> apply(ap_uint<32> crc, unsigned n)
+    {
+#pragma HLS inline
+        if (n & bit)
+            crc = crc32_raw<bit>(crc, 0);
+        return crc32_zeros<bit / 2>::apply(crc, n);
+    }
+};
+
+template <>
+struct crc32_zeros<0> {
+    static ap_uint<32> apply(ap_uint<32> crc, unsigned) { return crc; }
+};
+
+/** Update the CRC state with the first valid_bytes bytes of a data word.
+ *
+ * The data contribution does not depend on the current state, and leading
+ * zero bytes do not change a zero state, so the valid bytes are aligned to
+ * the end of the word and hashed with a zero state. Only the state
+ * contribution (a shift by valid_bytes) is on the word-to-word feedback
+ * path, which allows processing a full word every cycle. */
+template <unsigned bytes>
+ap_uint<32> crc32_word(ap_uint<32> crc, const ap_uint<bytes * 8>& data,
+                       unsigned valid_bytes)
+{
+#pragma HLS inline
+    ap_uint<bytes * 8> aligned = data >> ((bytes - valid_bytes) * 8);
+    return crc32_zeros<bytes>::apply(crc, valid_bytes) ^ crc32_raw<bytes>(0, aligned);
+}
+
+} // namespace
@@ -30,20 +30,45 @@
 #include "push_header.hpp"
 #include "push_suffix.hpp"
 #include "context_manager.hpp"
+#include "crc32.hpp"
+#include "coalesce.hpp"
 
 struct ring_context
 {
     ap_uint<24> dest_qpn;
     ap_uint<24> psn;
+    /* A multi-packet message has started and not yet ended */
+    bool in_message;
+
+    ring_context() : dest_qpn(0), psn(0), in_message(false) {}
+
+    /** Send opcode for the next packet, given its end-of-message bit */
+    ap_uint<8> send_opcode(bool end_of_message) const;
 };
 
-class ring_context_manager : public context_manager<ring_context, 4> {
+/* One context per custom ring, held in block RAM. Ring 0 (the network stack)
+ * has no context, so ring i uses entry i - 1. */
+class ring_context_manager : public context_manager<ring_context, hls_ik::ring_id_t::width> {
 public:
+    ring_context_manager() : last_valid(false) {}
+
     int gateway_write(int address, int value);
     int gateway_read(int address, int* value);
 
-    /* Query QPN and increment PSN */
-    ring_context next_packet(hls_ik::ring_id_t ring_id);
+    /* Apply pending gateway updates and queries. Called only on cycles
+     * without a next_packet lookup, so that the data path has both RAM
+     * ports to itself. */
+    void update();
+
+    /* Query QPN, increment PSN and track the message boundaries. Safe to
+     * call on consecutive cycles for the same ring: the last written entry
+     * is forwarded instead of waiting for the RAM write to complete. */
+    ring_context next_packet(hls_ik::ring_id_t ring_id, bool end_of_message);
+
+private:
+    bool last_valid;
+    index_t last_index;
+    ring_context last_context;
 };
 
 struct hdr_to_data
@@ -51,6 +76,17 @@ struct hdr_to_data
     hls_ik::ring_id_t ring_id;
 };
 
+/* Per-packet input to the ICRC calculation */
+struct icrc_descriptor
+{
+    /* A custom ring packet that needs an ICRC */
+    bool enable;
+    /* No data flits follow (only for packets without an ICRC) */
+    bool empty;
+    /* Raw CRC state after the masked LRH, IP and UDP headers */
+    ap_uint<32> crc;
+};
+
 /* Build RoCE UC send packets from ikernel outputs */
 class custom_rx_ring : public hls_ik::gateway_impl<custom_rx_ring>
 {
@@ -72,20 +108,43 @@ public:
 
 private:
     void ring_hdrs(udp::udp_builder_metadata_stream& hdr_in, udp::udp_builder_metadata_stream& hdr_out);
-    hls_ik::axi_data gen_bth(const ring_context& context, ap_uint<16> len);
+    hls_ik::axi_data gen_bth(const ring_context& context, ap_uint<16> len,
+                             bool end_of_message);
+    /** Computes the ICRC of the headers that precede the BTH */
+    static ap_uint<32> icrc_headers(const hls_ik::metadata& m);
+    /** Computes the ICRC over the BTH and payload */
+    void calc_icrc();
+    int update_coalesce();
 
     /* Metadata used for trasmitting to the host */
     hls_ik::packet_metadata metadata, metadata_cache;
     hls::stream<hls_ik::packet_metadata> metadata_updates;
     ring_context_manager contexts;
-    hls_ik::data_stream bth, data_bth_to_icrc;
+    /* Batching configuration, and a copy for the gateway */
+    hls::stream<coalesce_config> coalesce_updates;
+    coalesce_config coalesce_cache;
+    coalesce coalescer;
+    udp::udp_builder_metadata_stream hdr_coalesce_to_ring;
+    hls_ik::data_stream data_coalesce_to_bth;
+    hls_ik::data_stream bth, data_bth_to_icrc, data_icrc_to_suffix;
+    hls::stream<icrc_descriptor> icrc_descriptors;
     hls::stream<ap_uint<32> > icrc;
-    hls::stream<bool> empty_packet, empty_packet_bth, empty_packet_icrc,
-                      enable_stream, enable_bth, enable_icrc;
+    hls::stream<bool> empty_packet_bth, empty_packet_icrc,
+                      enable_bth, enable_icrc;
     push_header<12 * 8> push_bth;
     push_suffix<32> push_icrc;
 
+    /* Cycle counter that reserves a context table slot for the gateway */
+    enum { GATEWAY_SLOT_PERIOD = 16 };
+    ap_uint<hls_helpers::log2(GATEWAY_SLOT_PERIOD)> gateway_slot;
+
     /* Data-path state */
     enum { IDLE, STREAM } state;
     udp::udp_builder_metadata cur_metadata;
+
+    /* ICRC calculation state */
+    enum { ICRC_IDLE, ICRC_DATA } icrc_state;
+    icrc_descriptor cur_icrc;
+    /* The next flit is the first of the packet (holds the BTH) */
+    bool icrc_first;
 };
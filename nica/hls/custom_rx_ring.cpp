@@ -31,10 +31,14 @@ using hls_ik::metadata_stream;
 using hls_ik::data_stream;
 using hls_ik::axi_data;
 
-using hls_helpers::dup;
+using hls_helpers::crc32_raw;
+using hls_helpers::crc32_word;
 
 custom_rx_ring::custom_rx_ring() :
-    icrc("icrc")
+    icrc("icrc"),
+    gateway_slot(0),
+    state(IDLE),
+    icrc_state(ICRC_IDLE)
 {
     metadata.eth_src = 0x1;
     metadata.ip_src = 0x0a000001;
@@ -49,57 +53,135 @@ void custom_rx_ring::custom_ring(udp::udp_builder_metadata_stream& hdr_in, data_
 {
 #pragma HLS inline
     gateway(this, r);
-    ring_hdrs(hdr_in, hdr_out);
-    dup(enable_stream, enable_bth, enable_icrc);
-    dup(empty_packet, empty_packet_bth, empty_packet_icrc);
-    push_bth.reorder(bth, empty_packet_bth, enable_bth, data_in, data_bth_to_icrc);
-    push_icrc.reorder(data_bth_to_icrc, empty_packet_icrc, enable_icrc, icrc, data_out);
+    coalescer.step(coalesce_updates, hdr_in, data_in, hdr_coalesce_to_ring, data_coalesce_to_bth);
+    ring_hdrs(hdr_coalesce_to_ring, hdr_out);
+    push_bth.reorder(bth, empty_packet_bth, enable_bth, data_coalesce_to_bth, data_bth_to_icrc);
+    calc_icrc();
+    push_icrc.reorder(data_icrc_to_suffix, empty_packet_icrc, enable_icrc, icrc, data_out);
 }
 
-hls_ik::axi_data custom_rx_ring::gen_bth(const ring_context& context, ap_uint<16> len)
+hls_ik::axi_data custom_rx_ring::gen_bth(const ring_context& context, ap_uint<16> len,
+                                         bool end_of_message)
 {
     rxe_bth bth = {};
-    bth.opcode = IB_OPCODE_UC_SEND_ONLY;
+    bth.opcode = context.send_opcode(end_of_message);
     bth.pkey = 0xffff;
     bth.qpn = context.dest_qpn;
     bth.apsn = context.psn;
-    const ap_uint<2> pad_count = (-len) & 3;
+    /* Only the last packet of a message may be padded */
+    const ap_uint<2> pad_count = end_of_message ? ap_uint<2>((-len) & 3) : ap_uint<2>(0);
     bth.flags = ap_uint<8>(pad_count) << 4;
 
-    ap_uint<256> data = (ap_uint<8>(bth.opcode), ap_uint<8>(bth.flags),
+    mlx::word data = (ap_uint<8>(bth.opcode), ap_uint<8>(bth.flags),
 		    ap_uint<16>(bth.pkey), ap_uint<8>(0),
 		    ap_uint<24>(bth.qpn),
-		    ap_uint<32>(bth.apsn), ap_uint<(32 - IB_BTH_BYTES) * 8>(0));
+		    ap_uint<32>(bth.apsn), ap_uint<(MLX_AXI4_WIDTH_BYTES - IB_BTH_BYTES) * 8>(0));
     return hls_ik::axi_data(data, hls_ik::axi_data::keep_bytes(IB_BTH_BYTES), true);
 }
 
 void custom_rx_ring::ring_hdrs(udp::udp_builder_metadata_stream& hdr_in, udp::udp_builder_metadata_stream& hdr_out)
 {
-#pragma HLS pipeline enable_flush ii=3
+#pragma HLS pipeline enable_flush ii=1
     if (!metadata_updates.empty())
         metadata = metadata_updates.read();
-    contexts.update();
 
-    if (hdr_in.empty() || hdr_out.full() || bth.full() ||
-        enable_stream.full() || empty_packet.full() || icrc.full())
+    /* Ring creation and queries use the context table on idle cycles. When
+     * they are pending, they also take one of every GATEWAY_SLOT_PERIOD
+     * cycles, so that a busy header path cannot starve them. */
+    if ((++gateway_slot == 0 && contexts.update_pending()) || hdr_in.empty() || hdr_out.full() || bth.full() ||
+        enable_bth.full() || empty_packet_bth.full() || icrc_descriptors.full()) {
+        contexts.update();
         return;
+    }
 
     auto m = hdr_in.read();
     if (!m.mlx.get_drop()) {
-        empty_packet.write(m.ik.empty_packet());
-        enable_stream.write(m.ik.ring_id != 0);
-        if (m.ik.ring_id != 0) {
+        const bool enable = m.ik.ring_id != 0;
+        icrc_descriptor desc = { enable, m.ik.empty_packet(), 0 };
+        empty_packet_bth.write(desc.empty);
+        enable_bth.write(enable);
+        if (enable) {
             // custom ring
+            const bool end_of_message = m.ik.get_custom_ring_metadata().end_of_message;
             m.ik.set_packet_metadata(metadata);
-            bth.write(gen_bth(contexts.next_packet(m.ik.ring_id), m.ik.length));
+            bth.write(gen_bth(contexts.next_packet(m.ik.ring_id, end_of_message),
+                              m.ik.length, end_of_message));
             m.ik.length += IB_BTH_BYTES + 4;
             m.ik.ring_id = 0;
+            desc.crc = icrc_headers(m.ik);
+            /* The BTH is always present, even without payload */
+            desc.empty = false;
         }
-        icrc.write(0); // TODO calc icrc
+        icrc_descriptors.write(desc);
     }
     hdr_out.write(m);
 }
 
+ap_uint<32> custom_rx_ring::icrc_headers(const hls_ik::metadata& m)
+{
+#pragma HLS inline
+    /* Variant fields are masked with ones: the LRH (replaced by 64 bits for
+     * RoCEv2), the IP TOS, TTL and checksum, and the UDP checksum. */
+    udp::header_parser hdr = udp::header_to_mlx::metadata_to_header(m);
+    hdr.ip.tos = 0xff;
+    hdr.ip.ttl = 0xff;
+    hdr.ip.check = 0xffff;
+    hdr.udp.checksum = 0xffff;
+
+    const int bytes = (64 + udp::ip_header::width + udp::udp_header::width) / 8;
+    return crc32_raw<bytes>(~ap_uint<32>(0),
+        (~ap_uint<64>(0), ap_uint<udp::ip_header::width>(hdr.ip),
+         ap_uint<udp::udp_header::width>(hdr.udp)));
+}
+
+void custom_rx_ring::calc_icrc()
+{
+#pragma HLS pipeline enable_flush ii=1
+    switch (icrc_state) {
+    case ICRC_IDLE:
+        if (icrc_descriptors.empty() || enable_icrc.full() ||
+            empty_packet_icrc.full() || icrc.full())
+            return;
+
+        cur_icrc = icrc_descriptors.read();
+        enable_icrc.write(cur_icrc.enable);
+        empty_packet_icrc.write(cur_icrc.empty);
+        if (!cur_icrc.enable)
+            icrc.write(0);
+        if (cur_icrc.empty)
+            return;
+
+        icrc_first = true;
+        icrc_state = ICRC_DATA;
+        /* Fall through */
+    case ICRC_DATA:
+        if (data_bth_to_icrc.empty() || data_icrc_to_suffix.full() || icrc.full())
+            return;
+
+        axi_data flit = data_bth_to_icrc.read();
+        data_icrc_to_suffix.write(flit);
+
+        if (cur_icrc.enable) {
+            mlx::word data = flit.data;
+            /* The BTH reserved byte (resv8a) is masked */
+            if (icrc_first)
+                data(data.width - 33, data.width - 40) = 0xff;
+            cur_icrc.crc = crc32_word<axi_data::data_bytes>(cur_icrc.crc, data,
+                                                            flit.num_valid_bytes());
+            if (flit.last) {
+                /* The ICRC is transmitted in little endian order */
+                const ap_uint<32> crc = ~cur_icrc.crc;
+                icrc.write((ap_uint<8>(crc(7, 0)), ap_uint<8>(crc(15, 8)),
+                            ap_uint<8>(crc(23, 16)), ap_uint<8>(crc(31, 24))));
+            }
+        }
+        icrc_first = false;
+        if (flit.last)
+            icrc_state = ICRC_IDLE;
+        break;
+    }
+}
+
 int custom_rx_ring::reg_read(int address, int* value)
 {
     switch (address) {
@@ -127,6 +209,12 @@ int custom_rx_ring::reg_read(int address, int* value)
     case CR_SRC_UDP:
         *value = metadata_cache.udp_src;
         break;
+    case CR_COALESCE_MAX_BYTES:
+        *value = coalesce_cache.max_bytes;
+        break;
+    case CR_COALESCE_TIMEOUT:
+        *value = coalesce_cache.timeout;
+        break;
     case CR_NUM_CONTEXTS:
         *value = contexts.size;
         break;
@@ -168,8 +256,16 @@ int custom_rx_ring::reg_write(int address, int value)
     case CR_SRC_UDP:
         metadata_cache.udp_src = value;
         break;
+    case CR_COALESCE_MAX_BYTES:
+        coalesce_cache.max_bytes = std::min(value, int(COALESCE_MAX_BYTES));
+        return update_coalesce();
+    case CR_COALESCE_TIMEOUT:
+        coalesce_cache.timeout = value;
+        return update_coalesce();
     case CR_DST_QPN:
     case CR_PSN:
+    case CR_DUMP_CONTEXTS:
+    case CR_NEXT_CONTEXT:
     case CR_WRITE_CONTEXT:
     case CR_READ_CONTEXT:
         return contexts.gateway_write(address, value);
@@ -184,6 +280,15 @@ int custom_rx_ring::reg_write(int address, int value)
     return GW_DONE;
 }
 
+int custom_rx_ring::update_coalesce()
+{
+    if (coalesce_updates.full())
+        return GW_BUSY;
+    coalesce_updates.write(coalesce_cache);
+
+    return GW_DONE;
+}
+
 #if !defined(__SYNTHESIS__)
 void custom_rx_ring::verify()
 {
@@ -201,13 +306,34 @@ int ring_context_manager::gateway_write(int address, int value)
         gateway_context.psn = value;
         return GW_DONE;
     case CR_WRITE_CONTEXT:
+        /* Writing a context aborts any message in progress */
+        gateway_context.in_message = false;
         if (gateway_set(value - 1))
             return GW_DONE;
         return GW_BUSY;
     case CR_READ_CONTEXT:
+        if (gateway_dumping())
+            return GW_FAIL;
         if (gateway_query(value - 1))
             return GW_DONE;
         return GW_BUSY;
+    case CR_DUMP_CONTEXTS:
+        if (value == 0) {
+            if (gateway_dump(0, 0))
+                return GW_DONE;
+            return GW_BUSY;
+        }
+        if (value < 1 || value >= int(size) || gateway_dumping())
+            return GW_FAIL;
+        if (gateway_dump(value - 1, size - value))
+            return GW_DONE;
+        return GW_BUSY;
+    case CR_NEXT_CONTEXT:
+        if (!gateway_dumping())
+            return GW_FAIL;
+        if (gateway_next())
+            return GW_DONE;
+        return GW_BUSY;
     default:
         return GW_FAIL;
     }
@@ -230,9 +356,36 @@ int ring_context_manager::gateway_read(int address, int* value)
     return GW_DONE;
 }
 
-ring_context ring_context_manager::next_packet(hls_ik::ring_id_t ring_id)
+void ring_context_manager::update()
+{
+    /* A gateway write may replace the forwarded entry */
+    last_valid = false;
+    context_manager::update();
+}
+
+ring_context ring_context_manager::next_packet(hls_ik::ring_id_t ring_id,
+                                               bool end_of_message)
 {
-    auto ret = (*this)[ring_id - 1];
-    (*this)[ring_id - 1].psn++;
+#pragma HLS resource variable=contexts core=RAM_2P_BRAM
+#pragma HLS dependence variable=contexts inter false
+    const index_t index = ring_id - 1;
+    ring_context ret = last_valid && last_index == index ? last_context :
+                                                            contexts[index];
+    ring_context next = ret;
+    next.psn++;
+    next.in_message = !end_of_message;
+    contexts[index] = next;
+
+    last_valid = true;
+    last_index = index;
+    last_context = next;
     return ret;
 }
+
+ap_uint<8> ring_context::send_opcode(bool end_of_message) const
+{
+    if (in_message)
+        return end_of_message ? IB_OPCODE_UC_SEND_LAST : IB_OPCODE_UC_SEND_MIDDLE;
+    else
+        return end_of_message ? IB_OPCODE_UC_SEND_ONLY : IB_OPCODE_UC_SEND_FIRST;
+}
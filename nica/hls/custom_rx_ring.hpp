@@ -33,6 +33,9 @@ enum {
     CR_SRC_IP = 0x5,
     CR_DST_UDP = 0x6,
     CR_SRC_UDP = 0x7,
+    /* Batching of small messages (see coalesce.hpp) */
+    CR_COALESCE_MAX_BYTES = 0x8,
+    CR_COALESCE_TIMEOUT = 0x9,
 
     CR_NUM_CONTEXTS = 0xa,
 
@@ -40,6 +43,23 @@ enum {
     CR_DST_QPN = 0x10,
     CR_PSN = 0x11,
 
+    /* Dump the contexts of the given ring and all rings after it: each write
+     * to CR_NEXT_CONTEXT then loads the next one into the per context
+     * settings above. Writing zero cancels a dump that was not read to the
+     * end. */
+    CR_DUMP_CONTEXTS = 0x1c,
+    CR_NEXT_CONTEXT = 0x1d,
     CR_WRITE_CONTEXT = 0x1e,
     CR_READ_CONTEXT = 0x1f,
 };
+
+enum {
+    /* Buffer size for batched messages, and the default batch size */
+    COALESCE_MAX_BYTES = 1024,
+    /* Default number of cycles a batch waits for more records (10 us at
+     * 216.25 MHz) */
+    COALESCE_DEFAULT_TIMEOUT = 2163,
+    /* A batched message begins with the number of records and the length of
+     * each record, 16 bits each in network byte order. */
+    COALESCE_HEADER_BYTES = 4,
+};
@@ -112,6 +112,15 @@ int flow_table::reg_write(int address, int value)
     case FT_RESULT_IKERNEL:
         table[entry].result.ikernel = value;
         break;
+    case FT_RESULT_CHAIN:
+        table[entry].result.chain = value;
+        break;
+    case FT_RESULT_MULTICAST:
+        table[entry].result.multicast = value;
+        break;
+    case FT_RESULT_CAPTURE:
+        table[entry].result.capture = value;
+        break;
     default:
         return -1;
     }
@@ -154,6 +163,15 @@ int flow_table::reg_read(int address, int* value)
     case FT_RESULT_IKERNEL:
         *value = table[entry].result.ikernel;
         break;
+    case FT_RESULT_CHAIN:
+        *value = table[entry].result.chain;
+        break;
+    case FT_RESULT_MULTICAST:
+        *value = table[entry].result.multicast;
+        break;
+    case FT_RESULT_CAPTURE:
+        *value = table[entry].result.capture;
+        break;
     default:
         goto err;
     }
@@ -172,6 +190,9 @@ void flow_table::reset()
     for (int i = 0; i < FLOW_TABLE_SIZE; ++i) {
         table[i].key = flow();
         table[i].result.action = FT_PASSTHROUGH;
+        table[i].result.chain = 0;
+        table[i].result.multicast = 0;
+        table[i].result.capture = false;
     }
 }
 
@@ -41,6 +41,15 @@ enum flow_table_fields {
 #define FT_RESULT_ACTION 8
 #define FT_RESULT_IKERNEL 9
 #define FT_RESULT_IKERNEL_ID 10
+/* Bitmask of additional ikernels the packet visits after FT_RESULT_IKERNEL.
+ * Chained ikernels are visited in ascending index order. */
+#define FT_RESULT_CHAIN 11
+/* Bitmask of ikernels that receive a read-only copy of the packet. Only the
+ * FT_RESULT_IKERNEL ikernel decides what happens to the original packet. */
+#define FT_RESULT_MULTICAST 12
+/* Non-zero to copy the headers of all packets matching the entry into the
+ * capture ring. */
+#define FT_RESULT_CAPTURE 13
 #define FT_STRIDE 0x10
 
 #endif
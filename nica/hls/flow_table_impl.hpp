@@ -61,22 +61,35 @@ struct flow {
 
 std::size_t hash_value(flow const& f);
 
+/** A bit per ikernel, marking the ikernels a packet is chained through. */
+typedef ap_uint<NUM_IKERNELS> ikernel_chain_t;
+
 struct flow_table_value {
     flow_table_action action;
     int ikernel;
     hls_ik::ikernel_id_t ikernel_id;
-
-    explicit flow_table_value(flow_table_action action = FT_PASSTHROUGH, int ikernel = 0, hls_ik::ikernel_id_t ikernel_id = 0) :
-        action(action), ikernel(ikernel), ikernel_id(ikernel_id)
+    /** Ikernels to pass the packet to after the first one (service chain) */
+    ikernel_chain_t chain;
+    /** Ikernels that observe a copy of the packet */
+    ikernel_chain_t multicast;
+    /** Sample all packets of the flow into the capture ring */
+    bool capture;
+
+    explicit flow_table_value(flow_table_action action = FT_PASSTHROUGH, int ikernel = 0, hls_ik::ikernel_id_t ikernel_id = 0,
+                              ikernel_chain_t chain = 0, ikernel_chain_t multicast = 0) :
+        action(action), ikernel(ikernel), ikernel_id(ikernel_id), chain(chain),
+        multicast(multicast), capture(false)
     {}
 };
 
 struct flow_table_result {
     flow_table_value v;
     hls_ik::flow_id_t flow_id;
+    /** A read-only multicast copy of the packet */
+    bool mirrored;
 
     explicit flow_table_result(hls_ik::flow_id_t flow_id = 0, const flow_table_value& v = flow_table_value()) :
-        v(v), flow_id(flow_id)
+        v(v), flow_id(flow_id), mirrored(false)
     {}
 };
 
@@ -99,6 +112,8 @@ public:
     void reset();
 private:
     bool reset_done;
+    static_assert(FLOW_TABLE_SIZE <= (1 << hls_ik::flow_id_t::width),
+                  "flow_id_t must identify every flow table entry");
     match table[FLOW_TABLE_SIZE];
     int fields;
 };
@@ -223,10 +223,9 @@ void memcpy(T *dest, const T *src) {
 
 /* Zero out bytes in the data stream that have their keep bit cleared */
 template <typename axi>
-// TODO instead of 256 get the width from axi::data::width
-ap_uint<256> mask_last_word(axi word)
+typename axi::data_t mask_last_word(axi word)
 {
-    const size_t bits = 256;
+    const size_t bits = axi::data_t::width;
     const size_t bytes = bits / 8;
     ap_uint<8> ret[bytes];
 #pragma HLS array_partition variable=ret complete
@@ -27,9 +27,15 @@
 
 #include <ap_int.h>
 
+/* Width of a custom ring ID. Ring 0 stands for the network stack, leaving
+ * 2^NICA_LOG_NUM_RINGS - 1 custom rings. */
+#ifndef NICA_LOG_NUM_RINGS
+#define NICA_LOG_NUM_RINGS 4
+#endif
+
 namespace hls_ik {
 
-    typedef ap_uint<4> ring_id_t;
+    typedef ap_uint<NICA_LOG_NUM_RINGS> ring_id_t;
     typedef ap_uint<4> ikernel_id_t;
     typedef ap_uint<4> flow_id_t;
 
@@ -37,5 +43,5 @@ namespace hls_ik {
     #define HOST (0)
     #define NET (1)
 
-    typedef ap_uint<11> pkt_len_t;
+    typedef ap_uint<14> pkt_len_t; /* up to 9KB jumbo frames */
 }
@@ -38,12 +38,44 @@ namespace hls_ik {
 
     void ikernel::update(credit_update_registers& regs)
     {
-        if (last_host_credit_regs != regs) {
-            if (regs.reset)
-                host_credits[regs.ring_id - 1].msn = 0;
-            host_credits[regs.ring_id - 1].max_msn = regs.max_msn;
-            last_host_credit_regs = regs;
+        const ap_uint<32> legacy = regs.legacy;
+        if (legacy != last_legacy_credits) {
+            const ring_id_t ring = legacy(ring_id_t::width - 1, 0);
+            /* Ring 0 is not a custom ring */
+            if (ring != 0) {
+                ikernel_ring_context& context = host_credits[ring - 1];
+                if (legacy[ring_id_t::width + msn_t::width]) {
+                    context.msn = 0;
+                    context.record_credits = 0;
+                }
+                context.max_msn = legacy(ring_id_t::width + msn_t::width - 1, ring_id_t::width);
+            }
+            last_legacy_credits = legacy;
         }
+
+        const ring_id_t entry = next_credit_entry;
+        const ap_uint<32> word = regs.rings[entry];
+        if (word != last_credits[entry]) {
+            const credit_update credits(word);
+            ikernel_ring_context& context = host_credits[entry];
+
+            if (credits.reset != context.reset) {
+                context.msn = 0;
+                context.record_credits = 0;
+                context.reset = credits.reset;
+            }
+            context.max_msn = credits.max_msn;
+            last_credits[entry] = word;
+        }
+
+        next_credit_entry = entry == credit_update_registers::num_entries - 1 ?
+            ring_id_t(0) : ring_id_t(entry + 1);
+    }
+
+    void ikernel::grant_record_credits(ring_id_t ring, msn_t records)
+    {
+        if (ring != 0)
+            host_credits[ring - 1].record_credits = records;
     }
 
     void ikernel::new_message(ring_id_t ring, direction_t dir)
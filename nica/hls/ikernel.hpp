@@ -114,21 +114,30 @@ struct packet_metadata : public boost::equality_comparable<packet_metadata> {
 struct custom_ring_metadata : public
 			      boost::equality_comparable<custom_ring_metadata> {
     /* End of message bit. Can be used to create large messages that are
-     * comprised of multiple packets. At the moment must be set to 1. */
+     * comprised of multiple packets: packets with the bit cleared are sent
+     * as the first or middle packets of a RoCE send message, and the message
+     * (and its host completion) ends with the next packet that has it set.
+     * All packets but the last of a message must be of the path MTU size. */
     ap_uint<1> end_of_message;
+    /* The message is a record that may be batched with the following records
+     * of the same ring and length into a single message. Host credits still
+     * count records: the host grants back the records of each batch beyond
+     * the first through grant_record_credits(). */
+    ap_uint<1> coalesce;
 
     bool operator ==(const custom_ring_metadata& o) const {
-        return end_of_message == o.end_of_message;
+        return end_of_message == o.end_of_message && coalesce == o.coalesce;
     }
 
-    static const int width = 1;
+    static const int width = 2;
 
     custom_ring_metadata(const ap_uint<width> d = 0) :
-        end_of_message(d(0, 0))
+        end_of_message(d(0, 0)),
+        coalesce(d(1, 1))
     {}
 
     operator ap_uint<width>() const {
-        return end_of_message;
+        return (coalesce, end_of_message);
     }
 };
 
@@ -263,17 +272,44 @@ struct pipeline_ports {
 
 typedef ap_uint<16> msn_t;
 
-struct credit_update_registers : public boost::equality_comparable<credit_update_registers>
+/* A single ring's entry in the credit page */
+struct credit_update
 {
-    hls_ik::ring_id_t ring_id;
     msn_t max_msn;
+    /* Toggled by the host to restart the ring's message count from zero */
     ap_uint<1> reset;
+
+    credit_update() : max_msn(0), reset(0) {}
+    credit_update(msn_t max_msn, ap_uint<1> reset) :
+        max_msn(max_msn), reset(reset) {}
+    explicit credit_update(ap_uint<32> word) :
+        max_msn(word(15, 0)), reset(word(16, 16)) {}
+    operator ap_uint<32>() const { return (ap_uint<15>(0), reset, max_msn); }
 };
 
-static inline bool operator==(const credit_update_registers& l, const credit_update_registers& r)
+/* Host credit page: one word per custom ring, ring i (i > 0) at entry
+ * i - 1. The entries hold absolute credit limits, so the host may update any
+ * number of rings in one burst, and a newer write to a ring supersedes an
+ * older one that the ikernel has not seen yet.
+ *
+ * The deprecated single-ring register (reset, max_msn, ring_id from the
+ * most significant bits down) is kept for host libraries that predate the
+ * page. A set reset bit restarts the ring's message count. */
+struct credit_update_registers
 {
-    return l.ring_id == r.ring_id && l.max_msn == r.max_msn && l.reset == r.reset;
-}
+    static const int num_entries = (1 << ring_id_t::width) - 1;
+
+    ap_uint<32> rings[num_entries];
+    ap_uint<32> legacy;
+
+    credit_update_registers() : legacy(0)
+    {
+        static_assert(num_entries * 4 <= 0x800,
+                      "credit page does not fit its AXI4-Lite window");
+        for (int i = 0; i < num_entries; ++i)
+            rings[i] = 0;
+    }
+};
 
 struct ports {
     pipeline_ports host, net;
@@ -286,18 +322,32 @@ struct ikernel_ring_context
 {
     msn_t msn;
     msn_t max_msn;
+    /* Last reset toggle seen in the credit page */
+    ap_uint<1> reset;
+    /* Records the host received beyond one per message, as coalesced
+     * records are charged a credit each */
+    msn_t record_credits;
 
     bool can_transmit() const
     {
-        return msn != max_msn;
+        return msn != msn_t(max_msn + record_credits);
     }
 
     void inc_msn() { ++msn; }
 };
 
+template <typename derived> class bulk_read_gateway_impl;
+
 class ikernel {
+    /* Bulk reads are sent over custom rings and use the host credits */
+    template <typename derived> friend class bulk_read_gateway_impl;
+
 public:
-    ikernel() {}
+    ikernel() : next_credit_entry(0), last_legacy_credits(0)
+    {
+        for (int i = 0; i < credit_update_registers::num_entries; ++i)
+            last_credits[i] = 0;
+    }
     virtual ~ikernel() {}
 
     virtual void step(ports& ports) = 0;
@@ -348,12 +398,25 @@ protected:
     void new_message(ring_id_t ring, direction_t dir);
 
     /* Call from the same function that calls can_transmit() in order to
-     * implement the AXI-Lite interface for credit updates. */
+     * implement the AXI-Lite interface for credit updates. Each call applies
+     * one entry of the credit page if the host changed it, sweeping all rings
+     * in turn, and a new value of the deprecated register. */
     void update(credit_update_registers& regs);
 
+    /* Set the number of records the host received on a ring beyond one per
+     * message since the ring's credits were last reset. The count is
+     * absolute, so a newer value supersedes an older one. */
+    void grant_record_credits(ring_id_t ring, msn_t records);
+
 private:
-    ikernel_ring_context host_credits[16]; // TODO magic number
-    credit_update_registers last_host_credit_regs;
+    /* Ring i (i > 0) uses entry i - 1 */
+    ikernel_ring_context host_credits[credit_update_registers::num_entries];
+    /* Credit page entry to apply on the next update() */
+    ring_id_t next_credit_entry;
+    /* Page entries and deprecated register value last applied, so that
+     * neither overrides a newer write to the other */
+    ap_uint<32> last_credits[credit_update_registers::num_entries];
+    ap_uint<32> last_legacy_credits;
 };
 
 void pass_packets(pipeline_ports& p);
@@ -382,14 +445,14 @@ void pass_packets(pipeline_ports& p);
     DO_PRAGMA(HLS interface axis port=__pipeline.data_output) \
     DO_PRAGMA(HLS interface axis port=__pipeline.action)
 
-#define IKERNEL_CREDIT_REGS_PRAGMAS(__credit_regs, __offset) \
-    DO_PRAGMA(HLS data_pack variable=__credit_regs) \
-    DO_PRAGMA_SYN(HLS interface s_axilite port=__credit_regs offset=__offset)
+#define IKERNEL_CREDIT_REGS_PRAGMAS(__credit_regs, __offset, __legacy_offset) \
+    DO_PRAGMA_SYN(HLS interface s_axilite port=__credit_regs.rings offset=__offset) \
+    DO_PRAGMA_SYN(HLS interface s_axilite port=__credit_regs.legacy offset=__legacy_offset)
 
 #define IKERNEL_PORTS_PRAGMAS(__ports) \
     IKERNEL_PIPELINE_PORTS_PRAGMAS(__ports.net) \
     IKERNEL_PIPELINE_PORTS_PRAGMAS(__ports.host) \
-    IKERNEL_CREDIT_REGS_PRAGMAS(__ports.host_credit_regs, 0x1034)
+    IKERNEL_CREDIT_REGS_PRAGMAS(__ports.host_credit_regs, 0x1800, 0x1034)
 
 #define INSTANCE(__class) __class ## _inst
 #define DEFINE_TOP_FUNCTION(__name, __class, __uuid) \
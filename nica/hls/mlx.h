@@ -31,21 +31,44 @@
 #include "hls_helper.h"
 #include "axi_data.hpp"
 
-#define MLX_AXI4_WIDTH_BITS 256
+#define MLX_AXI4_WIDTH_BITS NICA_DATA_WIDTH
 #define MLX_AXI4_WIDTH_BYTES (MLX_AXI4_WIDTH_BITS / 8)
 
-#define MAX_PACKET_SIZE 1520
-#define MAX_PACKET_WORDS 48 // MAX_PACKET_SIZE / MLX_AXI4_WIDTH_BYTES
+#define MAX_PACKET_SIZE NICA_MAX_FRAME_SIZE
+#if MAX_PACKET_SIZE > 9216
+#  error "frames larger than 9216 bytes are not supported"
+#endif
+/* FIFOs are sized for the largest frame the build supports (1520 or 9216
+ * bytes) */
+#if MAX_PACKET_SIZE <= 1520
+#  if MLX_AXI4_WIDTH_BITS == 512
+#    define MAX_PACKET_WORDS 24 // 1520 / MLX_AXI4_WIDTH_BYTES
+#    define FIFO_WORDS 72 // FIFO_PACKETS * MAX_PACKET_WORDS
+#  else
+#    define MAX_PACKET_WORDS 48 // 1520 / MLX_AXI4_WIDTH_BYTES
+#    define FIFO_WORDS 144 // FIFO_PACKETS * MAX_PACKET_WORDS
+#  endif
+#else
+#  if MLX_AXI4_WIDTH_BITS == 512
+#    define MAX_PACKET_WORDS 144 // 9216 / MLX_AXI4_WIDTH_BYTES
+#    define FIFO_WORDS 432 // FIFO_PACKETS * MAX_PACKET_WORDS
+#  else
+#    define MAX_PACKET_WORDS 288 // 9216 / MLX_AXI4_WIDTH_BYTES
+#    define FIFO_WORDS 864 // FIFO_PACKETS * MAX_PACKET_WORDS
+#  endif
+#endif
 #define FIFO_PACKETS 2
-#define FIFO_WORDS 144 // FIFO_PACKETS * MAX_PACKET_WORDS
 
 namespace mlx {
     typedef ap_uint<MLX_AXI4_WIDTH_BITS> word;
+    typedef hls_ik::axi_data::keep_t keep_t;
+    /** Number of bytes in a word */
+    typedef hls_ik::axi_data::bytes_t bytes_t;
     typedef ap_uint<12> user_t;
     typedef ap_uint<3> pkt_id_t;
     struct axi4s {
         word data;
-        ap_uint<MLX_AXI4_WIDTH_BYTES> keep;
+        keep_t keep;
         ap_uint<1> last;
         /**
          * bit 0 - drop
@@ -56,7 +79,7 @@ namespace mlx {
         pkt_id_t id;
 
         axi4s(const word& data = 0,
-              const ap_uint<MLX_AXI4_WIDTH_BYTES>& keep = 0xffffffff,
+              const keep_t& keep = ~keep_t(0),
               const ap_uint<1>& last = 0,
               const user_t& user = 0,
               const pkt_id_t& id = 0) :
@@ -79,20 +102,18 @@ namespace mlx {
 
 #define MLX_TUSER_PRESERVE (~(mlx::USER_DROP | mlx::USER_LOSSY))
 
-    static inline ap_uint<MLX_AXI4_WIDTH_BYTES> last_word_keep_num_bytes_padding(ap_uint<5> padding)
+    static inline keep_t last_word_keep_num_bytes_padding(bytes_t padding)
 	{
-    	return 0xffffffff ^ ((1 << padding) - 1);
+    	return ~keep_t(0) << padding;
 	}
 
     /* 0 means all are valid */
-    static inline ap_uint<MLX_AXI4_WIDTH_BYTES> last_word_keep_num_bytes_valid(ap_uint<5> num_valid)
+    static inline keep_t last_word_keep_num_bytes_valid(bytes_t num_valid)
 	{
-		ap_uint<MLX_AXI4_WIDTH_BYTES> tmp = (1 << num_valid) - 1;
-		/* Reverse the bits */
-		return num_valid ? tmp(0, MLX_AXI4_WIDTH_BYTES - 1) : 0xffffffff;
+		return hls_ik::axi_data::keep_bytes(num_valid ? num_valid : bytes_t(MLX_AXI4_WIDTH_BYTES));
 	}
 
-    static inline axi4s last_word(ap_uint<MLX_AXI4_WIDTH_BITS> data, ap_uint<5> padding)
+    static inline axi4s last_word(ap_uint<MLX_AXI4_WIDTH_BITS> data, bytes_t padding)
     {
         axi4s word;
         word.data = data;
@@ -30,30 +30,121 @@
 
 #define IKERNEL_DELAY 64
 
+/** Packet headers passed to an ikernel, either from the crossbar or from a
+ * previous ikernel in a service chain. */
+struct chain_metadata {
+    hls_ik::metadata ik;
+    mlx::metadata mlx;
+    /** Ikernels the packet still has to visit (including the next one) */
+    ikernel_chain_t chain;
+    /** A read-only multicast copy */
+    bool mirrored;
+};
+
+typedef hls::stream<chain_metadata> chain_metadata_stream;
+
+/** Per-packet data kept aside while the packet is in the ikernel */
+struct ikernel_private {
+    mlx::metadata mlx;
+    /** Ikernels to visit after the current one */
+    ikernel_chain_t chain;
+    /** A read-only multicast copy */
+    bool mirrored;
+};
+
+typedef hls::stream<ikernel_private> ikernel_private_stream;
+
+/** Destination of the data of a packet coming out of an ikernel */
+enum chain_route_dest {
+    ROUTE_BUILDER = 0,
+    ROUTE_CHAIN = 1,
+    ROUTE_DISCARD = 2,
+};
+
+typedef hls::stream<ap_uint<2> > chain_route_stream;
+
 class header_to_metadata_and_private
 {
 public:
     void split_udp_hdr_stream(udp::header_stream& hdr_in, result_stream& ft_results,
-                              hls_ik::metadata_stream& metadata_out,
-                              mlx::metadata_stream& out_private);
+                              chain_metadata_stream& out);
+};
+
+/** Merge two streams of packets going into (or out of) an ikernel wrapper.
+ * Packets from the first stream (coming from earlier ikernels in the chain)
+ * take precedence. */
+class chain_merge {
+public:
+    chain_merge() : state(IDLE) {}
+
+    void merge(chain_metadata_stream& hdr_first, hls_ik::data_stream& data_first,
+               chain_metadata_stream& hdr_second, hls_ik::data_stream& data_second,
+               chain_metadata_stream& hdr_out, hls_ik::data_stream& data_out);
+
+private:
+    enum { IDLE, STREAM_FIRST, STREAM_SECOND } state;
 };
 
+/** Pass packets whose chain contains the current ikernel to it, and let other
+ * packets bypass it. */
+class chain_select {
+public:
+    chain_select() : state(IDLE) {}
+
+    void select(int index, chain_metadata_stream& hdr_in, hls_ik::data_stream& data_in,
+                hls_ik::metadata_stream& metadata_out, ikernel_private_stream& private_out,
+                hls_ik::data_stream& data_out,
+                chain_metadata_stream& bypass_hdr, hls_ik::data_stream& bypass_data);
+
+private:
+    enum { IDLE, STREAM } state;
+    bool bypass;
+};
+
+/** Route the data of packets coming out of an ikernel either to the next
+ * ikernel in the chain or to the UDP builder, or discard it. */
+class chain_route {
+public:
+    chain_route() : state(IDLE) {}
+
+    void route(chain_route_stream& dest_in, hls_ik::data_stream& data_in,
+               hls_ik::data_stream& chain_out, hls_ik::data_stream& data_out);
+
+private:
+    enum { IDLE, STREAM } state;
+    chain_route_dest dest;
+};
+
+/** Joins the ikernel output with the private data kept aside.
+ *
+ * Multicast copies are read-only: only the primary ikernel decides the fate
+ * of the original packet. Copies that are passed to the network stack or
+ * dropped are silently discarded. Custom ring messages and generated packets
+ * from a copy are transmitted as generated packets. */
 class data_and_private_to_udp {
 public:
     void join_ik_data_and_private(
         hls_ik::metadata_stream& metadata_in,
-        mlx::metadata_stream& priv_stream, hls_ik::action_stream& action, hls_ik::metadata_stream& metadata_fifo,
-        udp::udp_builder_metadata_stream& header_out, nica_ikernel_stats& ik_stats);
+        ikernel_private_stream& priv_stream, hls_ik::action_stream& action, hls_ik::metadata_stream& metadata_fifo,
+        udp::udp_builder_metadata_stream& header_out,
+        chain_metadata_stream& chain_out, chain_route_stream& data_route,
+        snapshot_generation snapshot, nica_ikernel_stats& ik_stats);
 
 private:
     enum { ACTION, ACTION_PASS, ACTION_DROP, HEADER } state;
     mlx::metadata priv;
+    /* Ikernels the current packet is chained to */
+    ikernel_chain_t chain;
+    /* Current packet is a multicast copy */
+    bool mirrored;
     hls_ik::action cur_action;
     nica_ikernel_stats stats;
+    stats_snapshot snapshot;
     /* Current packet is from a GENERATE action. Mark it as such. */
     bool generated;
 };
 
+
 /** Necessary logic to duplicate around each ikernel.
  *
  * pipeline points to the member variable in the ports structs of the desired
@@ -63,12 +154,16 @@ class ikernel_wrapper {
 public:
     ikernel_wrapper();
 
-    void wrapper(hls_ik::ports& ik, udp::header_stream& header_udp_to_ikernel,
+    /** index is the ikernel number. chain_in and chain_out connect the
+     * wrapper to the previous and next wrappers for service chaining. */
+    void wrapper(int index, hls_ik::ports& ik, udp::header_stream& header_udp_to_ikernel,
                  result_stream& ft_results,
                  hls_ik::data_stream& data_udp_to_ikernel,
+                 chain_metadata_stream& chain_in, hls_ik::data_stream& chain_data_in,
+                 chain_metadata_stream& chain_out, hls_ik::data_stream& chain_data_out,
                  mlx::stream& builder_to_arbiter,
                  mlx::stream& builder_generated_to_arbiter,
-                 nica_ikernel_stats& ik_stats,
+                 snapshot_generation snapshot, nica_ikernel_stats& ik_stats,
                  hls_ik::gateway_registers& custom_ring_gateway);
 
 #if !defined(__SYNTHESIS__)
@@ -77,13 +172,21 @@ public:
 
 private:
     header_to_metadata_and_private hdr_to_meta;
+    chain_merge input_merge, output_merge;
+    chain_select select;
+    chain_route route;
     hls_helpers::duplicator<1, ap_uint<hls_ik::metadata::width> > metadata_dup;
     data_and_private_to_udp join_data_and_private_to_udp;
     custom_rx_ring custom_ring;
     udp::udp_builder builder;
 
-    mlx::metadata_stream internal_private_stream, internal_ikernel_to_builder;
+    ikernel_private_stream internal_private_stream;
+    mlx::metadata_stream internal_ikernel_to_builder;
     hls_ik::metadata_stream metadata_split_to_dup, metadata_dup_to_join;
+    chain_metadata_stream hdr_split_to_merge, hdr_merge_to_select, hdr_bypass,
+                          hdr_join_to_chain;
+    hls_ik::data_stream data_merge_to_select, data_bypass, data_ikernel_to_chain;
+    chain_route_stream data_route;
     udp::bool_stream generated_ikernel_to_builder;
     udp::udp_builder_metadata_stream hdr_ikernel_to_custom_ring,
                                 hdr_custom_ring_to_builder;
@@ -121,6 +224,10 @@ private:
         builder_generated_to_arbiter ## i;
 #define BOOST_PP_LOCAL_LIMITS (0, NUM_IKERNELS - 1)
 %:include BOOST_PP_LOCAL_ITERATE()
+    /* Service chain links: chain_hdr[i] goes into ikernel i's wrapper, and
+     * chain_hdr[i + 1] goes out of it. */
+    chain_metadata_stream chain_hdr[NUM_IKERNELS + 1];
+    hls_ik::data_stream chain_data[NUM_IKERNELS + 1];
     arbiter<2 * NUM_IKERNELS + 1, mlx::axi4s> arb;
     udp::ethernet_padding ethernet_pad;
 
@@ -35,6 +35,13 @@
 struct nica_ikernel_stats {
     /** A counter per action as defined by the hls_ik::action enum */
     ap_uint<64> actions[3];
+
+    template <typename Visitor>
+    void visit(Visitor& v) const
+    {
+        for (int i = 0; i < 3; ++i)
+            v.counter("actions", i, actions[i]);
+    }
 };
 
 struct nica_pipeline_stats {
@@ -44,11 +51,30 @@ struct nica_pipeline_stats {
     nica_ikernel_stats ik ## i;
 #define BOOST_PP_LOCAL_LIMITS (0, NUM_IKERNELS - 1)
 %:include BOOST_PP_LOCAL_ITERATE()
+
+    template <typename Visitor>
+    void visit(Visitor& v) const
+    {
+        v.nested("udp", udp);
+        v.nested("arbiter", arbiter);
+#define BOOST_PP_LOCAL_MACRO(i) \
+        v.nested("ik" #i, ik ## i);
+#define BOOST_PP_LOCAL_LIMITS (0, NUM_IKERNELS - 1)
+%:include BOOST_PP_LOCAL_ITERATE()
+    }
 };
 
 struct nica_stats {
     nica_pipeline_stats n2h, h2n;
     int flow_table_size;
+
+    template <typename Visitor>
+    void visit(Visitor& v) const
+    {
+        v.nested("n2h", n2h);
+        v.nested("h2n", h2n);
+        v.gauge("flow_table_size", flow_table_size);
+    }
 };
 
 struct nica_config {
@@ -48,11 +48,10 @@ using namespace hls_helpers;
 
 void header_to_metadata_and_private::split_udp_hdr_stream(
     udp::header_stream& hdr_in, result_stream& ft_results,
-    hls_ik::metadata_stream& metadata_out,
-    mlx::metadata_stream& out_private)
+    chain_metadata_stream& out)
 {
 #pragma HLS pipeline enable_flush ii=1
-    if (hdr_in.empty() || ft_results.empty() || metadata_out.full() || out_private.full())
+    if (hdr_in.empty() || ft_results.empty() || out.full())
         return;
 
     auto ft_res = ft_results.read();
@@ -73,26 +72,155 @@ void header_to_metadata_and_private::split_udp_hdr_stream(
     m.length = hdr.udp.length - hdr.udp.width / 8;
     m.ikernel_id = ft_res.v.ikernel_id;
     m.flow_id = ft_res.flow_id;
-    metadata_out.write(m);
 
-    mlx::metadata priv;
-    priv.user = buf.user;
-    priv.id = buf.pkt_id;
-    out_private.write(priv);
+    chain_metadata c;
+    c.ik = m;
+    c.mlx.user = buf.user;
+    c.mlx.id = buf.pkt_id;
+    /* The crossbar sent the packet to this ikernel, so it is the first in the
+     * chain */
+    c.chain = ft_res.v.chain | (ikernel_chain_t(1) << ft_res.v.ikernel);
+    c.mirrored = ft_res.mirrored;
+    out.write(c);
+}
+
+void chain_merge::merge(chain_metadata_stream& hdr_first, hls_ik::data_stream& data_first,
+                        chain_metadata_stream& hdr_second, hls_ik::data_stream& data_second,
+                        chain_metadata_stream& hdr_out, hls_ik::data_stream& data_out)
+{
+#pragma HLS pipeline enable_flush ii=1
+    chain_metadata m;
+    hls_ik::axi_data d;
+
+    switch (state) {
+    case IDLE:
+        if (hdr_out.full())
+            return;
+
+        if (!hdr_first.empty()) {
+            m = hdr_first.read();
+            state = m.ik.empty_packet() ? IDLE : STREAM_FIRST;
+        } else if (!hdr_second.empty()) {
+            m = hdr_second.read();
+            state = m.ik.empty_packet() ? IDLE : STREAM_SECOND;
+        } else {
+            return;
+        }
+        hdr_out.write(m);
+        break;
+
+    case STREAM_FIRST:
+        if (data_first.empty() || data_out.full())
+            return;
+
+        d = data_first.read();
+        data_out.write(d);
+        state = d.last ? IDLE : STREAM_FIRST;
+        break;
+
+    case STREAM_SECOND:
+        if (data_second.empty() || data_out.full())
+            return;
+
+        d = data_second.read();
+        data_out.write(d);
+        state = d.last ? IDLE : STREAM_SECOND;
+        break;
+    }
+}
+
+void chain_select::select(int index, chain_metadata_stream& hdr_in, hls_ik::data_stream& data_in,
+                          hls_ik::metadata_stream& metadata_out, ikernel_private_stream& private_out,
+                          hls_ik::data_stream& data_out,
+                          chain_metadata_stream& bypass_hdr, hls_ik::data_stream& bypass_data)
+{
+#pragma HLS pipeline enable_flush ii=1
+    switch (state) {
+    case IDLE: {
+        if (hdr_in.empty() || metadata_out.full() || private_out.full() ||
+            bypass_hdr.full())
+            return;
+
+        chain_metadata m = hdr_in.read();
+        bypass = !m.chain[index];
+        if (bypass) {
+            bypass_hdr.write(m);
+        } else {
+            ikernel_private priv;
+            priv.mlx = m.mlx;
+            /* Chains only go forward, to ikernels with a higher index */
+            priv.chain = m.chain & (~ikernel_chain_t(0) << (index + 1));
+            priv.mirrored = m.mirrored;
+            metadata_out.write(m.ik);
+            private_out.write(priv);
+        }
+        state = m.ik.empty_packet() ? IDLE : STREAM;
+        break;
+    }
+    case STREAM: {
+        if (data_in.empty() || data_out.full() || bypass_data.full())
+            return;
+
+        hls_ik::axi_data d = data_in.read();
+        if (bypass)
+            bypass_data.write(d);
+        else
+            data_out.write(d);
+        state = d.last ? IDLE : STREAM;
+        break;
+    }
+    }
+}
+
+void chain_route::route(chain_route_stream& dest_in, hls_ik::data_stream& data_in,
+                        hls_ik::data_stream& chain_out, hls_ik::data_stream& data_out)
+{
+#pragma HLS pipeline enable_flush ii=1
+    switch (state) {
+    case IDLE:
+        if (dest_in.empty())
+            return;
+
+        dest = chain_route_dest(int(dest_in.read()));
+        state = STREAM;
+        /* Fall through */
+    case STREAM:
+        if (data_in.empty() || chain_out.full() || data_out.full())
+            return;
+
+        hls_ik::axi_data d = data_in.read();
+        switch (dest) {
+        case ROUTE_BUILDER:
+            data_out.write(d);
+            break;
+        case ROUTE_CHAIN:
+            chain_out.write(d);
+            break;
+        case ROUTE_DISCARD:
+            break;
+        }
+        state = d.last ? IDLE : STREAM;
+        break;
+    }
 }
 
 void data_and_private_to_udp::join_ik_data_and_private(
     hls_ik::metadata_stream& metadata_in,
-    mlx::metadata_stream& priv_stream, hls_ik::action_stream& action, hls_ik::metadata_stream& metadata_fifo,
-    udp::udp_builder_metadata_stream& header_out, nica_ikernel_stats& ik_stats)
+    ikernel_private_stream& priv_stream, hls_ik::action_stream& action, hls_ik::metadata_stream& metadata_fifo,
+    udp::udp_builder_metadata_stream& header_out,
+    chain_metadata_stream& chain_out, chain_route_stream& data_route,
+    snapshot_generation snapshot_gen, nica_ikernel_stats& ik_stats)
 {
 #pragma HLS pipeline enable_flush ii=1
 #pragma HLS array_partition variable=ik_stats.actions complete
 #pragma HLS array_partition variable=stats.actions complete
     hls_ik::metadata m;
     udp::udp_builder_metadata buf;
+    ikernel_private p;
+    chain_route_dest dest;
 
-    ik_stats = stats;
+    if (snapshot.latch(snapshot_gen))
+        ik_stats = stats;
 
     switch (state) {
     case ACTION:
@@ -110,6 +238,8 @@ void data_and_private_to_udp::join_ik_data_and_private(
         case hls_ik::GENERATE:
             priv.user = 0; // TODO pick the right prio
             priv.id = 0;
+            chain = 0;
+            mirrored = false;
             generated = true;
             state = HEADER;
             goto header;
@@ -125,7 +255,10 @@ action_pass:
         if (priv_stream.empty() || metadata_fifo.empty())
             return;
 
-        priv = priv_stream.read();
+        p = priv_stream.read();
+        priv = p.mlx;
+        chain = p.chain;
+        mirrored = p.mirrored;
         metadata_fifo.read();
         state = HEADER;
         goto header;
@@ -136,27 +269,54 @@ action_drop:
             header_out.full())
             return;
 
-        priv = priv_stream.read();
+        p = priv_stream.read();
+        priv = p.mlx;
         m = metadata_fifo.read();
         buf.ik = m;
         buf.mlx = priv;
         buf.mlx.set_drop(true);
         buf.generated = false;
-        header_out.write(buf);
+        /* The original packet is dropped by the primary ikernel */
+        if (!p.mirrored)
+            header_out.write(buf);
         state = ACTION;
         break;
 
     case HEADER:
 header:
-        if (metadata_in.empty() || header_out.full())
+        if (metadata_in.empty() || header_out.full() || chain_out.full() ||
+            data_route.full())
             return;
 
         m = metadata_in.read();
-        buf.ik = m;
-        buf.mlx = priv;
-        buf.mlx.set_drop(false);
-        buf.generated = generated;
-        header_out.write(buf);
+        if (mirrored && m.ring_id == 0) {
+            /* Passing a multicast copy has no effect */
+            dest = ROUTE_DISCARD;
+        } else if (chain != 0 && m.ring_id == 0) {
+            /* Passed packets continue to the next ikernel in their chain.
+             * Custom ring messages always go to the host. */
+            chain_metadata c;
+            c.ik = m;
+            c.mlx = priv;
+            c.chain = chain;
+            c.mirrored = false;
+            chain_out.write(c);
+            dest = ROUTE_CHAIN;
+        } else {
+            buf.ik = m;
+            buf.mlx = priv;
+            buf.mlx.set_drop(false);
+            buf.generated = generated;
+            if (mirrored) {
+                /* The original packet belongs to the primary ikernel */
+                buf.mlx = mlx::metadata();
+                buf.generated = true;
+            }
+            header_out.write(buf);
+            dest = ROUTE_BUILDER;
+        }
+        if (!m.empty_packet())
+            data_route.write(dest);
         state = ACTION;
         break;
     }
@@ -167,6 +327,14 @@ ikernel_wrapper<pipeline>::ikernel_wrapper() :
     internal_private_stream("internal_private_stream"),
     metadata_split_to_dup("metadata_split_to_dup"),
     metadata_dup_to_join("metadata_dup_to_join"),
+    hdr_split_to_merge("hdr_split_to_merge"),
+    hdr_merge_to_select("hdr_merge_to_select"),
+    hdr_bypass("hdr_bypass"),
+    hdr_join_to_chain("hdr_join_to_chain"),
+    data_merge_to_select("data_merge_to_select"),
+    data_bypass("data_bypass"),
+    data_ikernel_to_chain("data_ikernel_to_chain"),
+    data_route("data_route"),
     hdr_custom_ring_to_builder("hdr_custom_ring_to_builder"),
     data_ikernel_to_custom_ring("data_ikernel_to_custom_ring"),
     data_custom_ring_to_builder("data_custom_ring_to_builder")
@@ -174,12 +342,14 @@ ikernel_wrapper<pipeline>::ikernel_wrapper() :
 
 template <hls_ik::pipeline_ports hls_ik::ports::* pipeline>
 void ikernel_wrapper<pipeline>::wrapper(
-    hls_ik::ports& ik, udp::header_stream& header_udp_to_ikernel,
+    int index, hls_ik::ports& ik, udp::header_stream& header_udp_to_ikernel,
     result_stream& ft_results,
     hls_ik::data_stream& data_udp_to_ikernel,
+    chain_metadata_stream& chain_in, hls_ik::data_stream& chain_data_in,
+    chain_metadata_stream& chain_out, hls_ik::data_stream& chain_data_out,
     mlx::stream& builder_to_arbiter,
     mlx::stream& builder_generated_to_arbiter,
-    nica_ikernel_stats& ik_stats,
+    snapshot_generation snapshot, nica_ikernel_stats& ik_stats,
     hls_ik::gateway_registers& custom_ring_gateway) {
 #pragma HLS inline
     /* The internal private stream needs to buffer for the delay of the
@@ -189,19 +359,40 @@ void ikernel_wrapper<pipeline>::wrapper(
     DO_PRAGMA(HLS STREAM variable=metadata_dup_to_join depth=IKERNEL_DELAY);
 
     DO_PRAGMA(HLS STREAM variable=metadata_split_to_dup depth=FIFO_PACKETS);
+    DO_PRAGMA(HLS STREAM variable=hdr_split_to_merge depth=FIFO_PACKETS);
+    DO_PRAGMA(HLS STREAM variable=hdr_merge_to_select depth=FIFO_PACKETS);
+    DO_PRAGMA(HLS STREAM variable=hdr_bypass depth=FIFO_PACKETS);
+    DO_PRAGMA(HLS STREAM variable=hdr_join_to_chain depth=FIFO_PACKETS);
+    DO_PRAGMA(HLS STREAM variable=data_bypass depth=FIFO_WORDS);
+    DO_PRAGMA(HLS STREAM variable=data_ikernel_to_chain depth=FIFO_WORDS);
+    DO_PRAGMA(HLS STREAM variable=data_route depth=FIFO_PACKETS);
 
     DO_PRAGMA(HLS DATA_PACK variable=internal_private_stream);
+    DO_PRAGMA(HLS DATA_PACK variable=hdr_split_to_merge);
+    DO_PRAGMA(HLS DATA_PACK variable=hdr_merge_to_select);
+    DO_PRAGMA(HLS DATA_PACK variable=hdr_bypass);
+    DO_PRAGMA(HLS DATA_PACK variable=hdr_join_to_chain);
 
     hdr_to_meta.split_udp_hdr_stream(header_udp_to_ikernel,
                                      ft_results,
-                                     metadata_split_to_dup,
-                                     internal_private_stream);
-    hls_helpers::link(data_udp_to_ikernel, (ik.*pipeline).data_input);
+                                     hdr_split_to_merge);
+    /* Packets from the crossbar and packets chained from previous ikernels */
+    input_merge.merge(chain_in, chain_data_in,
+                      hdr_split_to_merge, data_udp_to_ikernel,
+                      hdr_merge_to_select, data_merge_to_select);
+    select.select(index, hdr_merge_to_select, data_merge_to_select,
+                  metadata_split_to_dup, internal_private_stream,
+                  (ik.*pipeline).data_input, hdr_bypass, data_bypass);
     metadata_dup.dup2(metadata_split_to_dup, (ik.*pipeline).metadata_input, metadata_dup_to_join);
     join_data_and_private_to_udp.join_ik_data_and_private((ik.*pipeline).metadata_output,
         internal_private_stream, (ik.*pipeline).action, metadata_dup_to_join,
-        hdr_ikernel_to_custom_ring, ik_stats);
-    hls_helpers::link((ik.*pipeline).data_output, data_ikernel_to_custom_ring);
+        hdr_ikernel_to_custom_ring, hdr_join_to_chain, data_route, snapshot, ik_stats);
+    route.route(data_route, (ik.*pipeline).data_output,
+                data_ikernel_to_chain, data_ikernel_to_custom_ring);
+    /* Packets continuing to the following ikernels */
+    output_merge.merge(hdr_bypass, data_bypass,
+                       hdr_join_to_chain, data_ikernel_to_chain,
+                       chain_out, chain_data_out);
     custom_ring.custom_ring(hdr_ikernel_to_custom_ring, data_ikernel_to_custom_ring,
         hdr_custom_ring_to_builder, data_custom_ring_to_builder, custom_ring_gateway);
     builder.builder_step(hdr_custom_ring_to_builder, data_custom_ring_to_builder,
@@ -250,6 +441,11 @@ void nica_state<pipeline>::nica_step(
 #define BOOST_PP_LOCAL_LIMITS (0, NUM_IKERNELS - 1)
 %:include BOOST_PP_LOCAL_ITERATE()
 
+    DO_PRAGMA(HLS DATA_PACK variable=chain_hdr);
+    DO_PRAGMA(HLS DATA_PACK variable=chain_data);
+    DO_PRAGMA(HLS STREAM variable=chain_hdr depth=FIFO_PACKETS);
+    DO_PRAGMA(HLS STREAM variable=chain_data depth=FIFO_WORDS);
+
     DO_PRAGMA(HLS DATA_PACK variable=raw_in_to_udp);
     DO_PRAGMA(HLS DATA_PACK variable=raw_in_to_dropper);
     DO_PRAGMA(HLS DATA_PACK variable=dropper_to_arbiter);
@@ -266,12 +462,14 @@ void nica_state<pipeline>::nica_step(
     dropper.step(raw_in_to_dropper, bool_pass_from_steering, dropper_to_arbiter);
 
 #define BOOST_PP_LOCAL_MACRO(i) \
-    wrapper ## i.wrapper(ik ## i, header_udp_to_ikernel ## i, \
+    wrapper ## i.wrapper(i, ik ## i, header_udp_to_ikernel ## i, \
                            ft_results_to_ik ## i, \
                            data_udp_to_ikernel ## i, \
+                           chain_hdr[i], chain_data[i], \
+                           chain_hdr[i + 1], chain_data[i + 1], \
                            builder_to_arbiter ## i, \
                            builder_generated_to_arbiter ## i, \
-                           s.ik ## i, \
+                           config.stats_snapshot, s.ik ## i, \
                            config.custom_ring_gateway);
 #define BOOST_PP_LOCAL_LIMITS (0, NUM_IKERNELS - 1)
 %:include BOOST_PP_LOCAL_ITERATE()
@@ -279,6 +477,7 @@ void nica_state<pipeline>::nica_step(
     arb.arbiter_step(
         raw_arbiter_to_pad,
         &s.arbiter,
+        config.stats_snapshot,
         config.arbiter_gateway,
         events,
         dropper_to_arbiter
@@ -367,20 +566,20 @@ void nica(mlx::stream& prt_nw2sbu, mlx::stream& sbu2prt_nw, mlx::stream& prt_cx2
 #  pragma HLS INTERFACE ap_ctrl_none port=return
 #  pragma HLS INTERFACE s_axilite port=cfg->n2h.enable offset=0x10
     GATEWAY_OFFSET(cfg->n2h.flow_table_gateway, 0x18, 0x20, 0x30)
-#  pragma HLS INTERFACE s_axilite port=cfg->n2h.capture_next offset=0x40
-#  pragma HLS INTERFACE s_axilite port=cfg->n2h.capture_ack offset=0x48
 // #  pragma HLS INTERFACE s_axilite port=cfg->n2h.lossy offset=0x50
     GATEWAY_OFFSET(cfg->n2h.arbiter_gateway, 0x58, 0x60, 0x70)
     GATEWAY_OFFSET(cfg->n2h.custom_ring_gateway, 0x78, 0x80, 0x90)
+    GATEWAY_OFFSET(cfg->n2h.capture_gateway, 0x98, 0xa0, 0xb0)
+#  pragma HLS INTERFACE s_axilite port=cfg->n2h.stats_snapshot offset=0xc0
 #  pragma HLS INTERFACE s_axilite port=stats->n2h offset=0x100
 
 #  pragma HLS INTERFACE s_axilite port=cfg->h2n.enable offset=0x410
     GATEWAY_OFFSET(cfg->h2n.flow_table_gateway, 0x418, 0x420, 0x430)
-#  pragma HLS INTERFACE s_axilite port=cfg->h2n.capture_next offset=0x440
-#  pragma HLS INTERFACE s_axilite port=cfg->h2n.capture_ack offset=0x448
 // #  pragma HLS INTERFACE s_axilite port=cfg->h2n.lossy offset=0x450
     GATEWAY_OFFSET(cfg->h2n.arbiter_gateway, 0x458, 0x460, 0x470)
     GATEWAY_OFFSET(cfg->h2n.custom_ring_gateway, 0x478, 0x480, 0x490)
+    GATEWAY_OFFSET(cfg->h2n.capture_gateway, 0x498, 0x4a0, 0x4b0)
+#  pragma HLS INTERFACE s_axilite port=cfg->h2n.stats_snapshot offset=0x4c0
 #  pragma HLS INTERFACE s_axilite port=stats->h2n offset=0x500
 
 #  pragma HLS INTERFACE s_axilite port=stats->flow_table_size offset=0x800
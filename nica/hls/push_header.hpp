@@ -29,14 +29,17 @@
 
 /** Merges a header and a payload into a single mlx stream, given the mlx
  * streams of the header and the payload. */
-template <unsigned header_length_bits>
+template <unsigned header_length_bits, unsigned data_width = NICA_DATA_WIDTH>
 class push_header
 {
 public:
+    typedef hls_ik::axi_data_t<data_width> axi;
+    typedef typename axi::stream stream;
+
     /* TODO use data_stream everywhere instead of relying on mlx::stream */
-    void reorder(hls_ik::data_stream& hdr_in, hls::stream<bool>& empty_packet,
+    void reorder(stream& hdr_in, hls::stream<bool>& empty_packet,
 		 hls::stream<bool>& enable_stream,
-                 hls_ik::data_stream& data_in, hls_ik::data_stream& out)
+                 stream& data_in, stream& out)
     {
 #pragma HLS pipeline enable_flush
         switch (state)
@@ -65,15 +68,15 @@ header:
             if (hdr_in.empty())
                 break;
 
-            hls_ik::axi_data cur = hdr_in.read();
+            axi cur = hdr_in.read();
 	    if (!cur.last) {
-	        assert(cur.keep == 0xffffffff);
+	        assert(cur.keep == typename axi::keep_t(~0));
 		out.write(cur);
 		break;
 	    }
-            assert(empty || cur.keep == ~((1U << (32 - buffer_size / 8)) - 1));
-            buffer = cur.data(MLX_AXI4_WIDTH_BITS - 1, MLX_AXI4_WIDTH_BITS - buffer_size);
-            last_word_keep = cur.keep >> ((MLX_AXI4_WIDTH_BITS - buffer_size) / 8);
+            assert(empty || cur.keep == axi::keep_bytes(buffer_size / 8));
+            buffer = cur.data(data_width - 1, data_width - buffer_size);
+            last_word_keep = cur.keep >> ((data_width - buffer_size) / 8);
             if (empty) {
                 state = IDLE;
                 out.write(cur);
@@ -87,9 +90,9 @@ header:
             if (data_in.empty() || out.full())
                 break;
 
-            hls_ik::axi_data word = data_in.read();
+            axi word = data_in.read();
 
-            ap_uint<256> out_data((buffer, word.data(word.data.width - 1, buffer_size)));
+            typename axi::data_t out_data((buffer, word.data(word.data.width - 1, buffer_size)));
             last_word_keep = word.keep;
 
             /* Check if the amount of new bytes in the input word is larger
@@ -100,15 +103,15 @@ header:
              * signal. */
             const int buffer_width_bit = buffer_size / 8 - 1;
             if (word.keep(buffer_width_bit, buffer_width_bit)) {
-                auto out_buf = hls_ik::axi_data(out_data, 0xffffffff, false);
+                auto out_buf = axi(out_data, ~typename axi::keep_t(0), false);
                 out.write(out_buf);
                 state = word.last ? LAST : DATA;
                 buffer = word.data(buffer_size - 1, 0);
             } else {
-                auto out_buf = hls_ik::axi_data(
+                auto out_buf = axi(
                         out_data,
                         last_word_keep >> (buffer_size / 8) |
-                            mlx::last_word_keep_num_bytes_valid(buffer_size / 8),
+                            axi::keep_bytes(buffer_size / 8),
                         true);
                 out.write(out_buf);
                 state = IDLE;
@@ -117,8 +120,8 @@ header:
         }
         case LAST: {
 last:
-            auto out_buf = hls_ik::axi_data((buffer, ap_uint<MLX_AXI4_WIDTH_BITS - buffer_size>(0)),
-                last_word_keep << ((mlx::word::width - buffer_size) / 8), true);
+            auto out_buf = axi((buffer, ap_uint<data_width - buffer_size>(0)),
+                last_word_keep << ((data_width - buffer_size) / 8), true);
             out.write(out_buf);
             state = IDLE;
 	    break;
@@ -128,7 +131,7 @@ no_header:
             if (data_in.empty() || out.full())
                 break;
 
-            hls_ik::axi_data word = data_in.read();
+            axi word = data_in.read();
 	    if (word.last)
 		state = IDLE;
 	    out.write(word);
@@ -148,9 +151,9 @@ protected:
     	NO_HEADER passing data stream as is to the output, when header push
 	          was not enabled */
     enum { IDLE, HEADER, DATA, LAST, NO_HEADER } state;
-    enum { buffer_size = header_length_bits % MLX_AXI4_WIDTH_BITS };
-    /** Buffer for leftovers from the first header word. */
+    enum { buffer_size = header_length_bits % data_width };
+    /** Buffer for leftovers from the last header word. */
     ap_uint<buffer_size> buffer;
-    ap_uint<32> last_word_keep;
+    typename axi::keep_t last_word_keep;
 };
 
@@ -28,82 +28,111 @@
 #include <mlx.h>
 
 /** Adds a suffix onto an existing stream */
-template <unsigned suffix_length_bits>
+template <unsigned suffix_length_bits, unsigned data_width = NICA_DATA_WIDTH>
 class push_suffix
 {
 public:
     typedef ap_uint<suffix_length_bits> suffix_t;
+    typedef hls_ik::axi_data_t<data_width> axi;
+    typedef typename axi::stream stream;
 
     push_suffix() : state(IDLE) {}
 
-    void reorder(hls_ik::data_stream& data_in, 
+    void reorder(stream& data_in,
                  hls::stream<bool>& empty_packet,
 		 hls::stream<bool>& enable_stream,
-                 hls::stream<suffix_t>& suffix_in, hls_ik::data_stream& out)
+                 hls::stream<suffix_t>& suffix_in, stream& out)
     {
 #pragma HLS pipeline enable_flush
-        static_assert(suffix_length_bits < 256, "suffix size too large - not implemented");
+        static_assert(suffix_length_bits < data_width, "suffix size too large - not implemented");
+        typedef typename axi::data_t data_t;
+        typedef typename axi::keep_t keep_t;
 
         switch (state)
         {
         case IDLE: {
-            if (empty_packet.empty() || enable_stream.empty() || suffix_in.empty())
+            if (empty_packet.empty() || enable_stream.empty())
                 break;
 
-            bool empty = empty_packet.read();
+            empty = empty_packet.read();
 	    enable = enable_stream.read();
-            suffix = suffix_in.read();
 
-            if (!enable && empty) {
-                // Nothing to do
-                break;
-            } else if (enable && empty) {
-                last_flit_bytes = suffix_length_bits / 8;
-                state = LAST;
-                goto last;
+            if (enable && empty) {
+                state = EMPTY;
+                goto empty_packet_suffix;
+            } else if (!enable) {
+                /* Consume the unused suffix */
+                state = DISABLED;
+                goto disabled;
             } else {
                 // We have data
                 state = DATA;
+                goto data;
             }
-            /* Fall through */
+        }
+        case EMPTY: {
+empty_packet_suffix:
+            if (suffix_in.empty() || out.full())
+                break;
+
+            suffix = suffix_in.read();
+            last_flit_bytes = suffix_length_bits / 8;
+            state = LAST;
+            goto last;
+        }
+        case DISABLED: {
+disabled:
+            if (suffix_in.empty())
+                break;
+
+            suffix_in.read();
+            state = empty ? IDLE : DATA;
+            break;
         }
         case DATA: {
+data:
             if (data_in.empty() || out.full())
                 break;
 
-            hls_ik::axi_data flit = data_in.read();
+            flit = data_in.read();
             if (!flit.last || !enable) {
                 out.write(flit);
                 state = flit.last ? IDLE : DATA;
                 break;
             }
 
-            if (!enable) {
-                state = IDLE;
+            /* The suffix is only needed with the last flit, so that it can
+             * be computed from the packet data as it streams by */
+            state = SUFFIX;
+            /* Fall through */
+        }
+        case SUFFIX: {
+            if (suffix_in.empty() || out.full())
                 break;
-            }
+
+            suffix = suffix_in.read();
 
             /* Check if the amount of remaining space in the last flit of the
              * data stream has enough room for the suffix */
 	    int b;
-            for (b = 0; b < 32; ++b) {
-                if (!flit.keep(31 - b, 31 - b))
+            for (b = 0; b < axi::data_bytes; ++b) {
+                if (!flit.keep(axi::data_bytes - 1 - b, axi::data_bytes - 1 - b))
 		    break;
 	    }
 
 	    /* Number of bits that fit in the current flit */
-	    const int cur_flit_suffix = std::min((32u - b) * 8, suffix_length_bits);
-	    const int shift = (32 - b) * 8 - cur_flit_suffix;
-	    const ap_uint<256> mask = ((ap_uint<256>(1) << cur_flit_suffix) - 1) << shift;
-	    const ap_uint<32> keep_mask = ((1u << cur_flit_suffix / 8) - 1) << (shift / 8);
+	    const int cur_flit_suffix = std::min((unsigned(axi::data_bytes) - b) * 8, suffix_length_bits);
+	    const int shift = (axi::data_bytes - b) * 8 - cur_flit_suffix;
+	    const data_t mask = ((data_t(1) << cur_flit_suffix) - 1) << shift;
+	    const keep_t keep_mask = ((keep_t(1) << cur_flit_suffix / 8) - 1) << (shift / 8);
 
-	    ap_uint<256> suffix_shifted;
+	    data_t suffix_shifted;
 
 	    if (cur_flit_suffix >= suffix_length_bits) {
-		suffix_shifted = ap_uint<256>(suffix) << shift;
+		suffix_shifted = data_t(suffix) << shift;
 		state = IDLE;
 	    } else {
-		suffix_shifted = ap_uint<256>(suffix) >> (suffix_length_bits - cur_flit_suffix);
+		suffix_shifted = data_t(suffix) >> (suffix_length_bits - cur_flit_suffix);
 		last_flit_bytes = (suffix_length_bits - cur_flit_suffix) / 8;
 		flit.last = false;
 		state = LAST;
@@ -116,9 +145,8 @@ public:
         }
         case LAST: {
 last:
-            ap_uint<256> data = ap_uint<256>(suffix) << (256 - last_flit_bytes * 8);
-            hls_ik::axi_data out_buf(data,
-                hls_ik::axi_data::keep_bytes(last_flit_bytes), true);
+            data_t data = data_t(suffix) << (data_width - last_flit_bytes * 8);
+            axi out_buf(data, axi::keep_bytes(last_flit_bytes), true);
             out.write(out_buf);
             state = IDLE;
 	    break;
@@ -128,13 +156,18 @@ last:
 
 protected:
     /** Reordering state:
-     *  IDLE   waiting for header stream entry.
-     *  DATA   reading and transmitting the data stream.
-     *  LAST   output the suffix if it did not fit in the last data flit.
+     *  IDLE     waiting for header stream entry.
+     *  EMPTY    waiting for the suffix of a packet without data.
+     *  DISABLED consuming the suffix of a packet that does not use it.
+     *  DATA     reading and transmitting the data stream.
+     *  SUFFIX   waiting for the suffix to append to the last data flit.
+     *  LAST     output the suffix if it did not fit in the last data flit.
      */
-    enum { IDLE, DATA, LAST } state;
-    bool enable;
+    enum { IDLE, EMPTY, DISABLED, DATA, SUFFIX, LAST } state;
+    bool enable, empty;
     suffix_t suffix;
-    ap_uint<6> last_flit_bytes;
+    /** The last data flit, held until the suffix is available */
+    axi flit;
+    typename axi::bytes_t last_flit_bytes;
 };
 
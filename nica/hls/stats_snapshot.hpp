@@ -0,0 +1,53 @@
+/* * Copyright (c) 2016-2018 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <ap_int.h>
+
+/** Statistics snapshot generation, written by the host.
+ *
+ * With a zero generation the statistics registers follow the live counters.
+ * Writing a new non-zero generation latches all the counters of a pipeline
+ * into the registers on the same cycle, and they hold their values until the
+ * next generation, so the host can read them at leisure. */
+typedef ap_uint<32> snapshot_generation;
+
+/** Decides when a process copies its counters to the statistics registers.
+ * Each process that outputs statistics needs its own instance. */
+class stats_snapshot {
+public:
+    stats_snapshot() : last_generation() {}
+
+    bool latch(snapshot_generation generation)
+    {
+#pragma HLS inline
+        const bool update = generation == 0 || generation != last_generation;
+        last_generation = generation;
+        return update;
+    }
+
+private:
+    snapshot_generation last_generation;
+};
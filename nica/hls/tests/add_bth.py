@@ -75,13 +75,13 @@ for p in pkts:
             p[UDP].payload = BTH(opcode=0x24, dqpn=int(options.dqpn), psn=psn, pkey=0xffff,
                                  padcount=((- payload_len) % 4))/data
             psn += 1
-            #p[BTH].payload = data / icrc(p)
             p[BTH].payload = data / ICRC(icrc=0)
 
             p[IP].len = payload_len + 20 + 8 + bth_len + icrc_len
             p[UDP].len = payload_len + 8 + bth_len + icrc_len
             p[UDP].chksum = 0
             p[IP].chksum = 0
+            p[ICRC].icrc = icrc(p).icrc
             #print 'IP: %d, UDP: %d, payload: %d' % (p[IP].len, p[UDP].len, \
             #    len(p[UDP].payload))
             #p[UDP].payload.show2()
@@ -23,6 +23,7 @@
 # SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 from scapy.all import *
+import sys
 
 class Vector(Packet):
     name = "Vector"
@@ -33,7 +34,15 @@ def make_pkt(sz):
     pkt = Ether()/IP()/UDP(dport=0x0bad, sport=sz)/Vector(list=payload)
     return pkt
 
+# Largest Ethernet frame in bytes (NICA_MAX_FRAME_SIZE)
+max_frame_size = int(sys.argv[1]) if len(sys.argv) > 1 else 1520
+max_payload = max_frame_size - 14 - 20 - 8
+
 sizes = range(32) + [2**x + x for x in range(5, 10)] + [1500 - 14 - 20 - 8]
+# Jumbo frames
+if max_frame_size > 1520:
+    sizes += [2**x + x for x in range(10, 14) if 2**x + x < max_payload]
+    sizes += [max_payload]
 pkts = []
 for sz in sizes:
     pkt = make_pkt(sz)
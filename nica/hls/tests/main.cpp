@@ -34,6 +34,10 @@
 #include "threshold-impl.hpp"
 #include "pktgen.hpp"
 #include "custom_rx_ring.hpp"
+#include "capture_ring.hpp"
+#include "crc32.hpp"
+#include "rxe_hdr.h"
+#include "ib_pack.h"
 
 #include <uuid/uuid.h>
 
@@ -148,7 +152,8 @@ public:
 	::h2n.verify();
     }
 
-    int num_extra_clocks() { return 300; }
+    /* Jumbo frames take proportionally longer to drain */
+    int num_extra_clocks() { return 300 * MAX_PACKET_SIZE / 1520; }
 
     void nica_top()
     {
@@ -179,6 +184,34 @@ public:
         /* TODO reset ikernel */
     }
 
+    /* The threshold ikernel keeps its state between tests: stop sending
+     * packets to a custom ring as the custom_rx_ring tests configure it */
+    void reset_threshold(gateway_wrapper& gw)
+    {
+        gw.write(THRESHOLD_RING_ID, 0);
+        gw.write(THRESHOLD_COALESCE, 0);
+    }
+
+    /* Remove the flow table entries earlier tests installed */
+    void reset_flow_table(gateway_wrapper& ft_gateway)
+    {
+        for (int entry = 0; entry < FLOW_TABLE_SIZE; ++entry) {
+            const int base = FT_FLOWS_BASE + entry * FT_STRIDE;
+            for (int field : { FT_KEY_SADDR, FT_KEY_DADDR, FT_KEY_SPORT, FT_KEY_DPORT,
+                               FT_RESULT_ACTION, FT_RESULT_IKERNEL, FT_RESULT_CHAIN,
+                               FT_RESULT_MULTICAST, FT_RESULT_CAPTURE })
+                ft_gateway.write(base + field, 0);
+        }
+    }
+
+    /* Post credits for a custom ring and let ikernel 0 sweep the credit page */
+    void update_credits(hls_ik::ring_id_t ring, hls_ik::msn_t max_msn)
+    {
+        ports0.host_credit_regs.rings[ring - 1] = hls_ik::credit_update(max_msn, 0);
+        for (int i = 0; i < hls_ik::credit_update_registers::num_entries; ++i)
+            top();
+    }
+
 protected:
     udp::header_stream header;
     hls_ik::data_stream data;
@@ -242,8 +275,10 @@ TEST_F(testbench, all_packet_sizes)
 
     udp_tb::pkt_id_verifier n2h_verifier;
     hls::stream<mlx::user_t> user_values;
-    read_pcap(input_filename, nwp2sbu, 0, std::numeric_limits<int>::max(),
-              &n2h_verifier, &user_values);
+    /* 38 packets, and more with jumbo frames enabled */
+    int packets = read_pcap(input_filename, nwp2sbu, 0, std::numeric_limits<int>::max(),
+                            &n2h_verifier, &user_values);
+    EXPECT_TRUE(NICA_MAX_FRAME_SIZE > 1520 ? packets > 38 : packets == 38) << "input packets";
     ikernel0 = passthrough_top;
     reset_ikernel();
     run();
@@ -258,12 +293,12 @@ TEST_F(testbench, all_packet_sizes)
     }
     nica_stats diff = stats();
     EXPECT_EQ(count, 0) << "number of packets";
-    EXPECT_EQ(diff.n2h.udp.hds.ft_action_ikernel, 38) << "packets in matched statistic";
+    EXPECT_EQ(diff.n2h.udp.hds.ft_action_ikernel, packets) << "packets in matched statistic";
     EXPECT_EQ(diff.n2h.udp.hds.passthrough_not_ipv4, 0) << "!ipv4";
     EXPECT_EQ(diff.n2h.udp.hds.passthrough_not_udp, 0) << "!udp";
     EXPECT_EQ(diff.n2h.udp.hds.passthrough_bad_length, 0) << "bad length";
     EXPECT_EQ(diff.n2h.udp.hds.passthrough_disabled, 0) << "disabled";
-    EXPECT_EQ(diff.n2h.ik0.actions[hls_ik::PASS], 38) << "PASS packets";
+    EXPECT_EQ(diff.n2h.ik0.actions[hls_ik::PASS], packets) << "PASS packets";
     EXPECT_EQ(diff.n2h.ik0.actions[hls_ik::DROP], 0) << "DROP packets";
     EXPECT_EQ(diff.n2h.ik0.actions[hls_ik::GENERATE], 0) << "GENERATE packets";
 }
@@ -339,6 +374,100 @@ TEST_F(testbench, drop)
     EXPECT_EQ(diff.n2h.ik0.actions[hls_ik::GENERATE], 0) << "GENERATE packets";
 }
 
+TEST_F(testbench, stats_snapshot)
+{
+    const char *input_filename = "input.pcap";
+
+    c.n2h.enable = true;
+    gateway_wrapper ft_gateway([&]() { nica_top(); }, c.n2h.flow_table_gateway);
+    ft_gateway.write(FT_FLOWS_BASE + FT_RESULT_ACTION, FT_IKERNEL);
+
+    /* Latch the statistics before sending any traffic */
+    c.n2h.stats_snapshot = 1;
+    nica_top();
+
+    read_pcap(input_filename, nwp2sbu);
+    ikernel0 = passthrough_top;
+    reset_ikernel();
+    run();
+    while (!sbu2cxp.empty())
+        sbu2cxp.read();
+
+    auto tx_packets = [](const nica_stats& s) {
+        ap_uint<64> packets = 0;
+        for (unsigned i = 0; i < NUM_IKERNELS * 2 + 1; ++i)
+            packets += s.n2h.arbiter.tx_port[i].packets;
+        return packets;
+    };
+
+    nica_stats diff = stats();
+    EXPECT_EQ(diff.n2h.udp.hds.ft_action_ikernel, 0) << "latched matched statistic";
+    EXPECT_EQ(diff.n2h.ik0.actions[hls_ik::PASS], 0) << "latched PASS packets";
+    EXPECT_EQ(tx_packets(diff), 0) << "latched transmitted packets";
+
+    /* A new generation latches the current counters */
+    c.n2h.stats_snapshot = 2;
+    nica_top();
+    diff = stats();
+    EXPECT_EQ(diff.n2h.udp.hds.ft_action_ikernel, 100) << "packets in matched statistic";
+    EXPECT_EQ(diff.n2h.ik0.actions[hls_ik::PASS], 100) << "PASS packets";
+    EXPECT_EQ(tx_packets(diff), 100) << "transmitted packets";
+
+    c.n2h.stats_snapshot = 0;
+    nica_top();
+}
+
+TEST_F(testbench, capture_ring)
+{
+    const char *input_filename = "input.pcap";
+    FILE* temp_file = tmpfile();
+    EXPECT_TRUE(temp_file) << "cannot create temporary file for output.";
+
+    c.n2h.enable = true;
+    gateway_wrapper ft_gateway([&]() { nica_top(); }, c.n2h.flow_table_gateway);
+    ft_gateway.write(FT_FLOWS_BASE + FT_RESULT_ACTION, FT_IKERNEL);
+    gateway_wrapper capture_gateway([&]() { nica_top(); }, c.n2h.capture_gateway);
+    capture_gateway.write(CAPTURE_SAMPLE_RATE, 10);
+
+    udp_tb::pkt_id_verifier n2h_verifier;
+    hls::stream<mlx::user_t> user_values;
+    ikernel0 = ::threshold_top;
+    reset_ikernel();
+    gateway_wrapper([&]() { top(); }, gateway0).write(THRESHOLD_VALUE, 0xffffffff);
+    read_pcap(input_filename, nwp2sbu, 0, std::numeric_limits<int>::max(), &n2h_verifier, &user_values);
+    run();
+    write_pcap(temp_file, sbu2cxp, false, &n2h_verifier, &user_values);
+    EXPECT_TRUE(compare_output(filename(temp_file), "", input_filename, "!ip || !udp"));
+
+    nica_stats diff = stats();
+    int packets = diff.n2h.udp.hds.ft_action_passthrough + diff.n2h.udp.hds.ft_action_drop +
+                  diff.n2h.udp.hds.ft_action_ikernel;
+    EXPECT_EQ(diff.n2h.ik0.actions[hls_ik::DROP], 100) << "DROP packets";
+    int sampled = capture_gateway.read(CAPTURE_COUNT);
+    EXPECT_EQ(sampled, packets / 10) << "sampled headers";
+    for (int i = 0; i < sampled; ++i) {
+        int ethertype = capture_gateway.read(CAPTURE_DATA_BASE + 3) >> 16;
+        EXPECT_EQ(ethertype, ETH_P_IP) << "sample " << i;
+        capture_gateway.write(CAPTURE_POP, 1);
+    }
+    EXPECT_EQ(capture_gateway.read(CAPTURE_COUNT), 0);
+    EXPECT_EQ(capture_gateway.read(CAPTURE_DROPPED), 0);
+
+    /* A capture rule keeps every matching header. Once the ring is full,
+     * samples are dropped while the data path keeps going. */
+    capture_gateway.write(CAPTURE_SAMPLE_RATE, 0);
+    ft_gateway.write(FT_FLOWS_BASE + FT_RESULT_CAPTURE, 1);
+    read_pcap(input_filename, nwp2sbu, 0, std::numeric_limits<int>::max(), &n2h_verifier, &user_values);
+    run();
+    write_pcap(temp_file, sbu2cxp, false, &n2h_verifier, &user_values);
+
+    diff = stats();
+    EXPECT_EQ(diff.n2h.ik0.actions[hls_ik::DROP], 200) << "DROP packets";
+    EXPECT_EQ(capture_gateway.read(CAPTURE_COUNT), CAPTURE_RING_SIZE);
+    EXPECT_EQ(capture_gateway.read(CAPTURE_DROPPED), packets - CAPTURE_RING_SIZE);
+    EXPECT_TRUE(sbu2nwp.empty());
+}
+
 TEST_F(testbench, custom_rx_ring)
 {
     const char *input_filename = "input.pcap";
@@ -359,7 +488,7 @@ TEST_F(testbench, custom_rx_ring)
     cr_gateway.write(CR_DST_UDP, 4791);
     cr_gateway.write(CR_DST_QPN, 1);
     cr_gateway.write(CR_WRITE_CONTEXT, 1);
-    EXPECT_EQ(cr_gateway.read(CR_NUM_CONTEXTS), 16);
+    EXPECT_EQ(cr_gateway.read(CR_NUM_CONTEXTS), 1 << NICA_LOG_NUM_RINGS);
 
     udp_tb::pkt_id_verifier n2h_verifier;
     hls::stream<mlx::user_t> user_values;
@@ -369,8 +498,7 @@ TEST_F(testbench, custom_rx_ring)
     auto gw = gateway_wrapper([&]() { top(); }, gateway0);
     gw.write(THRESHOLD_VALUE, 0);
     gw.write(THRESHOLD_RING_ID, 1);
-    ports0.host_credit_regs.ring_id = 1;
-    ports0.host_credit_regs.max_msn = 100;
+    update_credits(1, 100);
     read_pcap(input_filename, nwp2sbu, 0, std::numeric_limits<int>::max(), &n2h_verifier, &user_values);
     run();
     write_pcap(temp_file, sbu2cxp, false, &n2h_verifier, &user_values);
@@ -394,6 +522,451 @@ TEST_F(testbench, custom_rx_ring)
     EXPECT_EQ(diff.n2h.ik0.actions[hls_ik::GENERATE], 0) << "GENERATE packets";
 }
 
+/* Collect the bytes of the packets on a stream, skipping dropped packets */
+static std::vector<std::vector<uint8_t> > read_packets(mlx::stream& stream)
+{
+    std::vector<std::vector<uint8_t> > packets;
+    std::vector<uint8_t> cur;
+    while (!stream.empty()) {
+        mlx::axi4s w = stream.read();
+        for (int byte = 0; byte < MLX_AXI4_WIDTH_BYTES; ++byte)
+            if (w.keep[MLX_AXI4_WIDTH_BYTES - 1 - byte])
+                cur.push_back(w.data(w.data.width - 1 - 8 * byte, w.data.width - 8 - 8 * byte));
+        if (w.last) {
+            if (!w.user(0, 0))
+                packets.push_back(cur);
+            cur.clear();
+        }
+    }
+    return packets;
+}
+
+TEST_F(testbench, custom_rx_ring_coalesce)
+{
+    const int max_bytes = 64;
+    const int record_bytes = 4;
+    const int records_per_batch = (max_bytes - COALESCE_HEADER_BYTES) / record_bytes;
+    /* Offset of the payload in a RoCEv2 packet */
+    const int payload_offset = 14 + 20 + 8 + 12;
+
+    c.n2h.enable = true;
+    gateway_wrapper ft_gateway([&]() { nica_top(); }, c.n2h.flow_table_gateway);
+    ft_gateway.write(FT_FLOWS_BASE + FT_RESULT_ACTION, FT_IKERNEL);
+    gateway_wrapper cr_gateway([&]() { nica_top(); }, c.n2h.custom_ring_gateway);
+    /* Use a ring of its own, as the NICA state is not reset between tests */
+    const int ring = 2;
+    cr_gateway.write(CR_DST_QPN, 1);
+    cr_gateway.write(CR_PSN, 0);
+    cr_gateway.write(CR_WRITE_CONTEXT, ring);
+    cr_gateway.write(CR_COALESCE_MAX_BYTES, max_bytes);
+    cr_gateway.write(CR_COALESCE_TIMEOUT, 1000);
+    EXPECT_EQ(cr_gateway.read(CR_COALESCE_MAX_BYTES), max_bytes);
+
+    udp_tb::pkt_id_verifier n2h_verifier;
+    hls::stream<mlx::user_t> user_values;
+    ikernel0 = ::threshold_top;
+    reset_ikernel();
+    auto gw = gateway_wrapper([&]() { top(); }, gateway0);
+    gw.write(THRESHOLD_VALUE, 0);
+    gw.write(THRESHOLD_RING_ID, ring);
+    gw.write(THRESHOLD_COALESCE, 1);
+    update_credits(ring, 100);
+    read_pcap("input.pcap", nwp2sbu, 0, std::numeric_limits<int>::max(), &n2h_verifier, &user_values);
+    run();
+
+    /* The expected records are the payloads of the uncoalesced messages */
+    mlx::stream expected_stream;
+    read_pcap("input-bth.pcap", expected_stream);
+    std::vector<uint8_t> expected;
+    for (auto& p : read_packets(expected_stream))
+        expected.insert(expected.end(), p.begin() + payload_offset,
+                        p.begin() + payload_offset + record_bytes);
+    ASSERT_EQ(expected.size(), 100 * record_bytes);
+
+    auto batches = read_packets(sbu2cxp);
+    ASSERT_EQ(batches.size(), (100 + records_per_batch - 1) / records_per_batch);
+    std::vector<uint8_t> records;
+    uint32_t psn = 0;
+    for (auto& p : batches) {
+        const uint8_t* bth = &p[payload_offset - 12];
+        EXPECT_EQ(bth[0], IB_OPCODE_UC_SEND_ONLY);
+        EXPECT_EQ((bth[9] << 16) | (bth[10] << 8) | bth[11], psn++);
+        const uint8_t* header = &p[payload_offset];
+        const int count = (header[0] << 8) | header[1];
+        EXPECT_EQ((header[2] << 8) | header[3], record_bytes);
+        EXPECT_LE(count, records_per_batch);
+        ASSERT_EQ(p.size(), std::max<size_t>(60, payload_offset + COALESCE_HEADER_BYTES +
+                                                 count * record_bytes + 4));
+        records.insert(records.end(), header + COALESCE_HEADER_BYTES,
+                       header + COALESCE_HEADER_BYTES + count * record_bytes);
+    }
+    EXPECT_EQ(records, expected);
+    EXPECT_TRUE(sbu2nwp.empty());
+
+    nica_stats diff = stats();
+    EXPECT_EQ(diff.n2h.ik0.actions[hls_ik::PASS], 100) << "PASS packets";
+}
+
+TEST_F(testbench, custom_rx_ring_coalesce_credits)
+{
+    const int max_bytes = 64;
+    /* Receive buffers the host keeps posted, fewer than the records */
+    const int buffers = 8;
+    const int payload_offset = 14 + 20 + 8 + 12;
+
+    c.n2h.enable = true;
+    gateway_wrapper ft_gateway([&]() { nica_top(); }, c.n2h.flow_table_gateway);
+    ft_gateway.write(FT_FLOWS_BASE + FT_RESULT_ACTION, FT_IKERNEL);
+    gateway_wrapper cr_gateway([&]() { nica_top(); }, c.n2h.custom_ring_gateway);
+    const int ring = 5;
+    cr_gateway.write(CR_DST_QPN, 1);
+    cr_gateway.write(CR_PSN, 0);
+    cr_gateway.write(CR_WRITE_CONTEXT, ring);
+    cr_gateway.write(CR_COALESCE_MAX_BYTES, max_bytes);
+    cr_gateway.write(CR_COALESCE_TIMEOUT, 1000);
+
+    ikernel0 = ::threshold_top;
+    reset_ikernel();
+    auto gw = gateway_wrapper([&]() { top(); }, gateway0);
+    reset_threshold(gw);
+    gw.write(THRESHOLD_VALUE, 0);
+    gw.write(THRESHOLD_RING_ID, ring);
+    gw.write(THRESHOLD_COALESCE, 1);
+    const int dropped = gw.read(THRESHOLD_DROPPED_BACKPRESSURE);
+    update_credits(ring, buffers);
+
+    /* Like the host, repost a buffer for each batch, and grant back the
+     * credits of the other records in it */
+    int packets = buffers, batches = 0, records = 0;
+    for (int start = 0; start < packets; start += buffers) {
+        packets = read_pcap("input.pcap", nwp2sbu, start, start + buffers);
+        run();
+        for (auto& p : read_packets(sbu2cxp)) {
+            const uint8_t* header = &p[payload_offset];
+            records += (header[0] << 8) | header[1];
+            ++batches;
+        }
+        update_credits(ring, batches + buffers);
+        gw.write(THRESHOLD_RECORD_CREDITS, ((records - batches) << 16) | ring);
+    }
+
+    EXPECT_LT(batches, records);
+    EXPECT_EQ(records, 100);
+    EXPECT_EQ(gw.read(THRESHOLD_DROPPED_BACKPRESSURE), dropped);
+    EXPECT_TRUE(sbu2nwp.empty());
+    reset_threshold(gw);
+}
+
+/* Reference RoCEv2 ICRC of an Ethernet/IPv4 packet, computed bit by bit
+ * over the masked headers as the rxe driver does */
+static uint32_t reference_icrc(const std::vector<uint8_t>& p)
+{
+    const int ip = 14, ihl = (p[ip] & 0xf) * 4;
+    const int ip_len = (p[ip + 2] << 8) | p[ip + 3];
+    std::vector<uint8_t> data(8, 0xff); /* pseudo-LRH */
+    data.insert(data.end(), p.begin() + ip, p.begin() + ip + ip_len - 4);
+    uint8_t* masked = &data[8];
+    masked[1] = 0xff; /* TOS */
+    masked[8] = 0xff; /* TTL */
+    masked[10] = masked[11] = 0xff; /* IP checksum */
+    masked[ihl + 6] = masked[ihl + 7] = 0xff; /* UDP checksum */
+    masked[ihl + 8 + 4] = 0xff; /* BTH resv8a */
+
+    uint32_t crc = 0xffffffff;
+    for (uint8_t byte : data) {
+        crc ^= byte;
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+TEST_F(testbench, custom_rx_ring_icrc)
+{
+    c.n2h.enable = true;
+    gateway_wrapper ft_gateway([&]() { nica_top(); }, c.n2h.flow_table_gateway);
+    ft_gateway.write(FT_FLOWS_BASE + FT_RESULT_ACTION, FT_IKERNEL);
+    gateway_wrapper cr_gateway([&]() { nica_top(); }, c.n2h.custom_ring_gateway);
+    const int ring = 3;
+    cr_gateway.write(CR_SRC_IP, 0x0a000001);
+    cr_gateway.write(CR_DST_IP, 0x0a000002);
+    cr_gateway.write(CR_SRC_UDP, 49152);
+    cr_gateway.write(CR_DST_UDP, 4791);
+    cr_gateway.write(CR_DST_QPN, 0x123456);
+    cr_gateway.write(CR_PSN, 0xabcdef);
+    cr_gateway.write(CR_WRITE_CONTEXT, ring);
+
+    udp_tb::pkt_id_verifier n2h_verifier;
+    hls::stream<mlx::user_t> user_values;
+    ikernel0 = ::threshold_top;
+    reset_ikernel();
+    auto gw = gateway_wrapper([&]() { top(); }, gateway0);
+    reset_threshold(gw);
+    gw.write(THRESHOLD_VALUE, 0);
+    gw.write(THRESHOLD_RING_ID, ring);
+    update_credits(ring, 100);
+    read_pcap("input.pcap", nwp2sbu, 0, std::numeric_limits<int>::max(), &n2h_verifier, &user_values);
+    run();
+
+    auto packets = read_packets(sbu2cxp);
+    ASSERT_EQ(packets.size(), 100);
+    for (size_t i = 0; i < packets.size(); ++i) {
+        const std::vector<uint8_t>& p = packets[i];
+        const int icrc_offset = 14 + ((p[16] << 8) | p[17]) - 4;
+        ASSERT_LE(icrc_offset + 4, p.size());
+        /* The ICRC is transmitted in little endian order */
+        const uint32_t icrc = p[icrc_offset] | (p[icrc_offset + 1] << 8) |
+                              (p[icrc_offset + 2] << 16) | (uint32_t(p[icrc_offset + 3]) << 24);
+        EXPECT_EQ(icrc, reference_icrc(p)) << "packet " << i;
+    }
+    EXPECT_TRUE(sbu2nwp.empty());
+    reset_threshold(gw);
+}
+
+/* Collects the statistics fields by their flattened names */
+struct stats_collector {
+    std::map<std::string, std::pair<bool, uint64_t> > fields;
+    std::string prefix;
+
+    template <typename T>
+    void counter(const std::string& name, const T& value) { fields[prefix + name] = { true, uint64_t(value) }; }
+    template <typename T>
+    void counter(const std::string& name, int index, const T& value) { counter(name + "_" + std::to_string(index), value); }
+    template <typename T>
+    void gauge(const std::string& name, const T& value) { fields[prefix + name] = { false, uint64_t(value) }; }
+    template <typename T>
+    void nested(const std::string& name, const T& value)
+    {
+        std::string outer = prefix;
+        prefix += name + "_";
+        value.visit(*this);
+        prefix = outer;
+    }
+    template <typename T>
+    void nested(const std::string& name, int index, const T& value) { nested(name + "_" + std::to_string(index), value); }
+};
+
+TEST(nica_stats, visit)
+{
+    nica_stats s = {};
+    s.n2h.udp.hds.ft_action_ikernel = 5;
+    s.h2n.arbiter.tx_port[1].packets = 7;
+    s.n2h.ik0.actions[hls_ik::DROP] = 3;
+    s.flow_table_size = FLOW_TABLE_SIZE;
+
+    stats_collector c;
+    s.visit(c);
+    typedef std::pair<bool, uint64_t> field;
+    EXPECT_EQ(field(true, 5), c.fields["n2h_udp_hds_ft_action_ikernel"]);
+    EXPECT_EQ(field(true, 7), c.fields["h2n_arbiter_tx_port_1_packets"]);
+    EXPECT_EQ(field(true, 3), c.fields["n2h_ik0_actions_1"]);
+    EXPECT_EQ(field(false, FLOW_TABLE_SIZE), c.fields["flow_table_size"]);
+    EXPECT_EQ(field(false, 0), c.fields["h2n_arbiter_idle"]);
+    /* hds: 7 counters and 7 gauges; arbiter: 3 + 4 per port and 2 more;
+     * three actions per ikernel */
+    const int ports = NUM_IKERNELS * 2 + 1;
+    EXPECT_EQ(2 * (14 + 7 * ports + 2 + 3 * NUM_IKERNELS) + 1, c.fields.size());
+}
+
+TEST(crc32, check_value)
+{
+    using hls_helpers::crc32_word;
+    const char check[] = "123456789";
+    const int len = sizeof(check) - 1;
+
+    /* Hash the check string split between two words at every offset */
+    for (int split = 0; split <= len; ++split) {
+        hls_ik::axi_data first, second;
+        first.set_data(check, split);
+        second.set_data(check + split, len - split);
+        ap_uint<32> crc = ~ap_uint<32>(0);
+        crc = crc32_word<hls_ik::axi_data::data_bytes>(crc, first.data, first.num_valid_bytes());
+        crc = crc32_word<hls_ik::axi_data::data_bytes>(crc, second.data, second.num_valid_bytes());
+        EXPECT_EQ(~crc, 0xcbf43926) << "split at " << split;
+    }
+}
+
+TEST(capture_ring, sample_rate_with_busy_ring)
+{
+    udp::capture_ring ring;
+    udp::capture_candidate_stream candidates;
+    udp::header_stream captures;
+    hls_ik::gateway_registers gateway;
+
+    /* Sends a header after missed ones lost while the ring was busy */
+    auto step = [&](int missed) {
+        udp::capture_candidate c = udp::capture_candidate();
+        c.missed = missed;
+        candidates.write(c);
+        ring.capture_step(candidates, captures, gateway);
+    };
+    auto read = [&](int address) {
+        int value = 0;
+        EXPECT_EQ(ring.reg_read(address, &value), GW_DONE);
+        return value;
+    };
+
+    /* Every header is a sample: a lost one is dropped, and sampling goes on */
+    ring.reg_write(CAPTURE_SAMPLE_RATE, 1);
+    step(0);
+    step(1);
+    step(0);
+    EXPECT_EQ(read(CAPTURE_COUNT), 3);
+    EXPECT_EQ(read(CAPTURE_DROPPED), 1);
+
+    /* Headers 2 to 11 are lost, dropping the samples of headers 4 and 8.
+     * Header 12 is sampled on its own turn. */
+    ring.reg_write(CAPTURE_SAMPLE_RATE, 4);
+    step(0);
+    step(10);
+    EXPECT_EQ(read(CAPTURE_COUNT), 4);
+    EXPECT_EQ(read(CAPTURE_DROPPED), 3);
+
+    /* Headers 13 and 14 are lost, no sample was due on them */
+    step(2);
+    step(0);
+    EXPECT_EQ(read(CAPTURE_COUNT), 5);
+    EXPECT_EQ(read(CAPTURE_DROPPED), 3);
+}
+
+TEST(ring_context_manager, message_opcodes)
+{
+    ring_context_manager contexts;
+    contexts[0].psn = 0xfffffe;
+
+    const struct {
+        bool end_of_message;
+        int opcode;
+    } packets[] = {
+        { true, IB_OPCODE_UC_SEND_ONLY },
+        { false, IB_OPCODE_UC_SEND_FIRST },
+        { false, IB_OPCODE_UC_SEND_MIDDLE },
+        { true, IB_OPCODE_UC_SEND_LAST },
+        { false, IB_OPCODE_UC_SEND_FIRST },
+        { true, IB_OPCODE_UC_SEND_LAST },
+    };
+    ap_uint<24> psn = 0xfffffe;
+    for (auto& p : packets) {
+        ring_context context = contexts.next_packet(1, p.end_of_message);
+        EXPECT_EQ(context.send_opcode(p.end_of_message), p.opcode);
+        EXPECT_EQ(context.psn, psn++);
+    }
+    /* Other rings are not affected */
+    EXPECT_EQ(contexts[1].psn, 0);
+    EXPECT_FALSE(contexts[1].in_message);
+}
+
+TEST(ring_context_manager, gateway_write_between_packets)
+{
+    ring_context_manager contexts;
+    const hls_ik::ring_id_t last_ring = (1 << NICA_LOG_NUM_RINGS) - 1;
+
+    /* Back-to-back packets of the same ring see each other's PSN */
+    EXPECT_EQ(contexts.next_packet(last_ring, true).psn, 0);
+    EXPECT_EQ(contexts.next_packet(last_ring, false).psn, 1);
+
+    /* A context written on an idle cycle replaces the forwarded entry */
+    contexts.gateway_context.dest_qpn = 0x123;
+    contexts.gateway_context.psn = 100;
+    ASSERT_TRUE(contexts.gateway_set(last_ring - 1));
+    contexts.update();
+
+    ring_context context = contexts.next_packet(last_ring, true);
+    EXPECT_EQ(context.dest_qpn, 0x123);
+    EXPECT_EQ(context.psn, 100);
+    EXPECT_FALSE(context.in_message);
+    EXPECT_EQ(contexts.next_packet(last_ring, true).psn, 101);
+}
+
+TEST(ring_context_manager, update_pending)
+{
+    ring_context_manager contexts;
+    EXPECT_FALSE(contexts.update_pending());
+
+    ASSERT_TRUE(contexts.gateway_set(1));
+    EXPECT_TRUE(contexts.update_pending());
+    contexts.update();
+    EXPECT_FALSE(contexts.update_pending());
+
+    ASSERT_TRUE(contexts.gateway_dump(0, 2));
+    for (int i = 0; i < 2; ++i) {
+        EXPECT_TRUE(contexts.update_pending()) << "entry " << i;
+        contexts.update();
+    }
+    EXPECT_FALSE(contexts.update_pending());
+    EXPECT_TRUE(contexts.gateway_next());
+    EXPECT_TRUE(contexts.gateway_next());
+}
+
+TEST(ring_context_manager, dump)
+{
+    ring_context_manager contexts;
+    for (int i = 0; i < int(contexts.size); ++i) {
+        contexts.gateway_context.dest_qpn = i + 1;
+        ASSERT_TRUE(contexts.gateway_set(i));
+        contexts.update();
+    }
+
+    /* Queries cannot be mixed with a dump */
+    ASSERT_TRUE(contexts.gateway_dump(1, contexts.size - 1));
+    EXPECT_FALSE(contexts.gateway_dump(0, 1));
+    EXPECT_EQ(contexts.gateway_write(CR_READ_CONTEXT, 1), GW_FAIL);
+
+    /* Entries are read ahead of the gateway */
+    for (int i = 0; i < int(contexts.size); ++i)
+        contexts.update();
+    for (int i = 1; i < int(contexts.size); ++i) {
+        if (!contexts.gateway_next()) {
+            contexts.update();
+            ASSERT_TRUE(contexts.gateway_next());
+        }
+        EXPECT_EQ(contexts.gateway_context.dest_qpn, i + 1);
+    }
+    EXPECT_FALSE(contexts.gateway_next());
+    EXPECT_EQ(contexts.gateway_write(CR_NEXT_CONTEXT, 0), GW_FAIL);
+}
+
+TEST(ring_context_manager, dump_cancel)
+{
+    ring_context_manager contexts;
+    for (int i = 0; i < int(contexts.size); ++i) {
+        contexts.gateway_context.dest_qpn = i + 1;
+        ASSERT_TRUE(contexts.gateway_set(i));
+        contexts.update();
+    }
+
+    /* There is no ring with the table size as its ID */
+    EXPECT_EQ(contexts.gateway_write(CR_DUMP_CONTEXTS, contexts.size), GW_FAIL);
+
+    /* Abandon a dump after one entry, leaving the rest streamed ahead */
+    ASSERT_EQ(contexts.gateway_write(CR_DUMP_CONTEXTS, 1), GW_DONE);
+    for (int i = 0; i < 4; ++i)
+        contexts.update();
+    ASSERT_TRUE(contexts.gateway_next());
+    EXPECT_EQ(contexts.gateway_context.dest_qpn, 1);
+    EXPECT_TRUE(contexts.gateway_dumping());
+    EXPECT_EQ(contexts.gateway_write(CR_DUMP_CONTEXTS, 5), GW_FAIL);
+
+    ASSERT_EQ(contexts.gateway_write(CR_DUMP_CONTEXTS, 0), GW_DONE);
+    EXPECT_FALSE(contexts.gateway_dumping());
+    EXPECT_EQ(contexts.gateway_write(CR_NEXT_CONTEXT, 0), GW_FAIL);
+
+    /* A new dump only returns its own entries */
+    ASSERT_EQ(contexts.gateway_write(CR_DUMP_CONTEXTS, 5), GW_DONE);
+    for (int i = 5; i < int(contexts.size); ++i) {
+        while (!contexts.gateway_next())
+            contexts.update();
+        EXPECT_EQ(contexts.gateway_context.dest_qpn, i);
+    }
+    EXPECT_FALSE(contexts.gateway_dumping());
+
+    /* Single reads work again */
+    ASSERT_EQ(contexts.gateway_write(CR_READ_CONTEXT, 3), GW_BUSY);
+    contexts.update();
+    ASSERT_EQ(contexts.gateway_write(CR_READ_CONTEXT, 3), GW_DONE);
+    EXPECT_EQ(contexts.gateway_context.dest_qpn, 3);
+}
+
 TEST_F(testbench, mix_passthrough_and_generated)
 {
     const int burst_size = 3;
@@ -464,7 +1037,9 @@ TEST_F(testbench, two_ikernels)
     ikernel0 = ::threshold_top;
     ikernel1 = ::passthrough_top;
     reset_ikernel();
-    gateway_wrapper([&]() { top(); }, gateway0).write(THRESHOLD_VALUE, 0);
+    gateway_wrapper gw([&]() { top(); }, gateway0);
+    reset_threshold(gw);
+    gw.write(THRESHOLD_VALUE, 0);
     read_pcap(input_filename, nwp2sbu, 0, std::numeric_limits<int>::max(), &n2h_verifier);
     run();
     write_pcap(temp_file, sbu2cxp, false, &n2h_verifier);
@@ -495,6 +1070,103 @@ TEST_F(testbench, two_ikernels)
     EXPECT_EQ(diff.n2h.ik1.actions[hls_ik::DROP], 0) << "DROP packets";
     EXPECT_EQ(diff.n2h.ik1.actions[hls_ik::GENERATE], 0) << "GENERATE packets";
 }
+
+TEST_F(testbench, service_chain)
+{
+    const char *input_filename = "input.pcap";
+    FILE* temp_file = tmpfile();
+    EXPECT_TRUE(temp_file) << "cannot create temporary file for output.";
+
+    c.n2h.enable = true;
+    gateway_wrapper ft_gateway([&]() { nica_top(); }, c.n2h.flow_table_gateway);
+    ft_gateway.write(FT_FIELDS, FT_FIELD_DST_PORT);
+    /* Port 2989 goes through threshold and then passthrough */
+    ft_gateway.write(FT_FLOWS_BASE +             FT_KEY_DPORT, 2989);
+    ft_gateway.write(FT_FLOWS_BASE +             FT_RESULT_ACTION, FT_IKERNEL);
+    ft_gateway.write(FT_FLOWS_BASE +             FT_RESULT_IKERNEL, 0);
+    ft_gateway.write(FT_FLOWS_BASE +             FT_RESULT_CHAIN, 1 << 1);
+    EXPECT_EQ(ft_gateway.read(FT_FLOWS_BASE +    FT_RESULT_CHAIN), 1 << 1);
+    /* Port 47824 goes through passthrough only */
+    ft_gateway.write(FT_FLOWS_BASE + FT_STRIDE + FT_KEY_DPORT, 47824);
+    ft_gateway.write(FT_FLOWS_BASE + FT_STRIDE + FT_RESULT_ACTION, FT_IKERNEL);
+    ft_gateway.write(FT_FLOWS_BASE + FT_STRIDE + FT_RESULT_IKERNEL, 1);
+
+    udp_tb::pkt_id_verifier n2h_verifier;
+    ikernel0 = ::threshold_top;
+    ikernel1 = ::passthrough_top;
+    reset_ikernel();
+    gateway_wrapper gw([&]() { top(); }, gateway0);
+    reset_threshold(gw);
+    gw.write(THRESHOLD_VALUE, 0);
+    read_pcap(input_filename, nwp2sbu, 0, std::numeric_limits<int>::max(), &n2h_verifier);
+    run();
+    write_pcap(temp_file, sbu2cxp, false, &n2h_verifier);
+
+    EXPECT_TRUE(compare_output(filename(temp_file), "udp port 47824",
+                               "input-padded.pcap", "udp port 47824"));
+    EXPECT_TRUE(compare_output(filename(temp_file), "udp port 2989",
+                               "input-padded.pcap", "udp port 2989"));
+    int count = 0;
+    while (!sbu2nwp.empty()) {
+        mlx::axi4s w = sbu2nwp.read();
+        if (w.last && !w.user(0, 0))
+            ++count;
+    }
+    EXPECT_EQ(count, 0) << "number of packets";
+    nica_stats diff = stats();
+    EXPECT_EQ(diff.n2h.udp.hds.ft_action_ikernel, 100) << "packets in matched statistic";
+
+    EXPECT_EQ(diff.n2h.ik0.actions[hls_ik::PASS], 24) << "PASS packets";
+    EXPECT_EQ(diff.n2h.ik0.actions[hls_ik::DROP], 0) << "DROP packets";
+    EXPECT_EQ(diff.n2h.ik0.actions[hls_ik::GENERATE], 0) << "GENERATE packets";
+
+    /* Chained packets pass through the second ikernel too */
+    EXPECT_EQ(diff.n2h.ik1.actions[hls_ik::PASS], 100) << "PASS packets";
+    EXPECT_EQ(diff.n2h.ik1.actions[hls_ik::DROP], 0) << "DROP packets";
+    EXPECT_EQ(diff.n2h.ik1.actions[hls_ik::GENERATE], 0) << "GENERATE packets";
+    EXPECT_EQ(diff.n2h.arbiter.tx_port[1].packets, 0) << "first ikernel output packets";
+    EXPECT_EQ(diff.n2h.arbiter.tx_port[3].packets, 100) << "second ikernel output packets";
+}
+
+TEST_F(testbench, multicast)
+{
+    const char *input_filename = "input.pcap";
+    FILE* temp_file = tmpfile();
+    EXPECT_TRUE(temp_file) << "cannot create temporary file for output.";
+
+    c.n2h.enable = true;
+    gateway_wrapper ft_gateway([&]() { nica_top(); }, c.n2h.flow_table_gateway);
+    reset_flow_table(ft_gateway);
+    ft_gateway.write(FT_FIELDS, FT_FIELD_DST_PORT);
+    /* Port 2989 goes to threshold, and a copy is sent to passthrough */
+    ft_gateway.write(FT_FLOWS_BASE + FT_KEY_DPORT, 2989);
+    ft_gateway.write(FT_FLOWS_BASE + FT_RESULT_ACTION, FT_IKERNEL);
+    ft_gateway.write(FT_FLOWS_BASE + FT_RESULT_IKERNEL, 0);
+    ft_gateway.write(FT_FLOWS_BASE + FT_RESULT_MULTICAST, 1 << 1);
+    EXPECT_EQ(ft_gateway.read(FT_FLOWS_BASE + FT_RESULT_MULTICAST), 1 << 1);
+
+    udp_tb::pkt_id_verifier n2h_verifier;
+    ikernel0 = ::threshold_top;
+    ikernel1 = ::passthrough_top;
+    reset_ikernel();
+    gateway_wrapper gw([&]() { top(); }, gateway0);
+    reset_threshold(gw);
+    gw.write(THRESHOLD_VALUE, 0);
+    read_pcap(input_filename, nwp2sbu, 0, std::numeric_limits<int>::max(), &n2h_verifier);
+    run();
+    write_pcap(temp_file, sbu2cxp, false, &n2h_verifier);
+
+    /* The copies do not affect the original packets */
+    EXPECT_TRUE(compare_output(filename(temp_file), "udp port 2989",
+                               "input-padded.pcap", "udp port 2989"));
+    nica_stats diff = stats();
+    EXPECT_EQ(diff.n2h.udp.hds.ft_action_ikernel, 24) << "packets in matched statistic";
+
+    EXPECT_EQ(diff.n2h.ik0.actions[hls_ik::PASS], 24) << "PASS packets";
+    EXPECT_EQ(diff.n2h.ik1.actions[hls_ik::PASS], 24) << "PASS packets";
+    EXPECT_EQ(diff.n2h.arbiter.tx_port[1].packets, 24) << "primary ikernel output packets";
+    EXPECT_EQ(diff.n2h.arbiter.tx_port[3].packets, 0) << "multicast copies output packets";
+}
 #endif
 
 int main(int argc, char **argv) {
@@ -28,6 +28,8 @@
 
 namespace {
 
+    const unsigned word_bytes = hls_ik::axi_data::data_bytes;
+
     class push_suffix_tests : public ::testing::TestWithParam<unsigned> {
     protected:
         // SetUp() is run immediately before a test starts.
@@ -45,14 +47,14 @@ namespace {
     {
 	char c = 0;
 
-        for (unsigned i = 0; i < size; i += 32) {
-            char buf[32];
-	    for (unsigned cur_char = 0; cur_char < 32u; ++cur_char)
+        for (unsigned i = 0; i < size; i += word_bytes) {
+            char buf[word_bytes];
+	    for (unsigned cur_char = 0; cur_char < word_bytes; ++cur_char)
 		buf[cur_char] = ++c;
 
             hls_ik::axi_data out;
-            out.set_data(buf, std::min(32u, size - i));
-	    out.last = i + 32 >= size;
+            out.set_data(buf, std::min(word_bytes, size - i));
+	    out.last = i + word_bytes >= size;
             s.write(out);
         }
     }
@@ -64,7 +66,7 @@ namespace {
 
         while (!s.empty()) {
             hls_ik::axi_data out = s.read();
-            char buf[32];	
+            char buf[word_bytes];
             unsigned cur_size = out.get_data(buf);
 
 	    for (unsigned cur_char = 0; cur_char < cur_size; ++cur_char) {
@@ -116,7 +118,7 @@ namespace {
 }
 
 INSTANTIATE_TEST_CASE_P(push_list, push_suffix_tests,
-			::testing::Range(0u, 3 * 32u));
+			::testing::Range(0u, 3 * word_bytes));
 
 int main(int argc, char **argv) {
     testing::InitGoogleTest(&argc, argv);
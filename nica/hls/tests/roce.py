@@ -26,6 +26,7 @@
 
 from scapy.all import *
 from binascii import crc32
+import struct
 
 class BTH(Packet):
     name = "BTH"
@@ -47,10 +48,16 @@ class ICRC(Packet):
     fields_desc = [XIntField("icrc", 0)]
 
 def icrc(packet):
+    """Compute the RoCEv2 ICRC of a packet that ends with an ICRC layer."""
     p = copy.deepcopy(packet[IP])
-    dummy_lrh = 0xffffffffffffffff
     p.ttl = 0xff
     p.chksum = 0xffff
     p.tos = 0xff
     p[UDP].chksum = 0xffff
-    return ICRC(icrc=(crc32(str(p)) & 0xffffffff))
+    data = bytearray(str(p)[:p.len - len(ICRC())])
+    # BTH reserved byte (resv8a)
+    data[p.ihl * 4 + 8 + 4] = 0xff
+    dummy_lrh = '\xff' * 8
+    crc = crc32(dummy_lrh + str(data)) & 0xffffffff
+    # The ICRC is transmitted in little endian order
+    return ICRC(icrc=struct.unpack('<I', struct.pack('>I', crc))[0])
@@ -67,8 +67,11 @@ steering::steering() :
     hdr_dup_to_dropper("hdr_dup_to_dropper"),
     hdr_dup_to_checks("hdr_dup_to_checks"),
     hdr_dup_to_flow_table("hdr_dup_to_flow_table"),
+    checks_hdr("checks_hdr"),
     captures("captures"),
+    capture_candidates("capture_candidates"),
     matched("matched"),
+    missed_candidates(0), missed_captures(0),
     dropper(true) /* empty_packets_have_data */
 {
     HEADER_BUFFER(buf, 0, -1, -1, true);
@@ -85,10 +88,7 @@ steering::steering() :
 void steering::hdr_checks(const config& config)
 {
 #pragma HLS PIPELINE enable_flush ii=1
-    if (config.capture_ack)
-    	capture_done = false;
-
-    if (hdr_dup_to_checks.empty() || checks_to_actions.full())
+    if (hdr_dup_to_checks.empty() || checks_to_actions.full() || checks_hdr.full())
         return;
 
     checks c;
@@ -103,23 +103,36 @@ void steering::hdr_checks(const config& config)
 
     checks_to_actions.write(c);
     checks_to_stats.write_nb(c);
-
-    if (config.capture_next && !capture_done && !captures.full()) {
-        capture_done = true;
-        captures.write(buf);
-    }
+    checks_hdr.write(buf);
 }
 
 void steering::checks_to_action(const config& cfg, result_stream& result_out)
 {
 #pragma HLS pipeline enable_flush ii=1
-    if (checks_to_actions.empty() || ft_to_action.empty() ||
+    if (checks_to_actions.empty() || checks_hdr.empty() || ft_to_action.empty() ||
         ft_results.full() || result_out.full())
         return;
 
     checks c = checks_to_actions.read();
     c.ft_result = ft_to_action.read();
 
+    /* Sampling must not stall the pipeline. If the capture ring is busy,
+     * the header is lost, and the next candidate reports it to the ring so
+     * that it is counted in CAPTURE_DROPPED. */
+    capture_candidate candidate;
+    candidate.hdr = checks_hdr.read().hdr;
+    candidate.capture = c.ft_result.v.capture;
+    candidate.missed = missed_candidates;
+    candidate.missed_captures = missed_captures;
+    if (capture_candidates.write_nb(candidate)) {
+        missed_candidates = 0;
+        missed_captures = 0;
+    } else {
+        ++missed_candidates;
+        if (candidate.capture)
+            ++missed_captures;
+    }
+
     if (c.disabled || c.not_ipv4 || c.bad_length || c.not_udp)
         c.ft_result.v.action = FT_PASSTHROUGH;
 
@@ -129,21 +142,23 @@ void steering::checks_to_action(const config& cfg, result_stream& result_out)
         result_out.write(c.ft_result);
 }
 
-void steering::update_stats_checks(hds_stats* s)
+void steering::update_stats_checks(snapshot_generation snapshot, hds_stats* s)
 {
 #pragma HLS pipeline enable_flush ii=1
-    s->capture = stats.capture;
-    s->eth_proto = stats.eth_proto;
-    s->tot_len = stats.tot_len;
-    s->ip_proto = stats.ip_proto;
-    s->ip_saddr = stats.ip_saddr;
-    s->ip_daddr = stats.ip_daddr;
-    s->udp_sport = stats.udp_sport;
-    s->udp_dport = stats.udp_dport;
-    s->passthrough_disabled = stats.passthrough_disabled;
-    s->passthrough_not_ipv4 = stats.passthrough_not_ipv4;
-    s->passthrough_bad_length = stats.passthrough_bad_length;
-    s->passthrough_not_udp = stats.passthrough_not_udp;
+    if (checks_snapshot.latch(snapshot)) {
+        s->capture = stats.capture;
+        s->eth_proto = stats.eth_proto;
+        s->tot_len = stats.tot_len;
+        s->ip_proto = stats.ip_proto;
+        s->ip_saddr = stats.ip_saddr;
+        s->ip_daddr = stats.ip_daddr;
+        s->udp_sport = stats.udp_sport;
+        s->udp_dport = stats.udp_dport;
+        s->passthrough_disabled = stats.passthrough_disabled;
+        s->passthrough_not_ipv4 = stats.passthrough_not_ipv4;
+        s->passthrough_bad_length = stats.passthrough_bad_length;
+        s->passthrough_not_udp = stats.passthrough_not_udp;
+    }
 
     if (!captures.empty()) {
         header_buffer capture = captures.read();
@@ -176,12 +191,15 @@ void steering::update_stats_checks(hds_stats* s)
     }
 }
 
-void steering::update_stats_actions(bool_stream& pass_raw, hds_stats* s)
+void steering::update_stats_actions(snapshot_generation snapshot,
+                                    bool_stream& pass_raw, hds_stats* s)
 {
 #pragma HLS pipeline enable_flush ii=1
-    s->ft_action_passthrough = stats.ft_action_passthrough;
-    s->ft_action_drop = stats.ft_action_drop;
-    s->ft_action_ikernel = stats.ft_action_ikernel;
+    if (actions_snapshot.latch(snapshot)) {
+        s->ft_action_passthrough = stats.ft_action_passthrough;
+        s->ft_action_drop = stats.ft_action_drop;
+        s->ft_action_ikernel = stats.ft_action_ikernel;
+    }
 
     if (ft_results.empty() || matched.full() || pass_raw.full())
         return;
@@ -220,6 +238,8 @@ void steering::steer(header_stream& hdr_in, hls_ik::data_stream& data_in, bool_s
     DO_PRAGMA(HLS DATA_PACK variable=hdr_dup_to_flow_table);
     DO_PRAGMA(HLS DATA_PACK variable=checks_to_stats);
     DO_PRAGMA(HLS DATA_PACK variable=captures);
+    DO_PRAGMA(HLS DATA_PACK variable=checks_hdr);
+    DO_PRAGMA(HLS DATA_PACK variable=capture_candidates);
     DO_PRAGMA(HLS DATA_PACK variable=checks_to_actions);
     DO_PRAGMA(HLS DATA_PACK variable=ft_to_action);
     DO_PRAGMA(HLS DATA_PACK variable=ft_results);
@@ -228,29 +248,137 @@ void steering::steer(header_stream& hdr_in, hls_ik::data_stream& data_in, bool_s
     hdr_checks(*config);
     ft.ft_step(hdr_dup_to_flow_table, ft_to_action, config->flow_table_gateway);
     checks_to_action(*config, result_out);
-    update_stats_checks(s);
-    update_stats_actions(pass_raw, s);
+    ring.capture_step(capture_candidates, captures, config->capture_gateway);
+    update_stats_checks(config->stats_snapshot, s);
+    update_stats_actions(config->stats_snapshot, pass_raw, s);
     dropper.udp_dropper_step(matched, hdr_dup_to_dropper, data_in, hdr_out,
                              data_out);
 }
 
+capture_ring::capture_ring() :
+    head(0), tail(0),
+    sample_rate(0), sample_counter(0), dropped(0)
+{
+}
+
+void capture_ring::capture_step(capture_candidate_stream& candidates,
+                                header_stream& captures,
+                                hls_ik::gateway_registers& g)
+{
+#pragma HLS pipeline enable_flush ii=1
+    gateway(this, g);
+
+    if (candidates.empty())
+        return;
+
+    capture_candidate c = candidates.read();
+    dropped += c.missed_captures;
+
+    /* Headers lost before reaching the ring still count towards the
+     * sampling period: every sample due on one of them is dropped, and the
+     * current header is sampled if its own turn has come */
+    bool sample = false;
+    if (sample_rate != 0) {
+        const ap_uint<32> lost = sample_counter + c.missed;
+        dropped += lost / sample_rate;
+        sample_counter = lost % sample_rate + 1;
+        if (sample_counter == sample_rate) {
+            sample_counter = 0;
+            sample = true;
+        }
+    }
+    if (!(sample || c.capture))
+        return;
+
+    if (index_t(head - tail) == CAPTURE_RING_SIZE) {
+        ++dropped;
+        return;
+    }
+
+    /* Align the header to the most significant word so that word 0 holds
+     * the first bytes of the packet */
+    ring[head(head.width - 2, 0)] = ap_uint<CAPTURE_WORDS * 32>(c.hdr) <<
+        (CAPTURE_WORDS * 32 - header_parser::width);
+    ++head;
+
+    HEADER_BUFFER(buf, c.hdr, 0, 0, false);
+    captures.write_nb(buf);
+}
+
+int capture_ring::reg_write(int address, int value)
+{
+#pragma HLS inline
+    switch (address) {
+    case CAPTURE_SAMPLE_RATE:
+        sample_rate = value;
+        sample_counter = 0;
+        return GW_DONE;
+    case CAPTURE_POP:
+        if (head != tail)
+            ++tail;
+        return GW_DONE;
+    default:
+        return GW_FAIL;
+    }
+}
+
+int capture_ring::reg_read(int address, int* value)
+{
+#pragma HLS inline
+    if (address >= CAPTURE_DATA_BASE && address < CAPTURE_DATA_BASE + CAPTURE_WORDS) {
+        if (head == tail)
+            goto err;
+
+        int word = CAPTURE_WORDS - 1 - (address - CAPTURE_DATA_BASE);
+        *value = ring[tail(tail.width - 2, 0)](word * 32 + 31, word * 32);
+        return GW_DONE;
+    }
+
+    switch (address) {
+    case CAPTURE_SAMPLE_RATE:
+        *value = sample_rate;
+        return GW_DONE;
+    case CAPTURE_COUNT:
+        *value = index_t(head - tail);
+        return GW_DONE;
+    case CAPTURE_DROPPED:
+        *value = dropped;
+        return GW_DONE;
+    default:
+        goto err;
+    }
+
+err:
+    *value = -1;
+    return GW_FAIL;
+}
+
 void header_data_split::split(mlx::stream& in,
                               header_stream& header, hls_ik::data_stream& data)
 {
 #pragma HLS PIPELINE enable_flush
     mlx::axi4s cur;
-    /* Where does the header end and data start in the second word, in bits */
-    const int data_start = 512 - header_buffer::width;
+    /* Where does the header end and data start in its last word, in bits */
+    const int data_start = header_words * MLX_AXI4_WIDTH_BITS - header_buffer::width;
 
     switch (state) {
     case IDLE:
 idle:
-        if (!in.empty()) {
+        if (!in.empty() && (header_words > 1 || !header.full())) {
             in.read(cur);
-            buffer = cur.data;
             pkt_id = cur.id;
             user = cur.user;
-            state = READING_HEADER;
+            if (header_words == 1) {
+                /* The entire header fits in the first word */
+                HEADER_BUFFER(buf,
+                    cur.data(MLX_AXI4_WIDTH_BITS - 1, data_start),
+                    pkt_id, user, false);
+                header.write(buf);
+                state = cur.last ? LAST : STREAM;
+            } else {
+                state = READING_HEADER;
+            }
+            buffer = cur.data;
         }
         break;
     case READING_HEADER:
@@ -259,7 +387,7 @@ idle:
             assert(cur.user == user);
 
             HEADER_BUFFER(buf,
-                (buffer, cur.data(255, data_start)),
+                (buffer, cur.data(MLX_AXI4_WIDTH_BITS - 1, data_start)),
                 pkt_id, user, false);
             buffer = cur.data;
             state = cur.last ? LAST : STREAM;
@@ -271,8 +399,8 @@ idle:
             in.read(cur);
             assert(cur.user == user);
 
-            hls_ik::axi_data buf = hls_ik::axi_data((ap_uint<256>((buffer(data_start - 1, 0),
-                                                    cur.data(255, data_start)))), 0xffffffff, 0);
+            hls_ik::axi_data buf = hls_ik::axi_data(mlx::word((buffer(data_start - 1, 0),
+                                                    cur.data(MLX_AXI4_WIDTH_BITS - 1, data_start))), ~mlx::keep_t(0), 0);
             data.write(buf);
             buffer = cur.data;
             state = cur.last ? LAST : STREAM;
@@ -283,8 +411,8 @@ idle:
             break;
 
         ap_uint<data_start> last_part = buffer(data_start - 1, 0);
-        hls_ik::axi_data buf((last_part, ap_uint<256 - data_start>(0)),
-                             hls_ik::axi_data::keep_bytes(32 - data_start / 8), true);
+        hls_ik::axi_data buf((last_part, ap_uint<MLX_AXI4_WIDTH_BITS - data_start>(0)),
+                             hls_ik::axi_data::keep_bytes(MLX_AXI4_WIDTH_BYTES - data_start / 8), true);
         data.write(buf);
         state = IDLE;
         goto idle;
@@ -314,8 +442,8 @@ void length_adjust::find_length(header_stream& hdr_in)
 
     pkt.tot_len = hdr.ip.tot_len;
     ap_uint<16> data_length = (pkt.tot_len - header_length);
-    pkt.last_word_data = data_length(4, 0);
-    pkt.word_count = data_length(15, 5) + !!pkt.last_word_data;
+    pkt.last_word_data = data_length(log2_word_bytes - 1, 0);
+    pkt.word_count = data_length(15, log2_word_bytes) + !!pkt.last_word_data;
     DBG_DECL(pkt.pkt_id = buf.pkt_id);
 
     packets.write(pkt);
@@ -580,11 +708,21 @@ void udp::crossbar(header_stream& hdr_in, hls_ik::data_stream& data_in, result_s
             return;
 
         current_steering_decision = steer_results.read();
+        current_targets = current_steering_decision.v.multicast |
+            (ikernel_chain_t(1) << current_steering_decision.v.ikernel);
+        buf = hdr_in.read();
+        /* Multicast copies only go to their own ikernel, and are marked so
+         * that their actions do not affect the original packet. */
 #define BOOST_PP_LOCAL_MACRO(n) \
-        if (current_steering_decision.v.ikernel == n) { \
-            buf = hdr_in.read(); \
+        if (current_targets[n]) { \
+            flow_table_result result = current_steering_decision; \
+            if (current_steering_decision.v.ikernel != n) { \
+                result.v.ikernel = n; \
+                result.v.chain = 0; \
+                result.mirrored = true; \
+            } \
             (hdr_out ## n).write(buf); \
-            (ft_results ## n).write(current_steering_decision); \
+            (ft_results ## n).write(result); \
         }
 #define BOOST_PP_LOCAL_LIMITS (0, NUM_IKERNELS - 1)
 %:include BOOST_PP_LOCAL_ITERATE()
@@ -592,21 +730,25 @@ void udp::crossbar(header_stream& hdr_in, hls_ik::data_stream& data_in, result_s
         state = header_parser(buf.hdr).udp.empty_packet() ? IDLE : STREAM;
         break;
 
-    case STREAM:
+    case STREAM: {
+        if (data_in.empty()
 #define BOOST_PP_LOCAL_MACRO(n) \
-        if (current_steering_decision.v.ikernel == n) { \
-            if (data_in.empty() || (data_out ## n).full()) \
-                return; \
-            \
-            hls_ik::axi_data buf = data_in.read(); \
-            (data_out ## n).write(buf); \
-            state = buf.last ? IDLE : STREAM; \
-        }
+            || (current_targets[n] && (data_out ## n).full())
 #define BOOST_PP_LOCAL_LIMITS (0, NUM_IKERNELS - 1)
 %:include BOOST_PP_LOCAL_ITERATE()
+        )
+            return;
 
+        hls_ik::axi_data data = data_in.read();
+#define BOOST_PP_LOCAL_MACRO(n) \
+        if (current_targets[n]) \
+            (data_out ## n).write(data);
+#define BOOST_PP_LOCAL_LIMITS (0, NUM_IKERNELS - 1)
+%:include BOOST_PP_LOCAL_ITERATE()
+        state = data.last ? IDLE : STREAM;
         break;
     }
+    }
 }
 
 void udp::udp_step(mlx::stream& in,
@@ -711,24 +853,29 @@ void header_to_mlx::hdr_to_mlx(udp_builder_metadata_stream& in, hls_ik::data_str
 
         header_parser hdr = metadata_to_header(m.ik);
 	header_buffer buf = hdr;
-        ap_uint<256> word = buf.hdr(hdr.width - 1, hdr.width - 256);
-        buffer = buf.hdr(buffer_size - 1, 0);
-
-        hls_ik::axi_data output(word, 0xffffffff, false);
-        output.last = drop();
+        /* The header aligned to the start of its first word */
+        ap_uint<header_words * MLX_AXI4_WIDTH_BITS> aligned =
+            ap_uint<header_words * MLX_AXI4_WIDTH_BITS>(buf.hdr) <<
+                (header_words * MLX_AXI4_WIDTH_BITS - hdr.width);
+        mlx::word word = aligned(aligned.width - 1, aligned.width - MLX_AXI4_WIDTH_BITS);
+        buffer = aligned(MLX_AXI4_WIDTH_BITS - 1, 0);
+
+        hls_ik::axi_data output(word, ~mlx::keep_t(0), false);
+        if (header_words == 1)
+            output.keep = hls_ik::axi_data::keep_bytes(last_word_bytes);
+        output.last = drop() || header_words == 1;
         out.write(output);
 
         empty_packet.write(drop() || hdr.udp.empty_packet());
         generated_stream.write(m.generated);
 	enable_stream.write(true);
 
-        state = drop() ? IDLE : SECOND;
+        state = drop() || header_words == 1 ? IDLE : SECOND;
         break;
     }
     case SECOND:
-        hls_ik::axi_data out_buf(
-            (buffer, ap_uint<MLX_AXI4_WIDTH_BITS - buffer_size>(0)),
-            hls_ik::axi_data::keep_bytes(buffer_size / 8),
+        hls_ik::axi_data out_buf(buffer,
+            hls_ik::axi_data::keep_bytes(last_word_bytes),
             true);
         out.write(out_buf);
         state = IDLE;
@@ -767,20 +914,21 @@ void ethernet_padding::pad(mlx::stream& in, mlx::stream& out)
         return;
 
     mlx::axi4s beat = in.read();
-    if (beat.last && beat_count == 1) {
+    if (beat.last && beat_count == min_frame_words - 1) {
         beat.data = pad_one(beat.data, beat.keep);
-        beat.keep = beat.keep | 0xfffffff0;
+        beat.keep = beat.keep | hls_ik::axi_data::keep_bytes(
+            min_frame_size - (min_frame_words - 1) * MLX_AXI4_WIDTH_BYTES);
     }
     out.write(beat);
     if (beat.last)
         beat_count = 0;
-    else
+    else if (beat_count < min_frame_words)
         ++beat_count;
 }
 
-ap_uint<256> ethernet_padding::pad_one(ap_uint<256> data, ap_uint<32> keep)
+mlx::word ethernet_padding::pad_one(mlx::word data, mlx::keep_t keep)
 {
-    for (int i = 0; i < 32; ++i) {
+    for (int i = 0; i < MLX_AXI4_WIDTH_BYTES; ++i) {
         data(8 * i + 7, 8 * i) = keep(i, i) ? data(8 * i + 7, 8 * i) : 0;
     }
 
@@ -41,8 +41,10 @@
 #include <link_with_reg.hpp>
 #include <push_header.hpp>
 #include <ikernel.hpp>
+#include <stats_snapshot.hpp>
 
 #include "flow_table_impl.hpp"
+#include "capture_ring.hpp"
 
 #ifndef NDEBUG
   #define DBG_DECL(decl...) decl
@@ -202,15 +204,14 @@ namespace udp {
         hls_ik::gateway_registers flow_table_gateway;
         /** Gateway to access the arbiter */
         hls_ik::gateway_registers arbiter_gateway;
-        /** Captures the next packet for debugging. Packet is
-         * readable at hds_stats.capture */
-        bool capture_next;
-        /** Acknowledge a capture before setting another capture. */
-        bool capture_ack;
+        /** Gateway to access the sampled header capture ring */
+        hls_ik::gateway_registers capture_gateway;
         /** Gateway to access custom ring parameters */
         hls_ik::gateway_registers custom_ring_gateway;
         /** Relatively quick credit update mechanism */
         hls_ik::credit_update_registers credit_regs;
+        /** Latch the pipeline statistics (see stats_snapshot.hpp) */
+        snapshot_generation stats_snapshot;
     };
 
     typedef ap_uint<64> packet_counters;
@@ -224,6 +225,7 @@ namespace udp {
                         ft_action_drop,
                         ft_action_ikernel;
 
+        /** Most recently sampled header */
         header_buffer capture;
         ap_uint<16> eth_proto;
         ap_uint<16> tot_len;
@@ -232,6 +234,64 @@ namespace udp {
         ap_uint<32> ip_daddr;
         ap_uint<16> udp_sport;
         ap_uint<16> udp_dport;
+
+        /** Lists the fields for the host metrics registry. The visitor's
+         * counter() and gauge() get each field's name and value, and nested()
+         * descends into structs. Array elements also get their index. */
+        template <typename Visitor>
+        void visit(Visitor& v) const
+        {
+            v.counter("passthrough_disabled", passthrough_disabled);
+            v.counter("passthrough_not_ipv4", passthrough_not_ipv4);
+            v.counter("passthrough_bad_length", passthrough_bad_length);
+            v.counter("passthrough_not_udp", passthrough_not_udp);
+            v.counter("ft_action_passthrough", ft_action_passthrough);
+            v.counter("ft_action_drop", ft_action_drop);
+            v.counter("ft_action_ikernel", ft_action_ikernel);
+            v.gauge("eth_proto", eth_proto);
+            v.gauge("tot_len", tot_len);
+            v.gauge("ip_proto", ip_proto);
+            v.gauge("ip_saddr", ip_saddr);
+            v.gauge("ip_daddr", ip_daddr);
+            v.gauge("udp_sport", udp_sport);
+            v.gauge("udp_dport", udp_dport);
+        }
+    };
+
+    /** A packet header considered for sampling by the capture ring */
+    struct capture_candidate {
+        ap_uint<header_parser::width> hdr;
+        /** Matched a flow table rule that captures all of its packets */
+        bool capture;
+        /** Candidates lost since the previous one because the capture ring
+         * was busy, and how many of them matched a capture rule */
+        ap_uint<16> missed, missed_captures;
+    };
+
+    typedef hls::stream<capture_candidate> capture_candidate_stream;
+
+    /** Ring of sampled packet headers. Keeps one of every N packets, and
+     * packets matching a capture rule, until the host drains them through
+     * the gateway. Never back-pressures the data path: samples that do not
+     * fit in the ring are counted and dropped. */
+    class capture_ring : public hls_ik::gateway_impl<capture_ring> {
+    public:
+        capture_ring();
+        void capture_step(capture_candidate_stream& candidates, header_stream& captures,
+                          hls_ik::gateway_registers& gateway);
+
+        int reg_write(int address, int value);
+        int reg_read(int address, int* value);
+        void gateway_update() {}
+
+    private:
+        typedef ap_uint<hls_helpers::log2(CAPTURE_RING_SIZE) + 1> index_t;
+
+        ap_uint<CAPTURE_WORDS * 32> ring[CAPTURE_RING_SIZE];
+        /** Producer and consumer indices. Their difference is the number
+         * of headers in the ring. */
+        index_t head, tail;
+        ap_uint<32> sample_rate, sample_counter, dropped;
     };
 
     class udp_dropper {
@@ -260,6 +320,10 @@ namespace udp {
         void split(mlx::stream& in, header_stream& header, hls_ik::data_stream& data);
 
     private:
+        /** Number of words holding the packet headers */
+        enum { header_words = (header_buffer::width + MLX_AXI4_WIDTH_BITS - 1) / MLX_AXI4_WIDTH_BITS };
+        static_assert(header_words <= 2, "headers are expected to fit in two words");
+
         enum { IDLE, READING_HEADER, STREAM, LAST } state;
         ap_uint<MLX_AXI4_WIDTH_BITS> buffer;
         mlx::pkt_id_t pkt_id;
@@ -279,11 +343,12 @@ namespace udp {
     private:
         void hdr_checks(const config& config);
         void checks_to_action(const config& config, result_stream& result_out);
-        void update_stats_checks(hds_stats* s);
-        void update_stats_actions(bool_stream& pass_raw, hds_stats* s);
+        void update_stats_checks(snapshot_generation snapshot, hds_stats* s);
+        void update_stats_actions(snapshot_generation snapshot,
+                                  bool_stream& pass_raw, hds_stats* s);
 
         hds_stats stats;
-        bool capture_done;
+        stats_snapshot checks_snapshot, actions_snapshot;
 
         struct checks {
             bool disabled;
@@ -294,13 +359,18 @@ namespace udp {
         };
 
         hls::stream<checks> checks_to_stats, checks_to_actions;
-        header_stream hdr_dup_to_dropper, hdr_dup_to_checks, hdr_dup_to_flow_table, captures;
+        header_stream hdr_dup_to_dropper, hdr_dup_to_checks, hdr_dup_to_flow_table,
+                      checks_hdr, captures;
+        capture_candidate_stream capture_candidates;
         bool_stream matched;
+        /** Capture candidates lost since the last one the ring accepted */
+        ap_uint<16> missed_candidates, missed_captures;
 
         udp_dropper dropper;
         hls_helpers::duplicator<2, header_buffer> hdr_dup;
         result_stream ft_to_action, ft_results;
         flow_table ft;
+        capture_ring ring;
     };
 
     class length_adjust
@@ -320,11 +390,12 @@ namespace udp {
         struct packet_metadata {
             ap_uint<11> word_count;
             ap_uint<16> tot_len;
-            ap_uint<5> last_word_data;
+            ap_uint<hls_helpers::log2(MLX_AXI4_WIDTH_BYTES)> last_word_data;
             mlx::pkt_id_t pkt_id;
         };
         hls::stream<packet_metadata> packets;
         packet_metadata pkt;
+        static const int log2_word_bytes = hls_helpers::log2(MLX_AXI4_WIDTH_BYTES);
     };
 
 	class checksum {
@@ -371,6 +442,12 @@ namespace udp {
 
     struct udp_stats {
         hds_stats hds;
+
+        template <typename Visitor>
+        void visit(Visitor& v) const
+        {
+            v.nested("hds", hds);
+        }
     };
 
 	/* A basic UDP unit for parsing Ethernet, IP and UDP headers, detecting
@@ -396,6 +473,8 @@ namespace udp {
 		/* Crossbar state */
 		enum { IDLE, STREAM } state;
         flow_table_result current_steering_decision;
+        /** Ikernels receiving the current packet */
+        ikernel_chain_t current_targets;
         void crossbar(header_stream& hdr_in, hls_ik::data_stream& data_in, result_stream& steer_results,
             BOOST_PP_ENUM_PARAMS(NUM_IKERNELS, header_stream& hdr_out),
             BOOST_PP_ENUM_PARAMS(NUM_IKERNELS, result_stream& ft_results),
@@ -434,16 +513,21 @@ namespace udp {
                         bool_stream& generated_stream,
                         mlx::metadata_stream& metadata_out,
 			bool_stream& enable_stream);
+	/** Builds the packet headers (without checksums) for a metadata entry */
+	static header_parser metadata_to_header(const hls_ik::metadata& m);
     protected:
 	bool drop() const { return mlx_metadata.get_drop(); }
-	static header_parser metadata_to_header(const hls_ik::metadata& m);
-        enum { buffer_size = header_parser::width - MLX_AXI4_WIDTH_BITS };
-        /** Buffer for leftovers from the first header word. */
-        ap_uint<buffer_size> buffer;
+        /** Number of words holding the packet headers */
+        enum { header_words = (header_parser::width + MLX_AXI4_WIDTH_BITS - 1) / MLX_AXI4_WIDTH_BITS };
+        /** Number of valid bytes in the last header word */
+        enum { last_word_bytes = header_parser::width / 8 - (header_words - 1) * MLX_AXI4_WIDTH_BYTES };
+        /** Buffer for the second header word. */
+        mlx::word buffer;
 
         /** Reordering state:
          *  IDLE   waiting for header stream entry.
-         *  SECOND sending the second output word
+         *  SECOND sending the second output word, when the header does not
+         *         fit in a single word.
          */
         enum { IDLE, SECOND } state;
         mlx::metadata mlx_metadata;
@@ -456,9 +540,15 @@ namespace udp {
         void pad(mlx::stream& in, mlx::stream& out);
 
     protected:
-        ap_uint<256> pad_one(ap_uint<256> data, ap_uint<32> keep);
+        /** Minimum Ethernet frame length without the FCS */
+        enum { min_frame_size = 60 };
+        enum { min_frame_words = (min_frame_size + MLX_AXI4_WIDTH_BYTES - 1) / MLX_AXI4_WIDTH_BYTES };
+
+        mlx::word pad_one(mlx::word data, mlx::keep_t keep);
 
-        ap_uint<6> beat_count;
+        /** Number of beats seen in the current packet, saturating at
+         * min_frame_words */
+        ap_uint<hls_helpers::log2(min_frame_words) + 1> beat_count;
     };
 
     /* Build the AXI4 Stream of UDP packets back from the split header and data
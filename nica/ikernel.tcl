@@ -13,9 +13,15 @@ proc create_project {name top dir files tb_files} {
     }
 
     set num_ikernels $::env(NUM_IKERNELS)
+    set nica_data_width $::env(NICA_DATA_WIDTH)
+    set nica_max_frame_size $::env(NICA_MAX_FRAME_SIZE)
+    set nica_log_num_rings $::env(NICA_LOG_NUM_RINGS)
     set memcached_cache_size $::env(MEMCACHED_CACHE_SIZE)
+    set memcached_cache_ways $::env(MEMCACHED_CACHE_WAYS)
     set memcached_key_size $::env(MEMCACHED_KEY_SIZE)
     set memcached_value_size $::env(MEMCACHED_VALUE_SIZE)
+    set memcached_max_keys $::env(MEMCACHED_MAX_KEYS)
+    set memcached_dram_size $::env(MEMCACHED_DRAM_SIZE)
 
     global env nica_basedir
     set gtest_root $env(GTEST_ROOT)
@@ -27,7 +33,10 @@ proc create_project {name top dir files tb_files} {
                 -I$nica_basedir/../ikernels/hls \
                 -I$nica_basedir/../ikernels/hls/tests \
                 -I$gtest_root/include \
-                -Wno-gnu-designator -DNDEBUG -DNUM_IKERNELS=$num_ikernels"
+                -Wno-gnu-designator -DNDEBUG -DNUM_IKERNELS=$num_ikernels \
+                -DNICA_DATA_WIDTH=$nica_data_width \
+                -DNICA_MAX_FRAME_SIZE=$nica_max_frame_size \
+                -DNICA_LOG_NUM_RINGS=$nica_log_num_rings"
     if {$simulation_build} {
         set cflags "$cflags -DSIMULATION_BUILD=1"
     }
@@ -35,6 +44,10 @@ proc create_project {name top dir files tb_files} {
     if {$memcached_cache_size ne ""} {
         set cflags "$cflags -DMEMCACHED_CACHE_SIZE=$memcached_cache_size"
     }
+    puts $memcached_cache_ways
+    if {$memcached_cache_ways ne ""} {
+        set cflags "$cflags -DMEMCACHED_CACHE_WAYS=$memcached_cache_ways"
+    }
     puts $memcached_key_size
     if {$memcached_key_size ne ""} {
         set cflags "$cflags -DMEMCACHED_KEY_SIZE=$memcached_key_size"
@@ -43,6 +56,14 @@ proc create_project {name top dir files tb_files} {
     if {$memcached_value_size ne ""} {
         set cflags "$cflags -DMEMCACHED_VALUE_SIZE=$memcached_value_size"
     }
+    puts $memcached_max_keys
+    if {$memcached_max_keys ne ""} {
+        set cflags "$cflags -DMEMCACHED_MAX_KEYS=$memcached_max_keys"
+    }
+    puts $memcached_dram_size
+    if {$memcached_dram_size ne ""} {
+        set cflags "$cflags -DMEMCACHED_DRAM_SIZE=$memcached_dram_size"
+    }
 
     set ldflags "-lpcap $uuid_ldflags -L$gtest_root -lgtest -L$nica_basedir/../build/nica/ -lnica-hls"
 
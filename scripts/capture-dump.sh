@@ -0,0 +1,79 @@
+#!/bin/bash
+#
+# Copyright (c) 2016-2017 Haggai Eran, Gabi Malka, Lior Zeno, Maroun Tork
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+#
+#  * Redistributions of source code must retain the above copyright notice, this
+# list of conditions and the following disclaimer.
+#  * Redistributions in binary form must reproduce the above copyright notice,
+# this list of conditions and the following disclaimer in the documentation and/or
+# other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+# ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+# ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#
+#
+# Drain the sampled header capture ring into a pcap file.
+#
+# usage: capture-dump.sh n2h|h2n output.pcap [sample_rate]
+#
+# Captured packets hold only the Ethernet, IPv4 and UDP headers (42 bytes).
+# An optional sample rate (capture one of every N packets, 0 to stop
+# sampling) is written to the ring before draining it. Requires text2pcap.
+
+basedir="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+register=$basedir/register.sh
+
+case "$1" in
+n2h) base=0x98 ;;
+h2n) base=0x498 ;;
+*)
+	echo "usage: $0 n2h|h2n output.pcap [sample_rate]"
+	exit 1
+	;;
+esac
+output="$2"
+sample_rate="$3"
+
+# Register addresses from nica/hls/capture_ring.hpp
+CAPTURE_SAMPLE_RATE=0x0
+CAPTURE_COUNT=0x1
+CAPTURE_DROPPED=0x2
+CAPTURE_POP=0x3
+CAPTURE_DATA_BASE=0x10
+CAPTURE_WORDS=11
+
+if [[ -n "$sample_rate" ]]
+then
+	$register $base w $CAPTURE_SAMPLE_RATE $sample_rate
+fi
+
+let count=$($register $base r $CAPTURE_COUNT)
+let dropped=$($register $base r $CAPTURE_DROPPED)
+
+for (( i = 0; i < count; ++i ))
+do
+	# Read the whole header in a single register.sh invocation
+	hex=""
+	for word in $($register $base r $CAPTURE_DATA_BASE $CAPTURE_WORDS)
+	do
+		hex+=$(printf "%08x" $[word & 0xffffffff])
+	done
+	$register $base w $CAPTURE_POP 1
+	# The last word is only half used by the 42-byte header
+	echo "000000 $(echo ${hex:0:84} | sed 's/../& /g')"
+done | text2pcap - "$output"
+
+echo captured : $count
+echo dropped : $dropped
@@ -23,9 +23,18 @@
 # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
 # SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #
-let forward=$(sudo mlx_fpga -d /dev/mst/mt4117_pciconf0_fpga r 0x110)
-let drop=$(sudo mlx_fpga -d /dev/mst/mt4117_pciconf0_fpga r 0x11c)
-let process=$(sudo mlx_fpga -d /dev/mst/mt4117_pciconf0_fpga r 0x128)
+device=/dev/mst/mt4117_pciconf0_fpga
+# Latch the n2h statistics so the counters are taken at the same time. The
+# lock keeps the threshold server's metrics from latching or releasing them
+# while they are read (NICA_STATS_LOCK_FILE in baseline/AxiLiteStats.hpp).
+exec 9>>/tmp/nica-stats.lock
+flock 9
+sudo mlx_fpga -d $device w 0xc0 $(date +%s)
+let forward=$(sudo mlx_fpga -d $device r 0x110)
+let drop=$(sudo mlx_fpga -d $device r 0x11c)
+let process=$(sudo mlx_fpga -d $device r 0x128)
+sudo mlx_fpga -d $device w 0xc0 0
+flock -u 9
 echo forward : $forward
 echo drop : $drop
 echo process : $process
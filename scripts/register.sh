@@ -24,6 +24,7 @@
 # SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #
 #[input] : base read/write(r/w) addr_hexa value_hexa
+#          base r addr_hexa [count]
 
 base="$1"
 cmd="$2"
@@ -55,18 +56,23 @@ then
 		res=`sudo mlx_fpga -d $device r $done_reg`
 	done
 else
-	sudo mlx_fpga -d $device w $cmd_reg $[0x80000000|$addr]
-	res=0
-	while [[ "$res" == 0 ]]
-	do
-		res=`sudo mlx_fpga -d $device r $done_reg`
-        done
-	sudo mlx_fpga -d $device r $data_o_reg
-	# finally resetting the gateway for the next command and verifying the reset is done:
-        sudo mlx_fpga -d $device w $cmd_reg 0x0
-	res=1
-        while [[ "$res" == 1 ]]
+	# an optional count reads that many consecutive registers, one per line
+	count=${value:-1}
+	for (( i = 0; i < count; ++i ))
 	do
-		res=`sudo mlx_fpga -d $device r $done_reg`
-        done
+		sudo mlx_fpga -d $device w $cmd_reg $[0x80000000|$addr + i]
+		res=0
+		while [[ "$res" == 0 ]]
+		do
+			res=`sudo mlx_fpga -d $device r $done_reg`
+		done
+		sudo mlx_fpga -d $device r $data_o_reg
+		# finally resetting the gateway for the next command and verifying the reset is done:
+		sudo mlx_fpga -d $device w $cmd_reg 0x0
+		res=1
+		while [[ "$res" == 1 ]]
+		do
+			res=`sudo mlx_fpga -d $device r $done_reg`
+		done
+	done
 fi